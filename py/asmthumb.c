@@ -374,8 +374,8 @@ void asm_thumb_mov_reg_i32_aligned(asm_thumb_t *as, uint reg_dest, int i32) {
     asm_thumb_op16(as, OP_B_N(2));
     // store i32 on machine-word aligned boundary
     asm_thumb_data(as, 4, i32);
-    // do the actual load of the i32 value
-    asm_thumb_mov_reg_i32_optimised(as, reg_dest, i32);
+    // load the i32 value back from the word just stored: ldr.w reg_dest, [pc, #-8]
+    asm_thumb_op32(as, 0xf85f, (reg_dest << 12) | 8);
 }
 
 #define OP_STR_TO_SP_OFFSET(rlo_dest, word_offset) (0x9000 | ((rlo_dest) << 8) | ((word_offset) & 0x00ff))
@@ -464,8 +464,9 @@ void asm_thumb_bl_ind(asm_thumb_t *as, void *fun_ptr, uint fun_id, uint reg_temp
         asm_thumb_op16(as, ASM_THUMB_FORMAT_9_10_ENCODE(ASM_THUMB_FORMAT_9_LDR | ASM_THUMB_FORMAT_9_WORD_TRANSFER, reg_temp, ASM_THUMB_REG_R7, fun_id));
         asm_thumb_op16(as, OP_BLX(reg_temp));
     } else {
-        // load ptr to function into register using immediate; 6 bytes
-        asm_thumb_mov_reg_i32(as, reg_temp, (mp_uint_t)fun_ptr);
+        // load ptr to function from table using a 12-bit offset; 6 bytes
+        (void)fun_ptr;
+        asm_thumb_op32(as, 0xf8d0 | ASM_THUMB_REG_R7, (reg_temp << 12) | (fun_id * 4));
         asm_thumb_op16(as, OP_BLX(reg_temp));
     }
 }
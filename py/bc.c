@@ -54,6 +54,47 @@ mp_uint_t mp_decode_uint(const byte **ptr) {
     return unum;
 }
 
+// Returns the name of the function being executed by the given code state,
+// and sets the source file and line of its current instruction.
+qstr mp_code_state_get_location(const mp_code_state_t *code_state, qstr *source_file, size_t *source_line) {
+    const byte *ip = code_state->code_info;
+    mp_uint_t code_info_size = mp_decode_uint(&ip);
+    #if MICROPY_PERSISTENT_CODE
+    qstr block_name = ip[0] | (ip[1] << 8);
+    *source_file = ip[2] | (ip[3] << 8);
+    ip += 4;
+    #else
+    qstr block_name = mp_decode_uint(&ip);
+    *source_file = mp_decode_uint(&ip);
+    #endif
+    size_t bc = code_state->ip - code_state->code_info - code_info_size;
+    size_t line = 1;
+    size_t c;
+    while ((c = *ip)) {
+        mp_uint_t b, l;
+        if ((c & 0x80) == 0) {
+            // 0b0LLBBBBB encoding
+            b = c & 0x1f;
+            l = c >> 5;
+            ip += 1;
+        } else {
+            // 0b1LLLBBBB 0bLLLLLLLL encoding (l's LSB in second byte)
+            b = c & 0xf;
+            l = ((c << 4) & 0x700) | ip[1];
+            ip += 2;
+        }
+        if (bc >= b) {
+            bc -= b;
+            line += l;
+        } else {
+            // found source line corresponding to bytecode offset
+            break;
+        }
+    }
+    *source_line = line;
+    return block_name;
+}
+
 STATIC NORETURN void fun_pos_args_mismatch(mp_obj_fun_bc_t *f, size_t expected, size_t given) {
 #if MICROPY_ERROR_REPORTING == MICROPY_ERROR_REPORTING_TERSE
     // generic message, used also for other argument issues
@@ -100,6 +141,10 @@ void mp_setup_code_state(mp_code_state_t *code_state, mp_obj_fun_bc_t *self, siz
     // store pointer to constant table
     code_state->const_table = self->const_table;
 
+    #if MICROPY_EMIT_NATIVE_TIERING
+    code_state->tier = self->tier;
+    #endif
+
     #if MICROPY_STACKLESS
     code_state->prev = NULL;
     #endif
@@ -298,7 +343,7 @@ STATIC const byte opcode_format_table[64] = {
     OC4(B, B, V, V), // 0x20-0x23
     OC4(Q, Q, Q, B), // 0x24-0x27
     OC4(V, V, Q, Q), // 0x28-0x2b
-    OC4(U, U, U, U), // 0x2c-0x2f
+    OC4(B, B, B, B), // 0x2c-0x2f
     OC4(B, B, B, B), // 0x30-0x33
     OC4(B, O, O, O), // 0x34-0x37
     OC4(O, O, U, U), // 0x38-0x3b
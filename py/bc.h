@@ -69,17 +69,29 @@ typedef struct _mp_exc_stack_t {
     mp_obj_base_t *prev_exc;
 } mp_exc_stack_t;
 
+// Native code only sets ip and n_state before calling mp_native_setup_code_state
+// with a pointer to state, so those two must come just before it.  Native code
+// in a .mpy file reserves MP_CODE_STATE_MAX_WORDS words for this structure,
+// which is enough for any of its optional fields to be enabled.
 typedef struct _mp_code_state_t {
     const byte *code_info;
-    const byte *ip;
     const mp_uint_t *const_table;
     mp_obj_t *sp;
     // bit 0 is saved currently_in_except_block value
     mp_exc_stack_t *exc_sp;
     mp_obj_dict_t *old_globals;
+    #if MICROPY_EMIT_NATIVE_TIERING
+    // the running function's tiering state, which loop back-edges count towards
+    struct _mp_tier_t *tier;
+    #endif
     #if MICROPY_STACKLESS
     struct _mp_code_state_t *prev;
     #endif
+    #if MICROPY_TRACK_CODE_STATE
+    // code state of the bytecode function that called this one, if any
+    struct _mp_code_state_t *caller;
+    #endif
+    const byte *ip;
     size_t n_state;
     // Variable-length
     mp_obj_t state[0];
@@ -87,16 +99,35 @@ typedef struct _mp_code_state_t {
     //mp_exc_stack_t exc_state[0];
 } mp_code_state_t;
 
+#define MP_CODE_STATE_MAX_WORDS (10)
+
+#if MICROPY_STACKLESS
+// A chunk of the frame stack used by stackless calls, followed by the frames
+typedef struct _mp_frame_chunk_t {
+    struct _mp_frame_chunk_t *prev;
+    // the following chunk, kept when it's empty to save reallocating it
+    struct _mp_frame_chunk_t *next;
+    size_t size;
+} mp_frame_chunk_t;
+#endif
+
 mp_uint_t mp_decode_uint(const byte **ptr);
+qstr mp_code_state_get_location(const mp_code_state_t *code_state, qstr *source_file, size_t *source_line);
 
 mp_vm_return_kind_t mp_execute_bytecode(mp_code_state_t *code_state, volatile mp_obj_t inject_exc);
 mp_code_state_t *mp_obj_fun_bc_prepare_codestate(mp_obj_t func, size_t n_args, size_t n_kw, const mp_obj_t *args);
+void mp_obj_fun_bc_release_codestate(mp_code_state_t *code_state);
 struct _mp_obj_fun_bc_t;
 void mp_setup_code_state(mp_code_state_t *code_state, struct _mp_obj_fun_bc_t *self, size_t n_args, size_t n_kw, const mp_obj_t *args);
+void mp_native_setup_code_state(mp_obj_t *state, struct _mp_obj_fun_bc_t *self, size_t n_args, size_t n_kw, const mp_obj_t *args);
 void mp_bytecode_print(const void *descr, const byte *code, mp_uint_t len, const mp_uint_t *const_table);
 void mp_bytecode_print2(const byte *code, mp_uint_t len);
 const byte *mp_bytecode_print_str(const byte *ip);
 #define mp_bytecode_print_inst(code) mp_bytecode_print2(code, 1)
+const char *mp_bytecode_opcode_name(byte op);
+void mp_bytecode_print_opcode(const mp_print_t *print, byte op);
+void mp_vm_opcode_stats_reset(void);
+void mp_vm_opcode_stats_print(const mp_print_t *print);
 
 // Helper macros to access pointer with least significant bits holding flags
 #define MP_TAGPTR_PTR(x) ((void*)((uintptr_t)(x) & ~((uintptr_t)3)))
@@ -58,6 +58,12 @@
 #define MP_BC_DELETE_NAME        (0x2a) // qstr
 #define MP_BC_DELETE_GLOBAL      (0x2b) // qstr
 
+// Superinstructions, each a prefix in front of the sequence that it runs.
+#define MP_BC_FUSED_LOAD_FAST_ATTR      (0x2c) // then LOAD_FAST_MULTI, LOAD_ATTR
+#define MP_BC_FUSED_LOAD_FAST_METHOD    (0x2d) // then LOAD_FAST_MULTI, LOAD_METHOD
+#define MP_BC_FUSED_FAST_INT_BINARY_OP  (0x2e) // then LOAD_FAST_MULTI, LOAD_CONST_SMALL_INT_MULTI, BINARY_OP_MULTI
+#define MP_BC_FUSED_COMPARE_JUMP        (0x2f) // then BINARY_OP_MULTI, POP_JUMP_IF_TRUE or POP_JUMP_IF_FALSE
+
 #define MP_BC_DUP_TOP            (0x30)
 #define MP_BC_DUP_TOP_TWO        (0x31)
 #define MP_BC_POP_TOP            (0x32)
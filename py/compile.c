@@ -34,6 +34,7 @@
 #include "py/emit.h"
 #include "py/compile.h"
 #include "py/runtime.h"
+#include "py/objtuple.h"
 
 #if MICROPY_ENABLE_COMPILER
 
@@ -51,6 +52,43 @@ typedef enum {
 
 #define NEED_METHOD_TABLE MICROPY_EMIT_NATIVE
 
+#if MICROPY_EMIT_NATIVE
+
+typedef struct _native_emitter_t {
+    emit_t *(*emit_new)(mp_obj_t *error_slot, mp_uint_t max_num_labels);
+    void (*emit_free)(emit_t *emit);
+    const emit_method_table_t *method_table;
+} native_emitter_t;
+
+#if MICROPY_DYNAMIC_COMPILER
+// the target architecture is chosen at runtime, indexed by MP_NATIVE_ARCH_xxx
+STATIC const native_emitter_t native_emitter_table[] = {
+    [MP_NATIVE_ARCH_NONE] = { NULL, NULL, NULL },
+    #if MICROPY_EMIT_X64
+    [MP_NATIVE_ARCH_X64] = { emit_native_x64_new, emit_native_x64_free, &emit_native_x64_method_table },
+    #endif
+    #if MICROPY_EMIT_THUMB
+    [MP_NATIVE_ARCH_THUMB] = { emit_native_thumb_new, emit_native_thumb_free, &emit_native_thumb_method_table },
+    #endif
+};
+#define NATIVE_EMITTER (mp_dynamic_compiler.native_arch < MP_ARRAY_SIZE(native_emitter_table) ? &native_emitter_table[mp_dynamic_compiler.native_arch] : &native_emitter_table[0])
+#else
+STATIC const native_emitter_t native_emitter_table[] = {
+    #if MICROPY_EMIT_X64
+    { emit_native_x64_new, emit_native_x64_free, &emit_native_x64_method_table },
+    #elif MICROPY_EMIT_X86
+    { emit_native_x86_new, emit_native_x86_free, &emit_native_x86_method_table },
+    #elif MICROPY_EMIT_THUMB
+    { emit_native_thumb_new, emit_native_thumb_free, &emit_native_thumb_method_table },
+    #elif MICROPY_EMIT_ARM
+    { emit_native_arm_new, emit_native_arm_free, &emit_native_arm_method_table },
+    #endif
+};
+#define NATIVE_EMITTER (&native_emitter_table[0])
+#endif
+
+#endif // MICROPY_EMIT_NATIVE
+
 #if NEED_METHOD_TABLE
 
 // we need a method table to do the lookup for the emitter functions
@@ -80,6 +118,9 @@ typedef struct _compiler_t {
     uint8_t pass; // holds enum type pass_kind_t
     uint8_t func_arg_is_super; // used to compile special case of super() function call
     uint8_t have_star;
+    #if MICROPY_EMIT_NATIVE_TIERING
+    uint8_t tier_up; // compile the outermost scope natively after MP_PASS_SCOPE
+    #endif
 
     // try to keep compiler clean from nlr
     mp_obj_t compile_error; // set to an exception object if there's an error
@@ -222,7 +263,125 @@ STATIC void compile_delete_id(compiler_t *comp, qstr qst) {
     }
 }
 
+#if MICROPY_COMP_CONST_TUPLE
+// whether a node is a literal that can be an item of a constant tuple
+STATIC bool node_is_const_object(mp_parse_node_t pn) {
+    if (MP_PARSE_NODE_IS_SMALL_INT(pn)) {
+        return true;
+    } else if (MP_PARSE_NODE_IS_LEAF(pn)) {
+        uintptr_t arg = MP_PARSE_NODE_LEAF_ARG(pn);
+        switch (MP_PARSE_NODE_LEAF_KIND(pn)) {
+            case MP_PARSE_NODE_STRING:
+            case MP_PARSE_NODE_BYTES:
+                return true;
+            case MP_PARSE_NODE_TOKEN:
+                return arg == MP_TOKEN_KW_NONE
+                    || arg == MP_TOKEN_KW_TRUE
+                    || arg == MP_TOKEN_KW_FALSE
+                    || arg == MP_TOKEN_ELLIPSIS;
+            default:
+                return false;
+        }
+    } else if (MP_PARSE_NODE_IS_STRUCT_KIND(pn, PN_atom_paren)) {
+        // an empty tuple
+        return MP_PARSE_NODE_IS_NULL(((mp_parse_node_struct_t*)pn)->nodes[0]);
+    } else {
+        return MP_PARSE_NODE_IS_STRUCT_KIND(pn, PN_string)
+            || MP_PARSE_NODE_IS_STRUCT_KIND(pn, PN_bytes)
+            || MP_PARSE_NODE_IS_STRUCT_KIND(pn, PN_const_object);
+    }
+}
+
+// get the object for a node that passed node_is_const_object
+STATIC mp_obj_t node_get_const_object(mp_parse_node_t pn) {
+    if (MP_PARSE_NODE_IS_SMALL_INT(pn)) {
+        return MP_OBJ_NEW_SMALL_INT(MP_PARSE_NODE_LEAF_SMALL_INT(pn));
+    } else if (MP_PARSE_NODE_IS_LEAF(pn)) {
+        uintptr_t arg = MP_PARSE_NODE_LEAF_ARG(pn);
+        if (MP_PARSE_NODE_LEAF_KIND(pn) == MP_PARSE_NODE_STRING) {
+            return MP_OBJ_NEW_QSTR(arg);
+        } else if (MP_PARSE_NODE_LEAF_KIND(pn) == MP_PARSE_NODE_BYTES) {
+            size_t len;
+            const byte *data = qstr_data(arg, &len);
+            return mp_obj_new_bytes(data, len);
+        } else if (arg == MP_TOKEN_KW_NONE) {
+            return mp_const_none;
+        } else if (arg == MP_TOKEN_KW_TRUE) {
+            return mp_const_true;
+        } else if (arg == MP_TOKEN_KW_FALSE) {
+            return mp_const_false;
+        } else {
+            assert(arg == MP_TOKEN_ELLIPSIS);
+            return MP_OBJ_FROM_PTR(&mp_const_ellipsis_obj);
+        }
+    } else {
+        mp_parse_node_struct_t *pns = (mp_parse_node_struct_t*)pn;
+        switch (MP_PARSE_NODE_STRUCT_KIND(pns)) {
+            case PN_atom_paren:
+                return mp_const_empty_tuple;
+            case PN_string:
+                return mp_obj_new_str((const char*)pns->nodes[0], pns->nodes[1], false);
+            case PN_bytes:
+                return mp_obj_new_bytes((const byte*)pns->nodes[0], pns->nodes[1]);
+            default:
+                assert(MP_PARSE_NODE_STRUCT_KIND(pns) == PN_const_object);
+                #if MICROPY_OBJ_REPR == MICROPY_OBJ_REPR_D
+                // nodes are 32-bit pointers, but need to extract 64-bit object
+                return (uint64_t)pns->nodes[0] | ((uint64_t)pns->nodes[1] << 32);
+                #else
+                return (mp_obj_t)pns->nodes[0];
+                #endif
+        }
+    }
+}
+
+// a tuple whose items are all literals is loaded as a single constant object
+STATIC bool c_tuple_const(compiler_t *comp, mp_parse_node_t pn, mp_parse_node_struct_t *pns_list) {
+    int n = 0;
+    if (pns_list != NULL) {
+        n = MP_PARSE_NODE_STRUCT_NUM_NODES(pns_list);
+        for (int i = 0; i < n; i++) {
+            if (!node_is_const_object(pns_list->nodes[i])) {
+                return false;
+            }
+        }
+    }
+    int total = n;
+    if (!MP_PARSE_NODE_IS_NULL(pn)) {
+        if (!node_is_const_object(pn)) {
+            return false;
+        }
+        total += 1;
+    }
+    if (total == 0) {
+        // an empty tuple is cheap to build
+        return false;
+    }
+
+    // only create the actual tuple object on the last pass
+    if (comp->pass != MP_PASS_EMIT) {
+        EMIT_ARG(load_const_obj, mp_const_none);
+        return true;
+    }
+    mp_obj_tuple_t *tuple = MP_OBJ_TO_PTR(mp_obj_new_tuple(total, NULL));
+    size_t i = 0;
+    if (!MP_PARSE_NODE_IS_NULL(pn)) {
+        tuple->items[i++] = node_get_const_object(pn);
+    }
+    for (int j = 0; j < n; j++) {
+        tuple->items[i++] = node_get_const_object(pns_list->nodes[j]);
+    }
+    EMIT_ARG(load_const_obj, MP_OBJ_FROM_PTR(tuple));
+    return true;
+}
+#endif
+
 STATIC void c_tuple(compiler_t *comp, mp_parse_node_t pn, mp_parse_node_struct_t *pns_list) {
+    #if MICROPY_COMP_CONST_TUPLE
+    if (c_tuple_const(comp, pn, pns_list)) {
+        return;
+    }
+    #endif
     int total = 0;
     if (!MP_PARSE_NODE_IS_NULL(pn)) {
         compile_node(comp, pn);
@@ -245,6 +404,7 @@ STATIC void compile_generic_tuple(compiler_t *comp, mp_parse_node_struct_t *pns)
 
 STATIC bool node_is_const_false(mp_parse_node_t pn) {
     return MP_PARSE_NODE_IS_TOKEN_KIND(pn, MP_TOKEN_KW_FALSE)
+        || MP_PARSE_NODE_IS_TOKEN_KIND(pn, MP_TOKEN_KW_NONE)
         || (MP_PARSE_NODE_IS_SMALL_INT(pn) && MP_PARSE_NODE_LEAF_SMALL_INT(pn) == 0);
 }
 
@@ -3327,20 +3487,8 @@ STATIC void scope_compute_things(scope_t *scope) {
     }
 }
 
-#if !MICROPY_PERSISTENT_CODE_SAVE
-STATIC
-#endif
-mp_raw_code_t *mp_compile_to_raw_code(mp_parse_tree_t *parse_tree, qstr source_file, uint emit_opt, bool is_repl) {
-    // put compiler state on the stack, it's relatively small
-    compiler_t comp_state = {0};
-    compiler_t *comp = &comp_state;
-
-    comp->source_file = source_file;
-    comp->is_repl = is_repl;
-
-    // create the module scope
-    scope_t *module_scope = scope_new_and_link(comp, SCOPE_MODULE, parse_tree->root, emit_opt);
-
+// compile all scopes linked into comp, starting with the outermost one
+STATIC void compile_scopes(compiler_t *comp) {
     // create standard emitter; it's used at least for MP_PASS_SCOPE
     emit_t *emit_bc = emit_bc_new();
 
@@ -3366,6 +3514,14 @@ mp_raw_code_t *mp_compile_to_raw_code(mp_parse_tree_t *parse_tree, qstr source_f
         }
     }
 
+    #if MICROPY_EMIT_NATIVE_TIERING
+    if (comp->tier_up && comp->compile_error == MP_OBJ_NULL) {
+        // scopes within the function keep the default emitter, so they were
+        // created before it was switched over
+        comp->scope_head->emit_options = MP_EMIT_OPT_NATIVE_PYTHON;
+    }
+    #endif
+
     // compute some things related to scope and identifiers
     for (scope_t *s = comp->scope_head; s != NULL && comp->compile_error == MP_OBJ_NULL; s = s->next) {
         scope_compute_things(s);
@@ -3409,27 +3565,14 @@ mp_raw_code_t *mp_compile_to_raw_code(mp_parse_tree_t *parse_tree, qstr source_f
 #if MICROPY_EMIT_NATIVE
                 case MP_EMIT_OPT_NATIVE_PYTHON:
                 case MP_EMIT_OPT_VIPER:
-#if MICROPY_EMIT_X64
-                    if (emit_native == NULL) {
-                        emit_native = emit_native_x64_new(&comp->compile_error, max_num_labels);
-                    }
-                    comp->emit_method_table = &emit_native_x64_method_table;
-#elif MICROPY_EMIT_X86
-                    if (emit_native == NULL) {
-                        emit_native = emit_native_x86_new(&comp->compile_error, max_num_labels);
-                    }
-                    comp->emit_method_table = &emit_native_x86_method_table;
-#elif MICROPY_EMIT_THUMB
-                    if (emit_native == NULL) {
-                        emit_native = emit_native_thumb_new(&comp->compile_error, max_num_labels);
+                    if (NATIVE_EMITTER->emit_new == NULL) {
+                        compile_syntax_error(comp, s->pn, "native code not supported for this architecture");
+                        continue;
                     }
-                    comp->emit_method_table = &emit_native_thumb_method_table;
-#elif MICROPY_EMIT_ARM
                     if (emit_native == NULL) {
-                        emit_native = emit_native_arm_new(&comp->compile_error, max_num_labels);
+                        emit_native = NATIVE_EMITTER->emit_new(&comp->compile_error, max_num_labels);
                     }
-                    comp->emit_method_table = &emit_native_arm_method_table;
-#endif
+                    comp->emit_method_table = NATIVE_EMITTER->method_table;
                     comp->emit = emit_native;
                     EMIT_ARG(set_native_type, MP_EMIT_NATIVE_TYPE_ENABLE, s->emit_options == MP_EMIT_OPT_VIPER, 0);
                     break;
@@ -3472,15 +3615,7 @@ mp_raw_code_t *mp_compile_to_raw_code(mp_parse_tree_t *parse_tree, qstr source_f
     emit_bc_free(emit_bc);
 #if MICROPY_EMIT_NATIVE
     if (emit_native != NULL) {
-#if MICROPY_EMIT_X64
-        emit_native_x64_free(emit_native);
-#elif MICROPY_EMIT_X86
-        emit_native_x86_free(emit_native);
-#elif MICROPY_EMIT_THUMB
-        emit_native_thumb_free(emit_native);
-#elif MICROPY_EMIT_ARM
-        emit_native_arm_free(emit_native);
-#endif
+        NATIVE_EMITTER->emit_free(emit_native);
     }
 #endif
 #if MICROPY_EMIT_INLINE_THUMB
@@ -3488,9 +3623,67 @@ mp_raw_code_t *mp_compile_to_raw_code(mp_parse_tree_t *parse_tree, qstr source_f
         emit_inline_thumb_free(emit_inline_thumb);
     }
 #endif
+}
+
+#if MICROPY_EMIT_NATIVE_TIERING
+// A function can be recompiled on its own later if it uses the default
+// emitter, is not a generator, and doesn't close over its parent's variables.
+STATIC bool scope_can_tier(scope_t *scope) {
+    if (scope->kind != SCOPE_FUNCTION || scope->emit_options != MP_EMIT_OPT_NONE
+        || (scope->scope_flags & MP_SCOPE_FLAG_GENERATOR)) {
+        return false;
+    }
+    for (int i = 0; i < scope->id_info_len; i++) {
+        if (scope->id_info[i].kind == ID_INFO_KIND_FREE) {
+            return false;
+        }
+    }
+    return true;
+}
+#endif
+
+#if !MICROPY_PERSISTENT_CODE_SAVE
+STATIC
+#endif
+mp_raw_code_t *mp_compile_to_raw_code(mp_parse_tree_t *parse_tree, qstr source_file, uint emit_opt, bool is_repl) {
+    // put compiler state on the stack, it's relatively small
+    compiler_t comp_state = {0};
+    compiler_t *comp = &comp_state;
+
+    comp->source_file = source_file;
+    comp->is_repl = is_repl;
+
+    // create the module scope
+    scope_t *module_scope = scope_new_and_link(comp, SCOPE_MODULE, parse_tree->root, emit_opt);
 
-    // free the parse tree
-    mp_parse_tree_clear(parse_tree);
+    compile_scopes(comp);
+
+    #if MICROPY_EMIT_NATIVE_TIERING
+    // keep the parse tree for functions that may be recompiled natively
+    bool keep_parse_tree = false;
+    if (MP_STATE_VM(tier_threshold) != 0 && comp->compile_error == MP_OBJ_NULL) {
+        for (scope_t *s = module_scope; s != NULL; s = s->next) {
+            if (scope_can_tier(s)) {
+                mp_tier_t *tier = m_new_obj(mp_tier_t);
+                tier->pn = s->pn;
+                tier->chunk = parse_tree->chunk;
+                tier->source_file = source_file;
+                tier->simple_name = s->simple_name;
+                tier->scope_flags = s->scope_flags & MP_SCOPE_FLAG_DEFKWARGS;
+                tier->num_def_pos_args = s->num_def_pos_args;
+                tier->hotness = 0;
+                tier->native = NULL;
+                s->raw_code->data.u_byte.tier = tier;
+                keep_parse_tree = true;
+            }
+        }
+    }
+    if (!keep_parse_tree)
+    #endif
+    {
+        // free the parse tree
+        mp_parse_tree_clear(parse_tree);
+    }
 
     // free the scopes
     mp_raw_code_t *outer_raw_code = module_scope->raw_code;
@@ -3507,6 +3700,51 @@ mp_raw_code_t *mp_compile_to_raw_code(mp_parse_tree_t *parse_tree, qstr source_f
     }
 }
 
+#if MICROPY_EMIT_NATIVE_TIERING
+const mp_raw_code_t *mp_compile_tier(mp_tier_t *tier) {
+    if (tier->pn == MP_PARSE_NODE_NULL) {
+        // already compiled, or it failed
+        return tier->native;
+    }
+
+    compiler_t comp_state = {0};
+    compiler_t *comp = &comp_state;
+    comp->source_file = tier->source_file;
+    comp->tier_up = true;
+
+    // the function is compiled as if it were at the outermost level, which is
+    // fine because it has no free variables; the module scope is only there
+    // as the end of the chain of parents, and is not itself compiled
+    scope_t *module_scope = scope_new(SCOPE_MODULE, MP_PARSE_NODE_NULL, tier->source_file, MP_EMIT_OPT_NONE);
+    comp->scope_cur = module_scope;
+    nlr_buf_t nlr;
+    if (nlr_push(&nlr) == 0) {
+        scope_t *scope = scope_new_and_link(comp, SCOPE_FUNCTION, tier->pn, MP_EMIT_OPT_NONE);
+        scope->scope_flags = tier->scope_flags;
+        scope->num_def_pos_args = tier->num_def_pos_args;
+        compile_scopes(comp);
+        if (comp->compile_error == MP_OBJ_NULL) {
+            tier->native = comp->scope_head->raw_code;
+        }
+        nlr_pop();
+    }
+    // else out of memory, so it's left as bytecode
+
+    // the parse tree is not needed by this function any more
+    tier->pn = MP_PARSE_NODE_NULL;
+    tier->chunk = NULL;
+
+    for (scope_t *s = comp->scope_head; s;) {
+        scope_t *next = s->next;
+        scope_free(s);
+        s = next;
+    }
+    scope_free(module_scope);
+
+    return tier->native;
+}
+#endif
+
 mp_obj_t mp_compile(mp_parse_tree_t *parse_tree, qstr source_file, uint emit_opt, bool is_repl) {
     mp_raw_code_t *rc = mp_compile_to_raw_code(parse_tree, source_file, emit_opt, is_repl);
     // return function that executes the outer module
@@ -39,6 +39,10 @@
 #define BYTES_FOR_INT ((BYTES_PER_WORD * 8 + 6) / 7)
 #define DUMMY_DATA_SIZE (BYTES_FOR_INT)
 
+#if MICROPY_OPT_SUPERINSTRUCTIONS
+#define PEEP_DEPTH (3)
+#endif
+
 struct _emit_t {
     // Accessed as mp_obj_t, so must be aligned as such, and we rely on the
     // memory allocator returning a suitably aligned pointer.
@@ -70,6 +74,21 @@ struct _emit_t {
     uint16_t ct_cur_raw_code;
     #endif
     mp_uint_t *const_table;
+
+    #if MICROPY_OPT_SUPERINSTRUCTIONS
+    // For each label, the label that an unconditional jump placed at it goes to
+    mp_uint_t *label_jumps;
+
+    // The last few instructions seen by the peephole optimiser, most recent
+    // first.  They are only valid if nothing else has been written after
+    // them, ie if peep_end is the current bytecode offset.
+    struct {
+        byte kind;
+        mp_int_t arg;
+        size_t offset;
+    } peep[PEEP_DEPTH];
+    size_t peep_end;
+    #endif
 };
 
 emit_t *emit_bc_new(void) {
@@ -80,10 +99,16 @@ emit_t *emit_bc_new(void) {
 void emit_bc_set_max_num_labels(emit_t *emit, mp_uint_t max_num_labels) {
     emit->max_num_labels = max_num_labels;
     emit->label_offsets = m_new(mp_uint_t, emit->max_num_labels);
+    #if MICROPY_OPT_SUPERINSTRUCTIONS
+    emit->label_jumps = m_new(mp_uint_t, emit->max_num_labels);
+    #endif
 }
 
 void emit_bc_free(emit_t *emit) {
     m_del(mp_uint_t, emit->label_offsets, emit->max_num_labels);
+    #if MICROPY_OPT_SUPERINSTRUCTIONS
+    m_del(mp_uint_t, emit->label_jumps, emit->max_num_labels);
+    #endif
     m_del_obj(emit_t, emit);
 }
 
@@ -273,6 +298,63 @@ STATIC void emit_write_bytecode_byte_raw_code(emit_t *emit, byte b, mp_raw_code_
     #endif
 }
 
+#if MICROPY_OPT_SUPERINSTRUCTIONS
+
+// Instructions remembered by the peephole optimiser.  A superinstruction is
+// a prefix opcode in front of the unchanged sequence that it stands for, so
+// that it can be fused without knowing how any other instruction is encoded.
+#define PEEP_NONE (0)
+#define PEEP_LOAD_FAST (1) // arg is the local number, at most 15
+#define PEEP_SMALL_INT (2) // arg is the value, from -16 to 47
+#define PEEP_COMPARE_OP (3) // arg is the binary op
+#define PEEP_JUMP (4) // arg is the label
+#define PEEP_LABEL (5) // arg is the label; takes no bytes
+#define PEEP_LINE (6) // an entry in the line number table; takes no bytes
+
+// Remember the instruction just written, which started at offset
+STATIC void emit_peep_push(emit_t *emit, byte kind, mp_int_t arg, size_t offset) {
+    if (offset == emit->peep_end) {
+        for (size_t i = PEEP_DEPTH - 1; i > 0; --i) {
+            emit->peep[i] = emit->peep[i - 1];
+        }
+    } else {
+        emit->peep[1].kind = PEEP_NONE;
+    }
+    emit->peep[0].kind = kind;
+    emit->peep[0].arg = arg;
+    emit->peep[0].offset = offset;
+    emit->peep_end = emit->bytecode_offset;
+}
+
+// Kind of the nth last instruction, or PEEP_NONE if it's not known; nothing
+// older than a PEEP_NONE is known either
+STATIC byte emit_peep_kind(emit_t *emit, size_t n) {
+    if (emit->peep_end != emit->bytecode_offset) {
+        return PEEP_NONE;
+    }
+    return emit->peep[n].kind;
+}
+
+// If the last instruction was a LOAD_FAST_MULTI then rewrite it with the given
+// prefix, so the caller can append the instruction that it's fused with
+STATIC void emit_fuse_load_fast(emit_t *emit, byte prefix) {
+    if (emit_peep_kind(emit, 0) == PEEP_LOAD_FAST) {
+        emit->bytecode_offset = emit->peep[0].offset;
+        emit_write_bytecode_byte_byte(emit, prefix, MP_BC_LOAD_FAST_MULTI + emit->peep[0].arg);
+    }
+}
+
+// Follow a label through any unconditional jumps placed at it, so that a jump
+// to it can go straight to where they end up
+STATIC mp_uint_t emit_thread_label(emit_t *emit, mp_uint_t label) {
+    for (int n = 0; n < 8 && emit->label_jumps[label] != (mp_uint_t)-1; ++n) {
+        label = emit->label_jumps[label];
+    }
+    return label;
+}
+
+#endif
+
 // unsigned labels are relative to ip following this instruction, stored as 16 bits
 STATIC void emit_write_bytecode_byte_unsigned_label(emit_t *emit, byte b1, mp_uint_t label) {
     mp_uint_t bytecode_offset;
@@ -293,6 +375,9 @@ STATIC void emit_write_bytecode_byte_signed_label(emit_t *emit, byte b1, mp_uint
     if (emit->pass < MP_PASS_EMIT) {
         bytecode_offset = 0;
     } else {
+        #if MICROPY_OPT_SUPERINSTRUCTIONS
+        label = emit_thread_label(emit, label);
+        #endif
         bytecode_offset = emit->label_offsets[label] - emit->bytecode_offset - 3 + 0x8000;
     }
     byte *c = emit_get_cur_to_write_bytecode(emit, 3);
@@ -310,6 +395,9 @@ void mp_emit_bc_start_pass(emit_t *emit, pass_kind_t pass, scope_t *scope) {
     emit->last_source_line = 1;
     if (pass < MP_PASS_EMIT) {
         memset(emit->label_offsets, -1, emit->max_num_labels * sizeof(mp_uint_t));
+        #if MICROPY_OPT_SUPERINSTRUCTIONS
+        memset(emit->label_jumps, -1, emit->max_num_labels * sizeof(mp_uint_t));
+        #endif
     }
     emit->bytecode_offset = 0;
     emit->code_info_offset = 0;
@@ -362,6 +450,10 @@ void mp_emit_bc_start_pass(emit_t *emit, pass_kind_t pass, scope_t *scope) {
     emit->ct_cur_raw_code = 0;
     #endif
 
+    #if MICROPY_OPT_SUPERINSTRUCTIONS
+    emit->peep_end = (size_t)-1;
+    #endif
+
     if (pass == MP_PASS_EMIT) {
         // Write argument names (needed to resolve positional args passed as
         // keywords).  We store them as full word-sized objects for efficient access
@@ -459,6 +551,10 @@ void mp_emit_bc_set_source_line(emit_t *emit, mp_uint_t source_line) {
         emit_write_code_info_bytes_lines(emit, bytes_to_skip, lines_to_skip);
         emit->last_source_line_offset = emit->bytecode_offset;
         emit->last_source_line = source_line;
+        #if MICROPY_OPT_SUPERINSTRUCTIONS
+        // the line number table refers to this offset, so nothing before it can move
+        emit_peep_push(emit, PEEP_LINE, 0, emit->bytecode_offset);
+        #endif
     }
 #else
     (void)emit;
@@ -484,6 +580,14 @@ void mp_emit_bc_label_assign(emit_t *emit, mp_uint_t l) {
         return;
     }
     assert(l < emit->max_num_labels);
+    #if MICROPY_OPT_SUPERINSTRUCTIONS
+    if (emit_peep_kind(emit, 0) == PEEP_JUMP && emit->peep[0].arg == (mp_int_t)l) {
+        // a jump to the next instruction does nothing, so remove it
+        emit->bytecode_offset = emit->peep[0].offset;
+    }
+    // other jumps may land here, so nothing before the label can be fused
+    emit_peep_push(emit, PEEP_LABEL, l, emit->bytecode_offset);
+    #endif
     if (emit->pass < MP_PASS_EMIT) {
         // assign label offset
         assert(emit->label_offsets[l] == (mp_uint_t)-1);
@@ -526,7 +630,13 @@ void mp_emit_bc_load_const_tok(emit_t *emit, mp_token_kind_t tok) {
 void mp_emit_bc_load_const_small_int(emit_t *emit, mp_int_t arg) {
     emit_bc_pre(emit, 1);
     if (-16 <= arg && arg <= 47) {
+        #if MICROPY_OPT_SUPERINSTRUCTIONS
+        size_t offset = emit->bytecode_offset;
+        #endif
         emit_write_bytecode_byte(emit, MP_BC_LOAD_CONST_SMALL_INT_MULTI + 16 + arg);
+        #if MICROPY_OPT_SUPERINSTRUCTIONS
+        emit_peep_push(emit, PEEP_SMALL_INT, arg, offset);
+        #endif
     } else {
         emit_write_bytecode_byte_int(emit, MP_BC_LOAD_CONST_SMALL_INT, arg);
     }
@@ -551,7 +661,13 @@ void mp_emit_bc_load_fast(emit_t *emit, qstr qst, mp_uint_t local_num) {
     (void)qst;
     emit_bc_pre(emit, 1);
     if (local_num <= 15) {
+        #if MICROPY_OPT_SUPERINSTRUCTIONS
+        size_t offset = emit->bytecode_offset;
+        #endif
         emit_write_bytecode_byte(emit, MP_BC_LOAD_FAST_MULTI + local_num);
+        #if MICROPY_OPT_SUPERINSTRUCTIONS
+        emit_peep_push(emit, PEEP_LOAD_FAST, local_num, offset);
+        #endif
     } else {
         emit_write_bytecode_byte_uint(emit, MP_BC_LOAD_FAST_N, local_num);
     }
@@ -583,6 +699,9 @@ void mp_emit_bc_load_global(emit_t *emit, qstr qst) {
 
 void mp_emit_bc_load_attr(emit_t *emit, qstr qst) {
     emit_bc_pre(emit, 0);
+    #if MICROPY_OPT_SUPERINSTRUCTIONS
+    emit_fuse_load_fast(emit, MP_BC_FUSED_LOAD_FAST_ATTR);
+    #endif
     emit_write_bytecode_byte_qstr(emit, MP_BC_LOAD_ATTR, qst);
     if (MICROPY_OPT_CACHE_MAP_LOOKUP_IN_BYTECODE_DYNAMIC) {
         emit_write_bytecode_byte(emit, 0);
@@ -591,6 +710,9 @@ void mp_emit_bc_load_attr(emit_t *emit, qstr qst) {
 
 void mp_emit_bc_load_method(emit_t *emit, qstr qst) {
     emit_bc_pre(emit, 1);
+    #if MICROPY_OPT_SUPERINSTRUCTIONS
+    emit_fuse_load_fast(emit, MP_BC_FUSED_LOAD_FAST_METHOD);
+    #endif
     emit_write_bytecode_byte_qstr(emit, MP_BC_LOAD_METHOD, qst);
 }
 
@@ -702,11 +824,34 @@ void mp_emit_bc_rot_three(emit_t *emit) {
 
 void mp_emit_bc_jump(emit_t *emit, mp_uint_t label) {
     emit_bc_pre(emit, 0);
+    #if MICROPY_OPT_SUPERINSTRUCTIONS
+    if (emit->pass < MP_PASS_EMIT) {
+        // a jump to a label just before this one can go straight to its target
+        for (size_t i = 0; i < PEEP_DEPTH; ++i) {
+            byte kind = emit_peep_kind(emit, i);
+            if (kind == PEEP_LABEL) {
+                emit->label_jumps[emit->peep[i].arg] = label;
+            } else if (kind != PEEP_LINE) {
+                break;
+            }
+        }
+    }
+    size_t offset = emit->bytecode_offset;
+    #endif
     emit_write_bytecode_byte_signed_label(emit, MP_BC_JUMP, label);
+    #if MICROPY_OPT_SUPERINSTRUCTIONS
+    emit_peep_push(emit, PEEP_JUMP, label, offset);
+    #endif
 }
 
 void mp_emit_bc_pop_jump_if(emit_t *emit, bool cond, mp_uint_t label) {
     emit_bc_pre(emit, -1);
+    #if MICROPY_OPT_SUPERINSTRUCTIONS
+    if (emit_peep_kind(emit, 0) == PEEP_COMPARE_OP) {
+        emit->bytecode_offset = emit->peep[0].offset;
+        emit_write_bytecode_byte_byte(emit, MP_BC_FUSED_COMPARE_JUMP, MP_BC_BINARY_OP_MULTI + emit->peep[0].arg);
+    }
+    #endif
     if (cond) {
         emit_write_bytecode_byte_signed_label(emit, MP_BC_POP_JUMP_IF_TRUE, label);
     } else {
@@ -807,7 +952,23 @@ void mp_emit_bc_binary_op(emit_t *emit, mp_binary_op_t op) {
         op = MP_BINARY_OP_IS;
     }
     emit_bc_pre(emit, -1);
-    emit_write_bytecode_byte(emit, MP_BC_BINARY_OP_MULTI + op);
+    #if MICROPY_OPT_SUPERINSTRUCTIONS
+    if (emit_peep_kind(emit, 0) == PEEP_SMALL_INT && emit->peep[1].kind == PEEP_LOAD_FAST) {
+        // rewrite the local and the small int with the prefix in front
+        emit->bytecode_offset = emit->peep[1].offset;
+        emit_write_bytecode_byte_byte(emit, MP_BC_FUSED_FAST_INT_BINARY_OP, MP_BC_LOAD_FAST_MULTI + emit->peep[1].arg);
+        emit_write_bytecode_byte(emit, MP_BC_LOAD_CONST_SMALL_INT_MULTI + 16 + emit->peep[0].arg);
+        emit_write_bytecode_byte(emit, MP_BC_BINARY_OP_MULTI + op);
+    } else if (MP_BINARY_OP_LESS <= op && op <= MP_BINARY_OP_NOT_EQUAL) {
+        // a compare, which may be fused with a conditional jump after it
+        size_t offset = emit->bytecode_offset;
+        emit_write_bytecode_byte(emit, MP_BC_BINARY_OP_MULTI + op);
+        emit_peep_push(emit, PEEP_COMPARE_OP, op, offset);
+    } else
+    #endif
+    {
+        emit_write_bytecode_byte(emit, MP_BC_BINARY_OP_MULTI + op);
+    }
     if (invert) {
         emit_bc_pre(emit, 0);
         emit_write_bytecode_byte(emit, MP_BC_UNARY_OP_MULTI + MP_UNARY_OP_NOT);
@@ -34,6 +34,7 @@
 #include "py/emitglue.h"
 #include "py/runtime0.h"
 #include "py/bc.h"
+#include "py/objfun.h"
 
 #if 0 // print debugging info
 #define DEBUG_PRINT (1)
@@ -83,7 +84,11 @@ void mp_emit_glue_assign_bytecode(mp_raw_code_t *rc, const byte *code, mp_uint_t
 }
 
 #if MICROPY_EMIT_NATIVE || MICROPY_EMIT_INLINE_THUMB
-void mp_emit_glue_assign_native(mp_raw_code_t *rc, mp_raw_code_kind_t kind, void *fun_data, mp_uint_t fun_len, const mp_uint_t *const_table, mp_uint_t n_pos_args, mp_uint_t scope_flags, mp_uint_t type_sig) {
+void mp_emit_glue_assign_native(mp_raw_code_t *rc, mp_raw_code_kind_t kind, void *fun_data, mp_uint_t fun_len, const mp_uint_t *const_table,
+    #if MICROPY_PERSISTENT_CODE_SAVE
+    mp_uint_t n_reloc, const mp_native_reloc_t *reloc,
+    #endif
+    mp_uint_t n_pos_args, mp_uint_t scope_flags, mp_uint_t type_sig) {
     assert(kind == MP_CODE_NATIVE_PY || kind == MP_CODE_NATIVE_VIPER || kind == MP_CODE_NATIVE_ASM);
     rc->kind = kind;
     rc->scope_flags = scope_flags;
@@ -91,6 +96,11 @@ void mp_emit_glue_assign_native(mp_raw_code_t *rc, mp_raw_code_kind_t kind, void
     rc->data.u_native.fun_data = fun_data;
     rc->data.u_native.const_table = const_table;
     rc->data.u_native.type_sig = type_sig;
+    #if MICROPY_PERSISTENT_CODE_SAVE
+    rc->data.u_native.fun_len = fun_len;
+    rc->data.u_native.n_reloc = n_reloc;
+    rc->data.u_native.reloc = reloc;
+    #endif
 
 #ifdef DEBUG_PRINT
     DEBUG_printf("assign native: kind=%d fun=%p len=" UINT_FMT " n_pos_args=" UINT_FMT " flags=%x\n", kind, fun_data, fun_len, n_pos_args, (uint)scope_flags);
@@ -113,6 +123,32 @@ void mp_emit_glue_assign_native(mp_raw_code_t *rc, mp_raw_code_kind_t kind, void
 }
 #endif
 
+#if MICROPY_EMIT_NATIVE
+// Work out the word that a relocation in native code is set to in this runtime.
+mp_uint_t mp_native_reloc_value(mp_native_reloc_kind_t kind, mp_uint_t value) {
+    switch (kind) {
+        case MP_NATIVE_RELOC_FUN:
+            return (mp_uint_t)mp_fun_table[value];
+        case MP_NATIVE_RELOC_FUN_TABLE:
+            return (mp_uint_t)mp_fun_table;
+        case MP_NATIVE_RELOC_QSTR_OBJ:
+            return (mp_uint_t)MP_OBJ_NEW_QSTR(value);
+        case MP_NATIVE_RELOC_QSTR_STR:
+            return (mp_uint_t)qstr_str(value);
+        case MP_NATIVE_RELOC_CONST_TOK:
+            switch (value) {
+                case 0: return (mp_uint_t)mp_const_none;
+                case 1: return (mp_uint_t)mp_const_false;
+                case 2: return (mp_uint_t)mp_const_true;
+                default: return (mp_uint_t)MP_OBJ_FROM_PTR(&mp_const_ellipsis_obj);
+            }
+        default:
+            // the qstr, object or raw code is the value itself
+            return value;
+    }
+}
+#endif
+
 mp_obj_t mp_make_function_from_raw_code(const mp_raw_code_t *rc, mp_obj_t def_args, mp_obj_t def_kw_args) {
     DEBUG_OP_printf("make_function_from_raw_code %p\n", rc);
     assert(rc != NULL);
@@ -127,6 +163,21 @@ mp_obj_t mp_make_function_from_raw_code(const mp_raw_code_t *rc, mp_obj_t def_ar
     mp_obj_t fun;
     switch (rc->kind) {
         case MP_CODE_BYTECODE:
+            #if MICROPY_EMIT_NATIVE_TIERING
+            if (rc->data.u_byte.tier != NULL) {
+                mp_tier_t *tier = rc->data.u_byte.tier;
+                if (tier->native != NULL) {
+                    // already made native through another function object
+                    fun = mp_obj_new_fun_native(def_args, def_kw_args, tier->native->data.u_native.fun_data, tier->native->data.u_native.const_table);
+                } else {
+                    fun = mp_obj_new_fun_bc(def_args, def_kw_args, rc->data.u_byte.bytecode, rc->data.u_byte.const_table);
+                }
+                if (tier->native != NULL || tier->pn != MP_PARSE_NODE_NULL) {
+                    ((mp_obj_fun_bc_t*)MP_OBJ_TO_PTR(fun))->tier = tier;
+                }
+                break;
+            }
+            #endif
         no_other_choice:
             fun = mp_obj_new_fun_bc(def_args, def_kw_args, rc->data.u_byte.bytecode, rc->data.u_byte.const_table);
             break;
@@ -176,6 +227,9 @@ mp_obj_t mp_make_closure_from_raw_code(const mp_raw_code_t *rc, mp_uint_t n_clos
 
 #include "py/smallint.h"
 
+// The version of the .mpy format, which changes when the bytecode does.
+#define MPY_VERSION (3)
+
 // The feature flags byte encodes the compile-time config options that
 // affect the generate bytecode.
 #define MPY_FEATURE_FLAGS ( \
@@ -188,6 +242,16 @@ mp_obj_t mp_make_closure_from_raw_code(const mp_raw_code_t *rc, mp_uint_t n_clos
     | ((MICROPY_PY_BUILTINS_STR_UNICODE_DYNAMIC) << 1) \
     )
 
+// The arch of the native code that this port can load and save, stored in the
+// upper bits of the feature flags byte.
+#if MICROPY_EMIT_X64
+#define MPY_FEATURE_ARCH (MP_NATIVE_ARCH_X64)
+#elif MICROPY_EMIT_THUMB
+#define MPY_FEATURE_ARCH (MP_NATIVE_ARCH_THUMB)
+#else
+#define MPY_FEATURE_ARCH (MP_NATIVE_ARCH_NONE)
+#endif
+
 #if MICROPY_PERSISTENT_CODE_LOAD || (MICROPY_PERSISTENT_CODE_SAVE && !MICROPY_DYNAMIC_COMPILER)
 // The bytecode will depend on the number of bits in a small-int, and
 // this function computes that (could make it a fixed constant, but it
@@ -234,6 +298,7 @@ STATIC void extract_prelude(const byte **ip, const byte **ip2, bytecode_prelude_
 #if MICROPY_PERSISTENT_CODE_LOAD
 
 #include "py/parsenum.h"
+#include "py/objtuple.h"
 #include "py/bc0.h"
 
 STATIC int read_byte(mp_reader_t *reader) {
@@ -271,6 +336,19 @@ STATIC mp_obj_t load_obj(mp_reader_t *reader) {
     byte obj_type = read_byte(reader);
     if (obj_type == 'e') {
         return MP_OBJ_FROM_PTR(&mp_const_ellipsis_obj);
+    } else if (obj_type == 'N') {
+        return mp_const_none;
+    } else if (obj_type == 'F') {
+        return mp_const_false;
+    } else if (obj_type == 'T') {
+        return mp_const_true;
+    } else if (obj_type == 't') {
+        size_t len = read_uint(reader);
+        mp_obj_tuple_t *tuple = MP_OBJ_TO_PTR(mp_obj_new_tuple(len, NULL));
+        for (size_t i = 0; i < len; ++i) {
+            tuple->items[i] = load_obj(reader);
+        }
+        return MP_OBJ_FROM_PTR(tuple);
     } else {
         size_t len = read_uint(reader);
         vstr_t vstr;
@@ -300,9 +378,112 @@ STATIC void load_bytecode_qstrs(mp_reader_t *reader, byte *ip, byte *ip_top) {
     }
 }
 
-STATIC mp_raw_code_t *load_raw_code(mp_reader_t *reader) {
+STATIC mp_raw_code_t *load_raw_code(mp_reader_t *reader, byte arch);
+
+#if MICROPY_EMIT_NATIVE
+STATIC mp_raw_code_t *load_raw_code_native(mp_reader_t *reader, byte arch, mp_raw_code_kind_t kind, size_t fun_len) {
+    // the code must be for this arch, and its stack frame must fit the layout
+    // that the emitter assumed for it
+    if (arch == MP_NATIVE_ARCH_NONE || arch != MPY_FEATURE_ARCH || kind == MP_CODE_NATIVE_ASM
+        || sizeof(mp_code_state_t) / sizeof(mp_uint_t) > MP_CODE_STATE_MAX_WORDS
+        || sizeof(nlr_buf_t) / sizeof(mp_uint_t) != MP_NATIVE_ARCH_NLR_BUF_WORDS(MPY_FEATURE_ARCH)) {
+        mp_raise_ValueError("incompatible .mpy arch");
+    }
+
+    // load machine code into executable memory
+    byte *fun_data;
+    size_t fun_alloc;
+    MP_PLAT_ALLOC_EXEC(fun_len, (void**)&fun_data, &fun_alloc);
+    if (fun_data == NULL) {
+        m_malloc_fail(fun_len);
+    }
+    read_bytes(reader, fun_data, fun_len);
+
+    const mp_uint_t *const_table = NULL;
+    if (kind == MP_CODE_NATIVE_PY) {
+        const_table = (const mp_uint_t*)(fun_data + read_uint(reader));
+    }
+    mp_uint_t scope_flags = read_uint(reader);
+    mp_uint_t n_pos_args = read_uint(reader);
+    mp_uint_t type_sig = 0;
+    if (kind == MP_CODE_NATIVE_VIPER) {
+        type_sig = read_uint(reader);
+    }
+
+    // load the values that depend on where things are, and link them in
+    mp_uint_t n_reloc = read_uint(reader);
+    #if MICROPY_PERSISTENT_CODE_SAVE
+    mp_native_reloc_t *reloc = m_new(mp_native_reloc_t, n_reloc);
+    #endif
+    for (mp_uint_t i = 0; i < n_reloc; ++i) {
+        mp_uint_t offset = read_uint(reader);
+        mp_native_reloc_kind_t rkind = read_byte(reader);
+        mp_uint_t value;
+        switch (rkind) {
+            case MP_NATIVE_RELOC_FUN_TABLE:
+                value = 0;
+                break;
+            case MP_NATIVE_RELOC_QSTR:
+            case MP_NATIVE_RELOC_QSTR16:
+            case MP_NATIVE_RELOC_QSTR_OBJ:
+            case MP_NATIVE_RELOC_QSTR_STR:
+                value = load_qstr(reader);
+                break;
+            case MP_NATIVE_RELOC_OBJ:
+                value = (mp_uint_t)load_obj(reader);
+                break;
+            case MP_NATIVE_RELOC_RAW_CODE:
+                value = (mp_uint_t)(uintptr_t)load_raw_code(reader, arch);
+                break;
+            default:
+                // MP_NATIVE_RELOC_FUN and MP_NATIVE_RELOC_CONST_TOK
+                value = read_uint(reader);
+                break;
+        }
+        mp_uint_t word = mp_native_reloc_value(rkind, value);
+        size_t word_len = rkind == MP_NATIVE_RELOC_QSTR16 ? 2 : sizeof(mp_uint_t);
+        if (offset + word_len > fun_len) {
+            mp_raise_ValueError("invalid .mpy file");
+        }
+        if (rkind == MP_NATIVE_RELOC_QSTR16) {
+            fun_data[offset] = word;
+            fun_data[offset + 1] = word >> 8;
+        } else {
+            memcpy(fun_data + offset, &word, sizeof(word));
+        }
+        #if MICROPY_PERSISTENT_CODE_SAVE
+        reloc[i].offset = offset;
+        reloc[i].kind = rkind;
+        reloc[i].value = value;
+        #endif
+    }
+
+    // create raw_code and return it
+    mp_raw_code_t *rc = mp_emit_glue_new_raw_code();
+    mp_emit_glue_assign_native(rc, kind, fun_data, fun_len, const_table,
+        #if MICROPY_PERSISTENT_CODE_SAVE
+        n_reloc, reloc,
+        #endif
+        n_pos_args, scope_flags, type_sig);
+    return rc;
+}
+#endif
+
+STATIC mp_raw_code_t *load_raw_code(mp_reader_t *reader, byte arch) {
+    // the kind of raw code is stored in the lower 2 bits of its length
+    mp_uint_t kind_len = read_uint(reader);
+    mp_raw_code_kind_t kind = MP_CODE_BYTECODE + (kind_len & 3);
+    if (kind != MP_CODE_BYTECODE) {
+        #if MICROPY_EMIT_NATIVE
+        return load_raw_code_native(reader, arch, kind, kind_len >> 2);
+        #else
+        (void)arch;
+        mp_raise_ValueError("incompatible .mpy arch");
+        #endif
+    }
+
     // load bytecode
-    mp_uint_t bc_len = read_uint(reader);
+    mp_uint_t bc_len = kind_len >> 2;
     byte *bytecode = m_new(byte, bc_len);
     read_bytes(reader, bytecode, bc_len);
 
@@ -331,7 +512,7 @@ STATIC mp_raw_code_t *load_raw_code(mp_reader_t *reader) {
         *ct++ = (mp_uint_t)load_obj(reader);
     }
     for (mp_uint_t i = 0; i < n_raw_code; ++i) {
-        *ct++ = (mp_uint_t)(uintptr_t)load_raw_code(reader);
+        *ct++ = (mp_uint_t)(uintptr_t)load_raw_code(reader, arch);
     }
 
     // create raw_code and return it
@@ -347,13 +528,14 @@ STATIC mp_raw_code_t *load_raw_code(mp_reader_t *reader) {
 mp_raw_code_t *mp_raw_code_load(mp_reader_t *reader) {
     byte header[4];
     read_bytes(reader, header, sizeof(header));
-    if (strncmp((char*)header, "M\x00", 2) != 0) {
+    if (header[0] != 'M' || header[1] != MPY_VERSION) {
         mp_raise_ValueError("invalid .mpy file");
     }
-    if (header[2] != MPY_FEATURE_FLAGS || header[3] > mp_small_int_bits()) {
+    if ((header[2] & 3) != MPY_FEATURE_FLAGS || header[3] > mp_small_int_bits()) {
         mp_raise_ValueError("incompatible .mpy file");
     }
-    return load_raw_code(reader);
+    // the arch is only checked if the file contains native code
+    return load_raw_code(reader, header[2] >> 2);
 }
 
 typedef struct _mp_mem_reader_t {
@@ -480,6 +662,14 @@ mp_raw_code_t *mp_raw_code_load_file(const char *filename) {
 #if MICROPY_PERSISTENT_CODE_SAVE
 
 #include "py/objstr.h"
+#include "py/objtuple.h"
+
+// The arch that native code is saved for.
+#if MICROPY_DYNAMIC_COMPILER
+#define MPY_SAVE_ARCH (mp_dynamic_compiler.native_arch)
+#else
+#define MPY_SAVE_ARCH (MPY_FEATURE_ARCH)
+#endif
 
 STATIC void mp_print_bytes(mp_print_t *print, const byte *data, size_t len) {
     print->print_strn(print->data, (const char*)data, len);
@@ -520,11 +710,25 @@ STATIC void save_obj(mp_print_t *print, mp_obj_t o) {
     } else if (MP_OBJ_TO_PTR(o) == &mp_const_ellipsis_obj) {
         byte obj_type = 'e';
         mp_print_bytes(print, &obj_type, 1);
+    } else if (o == mp_const_none || o == mp_const_false || o == mp_const_true) {
+        byte obj_type = o == mp_const_none ? 'N' : o == mp_const_false ? 'F' : 'T';
+        mp_print_bytes(print, &obj_type, 1);
+    } else if (MP_OBJ_IS_TYPE(o, &mp_type_tuple)) {
+        // save the items of a constant tuple one after the other
+        size_t len;
+        mp_obj_t *items;
+        mp_obj_tuple_get(o, &len, &items);
+        byte obj_type = 't';
+        mp_print_bytes(print, &obj_type, 1);
+        mp_print_uint(print, len);
+        for (size_t i = 0; i < len; ++i) {
+            save_obj(print, items[i]);
+        }
     } else {
         // we save numbers using a simplistic text representation
         // TODO could be improved
         byte obj_type;
-        if (MP_OBJ_IS_TYPE(o, &mp_type_int)) {
+        if (MP_OBJ_IS_INT(o)) {
             obj_type = 'i';
         } else if (mp_obj_is_float(o)) {
             obj_type = 'f';
@@ -555,13 +759,71 @@ STATIC void save_bytecode_qstrs(mp_print_t *print, const byte *ip, const byte *i
     }
 }
 
+STATIC void save_raw_code(mp_print_t *print, mp_raw_code_t *rc);
+
+#if MICROPY_EMIT_NATIVE
+STATIC void save_raw_code_native(mp_print_t *print, mp_raw_code_t *rc) {
+    if (MPY_SAVE_ARCH == MP_NATIVE_ARCH_NONE) {
+        mp_raise_ValueError("can't save native code for this arch");
+    }
+
+    // save machine code, with the values that get relocated left as they are
+    const byte *fun_data = rc->data.u_native.fun_data;
+    mp_print_uint(print, rc->data.u_native.fun_len << 2 | (rc->kind - MP_CODE_BYTECODE));
+    mp_print_bytes(print, fun_data, rc->data.u_native.fun_len);
+
+    if (rc->kind == MP_CODE_NATIVE_PY) {
+        mp_print_uint(print, (const byte*)rc->data.u_native.const_table - fun_data);
+    }
+    mp_print_uint(print, rc->scope_flags);
+    mp_print_uint(print, rc->n_pos_args);
+    if (rc->kind == MP_CODE_NATIVE_VIPER) {
+        mp_print_uint(print, rc->data.u_native.type_sig);
+    }
+
+    // save relocations
+    mp_print_uint(print, rc->data.u_native.n_reloc);
+    for (mp_uint_t i = 0; i < rc->data.u_native.n_reloc; ++i) {
+        const mp_native_reloc_t *r = &rc->data.u_native.reloc[i];
+        byte kind = r->kind;
+        mp_print_uint(print, r->offset);
+        mp_print_bytes(print, &kind, 1);
+        switch (r->kind) {
+            case MP_NATIVE_RELOC_FUN_TABLE:
+                break;
+            case MP_NATIVE_RELOC_QSTR:
+            case MP_NATIVE_RELOC_QSTR16:
+            case MP_NATIVE_RELOC_QSTR_OBJ:
+            case MP_NATIVE_RELOC_QSTR_STR:
+                save_qstr(print, r->value);
+                break;
+            case MP_NATIVE_RELOC_OBJ:
+                save_obj(print, (mp_obj_t)r->value);
+                break;
+            case MP_NATIVE_RELOC_RAW_CODE:
+                save_raw_code(print, (mp_raw_code_t*)(uintptr_t)r->value);
+                break;
+            default:
+                mp_print_uint(print, r->value);
+                break;
+        }
+    }
+}
+#endif
+
 STATIC void save_raw_code(mp_print_t *print, mp_raw_code_t *rc) {
+    #if MICROPY_EMIT_NATIVE
+    if (rc->kind == MP_CODE_NATIVE_PY || rc->kind == MP_CODE_NATIVE_VIPER) {
+        save_raw_code_native(print, rc);
+        return;
+    }
+    #endif
     if (rc->kind != MP_CODE_BYTECODE) {
-        mp_raise_ValueError("can only save bytecode");
+        mp_raise_ValueError("can only save bytecode and native code");
     }
 
-    // save bytecode
-    mp_print_uint(print, rc->data.u_byte.bc_len);
+    // save bytecode, with the kind in the lower 2 bits of the length
+    mp_print_uint(print, rc->data.u_byte.bc_len << 2);
     mp_print_bytes(print, rc->data.u_byte.bytecode, rc->data.u_byte.bc_len);
 
     // extract prelude
@@ -595,9 +857,10 @@ void mp_raw_code_save(mp_raw_code_t *rc, mp_print_t *print) {
     // header contains:
     //  byte  'M'
     //  byte  version
-    //  byte  feature flags
+    //  byte  feature flags, and the native arch in the upper bits
     //  byte  number of bits in a small int
-    byte header[4] = {'M', 0, MPY_FEATURE_FLAGS_DYNAMIC,
+    byte header[4] = {'M', MPY_VERSION,
+        MPY_FEATURE_FLAGS_DYNAMIC | MPY_SAVE_ARCH << 2,
         #if MICROPY_DYNAMIC_COMPILER
         mp_dynamic_compiler.small_int_bits,
         #else
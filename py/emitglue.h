@@ -27,6 +27,7 @@
 #define __MICROPY_INCLUDED_PY_EMITGLUE_H__
 
 #include "py/obj.h"
+#include "py/parse.h"
 
 // These variables and functions glue the code emitters to the runtime.
 
@@ -39,6 +40,58 @@ typedef enum {
     MP_CODE_NATIVE_ASM,
 } mp_raw_code_kind_t;
 
+// The architectures that a .mpy file can contain native code for.  The arch
+// is stored in the header, and a .mpy file with native code can only be
+// loaded on a port that emits code for the same arch.
+enum {
+    MP_NATIVE_ARCH_NONE,
+    MP_NATIVE_ARCH_X64,
+    MP_NATIVE_ARCH_THUMB,
+};
+
+// Native code in a .mpy file uses the nlr_buf_t of the native nlr
+// implementation for its arch, which is this many words.
+#define MP_NATIVE_ARCH_NLR_BUF_WORDS(arch) ((arch) == MP_NATIVE_ARCH_X64 ? 10 : 12)
+
+// The values in native code that depend on where the code (or the runtime) is
+// loaded.  Each is a machine word in the code, which is filled in when the code
+// is loaded from a .mpy file, except MP_NATIVE_RELOC_QSTR16 which is 16 bits.
+typedef enum {
+    MP_NATIVE_RELOC_FUN,        // address of mp_fun_table[value]
+    MP_NATIVE_RELOC_FUN_TABLE,  // address of mp_fun_table
+    MP_NATIVE_RELOC_QSTR,       // the qstr value
+    MP_NATIVE_RELOC_QSTR16,     // the qstr value, in the code info
+    MP_NATIVE_RELOC_QSTR_OBJ,   // MP_OBJ_NEW_QSTR(value)
+    MP_NATIVE_RELOC_QSTR_STR,   // qstr_str(value)
+    MP_NATIVE_RELOC_CONST_TOK,  // None, False, True or Ellipsis, for value 0-3
+    MP_NATIVE_RELOC_OBJ,        // the constant object pointed to by value
+    MP_NATIVE_RELOC_RAW_CODE,   // the raw code pointed to by value
+} mp_native_reloc_kind_t;
+
+typedef struct _mp_native_reloc_t {
+    uint32_t offset : 28;
+    mp_native_reloc_kind_t kind : 4;
+    mp_uint_t value;
+} mp_native_reloc_t;
+
+mp_uint_t mp_native_reloc_value(mp_native_reloc_kind_t kind, mp_uint_t value);
+
+#if MICROPY_EMIT_NATIVE_TIERING
+// What is kept of a bytecode function so that it can be recompiled natively
+// once it becomes hot.  It's shared by all function objects made from the same
+// raw code, and references the parse tree that the function came from.
+typedef struct _mp_tier_t {
+    mp_parse_node_t pn;             // the funcdef node, or MP_PARSE_NODE_NULL when done
+    struct _mp_parse_chunk_t *chunk; // keeps the parse tree alive
+    qstr source_file;
+    qstr simple_name;
+    uint8_t scope_flags;            // flags and number of defaults set by the
+    uint16_t num_def_pos_args;      // parent scope, which can't be worked out again
+    mp_uint_t hotness;              // calls and loop back-edges so far
+    const struct _mp_raw_code_t *native; // the native version, once compiled
+} mp_tier_t;
+#endif
+
 typedef struct _mp_raw_code_t {
     mp_raw_code_kind_t kind : 3;
     mp_uint_t scope_flags : 7;
@@ -52,11 +105,19 @@ typedef struct _mp_raw_code_t {
             uint16_t n_obj;
             uint16_t n_raw_code;
             #endif
+            #if MICROPY_EMIT_NATIVE_TIERING
+            mp_tier_t *tier;
+            #endif
         } u_byte;
         struct {
             void *fun_data;
             const mp_uint_t *const_table;
             mp_uint_t type_sig; // for viper, compressed as 2-bit types; ret is MSB, then arg0, arg1, etc
+            #if MICROPY_PERSISTENT_CODE_SAVE
+            mp_uint_t fun_len;
+            mp_uint_t n_reloc;
+            const mp_native_reloc_t *reloc;
+            #endif
         } u_native;
     } data;
 } mp_raw_code_t;
@@ -69,7 +130,11 @@ void mp_emit_glue_assign_bytecode(mp_raw_code_t *rc, const byte *code, mp_uint_t
     uint16_t n_obj, uint16_t n_raw_code,
     #endif
     mp_uint_t scope_flags);
-void mp_emit_glue_assign_native(mp_raw_code_t *rc, mp_raw_code_kind_t kind, void *fun_data, mp_uint_t fun_len, const mp_uint_t *const_table, mp_uint_t n_pos_args, mp_uint_t scope_flags, mp_uint_t type_sig);
+void mp_emit_glue_assign_native(mp_raw_code_t *rc, mp_raw_code_kind_t kind, void *fun_data, mp_uint_t fun_len, const mp_uint_t *const_table,
+    #if MICROPY_PERSISTENT_CODE_SAVE
+    mp_uint_t n_reloc, const mp_native_reloc_t *reloc,
+    #endif
+    mp_uint_t n_pos_args, mp_uint_t scope_flags, mp_uint_t type_sig);
 
 mp_obj_t mp_make_function_from_raw_code(const mp_raw_code_t *rc, mp_obj_t def_args, mp_obj_t def_kw_args);
 mp_obj_t mp_make_closure_from_raw_code(const mp_raw_code_t *rc, mp_uint_t n_closed_over, const mp_obj_t *args);
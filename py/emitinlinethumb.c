@@ -91,7 +91,11 @@ STATIC void emit_inline_thumb_end_pass(emit_inline_asm_t *emit, mp_uint_t type_s
     if (emit->pass == MP_PASS_EMIT) {
         void *f = asm_thumb_get_code(emit->as);
         mp_emit_glue_assign_native(emit->scope->raw_code, MP_CODE_NATIVE_ASM, f,
-            asm_thumb_get_code_size(emit->as), NULL, emit->scope->num_pos_args, 0, type_sig);
+            asm_thumb_get_code_size(emit->as), NULL,
+            #if MICROPY_PERSISTENT_CODE_SAVE
+            0, NULL,
+            #endif
+            emit->scope->num_pos_args, 0, type_sig);
     }
 }
 
@@ -71,6 +71,7 @@
 
 #define EXPORT_FUN(name) emit_native_x64_##name
 
+#define NATIVE_ARCH (MP_NATIVE_ARCH_X64)
 #define ASM_WORD_SIZE (8)
 
 #define REG_RET ASM_X64_REG_RAX
@@ -89,7 +90,9 @@
 #define REG_LOCAL_1 ASM_X64_REG_RBX
 #define REG_LOCAL_2 ASM_X64_REG_R12
 #define REG_LOCAL_3 ASM_X64_REG_R13
-#define REG_LOCAL_NUM (3)
+#define REG_LOCAL_4 ASM_X64_REG_R14
+#define REG_LOCAL_5 ASM_X64_REG_R15
+#define REG_LOCAL_NUM (5)
 
 #define ASM_PASS_COMPUTE    ASM_X64_PASS_COMPUTE
 #define ASM_PASS_EMIT       ASM_X64_PASS_EMIT
@@ -130,6 +133,7 @@
 #define ASM_MOV_REG_TO_LOCAL        asm_x64_mov_r64_to_local
 #define ASM_MOV_IMM_TO_REG          asm_x64_mov_i64_to_r64_optimised
 #define ASM_MOV_ALIGNED_IMM_TO_REG  asm_x64_mov_i64_to_r64_aligned
+#define ASM_MOV_ALIGNED_IMM_TAIL    (0) // bytes after the immediate
 #define ASM_MOV_IMM_TO_LOCAL_USING(as, imm, local_num, reg_temp) \
     do { \
         asm_x64_mov_i64_to_r64_optimised(as, (imm), (reg_temp)); \
@@ -216,6 +220,7 @@ STATIC byte mp_f_n_args[MP_F_NUMBER_OF] = {
 
 #define EXPORT_FUN(name) emit_native_x86_##name
 
+#define NATIVE_ARCH (MP_NATIVE_ARCH_NONE)
 #define ASM_WORD_SIZE (4)
 
 #define REG_RET ASM_X86_REG_EAX
@@ -275,6 +280,7 @@ STATIC byte mp_f_n_args[MP_F_NUMBER_OF] = {
 #define ASM_MOV_REG_TO_LOCAL        asm_x86_mov_r32_to_local
 #define ASM_MOV_IMM_TO_REG          asm_x86_mov_i32_to_r32
 #define ASM_MOV_ALIGNED_IMM_TO_REG  asm_x86_mov_i32_to_r32_aligned
+#define ASM_MOV_ALIGNED_IMM_TAIL    (0) // bytes after the immediate
 #define ASM_MOV_IMM_TO_LOCAL_USING(as, imm, local_num, reg_temp) \
     do { \
         asm_x86_mov_i32_to_r32(as, (imm), (reg_temp)); \
@@ -313,6 +319,7 @@ STATIC byte mp_f_n_args[MP_F_NUMBER_OF] = {
 
 #define EXPORT_FUN(name) emit_native_thumb_##name
 
+#define NATIVE_ARCH (MP_NATIVE_ARCH_THUMB)
 #define ASM_WORD_SIZE (4)
 
 #define REG_RET ASM_THUMB_REG_R0
@@ -370,6 +377,7 @@ STATIC byte mp_f_n_args[MP_F_NUMBER_OF] = {
 #define ASM_MOV_REG_TO_LOCAL(as, reg, local_num) asm_thumb_mov_local_reg(as, (local_num), (reg))
 #define ASM_MOV_IMM_TO_REG(as, imm, reg) asm_thumb_mov_reg_i32_optimised(as, (reg), (imm))
 #define ASM_MOV_ALIGNED_IMM_TO_REG(as, imm, reg) asm_thumb_mov_reg_i32_aligned(as, (reg), (imm))
+#define ASM_MOV_ALIGNED_IMM_TAIL (4) // bytes after the immediate
 #define ASM_MOV_IMM_TO_LOCAL_USING(as, imm, local_num, reg_temp) \
     do { \
         asm_thumb_mov_reg_i32_optimised(as, (reg_temp), (imm)); \
@@ -410,6 +418,7 @@ STATIC byte mp_f_n_args[MP_F_NUMBER_OF] = {
 
 #define EXPORT_FUN(name) emit_native_arm_##name
 
+#define NATIVE_ARCH (MP_NATIVE_ARCH_NONE)
 #define REG_RET ASM_ARM_REG_R0
 #define REG_ARG_1 ASM_ARM_REG_R0
 #define REG_ARG_2 ASM_ARM_REG_R1
@@ -500,6 +509,25 @@ STATIC byte mp_f_n_args[MP_F_NUMBER_OF] = {
 
 #endif
 
+// callee-save registers that can hold locals
+STATIC const byte reg_local_table[REG_LOCAL_NUM] = {
+    REG_LOCAL_1, REG_LOCAL_2, REG_LOCAL_3,
+    #if REG_LOCAL_NUM > 3
+    REG_LOCAL_4, REG_LOCAL_5,
+    #endif
+};
+
+#define REG_LOCAL_NONE (0xff)
+#define LOCAL_NONE ((mp_uint_t)-1)
+
+// Locals are given registers by weight: each use counts 1, plus
+// LOCAL_WEIGHT_LOOP for each loop that contains it.
+#define LOCAL_WEIGHT_LOOP (8)
+#define LOCAL_WEIGHT_NO_REG ((mp_uint_t)-1)
+
+#define LABEL_POS_NONE ((mp_uint_t)-1)
+#define LABEL_POS_HANDLER ((mp_uint_t)1 << (8 * sizeof(mp_uint_t) - 1))
+
 #define EMIT_NATIVE_VIPER_TYPE_ERROR(emit, ...) do { \
         *emit->error_slot = mp_obj_new_exception_msg_varg(&mp_type_ViperTypeError, __VA_ARGS__); \
     } while (0)
@@ -562,6 +590,24 @@ struct _emit_t {
     mp_uint_t local_vtype_alloc;
     vtype_kind_t *local_vtype;
 
+    // register holding each local, or REG_LOCAL_NONE if it's in memory
+    byte *local_reg;
+    mp_uint_t *local_weight;
+
+    // the stack-size pass records the local loads and stores (local_num << 1,
+    // plus 1 for a store) in code order, and where each label falls in that
+    // list, to find loops and exception handlers
+    mp_uint_t use_list_alloc;
+    mp_uint_t use_list_len;
+    mp_uint_t *use_list;
+    mp_uint_t max_num_labels;
+    mp_uint_t *label_use_pos;
+
+    // a local that was just stored from REG_TEMP0, and the code position
+    // after the store; loading it straight back can reuse the register
+    mp_uint_t last_store_local;
+    mp_uint_t last_store_pos;
+
     mp_uint_t stack_info_alloc;
     stack_info_t *stack_info;
     vtype_kind_t saved_stack_vtype;
@@ -572,16 +618,28 @@ struct _emit_t {
     int stack_start;
     int stack_size;
 
+    // number of nlr_buf's pushed by the enclosing try and with blocks
+    int nlr_depth;
+
     bool last_emit_was_return_value;
 
     scope_t *scope;
 
+    #if MICROPY_PERSISTENT_CODE_SAVE
+    // the values in the code that are filled in when it's loaded from a .mpy file
+    mp_uint_t reloc_alloc;
+    mp_uint_t reloc_len;
+    mp_native_reloc_t *reloc;
+    #endif
+
     ASM_T *as;
 };
 
 emit_t *EXPORT_FUN(new)(mp_obj_t *error_slot, mp_uint_t max_num_labels) {
     emit_t *emit = m_new0(emit_t, 1);
     emit->error_slot = error_slot;
+    emit->max_num_labels = max_num_labels;
+    emit->label_use_pos = m_new(mp_uint_t, max_num_labels);
     emit->as = ASM_NEW(max_num_labels);
     return emit;
 }
@@ -589,7 +647,14 @@ emit_t *EXPORT_FUN(new)(mp_obj_t *error_slot, mp_uint_t max_num_labels) {
 void EXPORT_FUN(free)(emit_t *emit) {
     ASM_FREE(emit->as, false);
     m_del(vtype_kind_t, emit->local_vtype, emit->local_vtype_alloc);
+    m_del(byte, emit->local_reg, emit->local_vtype_alloc);
+    m_del(mp_uint_t, emit->local_weight, emit->local_vtype_alloc);
+    m_del(mp_uint_t, emit->use_list, emit->use_list_alloc);
+    m_del(mp_uint_t, emit->label_use_pos, emit->max_num_labels);
     m_del(stack_info_t, emit->stack_info, emit->stack_info_alloc);
+    #if MICROPY_PERSISTENT_CODE_SAVE
+    m_del(mp_native_reloc_t, emit->reloc, emit->reloc_alloc);
+    #endif
     m_del_obj(emit_t, emit);
 }
 
@@ -628,7 +693,140 @@ STATIC void emit_post_push_reg(emit_t *emit, vtype_kind_t vtype, int reg);
 STATIC void emit_native_load_fast(emit_t *emit, qstr qst, mp_uint_t local_num);
 STATIC void emit_native_store_fast(emit_t *emit, qstr qst, mp_uint_t local_num);
 
+#if MICROPY_DYNAMIC_COMPILER
+// the code may be loaded from a .mpy file by a port with any of the optional
+// fields of mp_code_state_t enabled, and uses the arch's native nlr_buf_t
+#define STATE_START (MP_CODE_STATE_MAX_WORDS)
+#define NLR_BUF_WORDS (MP_NATIVE_ARCH_NLR_BUF_WORDS(NATIVE_ARCH))
+#else
 #define STATE_START (sizeof(mp_code_state_t) / sizeof(mp_uint_t))
+#define NLR_BUF_WORDS (sizeof(nlr_buf_t) / sizeof(mp_uint_t))
+#endif
+
+// Give the registers to the locals with the highest weight.  A local that was
+// stored to while an exception handler was active has no weight, because the
+// registers are restored to their state at nlr_push when the handler is run.
+STATIC void emit_native_alloc_local_regs(emit_t *emit) {
+    mp_uint_t num_locals = emit->scope->num_locals;
+    memset(emit->local_reg, REG_LOCAL_NONE, num_locals);
+    for (int r = 0; r < REG_LOCAL_NUM; r++) {
+        mp_uint_t best = LOCAL_NONE;
+        mp_uint_t best_weight = 0;
+        for (mp_uint_t i = 0; i < num_locals; i++) {
+            mp_uint_t w = emit->local_weight[i];
+            if (emit->local_reg[i] == REG_LOCAL_NONE && w != LOCAL_WEIGHT_NO_REG && w > best_weight) {
+                best = i;
+                best_weight = w;
+            }
+        }
+        if (best == LOCAL_NONE) {
+            break;
+        }
+        emit->local_reg[best] = reg_local_table[r];
+    }
+}
+
+STATIC void emit_native_note_local(emit_t *emit, mp_uint_t local_num, bool is_store) {
+    if (emit->pass != MP_PASS_STACK_SIZE) {
+        return;
+    }
+    if (emit->use_list_len >= emit->use_list_alloc) {
+        mp_uint_t new_alloc = emit->use_list_alloc * 2 + 32;
+        emit->use_list = m_renew(mp_uint_t, emit->use_list, emit->use_list_alloc, new_alloc);
+        emit->use_list_alloc = new_alloc;
+    }
+    emit->use_list[emit->use_list_len++] = local_num << 1 | is_store;
+    if (emit->local_weight[local_num] < LOCAL_WEIGHT_NO_REG - 1) {
+        emit->local_weight[local_num] += 1;
+    }
+}
+
+STATIC void emit_native_note_label(emit_t *emit, mp_uint_t label) {
+    emit->last_store_local = LOCAL_NONE;
+    if (emit->pass != MP_PASS_STACK_SIZE) {
+        return;
+    }
+    mp_uint_t pos = emit->label_use_pos[label];
+    if (pos != LABEL_POS_NONE && (pos & LABEL_POS_HANDLER)) {
+        // end of a region protected by an exception handler
+        for (mp_uint_t i = pos & ~LABEL_POS_HANDLER; i < emit->use_list_len; i++) {
+            if (emit->use_list[i] & 1) {
+                emit->local_weight[emit->use_list[i] >> 1] = LOCAL_WEIGHT_NO_REG;
+            }
+        }
+    }
+    emit->label_use_pos[label] = emit->use_list_len;
+}
+
+// the code from here to the handler label is protected by an nlr_push
+STATIC void emit_native_note_handler(emit_t *emit, mp_uint_t label) {
+    if (emit->pass == MP_PASS_STACK_SIZE) {
+        emit->label_use_pos[label] = emit->use_list_len | LABEL_POS_HANDLER;
+    }
+}
+
+// a jump back to a label closes a loop, so the uses in it weigh more
+STATIC void emit_native_note_jump(emit_t *emit, mp_uint_t label) {
+    if (emit->pass != MP_PASS_STACK_SIZE) {
+        return;
+    }
+    mp_uint_t pos = emit->label_use_pos[label];
+    if (pos & LABEL_POS_HANDLER) {
+        // a forward jump (LABEL_POS_NONE has this bit set too)
+        return;
+    }
+    for (mp_uint_t i = pos; i < emit->use_list_len; i++) {
+        mp_uint_t *w = &emit->local_weight[emit->use_list[i] >> 1];
+        if (*w < LOCAL_WEIGHT_NO_REG - LOCAL_WEIGHT_LOOP) {
+            *w += LOCAL_WEIGHT_LOOP;
+        }
+    }
+}
+
+#if MICROPY_PERSISTENT_CODE_SAVE
+STATIC void emit_native_add_reloc(emit_t *emit, mp_uint_t offset, mp_native_reloc_kind_t kind, mp_uint_t value) {
+    if (emit->pass != MP_PASS_EMIT) {
+        return;
+    }
+    if (emit->reloc_len >= emit->reloc_alloc) {
+        emit->reloc = m_renew(mp_native_reloc_t, emit->reloc, emit->reloc_alloc, emit->reloc_alloc + 16);
+        emit->reloc_alloc += 16;
+    }
+    mp_native_reloc_t *r = &emit->reloc[emit->reloc_len++];
+    r->offset = offset;
+    r->kind = kind;
+    r->value = value;
+}
+#endif
+
+// Load a value that depends on where the code or the runtime is loaded.  When
+// the code may be saved to a .mpy file the value is put in a word of its own
+// and recorded, so the loader can fill it in.
+STATIC void emit_native_mov_reg_reloc(emit_t *emit, mp_native_reloc_kind_t kind, mp_uint_t value, int reg_dest) {
+    mp_uint_t imm = mp_native_reloc_value(kind, value);
+    #if MICROPY_PERSISTENT_CODE_SAVE
+    ASM_MOV_ALIGNED_IMM_TO_REG(emit->as, imm, reg_dest);
+    emit_native_add_reloc(emit, ASM_GET_CODE_POS(emit->as) - ASM_MOV_ALIGNED_IMM_TAIL - ASM_WORD_SIZE, kind, value);
+    #else
+    if (kind == MP_NATIVE_RELOC_OBJ || kind == MP_NATIVE_RELOC_RAW_CODE) {
+        // aligned, so that the GC finds the pointer when it scans the code
+        ASM_MOV_ALIGNED_IMM_TO_REG(emit->as, imm, reg_dest);
+    } else {
+        ASM_MOV_IMM_TO_REG(emit->as, imm, reg_dest);
+    }
+    #endif
+}
+
+// Call a runtime function.  On x64 the address of the function is an
+// immediate, which must be relocated if the code is saved to a .mpy file.
+STATIC void emit_native_call_ind(emit_t *emit, mp_fun_kind_t fun_kind) {
+    #if MICROPY_PERSISTENT_CODE_SAVE && N_X64
+    emit_native_mov_reg_reloc(emit, MP_NATIVE_RELOC_FUN, fun_kind, ASM_X64_REG_RAX);
+    asm_x64_call_r64(emit->as, ASM_X64_REG_RAX);
+    #else
+    ASM_CALL_IND(emit->as, mp_fun_table[fun_kind], fun_kind);
+    #endif
+}
 
 STATIC void emit_native_start_pass(emit_t *emit, pass_kind_t pass, scope_t *scope) {
     DEBUG_printf("start_pass(pass=%u, scope=%p)\n", pass, scope);
@@ -636,15 +834,37 @@ STATIC void emit_native_start_pass(emit_t *emit, pass_kind_t pass, scope_t *scop
     emit->pass = pass;
     emit->stack_start = 0;
     emit->stack_size = 0;
+    emit->nlr_depth = 0;
     emit->last_emit_was_return_value = false;
     emit->scope = scope;
+    #if MICROPY_PERSISTENT_CODE_SAVE
+    emit->reloc_len = 0;
+    #endif
 
     // allocate memory for keeping track of the types of locals
     if (emit->local_vtype_alloc < scope->num_locals) {
         emit->local_vtype = m_renew(vtype_kind_t, emit->local_vtype, emit->local_vtype_alloc, scope->num_locals);
+        emit->local_reg = m_renew(byte, emit->local_reg, emit->local_vtype_alloc, scope->num_locals);
+        emit->local_weight = m_renew(mp_uint_t, emit->local_weight, emit->local_vtype_alloc, scope->num_locals);
         emit->local_vtype_alloc = scope->num_locals;
     }
 
+    // the stack-size pass finds how the locals are used, with registers given
+    // to the first locals, then the later passes allocate the registers
+    emit->last_store_local = LOCAL_NONE;
+    if (pass == MP_PASS_STACK_SIZE) {
+        emit->use_list_len = 0;
+        for (mp_uint_t i = 0; i < emit->max_num_labels; i++) {
+            emit->label_use_pos[i] = LABEL_POS_NONE;
+        }
+        for (mp_uint_t i = 0; i < scope->num_locals; i++) {
+            emit->local_reg[i] = i < REG_LOCAL_NUM ? reg_local_table[i] : REG_LOCAL_NONE;
+            emit->local_weight[i] = 0;
+        }
+    } else if (pass == MP_PASS_CODE_SIZE) {
+        emit_native_alloc_local_regs(emit);
+    }
+
     // allocate memory for keeping track of the objects on the stack
     // XXX don't know stack size on entry, and it should be maximum over all scopes
     // XXX this is such a big hack and really needs to be fixed
@@ -692,12 +912,10 @@ STATIC void emit_native_start_pass(emit_t *emit, pass_kind_t pass, scope_t *scop
         }
 
         // entry to function
+        // each local has a slot on the C stack, which is used if it isn't in a register
         int num_locals = 0;
         if (pass > MP_PASS_SCOPE) {
-            num_locals = scope->num_locals - REG_LOCAL_NUM;
-            if (num_locals < 0) {
-                num_locals = 0;
-            }
+            num_locals = scope->num_locals;
             emit->stack_start = num_locals;
             num_locals += scope->stack_size;
         }
@@ -705,37 +923,27 @@ STATIC void emit_native_start_pass(emit_t *emit, pass_kind_t pass, scope_t *scop
 
         // TODO don't load r7 if we don't need it
         #if N_THUMB
-        asm_thumb_mov_reg_i32(emit->as, ASM_THUMB_REG_R7, (mp_uint_t)mp_fun_table);
+        emit_native_mov_reg_reloc(emit, MP_NATIVE_RELOC_FUN_TABLE, 0, ASM_THUMB_REG_R7);
         #elif N_ARM
         asm_arm_mov_reg_i32(emit->as, ASM_ARM_REG_R7, (mp_uint_t)mp_fun_table);
         #endif
 
         #if N_X86
         for (int i = 0; i < scope->num_pos_args; i++) {
-            if (i == 0) {
-                asm_x86_mov_arg_to_r32(emit->as, i, REG_LOCAL_1);
-            } else if (i == 1) {
-                asm_x86_mov_arg_to_r32(emit->as, i, REG_LOCAL_2);
-            } else if (i == 2) {
-                asm_x86_mov_arg_to_r32(emit->as, i, REG_LOCAL_3);
+            if (emit->local_reg[i] != REG_LOCAL_NONE) {
+                asm_x86_mov_arg_to_r32(emit->as, i, emit->local_reg[i]);
             } else {
                 asm_x86_mov_arg_to_r32(emit->as, i, REG_TEMP0);
-                asm_x86_mov_r32_to_local(emit->as, REG_TEMP0, i - REG_LOCAL_NUM);
+                asm_x86_mov_r32_to_local(emit->as, REG_TEMP0, i);
             }
         }
         #else
+        static const byte reg_arg_table[4] = {REG_ARG_1, REG_ARG_2, REG_ARG_3, REG_ARG_4};
         for (int i = 0; i < scope->num_pos_args; i++) {
-            if (i == 0) {
-                ASM_MOV_REG_REG(emit->as, REG_LOCAL_1, REG_ARG_1);
-            } else if (i == 1) {
-                ASM_MOV_REG_REG(emit->as, REG_LOCAL_2, REG_ARG_2);
-            } else if (i == 2) {
-                ASM_MOV_REG_REG(emit->as, REG_LOCAL_3, REG_ARG_3);
-            } else if (i == 3) {
-                ASM_MOV_REG_TO_LOCAL(emit->as, REG_ARG_4, i - REG_LOCAL_NUM);
+            if (emit->local_reg[i] != REG_LOCAL_NONE) {
+                ASM_MOV_REG_REG(emit->as, emit->local_reg[i], reg_arg_table[i]);
             } else {
-                // TODO not implemented
-                assert(0);
+                ASM_MOV_REG_TO_LOCAL(emit->as, reg_arg_table[i], i);
             }
         }
         #endif
@@ -749,7 +957,7 @@ STATIC void emit_native_start_pass(emit_t *emit, pass_kind_t pass, scope_t *scop
 
         // TODO don't load r7 if we don't need it
         #if N_THUMB
-        asm_thumb_mov_reg_i32(emit->as, ASM_THUMB_REG_R7, (mp_uint_t)mp_fun_table);
+        emit_native_mov_reg_reloc(emit, MP_NATIVE_RELOC_FUN_TABLE, 0, ASM_THUMB_REG_R7);
         #elif N_ARM
         asm_arm_mov_reg_i32(emit->as, ASM_ARM_REG_R7, (mp_uint_t)mp_fun_table);
         #endif
@@ -775,15 +983,15 @@ STATIC void emit_native_start_pass(emit_t *emit, pass_kind_t pass, scope_t *scop
 
         // set code_state.ip (offset from start of this function to prelude info)
         // XXX this encoding may change size
-        ASM_MOV_IMM_TO_LOCAL_USING(emit->as, emit->prelude_offset, offsetof(mp_code_state_t, ip) / sizeof(mp_uint_t), REG_ARG_1);
+        ASM_MOV_IMM_TO_LOCAL_USING(emit->as, emit->prelude_offset, STATE_START - 2, REG_ARG_1);
 
         // set code_state.n_state
-        ASM_MOV_IMM_TO_LOCAL_USING(emit->as, emit->n_state, offsetof(mp_code_state_t, n_state) / sizeof(mp_uint_t), REG_ARG_1);
+        ASM_MOV_IMM_TO_LOCAL_USING(emit->as, emit->n_state, STATE_START - 1, REG_ARG_1);
 
-        // put address of code_state into first arg
-        ASM_MOV_LOCAL_ADDR_TO_REG(emit->as, 0, REG_ARG_1);
+        // put address of code_state.state into first arg
+        ASM_MOV_LOCAL_ADDR_TO_REG(emit->as, STATE_START, REG_ARG_1);
 
-        // call mp_setup_code_state to prepare code_state structure
+        // call mp_native_setup_code_state to prepare code_state structure
         #if N_THUMB
         asm_thumb_op16(emit->as, 0xb400 | (1 << ASM_THUMB_REG_R4)); // push 5th arg
         asm_thumb_bl_ind(emit->as, mp_fun_table[MP_F_SETUP_CODE_STATE], MP_F_SETUP_CODE_STATE, ASM_THUMB_REG_R4);
@@ -793,17 +1001,13 @@ STATIC void emit_native_start_pass(emit_t *emit, pass_kind_t pass, scope_t *scop
         asm_arm_bl_ind(emit->as, mp_fun_table[MP_F_SETUP_CODE_STATE], MP_F_SETUP_CODE_STATE, ASM_ARM_REG_R4);
         asm_arm_pop(emit->as, 1 << REG_RET); // pop dummy (was 5th arg)
         #else
-        ASM_CALL_IND(emit->as, mp_fun_table[MP_F_SETUP_CODE_STATE], MP_F_SETUP_CODE_STATE);
+        emit_native_call_ind(emit, MP_F_SETUP_CODE_STATE);
         #endif
 
         // cache some locals in registers
-        if (scope->num_locals > 0) {
-            ASM_MOV_LOCAL_TO_REG(emit->as, STATE_START + emit->n_state - 1 - 0, REG_LOCAL_1);
-            if (scope->num_locals > 1) {
-                ASM_MOV_LOCAL_TO_REG(emit->as, STATE_START + emit->n_state - 1 - 1, REG_LOCAL_2);
-                if (scope->num_locals > 2) {
-                    ASM_MOV_LOCAL_TO_REG(emit->as, STATE_START + emit->n_state - 1 - 2, REG_LOCAL_3);
-                }
+        for (mp_uint_t i = 0; i < scope->num_locals; i++) {
+            if (emit->local_reg[i] != REG_LOCAL_NONE) {
+                ASM_MOV_LOCAL_TO_REG(emit->as, STATE_START + emit->n_state - 1 - i, emit->local_reg[i]);
             }
         }
 
@@ -833,6 +1037,10 @@ STATIC void emit_native_end_pass(emit_t *emit) {
         // write code info
         #if MICROPY_PERSISTENT_CODE
         ASM_DATA(emit->as, 1, 5);
+        #if MICROPY_PERSISTENT_CODE_SAVE
+        emit_native_add_reloc(emit, ASM_GET_CODE_POS(emit->as), MP_NATIVE_RELOC_QSTR16, emit->scope->simple_name);
+        emit_native_add_reloc(emit, ASM_GET_CODE_POS(emit->as) + 2, MP_NATIVE_RELOC_QSTR16, emit->scope->source_file);
+        #endif
         ASM_DATA(emit->as, 1, emit->scope->simple_name);
         ASM_DATA(emit->as, 1, emit->scope->simple_name >> 8);
         ASM_DATA(emit->as, 1, emit->scope->source_file);
@@ -865,6 +1073,9 @@ STATIC void emit_native_end_pass(emit_t *emit) {
                     break;
                 }
             }
+            #if MICROPY_PERSISTENT_CODE_SAVE
+            emit_native_add_reloc(emit, ASM_GET_CODE_POS(emit->as), MP_NATIVE_RELOC_QSTR_OBJ, qst);
+            #endif
             ASM_DATA(emit->as, ASM_WORD_SIZE, (mp_uint_t)MP_OBJ_NEW_QSTR(qst));
         }
 
@@ -888,9 +1099,17 @@ STATIC void emit_native_end_pass(emit_t *emit) {
             type_sig |= (emit->local_vtype[i] & 0xf) << (i * 4 + 4);
         }
 
+        #if MICROPY_PERSISTENT_CODE_SAVE
+        mp_native_reloc_t *reloc = m_new(mp_native_reloc_t, emit->reloc_len);
+        memcpy(reloc, emit->reloc, emit->reloc_len * sizeof(mp_native_reloc_t));
+        #endif
+
         mp_emit_glue_assign_native(emit->scope->raw_code,
             emit->do_viper_types ? MP_CODE_NATIVE_VIPER : MP_CODE_NATIVE_PY,
             f, f_len, (mp_uint_t*)((byte*)f + emit->const_table_offset),
+            #if MICROPY_PERSISTENT_CODE_SAVE
+            emit->reloc_len, reloc,
+            #endif
             emit->scope->num_pos_args, emit->scope->scope_flags, type_sig);
     }
 }
@@ -1146,38 +1365,47 @@ STATIC void emit_post_push_reg_reg_reg_reg(emit_t *emit, vtype_kind_t vtypea, in
     emit_post_push_reg(emit, vtyped, regd);
 }
 
+// Push a value that depends on where the code or the runtime is loaded.
+STATIC void emit_post_push_reloc(emit_t *emit, vtype_kind_t vtype, mp_native_reloc_kind_t kind, mp_uint_t value) {
+    #if MICROPY_PERSISTENT_CODE_SAVE
+    need_reg_single(emit, REG_RET, 0);
+    emit_native_mov_reg_reloc(emit, kind, value, REG_RET);
+    emit_post_push_reg(emit, vtype, REG_RET);
+    #else
+    emit_post_push_imm(emit, vtype, mp_native_reloc_value(kind, value));
+    #endif
+}
+
+STATIC void emit_post_push_none(emit_t *emit) {
+    emit_post_push_reloc(emit, VTYPE_PYOBJ, MP_NATIVE_RELOC_CONST_TOK, 0);
+}
+
 STATIC void emit_call(emit_t *emit, mp_fun_kind_t fun_kind) {
     need_reg_all(emit);
-    ASM_CALL_IND(emit->as, mp_fun_table[fun_kind], fun_kind);
+    emit_native_call_ind(emit, fun_kind);
 }
 
 STATIC void emit_call_with_imm_arg(emit_t *emit, mp_fun_kind_t fun_kind, mp_int_t arg_val, int arg_reg) {
     need_reg_all(emit);
     ASM_MOV_IMM_TO_REG(emit->as, arg_val, arg_reg);
-    ASM_CALL_IND(emit->as, mp_fun_table[fun_kind], fun_kind);
+    emit_native_call_ind(emit, fun_kind);
 }
 
-// the first arg is stored in the code aligned on a mp_uint_t boundary
-STATIC void emit_call_with_imm_arg_aligned(emit_t *emit, mp_fun_kind_t fun_kind, mp_int_t arg_val, int arg_reg) {
+STATIC void emit_call_with_reloc_arg(emit_t *emit, mp_fun_kind_t fun_kind, mp_native_reloc_kind_t kind, mp_uint_t value, int arg_reg) {
     need_reg_all(emit);
-    ASM_MOV_ALIGNED_IMM_TO_REG(emit->as, arg_val, arg_reg);
-    ASM_CALL_IND(emit->as, mp_fun_table[fun_kind], fun_kind);
+    emit_native_mov_reg_reloc(emit, kind, value, arg_reg);
+    emit_native_call_ind(emit, fun_kind);
 }
 
-STATIC void emit_call_with_2_imm_args(emit_t *emit, mp_fun_kind_t fun_kind, mp_int_t arg_val1, int arg_reg1, mp_int_t arg_val2, int arg_reg2) {
-    need_reg_all(emit);
-    ASM_MOV_IMM_TO_REG(emit->as, arg_val1, arg_reg1);
-    ASM_MOV_IMM_TO_REG(emit->as, arg_val2, arg_reg2);
-    ASM_CALL_IND(emit->as, mp_fun_table[fun_kind], fun_kind);
+STATIC void emit_call_with_qstr_arg(emit_t *emit, mp_fun_kind_t fun_kind, qstr qst, int arg_reg) {
+    emit_call_with_reloc_arg(emit, fun_kind, MP_NATIVE_RELOC_QSTR, qst, arg_reg);
 }
 
-// the first arg is stored in the code aligned on a mp_uint_t boundary
-STATIC void emit_call_with_3_imm_args_and_first_aligned(emit_t *emit, mp_fun_kind_t fun_kind, mp_int_t arg_val1, int arg_reg1, mp_int_t arg_val2, int arg_reg2, mp_int_t arg_val3, int arg_reg3) {
+STATIC void emit_call_with_2_imm_args(emit_t *emit, mp_fun_kind_t fun_kind, mp_int_t arg_val1, int arg_reg1, mp_int_t arg_val2, int arg_reg2) {
     need_reg_all(emit);
-    ASM_MOV_ALIGNED_IMM_TO_REG(emit->as, arg_val1, arg_reg1);
+    ASM_MOV_IMM_TO_REG(emit->as, arg_val1, arg_reg1);
     ASM_MOV_IMM_TO_REG(emit->as, arg_val2, arg_reg2);
-    ASM_MOV_IMM_TO_REG(emit->as, arg_val3, arg_reg3);
-    ASM_CALL_IND(emit->as, mp_fun_table[fun_kind], fun_kind);
+    emit_native_call_ind(emit, fun_kind);
 }
 
 // vtype of all n_pop objects is VTYPE_PYOBJ
@@ -1199,6 +1427,11 @@ STATIC void emit_get_stack_pointer_to_reg_for_pop(emit_t *emit, mp_uint_t reg_de
                     ASM_MOV_IMM_TO_LOCAL_USING(emit->as, si->data.u_imm, emit->stack_start + emit->stack_size - 1 - i, reg_dest);
                     break;
                 case VTYPE_BOOL:
+                    #if MICROPY_PERSISTENT_CODE_SAVE
+                    // True/False depend on the runtime, so let the second loop convert the value
+                    ASM_MOV_IMM_TO_LOCAL_USING(emit->as, si->data.u_imm, emit->stack_start + emit->stack_size - 1 - i, reg_dest);
+                    break;
+                    #endif
                     if (si->data.u_imm == 0) {
                         ASM_MOV_IMM_TO_LOCAL_USING(emit->as, (mp_uint_t)mp_const_false, emit->stack_start + emit->stack_size - 1 - i, reg_dest);
                     } else {
@@ -1252,6 +1485,7 @@ STATIC void emit_get_stack_pointer_to_reg_for_push(emit_t *emit, mp_uint_t reg_d
 
 STATIC void emit_native_label_assign(emit_t *emit, mp_uint_t l) {
     DEBUG_printf("label_assign(" UINT_FMT ")\n", l);
+    emit_native_note_label(emit, l);
     emit_native_pre(emit);
     // need to commit stack because we can jump here from elsewhere
     need_stack_settled(emit);
@@ -1266,7 +1500,7 @@ STATIC void emit_native_import_name(emit_t *emit, qstr qst) {
     emit_pre_pop_reg_reg(emit, &vtype_fromlist, REG_ARG_2, &vtype_level, REG_ARG_3); // arg2 = fromlist, arg3 = level
     assert(vtype_fromlist == VTYPE_PYOBJ);
     assert(vtype_level == VTYPE_PYOBJ);
-    emit_call_with_imm_arg(emit, MP_F_IMPORT_NAME, qst, REG_ARG_1); // arg1 = import name
+    emit_call_with_qstr_arg(emit, MP_F_IMPORT_NAME, qst, REG_ARG_1); // arg1 = import name
     emit_post_push_reg(emit, VTYPE_PYOBJ, REG_RET);
 }
 
@@ -1276,7 +1510,7 @@ STATIC void emit_native_import_from(emit_t *emit, qstr qst) {
     vtype_kind_t vtype_module;
     emit_access_stack(emit, 1, &vtype_module, REG_ARG_1); // arg1 = module
     assert(vtype_module == VTYPE_PYOBJ);
-    emit_call_with_imm_arg(emit, MP_F_IMPORT_FROM, qst, REG_ARG_2); // arg2 = import name
+    emit_call_with_qstr_arg(emit, MP_F_IMPORT_FROM, qst, REG_ARG_2); // arg2 = import name
     emit_post_push_reg(emit, VTYPE_PYOBJ, REG_RET);
 }
 
@@ -1292,29 +1526,25 @@ STATIC void emit_native_import_star(emit_t *emit) {
 STATIC void emit_native_load_const_tok(emit_t *emit, mp_token_kind_t tok) {
     DEBUG_printf("load_const_tok(tok=%u)\n", tok);
     emit_native_pre(emit);
-    vtype_kind_t vtype;
-    mp_uint_t val;
-    if (emit->do_viper_types) {
+    if (emit->do_viper_types && tok != MP_TOKEN_ELLIPSIS) {
         switch (tok) {
-            case MP_TOKEN_KW_NONE: vtype = VTYPE_PTR_NONE; val = 0; break;
-            case MP_TOKEN_KW_FALSE: vtype = VTYPE_BOOL; val = 0; break;
-            case MP_TOKEN_KW_TRUE: vtype = VTYPE_BOOL; val = 1; break;
-            no_other_choice1:
-            case MP_TOKEN_ELLIPSIS: vtype = VTYPE_PYOBJ; val = (mp_uint_t)&mp_const_ellipsis_obj; break;
-            default: assert(0); goto no_other_choice1; // to help flow control analysis
+            case MP_TOKEN_KW_NONE: emit_post_push_imm(emit, VTYPE_PTR_NONE, 0); break;
+            case MP_TOKEN_KW_FALSE: emit_post_push_imm(emit, VTYPE_BOOL, 0); break;
+            default: emit_post_push_imm(emit, VTYPE_BOOL, 1); break;
         }
     } else {
-        vtype = VTYPE_PYOBJ;
+        // index of the constant as understood by mp_native_reloc_value
+        mp_uint_t idx;
         switch (tok) {
-            case MP_TOKEN_KW_NONE: val = (mp_uint_t)mp_const_none; break;
-            case MP_TOKEN_KW_FALSE: val = (mp_uint_t)mp_const_false; break;
-            case MP_TOKEN_KW_TRUE: val = (mp_uint_t)mp_const_true; break;
-            no_other_choice2:
-            case MP_TOKEN_ELLIPSIS: val = (mp_uint_t)&mp_const_ellipsis_obj; break;
-            default: assert(0); goto no_other_choice2; // to help flow control analysis
+            case MP_TOKEN_KW_NONE: idx = 0; break;
+            case MP_TOKEN_KW_FALSE: idx = 1; break;
+            case MP_TOKEN_KW_TRUE: idx = 2; break;
+            no_other_choice:
+            case MP_TOKEN_ELLIPSIS: idx = 3; break;
+            default: assert(0); goto no_other_choice; // to help flow control analysis
         }
+        emit_post_push_reloc(emit, VTYPE_PYOBJ, MP_NATIVE_RELOC_CONST_TOK, idx);
     }
-    emit_post_push_imm(emit, vtype, val);
 }
 
 STATIC void emit_native_load_const_small_int(emit_t *emit, mp_int_t arg) {
@@ -1340,14 +1570,14 @@ STATIC void emit_native_load_const_str(emit_t *emit, qstr qst) {
     } else
     */
     {
-        emit_post_push_imm(emit, VTYPE_PYOBJ, (mp_uint_t)MP_OBJ_NEW_QSTR(qst));
+        emit_post_push_reloc(emit, VTYPE_PYOBJ, MP_NATIVE_RELOC_QSTR_OBJ, qst);
     }
 }
 
 STATIC void emit_native_load_const_obj(emit_t *emit, mp_obj_t obj) {
     emit_native_pre(emit);
     need_reg_single(emit, REG_RET, 0);
-    ASM_MOV_ALIGNED_IMM_TO_REG(emit->as, (mp_uint_t)obj, REG_RET);
+    emit_native_mov_reg_reloc(emit, MP_NATIVE_RELOC_OBJ, (mp_uint_t)obj, REG_RET);
     emit_post_push_reg(emit, VTYPE_PYOBJ, REG_RET);
 }
 
@@ -1362,17 +1592,18 @@ STATIC void emit_native_load_fast(emit_t *emit, qstr qst, mp_uint_t local_num) {
     if (vtype == VTYPE_UNBOUND) {
         EMIT_NATIVE_VIPER_TYPE_ERROR(emit, "local '%q' used before type known", qst);
     }
+    emit_native_note_local(emit, local_num, false);
+    bool reuse_temp0 = emit->last_store_local == local_num && emit->last_store_pos == ASM_GET_CODE_POS(emit->as);
     emit_native_pre(emit);
-    if (local_num == 0) {
-        emit_post_push_reg(emit, vtype, REG_LOCAL_1);
-    } else if (local_num == 1) {
-        emit_post_push_reg(emit, vtype, REG_LOCAL_2);
-    } else if (local_num == 2) {
-        emit_post_push_reg(emit, vtype, REG_LOCAL_3);
+    if (emit->local_reg[local_num] != REG_LOCAL_NONE) {
+        emit_post_push_reg(emit, vtype, emit->local_reg[local_num]);
+    } else if (reuse_temp0) {
+        // the value was just stored from REG_TEMP0, so no other stack entry uses it
+        emit_post_push_reg(emit, vtype, REG_TEMP0);
     } else {
         need_reg_single(emit, REG_TEMP0, 0);
         if (emit->do_viper_types) {
-            ASM_MOV_LOCAL_TO_REG(emit->as, local_num - REG_LOCAL_NUM, REG_TEMP0);
+            ASM_MOV_LOCAL_TO_REG(emit->as, local_num, REG_TEMP0);
         } else {
             ASM_MOV_LOCAL_TO_REG(emit->as, STATE_START + emit->n_state - 1 - local_num, REG_TEMP0);
         }
@@ -1395,7 +1626,7 @@ STATIC void emit_native_load_deref(emit_t *emit, qstr qst, mp_uint_t local_num)
 STATIC void emit_native_load_name(emit_t *emit, qstr qst) {
     DEBUG_printf("load_name(%s)\n", qstr_str(qst));
     emit_native_pre(emit);
-    emit_call_with_imm_arg(emit, MP_F_LOAD_NAME, qst, REG_ARG_1);
+    emit_call_with_qstr_arg(emit, MP_F_LOAD_NAME, qst, REG_ARG_1);
     emit_post_push_reg(emit, VTYPE_PYOBJ, REG_RET);
 }
 
@@ -1416,7 +1647,7 @@ STATIC void emit_native_load_global(emit_t *emit, qstr qst) {
     } else if (emit->do_viper_types && qst == MP_QSTR_ptr32) {
         emit_post_push_imm(emit, VTYPE_BUILTIN_CAST, VTYPE_PTR32);
     } else {
-        emit_call_with_imm_arg(emit, MP_F_LOAD_GLOBAL, qst, REG_ARG_1);
+        emit_call_with_qstr_arg(emit, MP_F_LOAD_GLOBAL, qst, REG_ARG_1);
         emit_post_push_reg(emit, VTYPE_PYOBJ, REG_RET);
     }
 }
@@ -1429,7 +1660,7 @@ STATIC void emit_native_load_attr(emit_t *emit, qstr qst) {
     vtype_kind_t vtype_base;
     emit_pre_pop_reg(emit, &vtype_base, REG_ARG_1); // arg1 = base
     assert(vtype_base == VTYPE_PYOBJ);
-    emit_call_with_imm_arg(emit, MP_F_LOAD_ATTR, qst, REG_ARG_2); // arg2 = attribute name
+    emit_call_with_qstr_arg(emit, MP_F_LOAD_ATTR, qst, REG_ARG_2); // arg2 = attribute name
     emit_post_push_reg(emit, VTYPE_PYOBJ, REG_RET);
 }
 
@@ -1438,7 +1669,7 @@ STATIC void emit_native_load_method(emit_t *emit, qstr qst) {
     emit_pre_pop_reg(emit, &vtype_base, REG_ARG_1); // arg1 = base
     assert(vtype_base == VTYPE_PYOBJ);
     emit_get_stack_pointer_to_reg_for_push(emit, REG_ARG_3, 2); // arg3 = dest ptr
-    emit_call_with_imm_arg(emit, MP_F_LOAD_METHOD, qst, REG_ARG_2); // arg2 = method name
+    emit_call_with_qstr_arg(emit, MP_F_LOAD_METHOD, qst, REG_ARG_2); // arg2 = method name
 }
 
 STATIC void emit_native_load_build_class(emit_t *emit) {
@@ -1482,6 +1713,9 @@ STATIC void emit_native_load_subscr(emit_t *emit) {
             int reg_base = REG_ARG_1;
             int reg_index = REG_ARG_2;
             emit_pre_pop_reg_flexible(emit, &vtype_base, &reg_base, reg_index, reg_index);
+            // the result and the scratch index may be in use by stacked values
+            need_reg_single(emit, REG_RET, 0);
+            need_reg_single(emit, reg_index, 0);
             switch (vtype_base) {
                 case VTYPE_PTR8: {
                     // pointer to 8-bit memory
@@ -1545,6 +1779,7 @@ STATIC void emit_native_load_subscr(emit_t *emit) {
             int reg_index = REG_ARG_2;
             emit_pre_pop_reg_flexible(emit, &vtype_index, &reg_index, REG_ARG_1, REG_ARG_1);
             emit_pre_pop_reg(emit, &vtype_base, REG_ARG_1);
+            need_reg_single(emit, REG_RET, 0);
             if (vtype_index != VTYPE_INT && vtype_index != VTYPE_UINT) {
                 EMIT_NATIVE_VIPER_TYPE_ERROR(emit,
                     "can't load with '%q' index", vtype_to_qstr(vtype_index));
@@ -1584,19 +1819,18 @@ STATIC void emit_native_load_subscr(emit_t *emit) {
 
 STATIC void emit_native_store_fast(emit_t *emit, qstr qst, mp_uint_t local_num) {
     vtype_kind_t vtype;
-    if (local_num == 0) {
-        emit_pre_pop_reg(emit, &vtype, REG_LOCAL_1);
-    } else if (local_num == 1) {
-        emit_pre_pop_reg(emit, &vtype, REG_LOCAL_2);
-    } else if (local_num == 2) {
-        emit_pre_pop_reg(emit, &vtype, REG_LOCAL_3);
+    emit_native_note_local(emit, local_num, true);
+    if (emit->local_reg[local_num] != REG_LOCAL_NONE) {
+        emit_pre_pop_reg(emit, &vtype, emit->local_reg[local_num]);
     } else {
         emit_pre_pop_reg(emit, &vtype, REG_TEMP0);
         if (emit->do_viper_types) {
-            ASM_MOV_REG_TO_LOCAL(emit->as, REG_TEMP0, local_num - REG_LOCAL_NUM);
+            ASM_MOV_REG_TO_LOCAL(emit->as, REG_TEMP0, local_num);
         } else {
             ASM_MOV_REG_TO_LOCAL(emit->as, REG_TEMP0, STATE_START + emit->n_state - 1 - local_num);
         }
+        emit->last_store_local = local_num;
+        emit->last_store_pos = ASM_GET_CODE_POS(emit->as);
     }
     emit_post(emit);
 
@@ -1631,7 +1865,7 @@ STATIC void emit_native_store_name(emit_t *emit, qstr qst) {
     vtype_kind_t vtype;
     emit_pre_pop_reg(emit, &vtype, REG_ARG_2);
     assert(vtype == VTYPE_PYOBJ);
-    emit_call_with_imm_arg(emit, MP_F_STORE_NAME, qst, REG_ARG_1); // arg1 = name
+    emit_call_with_qstr_arg(emit, MP_F_STORE_NAME, qst, REG_ARG_1); // arg1 = name
     emit_post(emit);
 }
 
@@ -1644,7 +1878,7 @@ STATIC void emit_native_store_global(emit_t *emit, qstr qst) {
         emit_call_with_imm_arg(emit, MP_F_CONVERT_NATIVE_TO_OBJ, vtype, REG_ARG_2); // arg2 = type
         ASM_MOV_REG_REG(emit->as, REG_ARG_2, REG_RET);
     }
-    emit_call_with_imm_arg(emit, MP_F_STORE_GLOBAL, qst, REG_ARG_1); // arg1 = name
+    emit_call_with_qstr_arg(emit, MP_F_STORE_GLOBAL, qst, REG_ARG_1); // arg1 = name
     emit_post(emit);
 }
 
@@ -1653,7 +1887,7 @@ STATIC void emit_native_store_attr(emit_t *emit, qstr qst) {
     emit_pre_pop_reg_reg(emit, &vtype_base, REG_ARG_1, &vtype_val, REG_ARG_3); // arg1 = base, arg3 = value
     assert(vtype_base == VTYPE_PYOBJ);
     assert(vtype_val == VTYPE_PYOBJ);
-    emit_call_with_imm_arg(emit, MP_F_STORE_ATTR, qst, REG_ARG_2); // arg2 = attribute name
+    emit_call_with_qstr_arg(emit, MP_F_STORE_ATTR, qst, REG_ARG_2); // arg2 = attribute name
     emit_post(emit);
 }
 
@@ -1698,6 +1932,8 @@ STATIC void emit_native_store_subscr(emit_t *emit) {
             #else
             emit_pre_pop_reg_flexible(emit, &vtype_value, &reg_value, reg_base, reg_index);
             #endif
+            // the scratch index may be in use by stacked values
+            need_reg_single(emit, reg_index, 0);
             if (vtype_value != VTYPE_BOOL && vtype_value != VTYPE_INT && vtype_value != VTYPE_UINT) {
                 EMIT_NATIVE_VIPER_TYPE_ERROR(emit,
                     "can't store '%q'", vtype_to_qstr(vtype_value));
@@ -1854,13 +2090,13 @@ STATIC void emit_native_delete_deref(emit_t *emit, qstr qst, mp_uint_t local_num
 
 STATIC void emit_native_delete_name(emit_t *emit, qstr qst) {
     emit_native_pre(emit);
-    emit_call_with_imm_arg(emit, MP_F_DELETE_NAME, qst, REG_ARG_1);
+    emit_call_with_qstr_arg(emit, MP_F_DELETE_NAME, qst, REG_ARG_1);
     emit_post(emit);
 }
 
 STATIC void emit_native_delete_global(emit_t *emit, qstr qst) {
     emit_native_pre(emit);
-    emit_call_with_imm_arg(emit, MP_F_DELETE_GLOBAL, qst, REG_ARG_1);
+    emit_call_with_qstr_arg(emit, MP_F_DELETE_GLOBAL, qst, REG_ARG_1);
     emit_post(emit);
 }
 
@@ -1868,7 +2104,10 @@ STATIC void emit_native_delete_attr(emit_t *emit, qstr qst) {
     vtype_kind_t vtype_base;
     emit_pre_pop_reg(emit, &vtype_base, REG_ARG_1); // arg1 = base
     assert(vtype_base == VTYPE_PYOBJ);
-    emit_call_with_2_imm_args(emit, MP_F_STORE_ATTR, qst, REG_ARG_2, (mp_uint_t)MP_OBJ_NULL, REG_ARG_3); // arg2 = attribute name, arg3 = value (null for delete)
+    need_reg_all(emit);
+    emit_native_mov_reg_reloc(emit, MP_NATIVE_RELOC_QSTR, qst, REG_ARG_2); // arg2 = attribute name
+    ASM_MOV_IMM_TO_REG(emit->as, (mp_uint_t)MP_OBJ_NULL, REG_ARG_3); // arg3 = value (null for delete)
+    emit_native_call_ind(emit, MP_F_STORE_ATTR);
     emit_post(emit);
 }
 
@@ -1916,6 +2155,7 @@ STATIC void emit_native_rot_three(emit_t *emit) {
 
 STATIC void emit_native_jump(emit_t *emit, mp_uint_t label) {
     DEBUG_printf("jump(label=" UINT_FMT ")\n", label);
+    emit_native_note_jump(emit, label);
     emit_native_pre(emit);
     // need to commit stack because we are jumping elsewhere
     need_stack_settled(emit);
@@ -1952,6 +2192,7 @@ STATIC void emit_native_jump_helper(emit_t *emit, bool pop) {
 
 STATIC void emit_native_pop_jump_if(emit_t *emit, bool cond, mp_uint_t label) {
     DEBUG_printf("pop_jump_if(cond=%u, label=" UINT_FMT ")\n", cond, label);
+    emit_native_note_jump(emit, label);
     emit_native_jump_helper(emit, true);
     if (cond) {
         ASM_JUMP_IF_REG_NONZERO(emit->as, REG_RET, label);
@@ -1963,6 +2204,7 @@ STATIC void emit_native_pop_jump_if(emit_t *emit, bool cond, mp_uint_t label) {
 
 STATIC void emit_native_jump_if_or_pop(emit_t *emit, bool cond, mp_uint_t label) {
     DEBUG_printf("jump_if_or_pop(cond=%u, label=" UINT_FMT ")\n", cond, label);
+    emit_native_note_jump(emit, label);
     emit_native_jump_helper(emit, false);
     if (cond) {
         ASM_JUMP_IF_REG_NONZERO(emit->as, REG_RET, label);
@@ -1987,12 +2229,14 @@ STATIC void emit_native_setup_with(emit_t *emit, mp_uint_t label) {
     // the context manager is on the top of the stack
     // stack: (..., ctx_mgr)
 
+    emit_native_note_handler(emit, label);
+
     // get __exit__ method
     vtype_kind_t vtype;
     emit_access_stack(emit, 1, &vtype, REG_ARG_1); // arg1 = ctx_mgr
     assert(vtype == VTYPE_PYOBJ);
     emit_get_stack_pointer_to_reg_for_push(emit, REG_ARG_3, 2); // arg3 = dest ptr
-    emit_call_with_imm_arg(emit, MP_F_LOAD_METHOD, MP_QSTR___exit__, REG_ARG_2);
+    emit_call_with_qstr_arg(emit, MP_F_LOAD_METHOD, MP_QSTR___exit__, REG_ARG_2);
     // stack: (..., ctx_mgr, __exit__, self)
 
     emit_pre_pop_reg(emit, &vtype, REG_ARG_3); // self
@@ -2005,7 +2249,7 @@ STATIC void emit_native_setup_with(emit_t *emit, mp_uint_t label) {
 
     // get __enter__ method
     emit_get_stack_pointer_to_reg_for_push(emit, REG_ARG_3, 2); // arg3 = dest ptr
-    emit_call_with_imm_arg(emit, MP_F_LOAD_METHOD, MP_QSTR___enter__, REG_ARG_2); // arg2 = method name
+    emit_call_with_qstr_arg(emit, MP_F_LOAD_METHOD, MP_QSTR___enter__, REG_ARG_2); // arg2 = method name
     // stack: (..., __exit__, self, __enter__, self)
 
     // call __enter__ method
@@ -2016,11 +2260,12 @@ STATIC void emit_native_setup_with(emit_t *emit, mp_uint_t label) {
 
     // need to commit stack because we may jump elsewhere
     need_stack_settled(emit);
-    emit_get_stack_pointer_to_reg_for_push(emit, REG_ARG_1, sizeof(nlr_buf_t) / sizeof(mp_uint_t)); // arg1 = pointer to nlr buf
+    emit_get_stack_pointer_to_reg_for_push(emit, REG_ARG_1, NLR_BUF_WORDS); // arg1 = pointer to nlr buf
     emit_call(emit, MP_F_NLR_PUSH);
+    emit->nlr_depth += 1;
     ASM_JUMP_IF_REG_NONZERO(emit->as, REG_RET, label);
 
-    emit_access_stack(emit, sizeof(nlr_buf_t) / sizeof(mp_uint_t) + 1, &vtype, REG_RET); // access return value of __enter__
+    emit_access_stack(emit, NLR_BUF_WORDS + 1, &vtype, REG_RET); // access return value of __enter__
     emit_post_push_reg(emit, VTYPE_PYOBJ, REG_RET); // push return value of __enter__
     // stack: (..., __exit__, self, as_value, nlr_buf, as_value)
 }
@@ -2031,13 +2276,14 @@ STATIC void emit_native_with_cleanup(emit_t *emit, mp_uint_t label) {
     // stack: (..., __exit__, self, as_value, nlr_buf)
     emit_native_pre(emit);
     emit_call(emit, MP_F_NLR_POP);
-    adjust_stack(emit, -(mp_int_t)(sizeof(nlr_buf_t) / sizeof(mp_uint_t)) - 1);
+    emit->nlr_depth -= 1;
+    adjust_stack(emit, -(mp_int_t)NLR_BUF_WORDS - 1);
     // stack: (..., __exit__, self)
 
     // call __exit__
-    emit_post_push_imm(emit, VTYPE_PYOBJ, (mp_uint_t)mp_const_none);
-    emit_post_push_imm(emit, VTYPE_PYOBJ, (mp_uint_t)mp_const_none);
-    emit_post_push_imm(emit, VTYPE_PYOBJ, (mp_uint_t)mp_const_none);
+    emit_post_push_none(emit);
+    emit_post_push_none(emit);
+    emit_post_push_none(emit);
     emit_get_stack_pointer_to_reg_for_pop(emit, REG_ARG_3, 5);
     emit_call_with_2_imm_args(emit, MP_F_CALL_METHOD_N_KW, 3, REG_ARG_1, 0, REG_ARG_2);
 
@@ -2071,7 +2317,7 @@ STATIC void emit_native_with_cleanup(emit_t *emit, mp_uint_t label) {
     ASM_LOAD_REG_REG_OFFSET(emit->as, REG_ARG_2, REG_ARG_1, 0); // get type(exc)
     emit_post_push_reg(emit, VTYPE_PYOBJ, REG_ARG_2); // push type(exc)
     emit_post_push_reg(emit, VTYPE_PYOBJ, REG_ARG_1); // push exc value
-    emit_post_push_imm(emit, VTYPE_PYOBJ, (mp_uint_t)mp_const_none); // traceback info
+    emit_post_push_none(emit); // traceback info
     // stack: (..., exc, __exit__, self, type(exc), exc, traceback)
 
     // call __exit__ method
@@ -2088,18 +2334,20 @@ STATIC void emit_native_with_cleanup(emit_t *emit, mp_uint_t label) {
 
     // replace exc with None
     emit_pre_pop_discard(emit);
-    emit_post_push_imm(emit, VTYPE_PYOBJ, (mp_uint_t)mp_const_none);
+    emit_post_push_none(emit);
 
     // end of with cleanup nlr_catch block
     emit_native_label_assign(emit, label + 1);
 }
 
 STATIC void emit_native_setup_except(emit_t *emit, mp_uint_t label) {
+    emit_native_note_handler(emit, label);
     emit_native_pre(emit);
     // need to commit stack because we may jump elsewhere
     need_stack_settled(emit);
-    emit_get_stack_pointer_to_reg_for_push(emit, REG_ARG_1, sizeof(nlr_buf_t) / sizeof(mp_uint_t)); // arg1 = pointer to nlr buf
+    emit_get_stack_pointer_to_reg_for_push(emit, REG_ARG_1, NLR_BUF_WORDS); // arg1 = pointer to nlr buf
     emit_call(emit, MP_F_NLR_PUSH);
+    emit->nlr_depth += 1;
     ASM_JUMP_IF_REG_NONZERO(emit->as, REG_RET, label);
     emit_post(emit);
 }
@@ -2153,7 +2401,8 @@ STATIC void emit_native_for_iter_end(emit_t *emit) {
 STATIC void emit_native_pop_block(emit_t *emit) {
     emit_native_pre(emit);
     emit_call(emit, MP_F_NLR_POP);
-    adjust_stack(emit, -(mp_int_t)(sizeof(nlr_buf_t) / sizeof(mp_uint_t)) + 1);
+    emit->nlr_depth -= 1;
+    adjust_stack(emit, -(mp_int_t)NLR_BUF_WORDS + 1);
     emit_post(emit);
 }
 
@@ -2162,7 +2411,7 @@ STATIC void emit_native_pop_except(emit_t *emit) {
     /*
     emit_native_pre(emit);
     emit_call(emit, MP_F_NLR_POP);
-    adjust_stack(emit, -(mp_int_t)(sizeof(nlr_buf_t) / sizeof(mp_uint_t)));
+    adjust_stack(emit, -(mp_int_t)NLR_BUF_WORDS);
     emit_post(emit);
     */
 }
@@ -2377,7 +2626,7 @@ STATIC void emit_native_build_slice(emit_t *emit, mp_uint_t n_args) {
         emit_pre_pop_reg_reg(emit, &vtype_stop, REG_ARG_2, &vtype_start, REG_ARG_1); // arg1 = start, arg2 = stop
         assert(vtype_start == VTYPE_PYOBJ);
         assert(vtype_stop == VTYPE_PYOBJ);
-        emit_call_with_imm_arg(emit, MP_F_NEW_SLICE, (mp_uint_t)mp_const_none, REG_ARG_3); // arg3 = step
+        emit_call_with_reloc_arg(emit, MP_F_NEW_SLICE, MP_NATIVE_RELOC_CONST_TOK, 0, REG_ARG_3); // arg3 = step
         emit_post_push_reg(emit, VTYPE_PYOBJ, REG_RET);
     } else {
         assert(n_args == 3);
@@ -2443,14 +2692,16 @@ STATIC void emit_native_make_function(emit_t *emit, scope_t *scope, mp_uint_t n_
     // call runtime, with type info for args, or don't support dict/default params, or only support Python objects for them
     emit_native_pre(emit);
     if (n_pos_defaults == 0 && n_kw_defaults == 0) {
-        emit_call_with_3_imm_args_and_first_aligned(emit, MP_F_MAKE_FUNCTION_FROM_RAW_CODE, (mp_uint_t)scope->raw_code, REG_ARG_1, (mp_uint_t)MP_OBJ_NULL, REG_ARG_2, (mp_uint_t)MP_OBJ_NULL, REG_ARG_3);
+        need_reg_all(emit);
+        ASM_MOV_IMM_TO_REG(emit->as, (mp_uint_t)MP_OBJ_NULL, REG_ARG_2);
+        ASM_MOV_IMM_TO_REG(emit->as, (mp_uint_t)MP_OBJ_NULL, REG_ARG_3);
     } else {
         vtype_kind_t vtype_def_tuple, vtype_def_dict;
         emit_pre_pop_reg_reg(emit, &vtype_def_dict, REG_ARG_3, &vtype_def_tuple, REG_ARG_2);
         assert(vtype_def_tuple == VTYPE_PYOBJ);
         assert(vtype_def_dict == VTYPE_PYOBJ);
-        emit_call_with_imm_arg_aligned(emit, MP_F_MAKE_FUNCTION_FROM_RAW_CODE, (mp_uint_t)scope->raw_code, REG_ARG_1);
     }
+    emit_call_with_reloc_arg(emit, MP_F_MAKE_FUNCTION_FROM_RAW_CODE, MP_NATIVE_RELOC_RAW_CODE, (mp_uint_t)scope->raw_code, REG_ARG_1);
     emit_post_push_reg(emit, VTYPE_PYOBJ, REG_RET);
 }
 
@@ -2463,8 +2714,8 @@ STATIC void emit_native_make_closure(emit_t *emit, scope_t *scope, mp_uint_t n_c
         emit_get_stack_pointer_to_reg_for_pop(emit, REG_ARG_3, n_closed_over + 2);
         ASM_MOV_IMM_TO_REG(emit->as, 0x100 | n_closed_over, REG_ARG_2);
     }
-    ASM_MOV_ALIGNED_IMM_TO_REG(emit->as, (mp_uint_t)scope->raw_code, REG_ARG_1);
-    ASM_CALL_IND(emit->as, mp_fun_table[MP_F_MAKE_CLOSURE_FROM_RAW_CODE], MP_F_MAKE_CLOSURE_FROM_RAW_CODE);
+    emit_native_mov_reg_reloc(emit, MP_NATIVE_RELOC_RAW_CODE, (mp_uint_t)scope->raw_code, REG_ARG_1);
+    emit_native_call_ind(emit, MP_F_MAKE_CLOSURE_FROM_RAW_CODE);
     emit_post_push_reg(emit, VTYPE_PYOBJ, REG_RET);
 }
 
@@ -2537,11 +2788,16 @@ STATIC void emit_native_call_method(emit_t *emit, mp_uint_t n_positional, mp_uin
 
 STATIC void emit_native_return_value(emit_t *emit) {
     DEBUG_printf("return_value\n");
+    // a return from inside a try or with block must unlink its nlr_buf's,
+    // which are about to go out of scope
+    for (int i = 0; i < emit->nlr_depth; i++) {
+        emit_call(emit, MP_F_NLR_POP);
+    }
     if (emit->do_viper_types) {
         if (peek_vtype(emit, 0) == VTYPE_PTR_NONE) {
             emit_pre_pop_discard(emit);
             if (emit->return_vtype == VTYPE_PYOBJ) {
-                ASM_MOV_IMM_TO_REG(emit->as, (mp_uint_t)mp_const_none, REG_RET);
+                emit_native_mov_reg_reloc(emit, MP_NATIVE_RELOC_CONST_TOK, 0, REG_RET);
             } else {
                 ASM_MOV_IMM_TO_REG(emit->as, 0, REG_RET);
             }
@@ -32,6 +32,8 @@
 #include "py/gc.h"
 #include "py/obj.h"
 #include "py/runtime.h"
+#include "py/bc.h"
+#include "py/mphal.h"
 
 #if MICROPY_ENABLE_GC
 
@@ -72,16 +74,30 @@
 #define ATB_3_IS_FREE(a) (((a) & ATB_MASK_3) == 0)
 
 #define BLOCK_SHIFT(block) (2 * ((block) & (BLOCKS_PER_ATB - 1)))
-#define ATB_GET_KIND(block) ((MP_STATE_MEM(gc_alloc_table_start)[(block) / BLOCKS_PER_ATB] >> BLOCK_SHIFT(block)) & 3)
-#define ATB_ANY_TO_FREE(block) do { MP_STATE_MEM(gc_alloc_table_start)[(block) / BLOCKS_PER_ATB] &= (~(AT_MARK << BLOCK_SHIFT(block))); } while (0)
-#define ATB_FREE_TO_HEAD(block) do { MP_STATE_MEM(gc_alloc_table_start)[(block) / BLOCKS_PER_ATB] |= (AT_HEAD << BLOCK_SHIFT(block)); } while (0)
-#define ATB_FREE_TO_TAIL(block) do { MP_STATE_MEM(gc_alloc_table_start)[(block) / BLOCKS_PER_ATB] |= (AT_TAIL << BLOCK_SHIFT(block)); } while (0)
-#define ATB_HEAD_TO_MARK(block) do { MP_STATE_MEM(gc_alloc_table_start)[(block) / BLOCKS_PER_ATB] |= (AT_MARK << BLOCK_SHIFT(block)); } while (0)
-#define ATB_MARK_TO_HEAD(block) do { MP_STATE_MEM(gc_alloc_table_start)[(block) / BLOCKS_PER_ATB] &= (~(AT_TAIL << BLOCK_SHIFT(block))); } while (0)
-
-#define BLOCK_FROM_PTR(ptr) (((byte*)(ptr) - MP_STATE_MEM(gc_pool_start)) / BYTES_PER_BLOCK)
-#define PTR_FROM_BLOCK(block) (((block) * BYTES_PER_BLOCK + (uintptr_t)MP_STATE_MEM(gc_pool_start)))
+#define ATB_GET_KIND(area, block) (((area)->gc_alloc_table_start[(block) / BLOCKS_PER_ATB] >> BLOCK_SHIFT(block)) & 3)
+#define ATB_ANY_TO_FREE(area, block) do { (area)->gc_alloc_table_start[(block) / BLOCKS_PER_ATB] &= (~(AT_MARK << BLOCK_SHIFT(block))); } while (0)
+#define ATB_FREE_TO_HEAD(area, block) do { (area)->gc_alloc_table_start[(block) / BLOCKS_PER_ATB] |= (AT_HEAD << BLOCK_SHIFT(block)); } while (0)
+#define ATB_FREE_TO_TAIL(area, block) do { (area)->gc_alloc_table_start[(block) / BLOCKS_PER_ATB] |= (AT_TAIL << BLOCK_SHIFT(block)); } while (0)
+#define ATB_HEAD_TO_MARK(area, block) do { (area)->gc_alloc_table_start[(block) / BLOCKS_PER_ATB] |= (AT_MARK << BLOCK_SHIFT(block)); } while (0)
+#define ATB_MARK_TO_HEAD(area, block) do { (area)->gc_alloc_table_start[(block) / BLOCKS_PER_ATB] &= (~(AT_TAIL << BLOCK_SHIFT(block))); } while (0)
+
+#define BLOCK_FROM_PTR(area, ptr) (((byte*)(ptr) - (area)->gc_pool_start) / BYTES_PER_BLOCK)
+#define PTR_FROM_BLOCK(area, block) (((block) * BYTES_PER_BLOCK + (uintptr_t)(area)->gc_pool_start))
 #define ATB_FROM_BLOCK(bl) ((bl) / BLOCKS_PER_ATB)
+#define AREA_NUM_BLOCKS(area) ((area)->gc_alloc_table_byte_len * BLOCKS_PER_ATB)
+
+#if MICROPY_GC_SPLIT_HEAP
+#define NEXT_AREA(area) ((area)->next)
+#else
+#define NEXT_AREA(area) (NULL)
+#endif
+
+#if MICROPY_GC_INCREMENTAL
+// marked heads are visible outside of a collection while a cycle is in progress
+#define ATB_KIND_IS_HEAD(kind) ((kind) == AT_HEAD || (kind) == AT_MARK)
+#else
+#define ATB_KIND_IS_HEAD(kind) ((kind) == AT_HEAD)
+#endif
 
 #if MICROPY_ENABLE_FINALISER
 // FTB = finaliser table byte
@@ -89,9 +105,85 @@
 
 #define BLOCKS_PER_FTB (8)
 
-#define FTB_GET(block) ((MP_STATE_MEM(gc_finaliser_table_start)[(block) / BLOCKS_PER_FTB] >> ((block) & 7)) & 1)
-#define FTB_SET(block) do { MP_STATE_MEM(gc_finaliser_table_start)[(block) / BLOCKS_PER_FTB] |= (1 << ((block) & 7)); } while (0)
-#define FTB_CLEAR(block) do { MP_STATE_MEM(gc_finaliser_table_start)[(block) / BLOCKS_PER_FTB] &= (~(1 << ((block) & 7))); } while (0)
+#define FTB_GET(area, block) (((area)->gc_finaliser_table_start[(block) / BLOCKS_PER_FTB] >> ((block) & 7)) & 1)
+#define FTB_SET(area, block) do { (area)->gc_finaliser_table_start[(block) / BLOCKS_PER_FTB] |= (1 << ((block) & 7)); } while (0)
+#define FTB_CLEAR(area, block) do { (area)->gc_finaliser_table_start[(block) / BLOCKS_PER_FTB] &= (~(1 << ((block) & 7))); } while (0)
+#endif
+
+#if MICROPY_GC_INCREMENTAL
+// NTB = new table byte
+// if set, then the corresponding block was allocated during the mark phase
+
+#define BLOCKS_PER_NTB (8)
+
+#define NTB_GET(area, block) (((area)->gc_new_table_start[(block) / BLOCKS_PER_NTB] >> ((block) & 7)) & 1)
+#define NTB_SET(area, block) do { (area)->gc_new_table_start[(block) / BLOCKS_PER_NTB] |= (1 << ((block) & 7)); } while (0)
+#define NTB_BYTE_LEN(area) ((AREA_NUM_BLOCKS(area) + BLOCKS_PER_NTB - 1) / BLOCKS_PER_NTB)
+#endif
+
+#if MICROPY_GC_CENSUS
+// OTB = object table byte
+// if set, then the corresponding block was allocated as an object
+
+#define BLOCKS_PER_OTB (8)
+
+#define OTB_GET(area, block) (((area)->gc_obj_table_start[(block) / BLOCKS_PER_OTB] >> ((block) & 7)) & 1)
+#define OTB_SET(area, block) do { (area)->gc_obj_table_start[(block) / BLOCKS_PER_OTB] |= (1 << ((block) & 7)); } while (0)
+#define OTB_CLEAR(area, block) do { (area)->gc_obj_table_start[(block) / BLOCKS_PER_OTB] &= (~(1 << ((block) & 7))); } while (0)
+#endif
+
+#if MICROPY_GC_FREE_SUMMARY
+// The pool is divided into chunks, and chunks into groups, and for each of
+// these we keep the length of the free run at its start, the longest free
+// run within it, and the length of the free run at its end.  Whenever blocks
+// are allocated or freed the enclosing chunk and group are marked dirty, and
+// they are summarised again the next time gc_alloc reaches them.  Clean
+// groups and chunks without a long enough run are skipped by gc_alloc.
+#define ATBS_PER_CHUNK (MICROPY_GC_FREE_SUMMARY_CHUNK)
+#define BLOCKS_PER_CHUNK (ATBS_PER_CHUNK * BLOCKS_PER_ATB)
+#define CHUNKS_PER_GROUP (64)
+#define ATBS_PER_GROUP (ATBS_PER_CHUNK * CHUNKS_PER_GROUP)
+#define BLOCKS_PER_GROUP (ATBS_PER_GROUP * BLOCKS_PER_ATB)
+#define FS_HEAD (0)
+#define FS_MAX (1)
+#define FS_TAIL (2)
+#define FS_DIRTY (0xffff)
+#define FS_NUM_CHUNKS(area) (((area)->gc_alloc_table_byte_len + ATBS_PER_CHUNK - 1) / ATBS_PER_CHUNK)
+#define FS_CHUNK(area, chunk) (&(area)->gc_free_summary_start[3 * (chunk)])
+#define FS_GROUP(area, group) (&(area)->gc_free_summary_start[3 * (FS_NUM_CHUNKS(area) + (group))])
+#define FS_SET_DIRTY(area, first_block, last_block) gc_fs_set_dirty((area), (first_block), (last_block))
+// smaller allocations are usually satisfied near gc_last_free_atb_index
+#define FS_MIN_BLOCKS (BLOCKS_PER_ATB)
+// result of gc_fs_check
+#define FS_FOUND (0)
+#define FS_SCAN (1)
+#define FS_SKIP (2)
+#if BLOCKS_PER_GROUP >= FS_DIRTY
+#error MICROPY_GC_FREE_SUMMARY_CHUNK is too large
+#endif
+#else
+#define FS_SET_DIRTY(area, first_block, last_block) ((void)(area), (void)(first_block), (void)(last_block))
+#endif
+
+#if MICROPY_GC_SPLIT_HEAP
+// the region of each block on the mark stack is kept in gc_area_stack
+#define GC_STACK_PUSH(area, block) do { \
+        MP_STATE_MEM(gc_area_stack)[MP_STATE_MEM(gc_sp) - MP_STATE_MEM(gc_stack)] = (area); \
+        *MP_STATE_MEM(gc_sp)++ = (block); \
+    } while (0)
+#define GC_STACK_POP(a, block) do { \
+        (block) = *--MP_STATE_MEM(gc_sp); \
+        (a) = MP_STATE_MEM(gc_area_stack)[MP_STATE_MEM(gc_sp) - MP_STATE_MEM(gc_stack)]; \
+    } while (0)
+#else
+#define GC_STACK_PUSH(area, block) do { (void)(area); *MP_STATE_MEM(gc_sp)++ = (block); } while (0)
+#define GC_STACK_POP(a, block) do { (block) = *--MP_STATE_MEM(gc_sp); (a) = &MP_STATE_MEM(area); } while (0)
+#endif
+
+#if MICROPY_GC_SPLIT_HEAP_AUTO
+// size of a region that can hold an allocation of n_bytes along with its state
+// and tables, allowing for the rounding done by gc_setup_area
+#define GC_REGION_MIN_SIZE(n_bytes) (sizeof(mp_state_mem_area_t) + (n_bytes) + (n_bytes) / 16 + 2 * BYTES_PER_BLOCK + 64)
 #endif
 
 #if MICROPY_PY_THREAD && !MICROPY_PY_THREAD_GIL
@@ -102,8 +194,38 @@
 #define GC_EXIT()
 #endif
 
+#if MICROPY_GC_AUTO_THRESHOLD && !MICROPY_GC_ALLOC_THRESHOLD
+#error MICROPY_GC_AUTO_THRESHOLD requires MICROPY_GC_ALLOC_THRESHOLD
+#endif
+
+#if MICROPY_GC_DEFER_FINALISER && !MICROPY_ENABLE_FINALISER
+#error MICROPY_GC_DEFER_FINALISER requires MICROPY_ENABLE_FINALISER
+#endif
+
+#if MICROPY_GC_PARALLEL_MARK
+#if !MICROPY_PY_THREAD
+#error MICROPY_GC_PARALLEL_MARK requires MICROPY_PY_THREAD
+#endif
+// markers may mark different blocks in the same ATB at once
+#define ATB_GET_KIND_ATOMIC(area, block) ((__atomic_load_n(&(area)->gc_alloc_table_start[(block) / BLOCKS_PER_ATB], __ATOMIC_RELAXED) >> BLOCK_SHIFT(block)) & 3)
+#define ATB_HEAD_TO_MARK_ATOMIC(area, block) ((__atomic_fetch_or(&(area)->gc_alloc_table_start[(block) / BLOCKS_PER_ATB], AT_MARK << BLOCK_SHIFT(block), __ATOMIC_RELAXED) >> BLOCK_SHIFT(block)) & 3)
+#define GC_PAR_PACKET_SIZE (MICROPY_GC_PARALLEL_MARK_STACK_SIZE / 2)
+#endif
+
+#if MICROPY_GC_INCREMENTAL
+#if MICROPY_PY_THREAD && !MICROPY_PY_THREAD_GIL
+#error MICROPY_GC_INCREMENTAL requires MICROPY_PY_THREAD_GIL
+#endif
+
+// what the port's gc_collect is being called for
+#define GC_ROOTS_FULL (0) // a complete stop-the-world collection
+#define GC_ROOTS_PUSH (1) // mark roots at the start of an incremental cycle
+#define GC_ROOTS_RETRACE (2) // mark and re-trace roots at the end of the mark phase
+#endif
+
+// Lay out the tables and pool of a heap region in the given memory.
 // TODO waste less memory; currently requires that all entries in alloc_table have a corresponding block in pool
-void gc_init(void *start, void *end) {
+STATIC void gc_setup_area(mp_state_mem_area_t *area, void *start, void *end) {
     // align end pointer on block boundary
     end = (void*)((uintptr_t)end & (~(BYTES_PER_BLOCK - 1)));
     DEBUG_printf("Initializing GC heap: %p..%p = " UINT_FMT " bytes\n", start, end, (byte*)end - (byte*)start);
@@ -114,37 +236,96 @@ void gc_init(void *start, void *end) {
     //     P = A * BLOCKS_PER_ATB * BYTES_PER_BLOCK
     // => T = A * (1 + BLOCKS_PER_ATB / BLOCKS_PER_FTB + BLOCKS_PER_ATB * BYTES_PER_BLOCK)
     size_t total_byte_len = (byte*)end - (byte*)start;
+#if MICROPY_GC_FREE_SUMMARY
+    // the free-run summary goes first, sized for the largest possible pool
+    size_t gc_free_summary_len = 3 * (total_byte_len / (BLOCKS_PER_CHUNK * BYTES_PER_BLOCK) + 1
+        + total_byte_len / (BLOCKS_PER_GROUP * BYTES_PER_BLOCK) + 1);
+    area->gc_free_summary_start = (uint16_t*)start;
+    start = area->gc_free_summary_start + gc_free_summary_len;
+    total_byte_len = (byte*)end - (byte*)start;
+#endif
+#if MICROPY_GC_INCREMENTAL
+    // so does the new table
+    size_t gc_new_table_byte_len = total_byte_len / (BLOCKS_PER_NTB * BYTES_PER_BLOCK) + 1;
+    area->gc_new_table_start = (byte*)start;
+    memset(area->gc_new_table_start, 0, gc_new_table_byte_len);
+    start = area->gc_new_table_start + gc_new_table_byte_len;
+    total_byte_len = (byte*)end - (byte*)start;
+#endif
+#if MICROPY_GC_CENSUS
+    // and the object table
+    size_t gc_obj_table_byte_len = total_byte_len / (BLOCKS_PER_OTB * BYTES_PER_BLOCK) + 1;
+    area->gc_obj_table_start = (byte*)start;
+    memset(area->gc_obj_table_start, 0, gc_obj_table_byte_len);
+    start = area->gc_obj_table_start + gc_obj_table_byte_len;
+    total_byte_len = (byte*)end - (byte*)start;
+#endif
 #if MICROPY_ENABLE_FINALISER
-    MP_STATE_MEM(gc_alloc_table_byte_len) = total_byte_len * BITS_PER_BYTE / (BITS_PER_BYTE + BITS_PER_BYTE * BLOCKS_PER_ATB / BLOCKS_PER_FTB + BITS_PER_BYTE * BLOCKS_PER_ATB * BYTES_PER_BLOCK);
+    area->gc_alloc_table_byte_len = total_byte_len * BITS_PER_BYTE / (BITS_PER_BYTE + BITS_PER_BYTE * BLOCKS_PER_ATB / BLOCKS_PER_FTB + BITS_PER_BYTE * BLOCKS_PER_ATB * BYTES_PER_BLOCK);
 #else
-    MP_STATE_MEM(gc_alloc_table_byte_len) = total_byte_len / (1 + BITS_PER_BYTE / 2 * BYTES_PER_BLOCK);
+    area->gc_alloc_table_byte_len = total_byte_len / (1 + BITS_PER_BYTE / 2 * BYTES_PER_BLOCK);
 #endif
 
-    MP_STATE_MEM(gc_alloc_table_start) = (byte*)start;
+    area->gc_alloc_table_start = (byte*)start;
 
 #if MICROPY_ENABLE_FINALISER
-    size_t gc_finaliser_table_byte_len = (MP_STATE_MEM(gc_alloc_table_byte_len) * BLOCKS_PER_ATB + BLOCKS_PER_FTB - 1) / BLOCKS_PER_FTB;
-    MP_STATE_MEM(gc_finaliser_table_start) = MP_STATE_MEM(gc_alloc_table_start) + MP_STATE_MEM(gc_alloc_table_byte_len);
+    size_t gc_finaliser_table_byte_len = (area->gc_alloc_table_byte_len * BLOCKS_PER_ATB + BLOCKS_PER_FTB - 1) / BLOCKS_PER_FTB;
+    area->gc_finaliser_table_start = area->gc_alloc_table_start + area->gc_alloc_table_byte_len;
 #endif
 
-    size_t gc_pool_block_len = MP_STATE_MEM(gc_alloc_table_byte_len) * BLOCKS_PER_ATB;
-    MP_STATE_MEM(gc_pool_start) = (byte*)end - gc_pool_block_len * BYTES_PER_BLOCK;
-    MP_STATE_MEM(gc_pool_end) = end;
+    size_t gc_pool_block_len = area->gc_alloc_table_byte_len * BLOCKS_PER_ATB;
+    area->gc_pool_start = (byte*)end - gc_pool_block_len * BYTES_PER_BLOCK;
+    area->gc_pool_end = end;
 
 #if MICROPY_ENABLE_FINALISER
-    assert(MP_STATE_MEM(gc_pool_start) >= MP_STATE_MEM(gc_finaliser_table_start) + gc_finaliser_table_byte_len);
+    assert(area->gc_pool_start >= area->gc_finaliser_table_start + gc_finaliser_table_byte_len);
 #endif
 
     // clear ATBs
-    memset(MP_STATE_MEM(gc_alloc_table_start), 0, MP_STATE_MEM(gc_alloc_table_byte_len));
+    memset(area->gc_alloc_table_start, 0, area->gc_alloc_table_byte_len);
 
 #if MICROPY_ENABLE_FINALISER
     // clear FTBs
-    memset(MP_STATE_MEM(gc_finaliser_table_start), 0, gc_finaliser_table_byte_len);
+    memset(area->gc_finaliser_table_start, 0, gc_finaliser_table_byte_len);
+#endif
+
+#if MICROPY_GC_FREE_SUMMARY
+    // mark all chunks and groups as dirty so they are summarised when first needed
+    memset(area->gc_free_summary_start, 0xff, gc_free_summary_len * sizeof(uint16_t));
 #endif
 
     // set last free ATB index to start of heap
-    MP_STATE_MEM(gc_last_free_atb_index) = 0;
+    area->gc_last_free_atb_index = 0;
+
+    #if MICROPY_GC_SPLIT_HEAP
+    area->next = NULL;
+    #endif
+
+    DEBUG_printf("GC layout:\n");
+    DEBUG_printf("  alloc table at %p, length " UINT_FMT " bytes, " UINT_FMT " blocks\n", area->gc_alloc_table_start, area->gc_alloc_table_byte_len, area->gc_alloc_table_byte_len * BLOCKS_PER_ATB);
+#if MICROPY_ENABLE_FINALISER
+    DEBUG_printf("  finaliser table at %p, length " UINT_FMT " bytes, " UINT_FMT " blocks\n", area->gc_finaliser_table_start, gc_finaliser_table_byte_len, gc_finaliser_table_byte_len * BLOCKS_PER_FTB);
+#endif
+    DEBUG_printf("  pool at %p, length " UINT_FMT " bytes, " UINT_FMT " blocks\n", area->gc_pool_start, gc_pool_block_len * BYTES_PER_BLOCK, gc_pool_block_len);
+}
+
+void gc_init(void *start, void *end) {
+    gc_setup_area(&MP_STATE_MEM(area), start, end);
+
+    #if MICROPY_GC_SPLIT_HEAP
+    MP_STATE_MEM(gc_lowest_ptr) = MP_STATE_MEM(area).gc_pool_start;
+    MP_STATE_MEM(gc_highest_ptr) = MP_STATE_MEM(area).gc_pool_end;
+    #endif
+
+    #if MICROPY_GC_FREE_LISTS
+    // the free lists are filled by the sweep
+    MP_STATE_MEM(gc_free_list)[0] = NULL;
+    MP_STATE_MEM(gc_free_list)[1] = NULL;
+    MP_STATE_MEM(gc_free_list_tail)[0] = NULL;
+    MP_STATE_MEM(gc_free_list_tail)[1] = NULL;
+    MP_STATE_MEM(gc_free_list_len)[0] = 0;
+    MP_STATE_MEM(gc_free_list_len)[1] = 0;
+    #endif
 
     // unlock the GC
     MP_STATE_MEM(gc_lock_depth) = 0;
@@ -158,18 +339,76 @@ void gc_init(void *start, void *end) {
     MP_STATE_MEM(gc_alloc_amount) = 0;
     #endif
 
+    #if MICROPY_GC_INCREMENTAL
+    MP_STATE_MEM(gc_inc_phase) = GC_PHASE_IDLE;
+    MP_STATE_MEM(gc_inc_roots) = GC_ROOTS_FULL;
+    #endif
+
+    #if MICROPY_GC_PROFILE
+    MP_STATE_MEM(gc_profile_countdown) = MICROPY_GC_PROFILE_PERIOD;
+    MP_STATE_MEM(gc_profile_lost) = 0;
+    memset(MP_STATE_MEM(gc_profile_table), 0, sizeof(MP_STATE_MEM(gc_profile_table)));
+    #endif
+
+    #if MICROPY_GC_STATS
+    memset(&MP_STATE_MEM(gc_stats), 0, sizeof(MP_STATE_MEM(gc_stats)));
+    #endif
+
+    #if MICROPY_GC_STATS || MICROPY_GC_AUTO_THRESHOLD
+    MP_STATE_MEM(gc_cycle_pause) = 0;
+    #endif
+
+    #if MICROPY_GC_AUTO_THRESHOLD
+    MP_STATE_MEM(gc_auto_threshold) = false;
+    MP_STATE_MEM(gc_auto_target_pause_us) = 0;
+    MP_STATE_MEM(gc_auto_alloc) = 0;
+    MP_STATE_MEM(gc_auto_last_end) = mp_hal_ticks_us();
+    #endif
+
     #if MICROPY_PY_THREAD
     mp_thread_mutex_init(&MP_STATE_MEM(gc_mutex));
     #endif
 
-    DEBUG_printf("GC layout:\n");
-    DEBUG_printf("  alloc table at %p, length " UINT_FMT " bytes, " UINT_FMT " blocks\n", MP_STATE_MEM(gc_alloc_table_start), MP_STATE_MEM(gc_alloc_table_byte_len), MP_STATE_MEM(gc_alloc_table_byte_len) * BLOCKS_PER_ATB);
-#if MICROPY_ENABLE_FINALISER
-    DEBUG_printf("  finaliser table at %p, length " UINT_FMT " bytes, " UINT_FMT " blocks\n", MP_STATE_MEM(gc_finaliser_table_start), gc_finaliser_table_byte_len, gc_finaliser_table_byte_len * BLOCKS_PER_FTB);
-#endif
-    DEBUG_printf("  pool at %p, length " UINT_FMT " bytes, " UINT_FMT " blocks\n", MP_STATE_MEM(gc_pool_start), gc_pool_block_len * BYTES_PER_BLOCK, gc_pool_block_len);
+    #if MICROPY_GC_DEFER_FINALISER
+    memset(MP_STATE_VM(gc_finaliser_queue), 0, sizeof(MP_STATE_VM(gc_finaliser_queue)));
+    MP_STATE_VM(gc_finaliser_queue_len) = 0;
+    MP_STATE_VM(gc_finalising) = false;
+    #endif
+
+    #if MICROPY_GC_PARALLEL_MARK
+    MP_STATE_MEM(gc_par_n_markers) = 0;
+    mp_thread_mutex_init(&MP_STATE_MEM(gc_par_mutex));
+    #endif
+}
+
+#if MICROPY_GC_SPLIT_HEAP
+// Add a region to the heap, the GC must be entered.
+STATIC void gc_add_area(void *start, void *end) {
+    // the region's own state is kept at its start
+    mp_state_mem_area_t *area = (mp_state_mem_area_t*)start;
+    gc_setup_area(area, area + 1, end);
+
+    // append the region so that allocation still prefers the earlier ones
+    mp_state_mem_area_t *prev = &MP_STATE_MEM(area);
+    while (prev->next != NULL) {
+        prev = prev->next;
+    }
+    prev->next = area;
+    if (area->gc_pool_start < MP_STATE_MEM(gc_lowest_ptr)) {
+        MP_STATE_MEM(gc_lowest_ptr) = area->gc_pool_start;
+    }
+    if (area->gc_pool_end > MP_STATE_MEM(gc_highest_ptr)) {
+        MP_STATE_MEM(gc_highest_ptr) = area->gc_pool_end;
+    }
 }
 
+void gc_add_region(void *start, void *end) {
+    GC_ENTER();
+    gc_add_area(start, end);
+    GC_EXIT();
+}
+#endif
+
 void gc_lock(void) {
     GC_ENTER();
     MP_STATE_MEM(gc_lock_depth)++;
@@ -186,24 +425,42 @@ bool gc_is_locked(void) {
     return MP_STATE_MEM(gc_lock_depth) != 0;
 }
 
+// Return the heap region that ptr points into, or NULL if ptr is not a valid
+// (block aligned) pointer into any of the pools.
+STATIC inline mp_state_mem_area_t *gc_get_ptr_area(const void *ptr) {
+    if (((uintptr_t)(ptr) & (BYTES_PER_BLOCK - 1)) != 0) {
+        // must be aligned on a block
+        return NULL;
+    }
+    #if MICROPY_GC_SPLIT_HEAP
+    // most non-heap values are rejected without looking at each region
+    if (ptr < (void*)MP_STATE_MEM(gc_lowest_ptr) || ptr >= (void*)MP_STATE_MEM(gc_highest_ptr)) {
+        return NULL;
+    }
+    #endif
+    for (mp_state_mem_area_t *area = &MP_STATE_MEM(area); area != NULL; area = NEXT_AREA(area)) {
+        if (ptr >= (void*)area->gc_pool_start && ptr < (void*)area->gc_pool_end) {
+            return area;
+        }
+    }
+    return NULL;
+}
+
 // ptr should be of type void*
-#define VERIFY_PTR(ptr) ( \
-        ((uintptr_t)(ptr) & (BYTES_PER_BLOCK - 1)) == 0      /* must be aligned on a block */ \
-        && ptr >= (void*)MP_STATE_MEM(gc_pool_start)     /* must be above start of pool */ \
-        && ptr < (void*)MP_STATE_MEM(gc_pool_end)        /* must be below end of pool */ \
-    )
+#define VERIFY_PTR(ptr) (gc_get_ptr_area(ptr) != NULL)
 
 // ptr should be of type void*
 #define VERIFY_MARK_AND_PUSH(ptr) \
     do { \
-        if (VERIFY_PTR(ptr)) { \
-            size_t _block = BLOCK_FROM_PTR(ptr); \
-            if (ATB_GET_KIND(_block) == AT_HEAD) { \
+        mp_state_mem_area_t *_area = gc_get_ptr_area(ptr); \
+        if (_area != NULL) { \
+            size_t _block = BLOCK_FROM_PTR(_area, ptr); \
+            if (ATB_GET_KIND(_area, _block) == AT_HEAD) { \
                 /* an unmarked head, mark it, and push it on gc stack */ \
                 DEBUG_printf("gc_mark(%p)\n", ptr); \
-                ATB_HEAD_TO_MARK(_block); \
+                ATB_HEAD_TO_MARK(_area, _block); \
                 if (MP_STATE_MEM(gc_sp) < &MP_STATE_MEM(gc_stack)[MICROPY_ALLOC_GC_STACK_SIZE]) { \
-                    *MP_STATE_MEM(gc_sp)++ = _block; \
+                    GC_STACK_PUSH(_area, _block); \
                 } else { \
                     MP_STATE_MEM(gc_stack_overflow) = 1; \
                 } \
@@ -214,97 +471,1010 @@ bool gc_is_locked(void) {
 STATIC void gc_drain_stack(void) {
     while (MP_STATE_MEM(gc_sp) > MP_STATE_MEM(gc_stack)) {
         // pop the next block off the stack
-        size_t block = *--MP_STATE_MEM(gc_sp);
+        mp_state_mem_area_t *area;
+        size_t block;
+        GC_STACK_POP(area, block);
+
+        // work out number of consecutive blocks in the chain starting with this one
+        size_t n_blocks = 0;
+        do {
+            n_blocks += 1;
+        } while (ATB_GET_KIND(area, block + n_blocks) == AT_TAIL);
+
+        // check this block's children
+        void **ptrs = (void**)PTR_FROM_BLOCK(area, block);
+        for (size_t i = n_blocks * BYTES_PER_BLOCK / sizeof(void*); i > 0; i--, ptrs++) {
+            void *ptr = *ptrs;
+            VERIFY_MARK_AND_PUSH(ptr);
+        }
+    }
+}
+
+STATIC void gc_deal_with_stack_overflow(void) {
+    while (MP_STATE_MEM(gc_stack_overflow)) {
+        MP_STATE_MEM(gc_stack_overflow) = 0;
+        MP_STATE_MEM(gc_sp) = MP_STATE_MEM(gc_stack);
+
+        // scan entire memory looking for blocks which have been marked but not their children
+        for (mp_state_mem_area_t *area = &MP_STATE_MEM(area); area != NULL; area = NEXT_AREA(area)) {
+            for (size_t block = 0; block < AREA_NUM_BLOCKS(area); block++) {
+                // trace (again) if mark bit set
+                if (ATB_GET_KIND(area, block) == AT_MARK) {
+                    GC_STACK_PUSH(area, block);
+                    gc_drain_stack();
+                }
+            }
+        }
+    }
+}
+
+#if MICROPY_GC_PARALLEL_MARK
+
+// A marked head whose children are yet to be traced.
+typedef struct _gc_par_entry_t {
+    #if MICROPY_GC_SPLIT_HEAP
+    mp_state_mem_area_t *area;
+    #endif
+    size_t block;
+} gc_par_entry_t;
+
+#if MICROPY_GC_SPLIT_HEAP
+#define GC_PAR_ENTRY_AREA(e) ((e)->area)
+#define GC_PAR_ENTRY_SET_AREA(e, a) ((e)->area = (a))
+#else
+#define GC_PAR_ENTRY_AREA(e) (&MP_STATE_MEM(area))
+#define GC_PAR_ENTRY_SET_AREA(e, a) ((void)(a))
+#endif
+
+// Work given up by a marker for others to take, free when len is 0.
+typedef struct _gc_par_packet_t {
+    size_t len;
+    gc_par_entry_t entries[GC_PAR_PACKET_SIZE];
+} gc_par_packet_t;
+
+// A marker's stack, and the packets it gives work away in.  Each marker keeps
+// these on its own C stack while it runs.  A marker only returns once all are
+// idle, and so the pool is empty, so no packet is used after its marker ends.
+typedef struct _gc_par_marker_t {
+    size_t sp;
+    gc_par_entry_t stack[MICROPY_GC_PARALLEL_MARK_STACK_SIZE];
+    gc_par_packet_t packets[MICROPY_GC_PARALLEL_MARK_PACKETS];
+} gc_par_marker_t;
+
+// Move the older half of a marker's stack to the pool, for other markers to
+// take.  Returns false if all of the marker's packets are in the pool.
+STATIC bool gc_par_give(gc_par_marker_t *m) {
+    size_t n = MIN(m->sp - m->sp / 2, GC_PAR_PACKET_SIZE);
+    mp_thread_mutex_lock(&MP_STATE_MEM(gc_par_mutex), 1);
+    gc_par_packet_t *p = NULL;
+    for (size_t i = 0; i < MICROPY_GC_PARALLEL_MARK_PACKETS; i++) {
+        if (m->packets[i].len == 0) {
+            p = &m->packets[i];
+            break;
+        }
+    }
+    if (p != NULL) {
+        p->len = n;
+        memcpy(p->entries, m->stack, n * sizeof(gc_par_entry_t));
+        memmove(m->stack, m->stack + n, (m->sp - n) * sizeof(gc_par_entry_t));
+        m->sp -= n;
+        MP_STATE_MEM(gc_par_pool)[MP_STATE_MEM(gc_par_pool_len)++] = p;
+    }
+    mp_thread_mutex_unlock(&MP_STATE_MEM(gc_par_mutex));
+    return p != NULL;
+}
+
+// Take a packet from the pool onto a marker's empty stack, must be called
+// with gc_par_mutex held.  Returns false if the pool is empty.
+STATIC bool gc_par_take(gc_par_marker_t *m) {
+    if (MP_STATE_MEM(gc_par_pool_len) == 0) {
+        return false;
+    }
+    gc_par_packet_t *p = MP_STATE_MEM(gc_par_pool)[--MP_STATE_MEM(gc_par_pool_len)];
+    memcpy(m->stack, p->entries, p->len * sizeof(gc_par_entry_t));
+    m->sp = p->len;
+    p->len = 0;
+    return true;
+}
+
+// Push a marked head on the marker's stack.
+STATIC void gc_par_push(gc_par_marker_t *m, mp_state_mem_area_t *area, size_t block) {
+    if (m->sp == MICROPY_GC_PARALLEL_MARK_STACK_SIZE && !gc_par_give(m)) {
+        // the marked block must be found by a rescan of the heap
+        __atomic_store_n(&MP_STATE_MEM(gc_stack_overflow), 1, __ATOMIC_RELAXED);
+        return;
+    }
+    gc_par_entry_t *e = &m->stack[m->sp++];
+    GC_PAR_ENTRY_SET_AREA(e, area);
+    e->block = block;
+}
+
+// Mark ptr if it is an unmarked head, and push it on the marker's stack.
+STATIC void gc_par_mark_and_push(gc_par_marker_t *m, void *ptr) {
+    mp_state_mem_area_t *area = gc_get_ptr_area(ptr);
+    if (area == NULL) {
+        return;
+    }
+    size_t block = BLOCK_FROM_PTR(area, ptr);
+    if (ATB_GET_KIND_ATOMIC(area, block) != AT_HEAD || ATB_HEAD_TO_MARK_ATOMIC(area, block) != AT_HEAD) {
+        // not a head, or another marker got to it first
+        return;
+    }
+    gc_par_push(m, area, block);
+}
+
+// Trace the children of everything on the marker's stack.
+STATIC void gc_par_drain_stack(gc_par_marker_t *m) {
+    while (m->sp > 0) {
+        gc_par_entry_t *e = &m->stack[--m->sp];
+        mp_state_mem_area_t *area = GC_PAR_ENTRY_AREA(e);
+        size_t block = e->block;
+
+        // share work with markers that have run out
+        if (m->sp >= 2 && __atomic_load_n(&MP_STATE_MEM(gc_par_n_idle), __ATOMIC_RELAXED) > 0
+            && __atomic_load_n(&MP_STATE_MEM(gc_par_pool_len), __ATOMIC_RELAXED) == 0) {
+            gc_par_give(m);
+        }
+
+        size_t n_blocks = 0;
+        do {
+            n_blocks += 1;
+        } while (ATB_GET_KIND_ATOMIC(area, block + n_blocks) == AT_TAIL);
+
+        void **ptrs = (void**)PTR_FROM_BLOCK(area, block);
+        for (size_t i = n_blocks * BYTES_PER_BLOCK / sizeof(void*); i > 0; i--, ptrs++) {
+            gc_par_mark_and_push(m, *ptrs);
+        }
+    }
+}
+
+// Called by the port on each of the threads tracing the heap.
+void gc_mark_worker(size_t id) {
+    size_t n_markers = MP_STATE_MEM(gc_par_n_markers);
+    gc_par_marker_t m;
+    m.sp = 0;
+    for (size_t i = 0; i < MICROPY_GC_PARALLEL_MARK_PACKETS; i++) {
+        m.packets[i].len = 0;
+    }
+
+    if (id == 0) {
+        // start from the roots that the collecting thread marked
+        while (MP_STATE_MEM(gc_sp) > MP_STATE_MEM(gc_stack)) {
+            mp_state_mem_area_t *area;
+            size_t block;
+            GC_STACK_POP(area, block);
+            gc_par_push(&m, area, block);
+        }
+    }
+
+    if (MP_STATE_MEM(gc_par_rescan)) {
+        gc_par_drain_stack(&m);
+        // each marker re-traces the marked blocks in its share of every region
+        for (mp_state_mem_area_t *area = &MP_STATE_MEM(area); area != NULL; area = NEXT_AREA(area)) {
+            size_t n = AREA_NUM_BLOCKS(area);
+            size_t end = n / n_markers * (id + 1);
+            if (id == n_markers - 1) {
+                end = n;
+            }
+            for (size_t block = n / n_markers * id; block < end; block++) {
+                if (ATB_GET_KIND_ATOMIC(area, block) == AT_MARK) {
+                    gc_par_push(&m, area, block);
+                    gc_par_drain_stack(&m);
+                }
+            }
+        }
+    }
+
+    for (;;) {
+        gc_par_drain_stack(&m);
+
+        // look for more work, waiting until there is some or all markers are
+        // idle; only a marker with work can add to the pool so then it's done
+        mp_thread_mutex_lock(&MP_STATE_MEM(gc_par_mutex), 1);
+        if (!gc_par_take(&m)) {
+            __atomic_add_fetch(&MP_STATE_MEM(gc_par_n_idle), 1, __ATOMIC_RELAXED);
+            for (;;) {
+                if (__atomic_load_n(&MP_STATE_MEM(gc_par_n_idle), __ATOMIC_RELAXED) == n_markers) {
+                    mp_thread_mutex_unlock(&MP_STATE_MEM(gc_par_mutex));
+                    return;
+                }
+                if (gc_par_take(&m)) {
+                    __atomic_sub_fetch(&MP_STATE_MEM(gc_par_n_idle), 1, __ATOMIC_RELAXED);
+                    break;
+                }
+                mp_thread_mutex_unlock(&MP_STATE_MEM(gc_par_mutex));
+                MICROPY_GC_PARALLEL_MARK_IDLE();
+                mp_thread_mutex_lock(&MP_STATE_MEM(gc_par_mutex), 1);
+            }
+        }
+        mp_thread_mutex_unlock(&MP_STATE_MEM(gc_par_mutex));
+    }
+}
+
+// Trace everything reachable from the marked roots, using all the markers.
+STATIC void gc_par_mark(void) {
+    // roots that didn't fit on the stack are found by a rescan
+    MP_STATE_MEM(gc_par_rescan) = MP_STATE_MEM(gc_stack_overflow);
+    do {
+        MP_STATE_MEM(gc_par_n_idle) = 0;
+        MP_STATE_MEM(gc_stack_overflow) = 0;
+        gc_port_run_markers(MP_STATE_MEM(gc_par_n_markers));
+        MP_STATE_MEM(gc_par_rescan) = true;
+    } while (MP_STATE_MEM(gc_stack_overflow));
+    MP_STATE_MEM(gc_par_n_markers) = 0;
+}
+
+#endif // MICROPY_GC_PARALLEL_MARK
+
+#if MICROPY_GC_FREE_SUMMARY
+// Mark the chunks and groups holding the given range of blocks (inclusive) as dirty.
+STATIC void gc_fs_set_dirty(mp_state_mem_area_t *area, size_t first_block, size_t last_block) {
+    for (size_t chunk = first_block / BLOCKS_PER_CHUNK; chunk <= last_block / BLOCKS_PER_CHUNK; chunk++) {
+        FS_CHUNK(area, chunk)[FS_MAX] = FS_DIRTY;
+    }
+    for (size_t group = first_block / BLOCKS_PER_GROUP; group <= last_block / BLOCKS_PER_GROUP; group++) {
+        FS_GROUP(area, group)[FS_MAX] = FS_DIRTY;
+    }
+}
+
+// Return the summary of the given chunk, computing it from the ATBs if needed.
+STATIC uint16_t *gc_fs_chunk(mp_state_mem_area_t *area, size_t chunk) {
+    uint16_t *fs = FS_CHUNK(area, chunk);
+    if (fs[FS_MAX] != FS_DIRTY) {
+        return fs;
+    }
+    size_t atb = chunk * ATBS_PER_CHUNK;
+    size_t atb_end = MIN(atb + ATBS_PER_CHUNK, area->gc_alloc_table_byte_len);
+    size_t head = 0;
+    size_t max = 0;
+    size_t run = 0;
+    bool in_head = true;
+    for (; atb < atb_end; atb++) {
+        byte a = area->gc_alloc_table_start[atb];
+        if (a == 0) {
+            // all 4 blocks are free
+            run += BLOCKS_PER_ATB;
+            continue;
+        }
+        for (size_t j = 0; j < BLOCKS_PER_ATB; j++, a >>= 2) {
+            if ((a & 3) == AT_FREE) {
+                run += 1;
+            } else {
+                if (in_head) {
+                    head = run;
+                    in_head = false;
+                }
+                max = MAX(max, run);
+                run = 0;
+            }
+        }
+    }
+    fs[FS_HEAD] = in_head ? run : head;
+    fs[FS_MAX] = MAX(max, run);
+    fs[FS_TAIL] = run;
+    return fs;
+}
+
+// Return the summary of the given group, computing it from its chunks if needed.
+STATIC uint16_t *gc_fs_group(mp_state_mem_area_t *area, size_t group) {
+    uint16_t *fs = FS_GROUP(area, group);
+    if (fs[FS_MAX] != FS_DIRTY) {
+        return fs;
+    }
+    size_t chunk = group * CHUNKS_PER_GROUP;
+    size_t chunk_end = MIN(chunk + CHUNKS_PER_GROUP, FS_NUM_CHUNKS(area));
+    size_t head = 0;
+    size_t max = 0;
+    size_t run = 0;
+    bool in_head = true;
+    for (; chunk < chunk_end; chunk++) {
+        uint16_t *c = gc_fs_chunk(area, chunk);
+        if (c[FS_HEAD] == BLOCKS_PER_CHUNK) {
+            // the whole chunk is free
+            run += BLOCKS_PER_CHUNK;
+            continue;
+        }
+        run += c[FS_HEAD];
+        if (in_head) {
+            head = run;
+            in_head = false;
+        }
+        max = MAX(max, MAX(run, c[FS_MAX]));
+        run = c[FS_TAIL];
+    }
+    fs[FS_HEAD] = in_head ? run : head;
+    fs[FS_MAX] = MAX(max, run);
+    fs[FS_TAIL] = run;
+    return fs;
+}
+
+// Check whether a run of n_blocks ends in the region with the given summary
+// of len blocks, where n_free is the number of free blocks preceding it.  If
+// the region can be skipped then n_free is updated to the number of free
+// blocks at its end.
+STATIC int gc_fs_check(const uint16_t *fs, size_t len, size_t n_blocks, size_t *n_free) {
+    if (*n_free + fs[FS_HEAD] >= n_blocks) {
+        return FS_FOUND;
+    }
+    if (fs[FS_MAX] >= n_blocks) {
+        return FS_SCAN;
+    }
+    if (fs[FS_HEAD] == len) {
+        *n_free += len;
+    } else {
+        *n_free = fs[FS_TAIL];
+    }
+    return FS_SKIP;
+}
+#endif
+
+#if MICROPY_GC_FREE_LISTS
+// Blocks on the free lists keep their HEAD/TAIL state in the ATB so that
+// they are not found by the search in gc_alloc, and are freed properly
+// before marking starts so that the sweep does not see them again.
+
+// Try to put the unmarked 1-block or 2-block chain at the given head block
+// on a free list instead of freeing it.  Returns the number of blocks kept.
+STATIC size_t gc_free_list_push(mp_state_mem_area_t *area, size_t block, size_t max_block) {
+    size_t n_blocks = 1;
+    if (block + 1 < max_block && ATB_GET_KIND(area, block + 1) == AT_TAIL) {
+        n_blocks = 2;
+        if (block + 2 < max_block && ATB_GET_KIND(area, block + 2) == AT_TAIL) {
+            return 0;
+        }
+    }
+    if (MP_STATE_MEM(gc_free_list_len)[n_blocks - 1] >= MICROPY_GC_FREE_LIST_MAX) {
+        return 0;
+    }
+    // append to the list so that allocations are handed out in address order
+    void **ptr = (void**)PTR_FROM_BLOCK(area, block);
+    *ptr = NULL;
+    if (MP_STATE_MEM(gc_free_list)[n_blocks - 1] == NULL) {
+        MP_STATE_MEM(gc_free_list)[n_blocks - 1] = ptr;
+    } else {
+        *(void**)MP_STATE_MEM(gc_free_list_tail)[n_blocks - 1] = ptr;
+    }
+    MP_STATE_MEM(gc_free_list_tail)[n_blocks - 1] = ptr;
+    MP_STATE_MEM(gc_free_list_len)[n_blocks - 1] += 1;
+    return n_blocks;
+}
+
+// Free all the blocks on the free lists.
+STATIC void gc_free_lists_release(void) {
+    for (size_t i = 0; i < 2; i++) {
+        for (void **ptr = MP_STATE_MEM(gc_free_list)[i]; ptr != NULL; ptr = *ptr) {
+            mp_state_mem_area_t *area = gc_get_ptr_area(ptr);
+            size_t block = BLOCK_FROM_PTR(area, ptr);
+            ATB_ANY_TO_FREE(area, block);
+            if (i == 1) {
+                ATB_ANY_TO_FREE(area, block + 1);
+            }
+            FS_SET_DIRTY(area, block, block + i);
+            if (block / BLOCKS_PER_ATB < area->gc_last_free_atb_index) {
+                area->gc_last_free_atb_index = block / BLOCKS_PER_ATB;
+            }
+        }
+        MP_STATE_MEM(gc_free_list)[i] = NULL;
+        MP_STATE_MEM(gc_free_list_tail)[i] = NULL;
+        MP_STATE_MEM(gc_free_list_len)[i] = 0;
+    }
+}
+#endif
+
+#if MICROPY_GC_STATS
+#define GC_STATS_ADD(field, n) (MP_STATE_MEM(gc_stats).field += (n))
+
+STATIC void gc_stats_alloc(size_t n_bytes, size_t n_blocks) {
+    size_t bin = 0;
+    for (size_t n = n_blocks - 1; n != 0 && bin < MICROPY_GC_STATS_HIST_BINS - 1; n >>= 1) {
+        bin += 1;
+    }
+    MP_STATE_MEM(gc_stats).alloc_hist[bin] += 1;
+    MP_STATE_MEM(gc_stats).n_bytes_alloc += n_bytes;
+}
+#else
+#define GC_STATS_ADD(field, n)
+#endif
+
+#if MICROPY_GC_AUTO_THRESHOLD
+// Called after each collection to choose how many blocks may be allocated
+// before the next one.  Collections are spaced out so that, at the rate
+// blocks were allocated since the last one, they take about
+// MICROPY_GC_AUTO_THRESHOLD_SHARE percent of the time.  Marking takes time
+// in proportion to the live blocks, and the survival ratio tells how many of
+// the blocks allocated will be live, so with a target pause the threshold is
+// also limited to what is expected to fit in the target.  Collections are
+// never made so frequent that they take more than half of the time, which
+// would happen if the target can't be met.
+STATIC void gc_auto_threshold_update(mp_uint_t pause) {
+    mp_uint_t now = mp_hal_ticks_us();
+    mp_uint_t run_time = now - MP_STATE_MEM(gc_auto_last_end) - pause;
+    size_t n_alloc = MP_STATE_MEM(gc_auto_alloc);
+    MP_STATE_MEM(gc_auto_last_end) = now;
+    MP_STATE_MEM(gc_auto_alloc) = 0;
+    if (!MP_STATE_MEM(gc_auto_threshold)) {
+        return;
+    }
+
+    size_t n_live = MP_STATE_MEM(gc_cycle_marked);
+    size_t n_used = n_live + MP_STATE_MEM(gc_cycle_swept);
+    size_t n_total = 0;
+    for (mp_state_mem_area_t *area = &MP_STATE_MEM(area); area != NULL; area = NEXT_AREA(area)) {
+        n_total += AREA_NUM_BLOCKS(area);
+    }
+    if (pause == 0) {
+        pause = 1;
+    }
+
+    uint64_t threshold = n_total;
+    uint64_t min_threshold = 0;
+    if (run_time > 0) {
+        threshold = (uint64_t)n_alloc * pause * (100 - MICROPY_GC_AUTO_THRESHOLD_SHARE)
+            / ((uint64_t)MICROPY_GC_AUTO_THRESHOLD_SHARE * run_time);
+        min_threshold = (uint64_t)n_alloc * pause / run_time;
+    }
+    mp_uint_t target = MP_STATE_MEM(gc_auto_target_pause_us);
+    if (target > 0 && n_live > 0) {
+        // the next pause is about pause * (n_live + survival * threshold) / n_live,
+        // with a survival ratio of n_live / n_used
+        uint64_t limit = 0;
+        if (target > pause) {
+            limit = (uint64_t)n_used * (target - pause) / pause;
+        }
+        threshold = MAX(MIN(threshold, limit), min_threshold);
+    }
+
+    // move half way to the new value to smooth out changes in the program
+    threshold = (threshold + MP_STATE_MEM(gc_alloc_threshold)) / 2;
+    threshold = MIN(threshold, n_total - n_live);
+    MP_STATE_MEM(gc_alloc_threshold) = MAX(threshold, MICROPY_GC_AUTO_THRESHOLD_MIN);
+}
+#endif
+
+#if MICROPY_GC_STATS || MICROPY_GC_AUTO_THRESHOLD
+#define GC_CYCLE_ADD(field, n) (MP_STATE_MEM(field) += (n))
+
+// Account for a pause of the program that began at the given time, which
+// completed a collection if done is true.
+STATIC void gc_pause_end(mp_uint_t start, bool done) {
+    mp_uint_t pause = mp_hal_ticks_us() - start;
+    MP_STATE_MEM(gc_cycle_pause) += pause;
+    #if MICROPY_GC_STATS
+    MP_STATE_MEM(gc_stats).total_pause_us += pause;
+    if (pause > MP_STATE_MEM(gc_stats).max_pause_us) {
+        MP_STATE_MEM(gc_stats).max_pause_us = pause;
+    }
+    #endif
+    if (!done) {
+        return;
+    }
+    #if MICROPY_GC_STATS
+    MP_STATE_MEM(gc_stats).n_collections += 1;
+    MP_STATE_MEM(gc_stats).n_marked += MP_STATE_MEM(gc_cycle_marked);
+    MP_STATE_MEM(gc_stats).n_swept += MP_STATE_MEM(gc_cycle_swept);
+    #endif
+    #if MICROPY_GC_AUTO_THRESHOLD
+    gc_auto_threshold_update(MP_STATE_MEM(gc_cycle_pause));
+    #endif
+    MP_STATE_MEM(gc_cycle_pause) = 0;
+}
+#else
+#define GC_CYCLE_ADD(field, n)
+#endif
+
+#if MICROPY_GC_DEFER_FINALISER
+// Called once marking is complete.  Unmarked objects with a finaliser are put
+// in the finaliser queue, or left for a later collection if it's full, and
+// either way they are marked with everything they refer to so they survive.
+STATIC void gc_queue_finalisers(void) {
+    for (mp_state_mem_area_t *area = &MP_STATE_MEM(area); area != NULL; area = NEXT_AREA(area)) {
+        size_t ftb_len = (AREA_NUM_BLOCKS(area) + BLOCKS_PER_FTB - 1) / BLOCKS_PER_FTB;
+        for (size_t i = 0; i < ftb_len; i++) {
+            byte ftb = area->gc_finaliser_table_start[i];
+            for (size_t block = i * BLOCKS_PER_FTB; ftb != 0; block++, ftb >>= 1) {
+                if ((ftb & 1) && ATB_GET_KIND(area, block) == AT_HEAD) {
+                    if (MP_STATE_VM(gc_finaliser_queue_len) < MICROPY_GC_FINALISER_QUEUE_SIZE) {
+                        MP_STATE_VM(gc_finaliser_queue)[MP_STATE_VM(gc_finaliser_queue_len)++] = (void*)PTR_FROM_BLOCK(area, block);
+                        FTB_CLEAR(area, block);
+                    }
+                    ATB_HEAD_TO_MARK(area, block);
+                    GC_STACK_PUSH(area, block);
+                    gc_drain_stack();
+                }
+            }
+        }
+    }
+    gc_deal_with_stack_overflow();
+}
+
+void gc_run_finalisers(size_t max_n) {
+    // a finaliser can release the GIL, so the flag is taken under the GC mutex
+    GC_ENTER();
+    bool finalising = MP_STATE_VM(gc_finalising);
+    MP_STATE_VM(gc_finalising) = true;
+    GC_EXIT();
+    if (finalising) {
+        return;
+    }
+    for (; max_n > 0; max_n--) {
+        GC_ENTER();
+        if (MP_STATE_MEM(gc_lock_depth) > 0 || MP_STATE_VM(gc_finaliser_queue_len) == 0) {
+            GC_EXIT();
+            break;
+        }
+        // once removed from the queue the object is only held by this function
+        size_t i = --MP_STATE_VM(gc_finaliser_queue_len);
+        mp_obj_base_t *obj = MP_STATE_VM(gc_finaliser_queue)[i];
+        MP_STATE_VM(gc_finaliser_queue)[i] = NULL;
+        GC_EXIT();
+
+        if (obj->type != NULL) {
+            nlr_buf_t nlr;
+            if (nlr_push(&nlr) == 0) {
+                mp_obj_t dest[2];
+                mp_load_method_maybe(MP_OBJ_FROM_PTR(obj), MP_QSTR___del__, dest);
+                if (dest[0] != MP_OBJ_NULL) {
+                    mp_call_method_n_kw(0, 0, dest);
+                    GC_STATS_ADD(n_finalised, 1);
+                }
+                nlr_pop();
+            } else {
+                mp_printf(&mp_plat_print, "Unhandled exception in __del__\n");
+                mp_obj_print_exception(&mp_plat_print, MP_OBJ_FROM_PTR(nlr.ret_val));
+            }
+        }
+    }
+    GC_ENTER();
+    MP_STATE_VM(gc_finalising) = false;
+    GC_EXIT();
+}
+#endif
+
+// Free unmarked heads and their tails in the given region from block up to
+// end, and continue past end to finish the chain being swept.  Returns the
+// block after the last one that was swept.
+STATIC size_t gc_sweep_range(mp_state_mem_area_t *area, size_t block, size_t end) {
+    size_t max_block = AREA_NUM_BLOCKS(area);
+    #if MICROPY_GC_FREE_SUMMARY
+    size_t first_block = block;
+    #endif
+    int free_tail = 0;
+    for (; block < max_block && (block < end || ATB_GET_KIND(area, block) == AT_TAIL); block++) {
+        switch (ATB_GET_KIND(area, block)) {
+            case AT_HEAD:
+#if MICROPY_ENABLE_FINALISER
+                if (FTB_GET(area, block)) {
+                    #if MICROPY_PY_THREAD
+                    // TODO need to think about reentrancy with finaliser code
+                    assert(!"finaliser with threading not implemented");
+                    #endif
+                    mp_obj_base_t *obj = (mp_obj_base_t*)PTR_FROM_BLOCK(area, block);
+                    if (obj->type != NULL) {
+                        // if the object has a type then see if it has a __del__ method
+                        mp_obj_t dest[2];
+                        mp_load_method_maybe(MP_OBJ_FROM_PTR(obj), MP_QSTR___del__, dest);
+                        if (dest[0] != MP_OBJ_NULL) {
+                            // load_method returned a method
+                            mp_call_method_n_kw(0, 0, dest);
+                            GC_STATS_ADD(n_finalised, 1);
+                        }
+                    }
+                    // clear finaliser flag
+                    FTB_CLEAR(area, block);
+                }
+#endif
+                free_tail = 1;
+                DEBUG_printf("gc_sweep(%x)\n", PTR_FROM_BLOCK(area, block));
+                #if MICROPY_PY_GC_COLLECT_RETVAL
+                MP_STATE_MEM(gc_collected)++;
+                #endif
+                #if MICROPY_GC_FREE_LISTS
+                {
+                    size_t n_kept = gc_free_list_push(area, block, max_block);
+                    if (n_kept > 0) {
+                        GC_CYCLE_ADD(gc_cycle_swept, n_kept);
+                        block += n_kept - 1;
+                        free_tail = 0;
+                        break;
+                    }
+                }
+                #endif
+                // fall through to free the head
+
+            case AT_TAIL:
+                if (free_tail) {
+                    ATB_ANY_TO_FREE(area, block);
+                    GC_CYCLE_ADD(gc_cycle_swept, 1);
+                } else {
+                    GC_CYCLE_ADD(gc_cycle_marked, 1);
+                }
+                break;
+
+            case AT_MARK:
+                ATB_MARK_TO_HEAD(area, block);
+                GC_CYCLE_ADD(gc_cycle_marked, 1);
+                free_tail = 0;
+                break;
+        }
+    }
+    #if MICROPY_GC_FREE_SUMMARY
+    if (block > first_block) {
+        gc_fs_set_dirty(area, first_block, block - 1);
+    }
+    #endif
+    return block;
+}
+
+STATIC void gc_sweep(void) {
+    #if MICROPY_PY_GC_COLLECT_RETVAL
+    MP_STATE_MEM(gc_collected) = 0;
+    #endif
+    #if MICROPY_GC_STATS || MICROPY_GC_AUTO_THRESHOLD
+    MP_STATE_MEM(gc_cycle_marked) = 0;
+    MP_STATE_MEM(gc_cycle_swept) = 0;
+    #endif
+    for (mp_state_mem_area_t *area = &MP_STATE_MEM(area); area != NULL; area = NEXT_AREA(area)) {
+        gc_sweep_range(area, 0, AREA_NUM_BLOCKS(area));
+    }
+}
+
+#if MICROPY_GC_INCREMENTAL
+
+// Record that the marked object at the given head block has been modified.
+STATIC void gc_inc_add_dirty(mp_state_mem_area_t *area, size_t block) {
+    void *ptr = (void*)PTR_FROM_BLOCK(area, block);
+    size_t len = MP_STATE_MEM(gc_inc_dirty_len);
+    if (len > MICROPY_GC_INCREMENTAL_DIRTY_SIZE) {
+        // already overflowed, the whole heap will be re-traced
+        return;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (MP_STATE_MEM(gc_inc_dirty)[i] == ptr) {
+            return;
+        }
+    }
+    if (len < MICROPY_GC_INCREMENTAL_DIRTY_SIZE) {
+        MP_STATE_MEM(gc_inc_dirty)[len] = ptr;
+    }
+    MP_STATE_MEM(gc_inc_dirty_len) = len + 1;
+}
+
+// Whether the given block has not been reached yet by the current sweep.
+STATIC bool gc_inc_unswept(mp_state_mem_area_t *area, size_t block) {
+    if (area == MP_STATE_MEM(gc_inc_area)) {
+        return block >= MP_STATE_MEM(gc_inc_cursor);
+    }
+    // regions are swept in order
+    for (mp_state_mem_area_t *a = MP_STATE_MEM(gc_inc_area); a != NULL; a = NEXT_AREA(a)) {
+        if (a == area) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Like gc_drain_stack, but stop once *budget blocks have been traced.
+STATIC void gc_inc_drain_stack(size_t *budget) {
+    while (*budget > 0 && MP_STATE_MEM(gc_sp) > MP_STATE_MEM(gc_stack)) {
+        // pop the next block off the stack
+        mp_state_mem_area_t *area;
+        size_t block;
+        GC_STACK_POP(area, block);
 
         // work out number of consecutive blocks in the chain starting with this one
         size_t n_blocks = 0;
         do {
             n_blocks += 1;
-        } while (ATB_GET_KIND(block + n_blocks) == AT_TAIL);
+        } while (ATB_GET_KIND(area, block + n_blocks) == AT_TAIL);
 
         // check this block's children
-        void **ptrs = (void**)PTR_FROM_BLOCK(block);
+        void **ptrs = (void**)PTR_FROM_BLOCK(area, block);
         for (size_t i = n_blocks * BYTES_PER_BLOCK / sizeof(void*); i > 0; i--, ptrs++) {
             void *ptr = *ptrs;
             VERIFY_MARK_AND_PUSH(ptr);
         }
+
+        *budget -= MIN(n_blocks, *budget);
+    }
+}
+
+// Do a slice of the mark phase.  Returns true when everything reachable from
+// the initial roots has been traced.
+STATIC bool gc_inc_mark(size_t *budget) {
+    for (;;) {
+        gc_inc_drain_stack(budget);
+        if (MP_STATE_MEM(gc_sp) > MP_STATE_MEM(gc_stack)) {
+            // out of budget
+            return false;
+        }
+
+        if (!MP_STATE_MEM(gc_inc_overflow_scan)) {
+            if (!MP_STATE_MEM(gc_stack_overflow)) {
+                return true;
+            }
+            // the stack overflowed so start scanning the heap for blocks which
+            // have been marked but not their children (see gc_deal_with_stack_overflow)
+            MP_STATE_MEM(gc_stack_overflow) = 0;
+            MP_STATE_MEM(gc_inc_overflow_scan) = true;
+            MP_STATE_MEM(gc_inc_area) = &MP_STATE_MEM(area);
+            MP_STATE_MEM(gc_inc_cursor) = 0;
+        }
+
+        // find the next marked block, skipping whole ATBs that have no marks,
+        // scanning 16 ATBs costs one unit of budget
+        mp_state_mem_area_t *area = MP_STATE_MEM(gc_inc_area);
+        size_t block = MP_STATE_MEM(gc_inc_cursor);
+        while (area != NULL) {
+            size_t max_block = AREA_NUM_BLOCKS(area);
+            while (block < max_block && ATB_GET_KIND(area, block) != AT_MARK) {
+                if (block % (16 * BLOCKS_PER_ATB) == 0) {
+                    if (*budget == 0) {
+                        MP_STATE_MEM(gc_inc_area) = area;
+                        MP_STATE_MEM(gc_inc_cursor) = block;
+                        return false;
+                    }
+                    *budget -= 1;
+                }
+                byte a = area->gc_alloc_table_start[ATB_FROM_BLOCK(block)];
+                if (block % BLOCKS_PER_ATB == 0 && (a & (a >> 1) & 0x55) == 0) {
+                    block += BLOCKS_PER_ATB;
+                } else {
+                    block += 1;
+                }
+            }
+            if (block < max_block) {
+                break;
+            }
+            area = NEXT_AREA(area);
+            block = 0;
+        }
+        if (area == NULL) {
+            // end of this scan, it must be repeated if the stack overflowed again
+            MP_STATE_MEM(gc_inc_overflow_scan) = false;
+        } else {
+            GC_STACK_PUSH(area, block);
+            MP_STATE_MEM(gc_inc_area) = area;
+            MP_STATE_MEM(gc_inc_cursor) = block + 1;
+        }
+    }
+}
+
+#if MICROPY_STACKLESS
+// The VM writes to the frame stack without a write barrier, so like the C
+// stack it's traced again, for every thread.
+STATIC void gc_inc_retrace_frame_stack(mp_frame_chunk_t *c) {
+    for (; c != NULL; c = c->prev) {
+        mp_state_mem_area_t *area = gc_get_ptr_area(c);
+        size_t block = BLOCK_FROM_PTR(area, c);
+        if (ATB_GET_KIND(area, block) == AT_MARK) {
+            GC_STACK_PUSH(area, block);
+            gc_drain_stack();
+        }
+    }
+}
+#endif
+
+// Called from gc_collect_end once the roots have been re-traced, to complete
+// the mark phase.
+STATIC void gc_inc_finish_mark(void) {
+    #if MICROPY_STACKLESS
+    #if MICROPY_PY_THREAD
+    for (mp_state_thread_t *ts = MP_STATE_VM(stackless_threads); ts != NULL; ts = ts->next_thread) {
+        gc_inc_retrace_frame_stack(ts->frame_chunk);
+    }
+    #else
+    gc_inc_retrace_frame_stack(MP_STATE_THREAD(frame_chunk));
+    #endif
+    #endif
+
+    if (MP_STATE_MEM(gc_inc_dirty_len) > MICROPY_GC_INCREMENTAL_DIRTY_SIZE) {
+        // too many objects were modified to remember them all, so re-trace
+        // every marked block in the heap
+        MP_STATE_MEM(gc_stack_overflow) = 1;
+    } else {
+        for (size_t i = 0; i < MP_STATE_MEM(gc_inc_dirty_len); i++) {
+            void *ptr = MP_STATE_MEM(gc_inc_dirty)[i];
+            mp_state_mem_area_t *area = gc_get_ptr_area(ptr);
+            size_t block = BLOCK_FROM_PTR(area, ptr);
+            // the object may have been freed since it was recorded
+            if (ATB_GET_KIND(area, block) == AT_MARK) {
+                GC_STACK_PUSH(area, block);
+                gc_drain_stack();
+            }
+        }
+    }
+    MP_STATE_MEM(gc_inc_dirty_len) = 0;
+
+    // objects allocated while marking were marked without being traced, and
+    // may since have been filled in without a write barrier, so trace them now
+    for (mp_state_mem_area_t *area = &MP_STATE_MEM(area); area != NULL; area = NEXT_AREA(area)) {
+        for (size_t i = 0; i < NTB_BYTE_LEN(area); i++) {
+            byte ntb = area->gc_new_table_start[i];
+            area->gc_new_table_start[i] = 0;
+            for (size_t block = i * BLOCKS_PER_NTB; ntb != 0; block++, ntb >>= 1) {
+                // the object may have been freed since it was allocated
+                if ((ntb & 1) && ATB_GET_KIND(area, block) == AT_MARK) {
+                    GC_STACK_PUSH(area, block);
+                    gc_drain_stack();
+                }
+            }
+        }
+    }
+    gc_deal_with_stack_overflow();
+    #if MICROPY_GC_DEFER_FINALISER
+    gc_queue_finalisers();
+    #endif
+
+    MP_STATE_MEM(gc_inc_phase) = GC_PHASE_SWEEP;
+    MP_STATE_MEM(gc_inc_area) = &MP_STATE_MEM(area);
+    MP_STATE_MEM(gc_inc_cursor) = 0;
+    #if MICROPY_PY_GC_COLLECT_RETVAL
+    MP_STATE_MEM(gc_collected) = 0;
+    #endif
+    #if MICROPY_GC_STATS || MICROPY_GC_AUTO_THRESHOLD
+    MP_STATE_MEM(gc_cycle_marked) = 0;
+    MP_STATE_MEM(gc_cycle_swept) = 0;
+    #endif
+}
+
+// Give up on an incremental cycle so that a full collection can be done.
+STATIC void gc_inc_abort(void) {
+    if (MP_STATE_MEM(gc_inc_phase) == GC_PHASE_MARK) {
+        // discard the marks made so far
+        for (mp_state_mem_area_t *area = &MP_STATE_MEM(area); area != NULL; area = NEXT_AREA(area)) {
+            for (size_t block = 0; block < AREA_NUM_BLOCKS(area); block++) {
+                if (ATB_GET_KIND(area, block) == AT_MARK) {
+                    ATB_MARK_TO_HEAD(area, block);
+                }
+            }
+        }
+        MP_STATE_MEM(gc_inc_overflow_scan) = false;
+        MP_STATE_MEM(gc_inc_dirty_len) = 0;
+        for (mp_state_mem_area_t *area = &MP_STATE_MEM(area); area != NULL; area = NEXT_AREA(area)) {
+            memset(area->gc_new_table_start, 0, NTB_BYTE_LEN(area));
+        }
+    } else if (MP_STATE_MEM(gc_inc_phase) == GC_PHASE_SWEEP) {
+        // marking is complete so the sweep may as well be finished
+        size_t block = MP_STATE_MEM(gc_inc_cursor);
+        for (mp_state_mem_area_t *area = MP_STATE_MEM(gc_inc_area); area != NULL; area = NEXT_AREA(area)) {
+            gc_sweep_range(area, block, AREA_NUM_BLOCKS(area));
+            block = 0;
+        }
+    }
+    MP_STATE_MEM(gc_inc_phase) = GC_PHASE_IDLE;
+}
+
+bool gc_collect_step(size_t budget) {
+    GC_ENTER();
+
+    if (MP_STATE_MEM(gc_lock_depth) > 0) {
+        GC_EXIT();
+        return false;
+    }
+
+    #if MICROPY_GC_STATS || MICROPY_GC_AUTO_THRESHOLD
+    mp_uint_t start = mp_hal_ticks_us();
+    #endif
+
+    if (MP_STATE_MEM(gc_inc_phase) == GC_PHASE_IDLE) {
+        // start a new cycle by marking the roots, they are traced by later steps
+        MP_STATE_MEM(gc_inc_phase) = GC_PHASE_MARK;
+        MP_STATE_MEM(gc_inc_overflow_scan) = false;
+        MP_STATE_MEM(gc_inc_dirty_len) = 0;
+        MP_STATE_MEM(gc_inc_roots) = GC_ROOTS_PUSH;
+        GC_EXIT();
+        gc_collect();
+        GC_ENTER();
+        MP_STATE_MEM(gc_inc_roots) = GC_ROOTS_FULL;
     }
-}
 
-STATIC void gc_deal_with_stack_overflow(void) {
-    while (MP_STATE_MEM(gc_stack_overflow)) {
-        MP_STATE_MEM(gc_stack_overflow) = 0;
-        MP_STATE_MEM(gc_sp) = MP_STATE_MEM(gc_stack);
+    MP_STATE_MEM(gc_lock_depth)++;
 
-        // scan entire memory looking for blocks which have been marked but not their children
-        for (size_t block = 0; block < MP_STATE_MEM(gc_alloc_table_byte_len) * BLOCKS_PER_ATB; block++) {
-            // trace (again) if mark bit set
-            if (ATB_GET_KIND(block) == AT_MARK) {
-                *MP_STATE_MEM(gc_sp)++ = block;
-                gc_drain_stack();
+    if (MP_STATE_MEM(gc_inc_phase) == GC_PHASE_MARK && gc_inc_mark(&budget)) {
+        // The roots and modified objects may now refer to objects that were
+        // not reachable when they were traced.  Trace them again in one go to
+        // complete the mark phase.
+        MP_STATE_MEM(gc_lock_depth)--;
+        MP_STATE_MEM(gc_inc_roots) = GC_ROOTS_RETRACE;
+        GC_EXIT();
+        gc_collect();
+        GC_ENTER();
+        MP_STATE_MEM(gc_inc_roots) = GC_ROOTS_FULL;
+        MP_STATE_MEM(gc_lock_depth)++;
+    }
+
+    while (MP_STATE_MEM(gc_inc_phase) == GC_PHASE_SWEEP && budget > 0) {
+        mp_state_mem_area_t *area = MP_STATE_MEM(gc_inc_area);
+        size_t max_block = AREA_NUM_BLOCKS(area);
+        size_t block = MP_STATE_MEM(gc_inc_cursor);
+        size_t end = budget < max_block - block ? block + budget : max_block;
+        MP_STATE_MEM(gc_inc_cursor) = gc_sweep_range(area, block, end);
+        budget -= MIN(MP_STATE_MEM(gc_inc_cursor) - block, budget);
+        // allocation must be able to find the blocks that were just freed
+        if (block / BLOCKS_PER_ATB < area->gc_last_free_atb_index) {
+            area->gc_last_free_atb_index = block / BLOCKS_PER_ATB;
+        }
+        if (MP_STATE_MEM(gc_inc_cursor) == max_block) {
+            // move on to the next region
+            MP_STATE_MEM(gc_inc_area) = NEXT_AREA(area);
+            MP_STATE_MEM(gc_inc_cursor) = 0;
+            if (MP_STATE_MEM(gc_inc_area) == NULL) {
+                MP_STATE_MEM(gc_inc_phase) = GC_PHASE_IDLE;
             }
         }
     }
-}
 
-STATIC void gc_sweep(void) {
-    #if MICROPY_PY_GC_COLLECT_RETVAL
-    MP_STATE_MEM(gc_collected) = 0;
+    MP_STATE_MEM(gc_lock_depth)--;
+    bool done = MP_STATE_MEM(gc_inc_phase) == GC_PHASE_IDLE;
+    #if MICROPY_GC_STATS || MICROPY_GC_AUTO_THRESHOLD
+    gc_pause_end(start, done);
     #endif
-    // free unmarked heads and their tails
-    int free_tail = 0;
-    for (size_t block = 0; block < MP_STATE_MEM(gc_alloc_table_byte_len) * BLOCKS_PER_ATB; block++) {
-        switch (ATB_GET_KIND(block)) {
-            case AT_HEAD:
-#if MICROPY_ENABLE_FINALISER
-                if (FTB_GET(block)) {
-                    #if MICROPY_PY_THREAD
-                    // TODO need to think about reentrancy with finaliser code
-                    assert(!"finaliser with threading not implemented");
-                    #endif
-                    mp_obj_base_t *obj = (mp_obj_base_t*)PTR_FROM_BLOCK(block);
-                    if (obj->type != NULL) {
-                        // if the object has a type then see if it has a __del__ method
-                        mp_obj_t dest[2];
-                        mp_load_method_maybe(MP_OBJ_FROM_PTR(obj), MP_QSTR___del__, dest);
-                        if (dest[0] != MP_OBJ_NULL) {
-                            // load_method returned a method
-                            mp_call_method_n_kw(0, 0, dest);
-                        }
-                    }
-                    // clear finaliser flag
-                    FTB_CLEAR(block);
-                }
-#endif
-                free_tail = 1;
-                DEBUG_printf("gc_sweep(%x)\n", PTR_FROM_BLOCK(block));
-                #if MICROPY_PY_GC_COLLECT_RETVAL
-                MP_STATE_MEM(gc_collected)++;
-                #endif
-                // fall through to free the head
-
-            case AT_TAIL:
-                if (free_tail) {
-                    ATB_ANY_TO_FREE(block);
-                }
-                break;
+    GC_EXIT();
+    return done;
+}
 
-            case AT_MARK:
-                ATB_MARK_TO_HEAD(block);
-                free_tail = 0;
-                break;
+void gc_write_barrier(const void *ptr) {
+    // only objects that were already traced in this cycle need to be recorded
+    if (MP_STATE_MEM(gc_inc_phase) != GC_PHASE_MARK) {
+        return;
+    }
+    GC_ENTER();
+    for (mp_state_mem_area_t *area = &MP_STATE_MEM(area); area != NULL; area = NEXT_AREA(area)) {
+        if (ptr >= (void*)area->gc_pool_start && ptr < (void*)area->gc_pool_end) {
+            // ptr may point inside the object, so find its head
+            size_t block = BLOCK_FROM_PTR(area, ptr);
+            while (ATB_GET_KIND(area, block) == AT_TAIL) {
+                block--;
+            }
+            // new objects are traced at the end of the mark phase anyway
+            if (ATB_GET_KIND(area, block) == AT_MARK && !NTB_GET(area, block)) {
+                gc_inc_add_dirty(area, block);
+            }
+            break;
         }
     }
+    GC_EXIT();
 }
 
+#endif // MICROPY_GC_INCREMENTAL
+
 void gc_collect_start(void) {
     GC_ENTER();
     MP_STATE_MEM(gc_lock_depth)++;
+    #if MICROPY_GC_STATS || MICROPY_GC_AUTO_THRESHOLD
+    MP_STATE_MEM(gc_pause_start) = mp_hal_ticks_us();
+    #endif
+    #if MICROPY_GC_INCREMENTAL
+    if (MP_STATE_MEM(gc_inc_roots) == GC_ROOTS_FULL) {
+        gc_inc_abort();
+    }
+    #endif
     #if MICROPY_GC_ALLOC_THRESHOLD
     MP_STATE_MEM(gc_alloc_amount) = 0;
     #endif
+    #if MICROPY_GC_FREE_LISTS
+    // blocks on the free lists must look free to the sweep
+    gc_free_lists_release();
+    #endif
     MP_STATE_MEM(gc_stack_overflow) = 0;
     MP_STATE_MEM(gc_sp) = MP_STATE_MEM(gc_stack);
+    #if MICROPY_GC_PARALLEL_MARK
+    #if MICROPY_GC_INCREMENTAL
+    if (MP_STATE_MEM(gc_inc_roots) == GC_ROOTS_FULL)
+    #endif
+    {
+        // the roots are only marked, to be traced in parallel by gc_collect_end
+        size_t n_blocks = 0;
+        for (mp_state_mem_area_t *area = &MP_STATE_MEM(area); area != NULL; area = NEXT_AREA(area)) {
+            n_blocks += AREA_NUM_BLOCKS(area);
+        }
+        if (n_blocks >= MICROPY_GC_PARALLEL_MARK_MIN_BLOCKS) {
+            size_t n_markers = MIN(gc_port_num_markers(), MICROPY_GC_PARALLEL_MARK_THREADS);
+            MP_STATE_MEM(gc_par_n_markers) = n_markers > 1 ? n_markers : 0;
+            MP_STATE_MEM(gc_par_pool_len) = 0;
+        }
+    }
+    #endif
     // Trace root pointers.  This relies on the root pointers being organised
     // correctly in the mp_state_ctx structure.  We scan nlr_top, dict_locals,
     // dict_globals, then the root pointer section of mp_state_vm.
@@ -313,6 +1483,39 @@ void gc_collect_start(void) {
 }
 
 void gc_collect_root(void **ptrs, size_t len) {
+    #if MICROPY_GC_INCREMENTAL
+    if (MP_STATE_MEM(gc_inc_roots) == GC_ROOTS_PUSH) {
+        // only mark the roots, tracing is done by gc_collect_step
+        for (size_t i = 0; i < len; i++) {
+            void *ptr = ptrs[i];
+            VERIFY_MARK_AND_PUSH(ptr);
+        }
+        return;
+    } else if (MP_STATE_MEM(gc_inc_roots) == GC_ROOTS_RETRACE) {
+        // objects referenced by the roots may have been modified after they
+        // were traced, so unmark them to have them traced again
+        for (size_t i = 0; i < len; i++) {
+            void *ptr = ptrs[i];
+            mp_state_mem_area_t *area = gc_get_ptr_area(ptr);
+            if (area != NULL && ATB_GET_KIND(area, BLOCK_FROM_PTR(area, ptr)) == AT_MARK) {
+                ATB_MARK_TO_HEAD(area, BLOCK_FROM_PTR(area, ptr));
+            }
+            VERIFY_MARK_AND_PUSH(ptr);
+            gc_drain_stack();
+        }
+        return;
+    }
+    #endif
+    #if MICROPY_GC_PARALLEL_MARK
+    if (MP_STATE_MEM(gc_par_n_markers) > 0) {
+        // the roots are only marked, and traced by the markers
+        for (size_t i = 0; i < len; i++) {
+            void *ptr = ptrs[i];
+            VERIFY_MARK_AND_PUSH(ptr);
+        }
+        return;
+    }
+    #endif
     for (size_t i = 0; i < len; i++) {
         void *ptr = ptrs[i];
         VERIFY_MARK_AND_PUSH(ptr);
@@ -321,78 +1524,253 @@ void gc_collect_root(void **ptrs, size_t len) {
 }
 
 void gc_collect_end(void) {
+    #if MICROPY_GC_INCREMENTAL
+    if (MP_STATE_MEM(gc_inc_roots) != GC_ROOTS_FULL) {
+        if (MP_STATE_MEM(gc_inc_roots) == GC_ROOTS_RETRACE) {
+            gc_inc_finish_mark();
+        }
+        MP_STATE_MEM(gc_lock_depth)--;
+        GC_EXIT();
+        return;
+    }
+    #endif
+    #if MICROPY_GC_PARALLEL_MARK
+    if (MP_STATE_MEM(gc_par_n_markers) > 0) {
+        gc_par_mark();
+    }
+    #endif
     gc_deal_with_stack_overflow();
+    #if MICROPY_GC_DEFER_FINALISER
+    gc_queue_finalisers();
+    #endif
     gc_sweep();
-    MP_STATE_MEM(gc_last_free_atb_index) = 0;
+    for (mp_state_mem_area_t *area = &MP_STATE_MEM(area); area != NULL; area = NEXT_AREA(area)) {
+        area->gc_last_free_atb_index = 0;
+    }
+    #if MICROPY_GC_STATS || MICROPY_GC_AUTO_THRESHOLD
+    gc_pause_end(MP_STATE_MEM(gc_pause_start), true);
+    #endif
     MP_STATE_MEM(gc_lock_depth)--;
     GC_EXIT();
 }
 
 void gc_info(gc_info_t *info) {
     GC_ENTER();
-    info->total = MP_STATE_MEM(gc_pool_end) - MP_STATE_MEM(gc_pool_start);
+    info->total = 0;
     info->used = 0;
     info->free = 0;
     info->max_free = 0;
     info->num_1block = 0;
     info->num_2block = 0;
     info->max_block = 0;
-    bool finish = false;
-    for (size_t block = 0, len = 0, len_free = 0; !finish;) {
-        size_t kind = ATB_GET_KIND(block);
-        switch (kind) {
-            case AT_FREE:
-                info->free += 1;
-                len_free += 1;
-                len = 0;
-                break;
+    for (mp_state_mem_area_t *area = &MP_STATE_MEM(area); area != NULL; area = NEXT_AREA(area)) {
+        info->total += area->gc_pool_end - area->gc_pool_start;
+        bool finish = false;
+        for (size_t block = 0, len = 0, len_free = 0; !finish;) {
+            size_t kind = ATB_GET_KIND(area, block);
+            switch (kind) {
+                case AT_FREE:
+                    info->free += 1;
+                    len_free += 1;
+                    len = 0;
+                    break;
+
+                #if MICROPY_GC_INCREMENTAL
+                case AT_MARK:
+                #endif
+                case AT_HEAD:
+                    info->used += 1;
+                    len = 1;
+                    break;
+
+                case AT_TAIL:
+                    info->used += 1;
+                    len += 1;
+                    break;
+
+                #if !MICROPY_GC_INCREMENTAL
+                case AT_MARK:
+                    // shouldn't happen
+                    break;
+                #endif
+            }
 
-            case AT_HEAD:
-                info->used += 1;
-                len = 1;
-                break;
+            block++;
+            finish = (block == AREA_NUM_BLOCKS(area));
+            // Get next block type if possible
+            if (!finish) {
+                kind = ATB_GET_KIND(area, block);
+            }
 
-            case AT_TAIL:
-                info->used += 1;
-                len += 1;
-                break;
+            if (finish || kind == AT_FREE || ATB_KIND_IS_HEAD(kind)) {
+                if (len == 1) {
+                    info->num_1block += 1;
+                } else if (len == 2) {
+                    info->num_2block += 1;
+                }
+                if (len > info->max_block) {
+                    info->max_block = len;
+                }
+                if (finish || ATB_KIND_IS_HEAD(kind)) {
+                    if (len_free > info->max_free) {
+                        info->max_free = len_free;
+                    }
+                    len_free = 0;
+                }
+            }
+        }
+    }
 
-            case AT_MARK:
-                // shouldn't happen
-                break;
+    #if MICROPY_GC_FREE_LISTS
+    // blocks on the free lists are available for allocation
+    size_t n_listed = MP_STATE_MEM(gc_free_list_len)[0] + 2 * MP_STATE_MEM(gc_free_list_len)[1];
+    info->used -= n_listed;
+    info->free += n_listed;
+    #endif
+
+    info->used *= BYTES_PER_BLOCK;
+    info->free *= BYTES_PER_BLOCK;
+    GC_EXIT();
+}
+
+#if MICROPY_GC_CENSUS
+// Return the type of the object at ptr, or NULL if it doesn't start with a
+// pointer to a type object.  Only blocks allocated as objects are looked at,
+// so eg the items of a list of types aren't mistaken for an instance.
+STATIC const mp_obj_type_t *gc_census_type(const void *ptr) {
+    const mp_obj_type_t *type = ((const mp_obj_base_t*)ptr)->type;
+    if (type == NULL || ((uintptr_t)type & (sizeof(void*) - 1)) != 0) {
+        return NULL;
+    }
+    mp_state_mem_area_t *area = gc_get_ptr_area(type);
+    if (area != NULL) {
+        // a class, which must be at the start of a block allocated as an object
+        size_t block = BLOCK_FROM_PTR(area, type);
+        if (!ATB_KIND_IS_HEAD(ATB_GET_KIND(area, block)) || !OTB_GET(area, block)) {
+            return NULL;
         }
+    } else if (!MICROPY_GC_CENSUS_STATIC_PTR(type)) {
+        return NULL;
+    }
+    if (type->base.type != &mp_type_type) {
+        return NULL;
+    }
+    return type;
+}
 
-        block++;
-        finish = (block == MP_STATE_MEM(gc_alloc_table_byte_len) * BLOCKS_PER_ATB);
-        // Get next block type if possible
-        if (!finish) {
-            kind = ATB_GET_KIND(block);
+STATIC bool gc_census_add(gc_census_entry_t *table, size_t len, const mp_obj_type_t *type, size_t n_blocks) {
+    gc_census_entry_t *e = &table[0];
+    if (type != NULL) {
+        // find the type's entry in the rest of the table by linear probing
+        size_t i = ((uintptr_t)type / sizeof(void*)) % (len - 1);
+        for (size_t n = 0; n < len - 1; n++) {
+            if (table[1 + i].type == NULL || table[1 + i].type == type) {
+                e = &table[1 + i];
+                e->type = type;
+                break;
+            }
+            i = (i + 1) % (len - 1);
         }
+    }
+    e->count += 1;
+    e->n_bytes += n_blocks * BYTES_PER_BLOCK;
+    return e != &table[0] || type == NULL;
+}
 
-        if (finish || kind == AT_FREE || kind == AT_HEAD) {
-            if (len == 1) {
-                info->num_1block += 1;
-            } else if (len == 2) {
-                info->num_2block += 1;
+bool gc_census(gc_census_entry_t *table, size_t len) {
+    memset(table, 0, len * sizeof(*table));
+    bool complete = true;
+    GC_ENTER();
+    for (mp_state_mem_area_t *area = &MP_STATE_MEM(area); area != NULL; area = NEXT_AREA(area)) {
+        size_t n_blocks = AREA_NUM_BLOCKS(area);
+        for (size_t block = 0; block < n_blocks;) {
+            if (block % BLOCKS_PER_ATB == 0 && area->gc_alloc_table_start[block / BLOCKS_PER_ATB] == 0) {
+                // skip a whole ATB byte of free blocks
+                block += BLOCKS_PER_ATB;
+                continue;
             }
-            if (len > info->max_block) {
-                info->max_block = len;
+            if (!ATB_KIND_IS_HEAD(ATB_GET_KIND(area, block))) {
+                block += 1;
+                continue;
             }
-            if (finish || kind == AT_HEAD) {
-                if (len_free > info->max_free) {
-                    info->max_free = len_free;
-                }
-                len_free = 0;
+            size_t start = block;
+            do {
+                block += 1;
+            } while (block < n_blocks && ATB_GET_KIND(area, block) == AT_TAIL);
+            const mp_obj_type_t *type = NULL;
+            if (OTB_GET(area, start)) {
+                type = gc_census_type((void*)PTR_FROM_BLOCK(area, start));
             }
+            complete &= gc_census_add(table, len, type, block - start);
         }
     }
-
-    info->used *= BYTES_PER_BLOCK;
-    info->free *= BYTES_PER_BLOCK;
+    #if MICROPY_GC_FREE_LISTS
+    // blocks on the free lists were counted as raw data, but are available
+    table[0].count -= MP_STATE_MEM(gc_free_list_len)[0] + MP_STATE_MEM(gc_free_list_len)[1];
+    table[0].n_bytes -= (MP_STATE_MEM(gc_free_list_len)[0] + 2 * MP_STATE_MEM(gc_free_list_len)[1]) * BYTES_PER_BLOCK;
+    #endif
     GC_EXIT();
+    return complete;
+}
+#endif
+
+#if MICROPY_GC_PROFILE
+// Called when at least gc_profile_countdown bytes have been allocated since
+// the last sample, to take another one.  There is a sample for every
+// MICROPY_GC_PROFILE_PERIOD bytes, so large allocations are always seen and
+// small ones in proportion to the memory they use.
+STATIC void gc_profile_sample(size_t n_bytes) {
+    n_bytes -= MP_STATE_MEM(gc_profile_countdown);
+    size_t n_sampled = (1 + n_bytes / MICROPY_GC_PROFILE_PERIOD) * MICROPY_GC_PROFILE_PERIOD;
+    MP_STATE_MEM(gc_profile_countdown) = MICROPY_GC_PROFILE_PERIOD - n_bytes % MICROPY_GC_PROFILE_PERIOD;
+
+    // get the innermost part of the Python call stack
+    mp_gc_profile_entry_t key;
+    key.n_bytes = 0;
+    key.n_samples = 0;
+    key.depth = 0;
+    size_t hash = 0;
+    for (const mp_code_state_t *cs = MP_STATE_THREAD(current_code_state);
+        cs != NULL && key.depth < MICROPY_GC_PROFILE_DEPTH; cs = cs->caller) {
+        qstr source_file;
+        qstr block_name = mp_code_state_get_location(cs, &source_file, &key.frame[key.depth].source_line);
+        key.frame[key.depth].block_name = block_name;
+        hash = hash * 33 + block_name * 7 + key.frame[key.depth].source_line;
+        key.depth += 1;
+    }
+
+    // find its entry in the table by linear probing, making one if needed
+    size_t i = hash % MICROPY_GC_PROFILE_ENTRIES;
+    for (size_t n = 0; n < MICROPY_GC_PROFILE_ENTRIES; n++) {
+        mp_gc_profile_entry_t *e = &MP_STATE_MEM(gc_profile_table)[i];
+        if (e->n_samples == 0) {
+            *e = key;
+        }
+        if (e->depth == key.depth && memcmp(e->frame, key.frame, key.depth * sizeof(key.frame[0])) == 0) {
+            e->n_bytes += n_sampled;
+            e->n_samples += 1;
+            return;
+        }
+        i = (i + 1) % MICROPY_GC_PROFILE_ENTRIES;
+    }
+
+    // the table is full
+    MP_STATE_MEM(gc_profile_lost) += n_sampled;
 }
 
-void *gc_alloc(size_t n_bytes, bool has_finaliser) {
+#define GC_PROFILE_ALLOC(n_bytes) \
+    do { \
+        if ((n_bytes) < MP_STATE_MEM(gc_profile_countdown)) { \
+            MP_STATE_MEM(gc_profile_countdown) -= (n_bytes); \
+        } else { \
+            gc_profile_sample(n_bytes); \
+        } \
+    } while (0)
+#else
+#define GC_PROFILE_ALLOC(n_bytes)
+#endif
+
+void *gc_alloc(size_t n_bytes, unsigned int alloc_flags) {
     size_t n_blocks = ((n_bytes + BYTES_PER_BLOCK - 1) & (~(BYTES_PER_BLOCK - 1))) / BYTES_PER_BLOCK;
     DEBUG_printf("gc_alloc(" UINT_FMT " bytes -> " UINT_FMT " blocks)\n", n_bytes, n_blocks);
 
@@ -409,13 +1787,25 @@ void *gc_alloc(size_t n_bytes, bool has_finaliser) {
         return NULL;
     }
 
+    mp_state_mem_area_t *area;
     size_t i;
     size_t end_block;
     size_t start_block;
-    size_t n_free = 0;
+    size_t n_free;
     int collected = !MP_STATE_MEM(gc_auto_collect_enabled);
 
-    #if MICROPY_GC_ALLOC_THRESHOLD
+    #if MICROPY_GC_INCREMENTAL
+    if (!collected && (MP_STATE_MEM(gc_inc_phase) != GC_PHASE_IDLE
+        #if MICROPY_GC_ALLOC_THRESHOLD
+        || MP_STATE_MEM(gc_alloc_amount) >= MP_STATE_MEM(gc_alloc_threshold)
+        #endif
+        )) {
+        // do some work on the current cycle, or start a new one
+        GC_EXIT();
+        gc_collect_step(MICROPY_GC_INCREMENTAL_BUDGET);
+        GC_ENTER();
+    }
+    #elif MICROPY_GC_ALLOC_THRESHOLD
     if (!collected && MP_STATE_MEM(gc_alloc_amount) >= MP_STATE_MEM(gc_alloc_threshold)) {
         GC_EXIT();
         gc_collect();
@@ -423,16 +1813,82 @@ void *gc_alloc(size_t n_bytes, bool has_finaliser) {
     }
     #endif
 
+    #if MICROPY_GC_FREE_LISTS
+    if (n_blocks <= 2 && MP_STATE_MEM(gc_free_list)[n_blocks - 1] != NULL) {
+        // take a chunk of the right size from the free list, its ATB entries
+        // are already set
+        void **ptr = MP_STATE_MEM(gc_free_list)[n_blocks - 1];
+        MP_STATE_MEM(gc_free_list)[n_blocks - 1] = *ptr;
+        if (*ptr == NULL) {
+            MP_STATE_MEM(gc_free_list_tail)[n_blocks - 1] = NULL;
+        }
+        MP_STATE_MEM(gc_free_list_len)[n_blocks - 1] -= 1;
+        area = gc_get_ptr_area(ptr);
+        start_block = BLOCK_FROM_PTR(area, ptr);
+        end_block = start_block + n_blocks - 1;
+        goto allocated;
+    }
+    #endif
+
     for (;;) {
 
-        // look for a run of n_blocks available blocks
-        for (i = MP_STATE_MEM(gc_last_free_atb_index); i < MP_STATE_MEM(gc_alloc_table_byte_len); i++) {
-            byte a = MP_STATE_MEM(gc_alloc_table_start)[i];
-            if (ATB_0_IS_FREE(a)) { if (++n_free >= n_blocks) { i = i * BLOCKS_PER_ATB + 0; goto found; } } else { n_free = 0; }
-            if (ATB_1_IS_FREE(a)) { if (++n_free >= n_blocks) { i = i * BLOCKS_PER_ATB + 1; goto found; } } else { n_free = 0; }
-            if (ATB_2_IS_FREE(a)) { if (++n_free >= n_blocks) { i = i * BLOCKS_PER_ATB + 2; goto found; } } else { n_free = 0; }
-            if (ATB_3_IS_FREE(a)) { if (++n_free >= n_blocks) { i = i * BLOCKS_PER_ATB + 3; goto found; } } else { n_free = 0; }
+        // look for a run of n_blocks available blocks in each region in turn
+        for (area = &MP_STATE_MEM(area); area != NULL; area = NEXT_AREA(area)) {
+            n_free = 0;
+            for (i = area->gc_last_free_atb_index; i < area->gc_alloc_table_byte_len; i++) {
+                #if MICROPY_GC_FREE_SUMMARY
+                if (n_blocks > FS_MIN_BLOCKS && i % ATBS_PER_CHUNK == 0) {
+                    // use the summaries to skip regions without a long enough run
+                    int fs_res = FS_SCAN;
+                    if (i % ATBS_PER_GROUP == 0) {
+                        fs_res = gc_fs_check(gc_fs_group(area, i / ATBS_PER_GROUP), BLOCKS_PER_GROUP, n_blocks, &n_free);
+                        if (fs_res == FS_SKIP) {
+                            i += ATBS_PER_GROUP - 1;
+                            continue;
+                        }
+                    }
+                    if (fs_res == FS_SCAN) {
+                        fs_res = gc_fs_check(gc_fs_chunk(area, i / ATBS_PER_CHUNK), BLOCKS_PER_CHUNK, n_blocks, &n_free);
+                        if (fs_res == FS_SKIP) {
+                            i += ATBS_PER_CHUNK - 1;
+                            continue;
+                        }
+                    }
+                    if (fs_res == FS_FOUND) {
+                        // the run ends in the free blocks at the start of this region
+                        i = i * BLOCKS_PER_ATB + n_blocks - n_free - 1;
+                        n_free = n_blocks;
+                        goto found;
+                    }
+                }
+                #endif
+                byte a = area->gc_alloc_table_start[i];
+                if (ATB_0_IS_FREE(a)) { if (++n_free >= n_blocks) { i = i * BLOCKS_PER_ATB + 0; goto found; } } else { n_free = 0; }
+                if (ATB_1_IS_FREE(a)) { if (++n_free >= n_blocks) { i = i * BLOCKS_PER_ATB + 1; goto found; } } else { n_free = 0; }
+                if (ATB_2_IS_FREE(a)) { if (++n_free >= n_blocks) { i = i * BLOCKS_PER_ATB + 2; goto found; } } else { n_free = 0; }
+                if (ATB_3_IS_FREE(a)) { if (++n_free >= n_blocks) { i = i * BLOCKS_PER_ATB + 3; goto found; } } else { n_free = 0; }
+            }
+        }
+
+        #if MICROPY_GC_FREE_LISTS
+        if (MP_STATE_MEM(gc_free_list)[0] != NULL || MP_STATE_MEM(gc_free_list)[1] != NULL) {
+            // the blocks on the free lists may join up with others
+            gc_free_lists_release();
+            continue;
+        }
+        #endif
+
+        #if MICROPY_GC_SPLIT_HEAP_AUTO
+        if (collected) {
+            // try to grow the heap before giving up
+            size_t region_size = GC_REGION_MIN_SIZE(n_bytes);
+            void *region = gc_port_get_region(&region_size);
+            if (region != NULL) {
+                gc_add_area(region, (byte*)region + region_size);
+                continue;
+            }
         }
+        #endif
 
         GC_EXIT();
         // nothing found!
@@ -457,27 +1913,64 @@ found:
     // before this one.  Also, whenever we free or shink a block we must check
     // if this index needs adjusting (see gc_realloc and gc_free).
     if (n_free == 1) {
-        MP_STATE_MEM(gc_last_free_atb_index) = (i + 1) / BLOCKS_PER_ATB;
+        area->gc_last_free_atb_index = (i + 1) / BLOCKS_PER_ATB;
     }
 
     // mark first block as used head
-    ATB_FREE_TO_HEAD(start_block);
+    ATB_FREE_TO_HEAD(area, start_block);
 
     // mark rest of blocks as used tail
     // TODO for a run of many blocks can make this more efficient
     for (size_t bl = start_block + 1; bl <= end_block; bl++) {
-        ATB_FREE_TO_TAIL(bl);
+        ATB_FREE_TO_TAIL(area, bl);
+    }
+    FS_SET_DIRTY(area, start_block, end_block);
+
+    #if MICROPY_GC_FREE_LISTS
+allocated:
+    #endif
+
+    #if MICROPY_GC_INCREMENTAL
+    if (MP_STATE_MEM(gc_inc_phase) == GC_PHASE_MARK) {
+        // Objects allocated while marking survive this cycle.  They are
+        // usually filled in by code without a write barrier, so they are
+        // traced once the mark phase is otherwise complete.
+        ATB_HEAD_TO_MARK(area, start_block);
+        NTB_SET(area, start_block);
+    } else if (MP_STATE_MEM(gc_inc_phase) == GC_PHASE_SWEEP && gc_inc_unswept(area, start_block)) {
+        // this block is yet to be swept, so it must be marked to survive
+        ATB_HEAD_TO_MARK(area, start_block);
+    }
+    #endif
+
+    #if MICROPY_GC_CENSUS
+    // the head may have been an object or not when it was last allocated
+    if (alloc_flags & GC_ALLOC_FLAG_OBJ) {
+        OTB_SET(area, start_block);
+    } else {
+        OTB_CLEAR(area, start_block);
     }
+    #endif
 
     // get pointer to first block
     // we must create this pointer before unlocking the GC so a collection can find it
-    void *ret_ptr = (void*)(MP_STATE_MEM(gc_pool_start) + start_block * BYTES_PER_BLOCK);
+    void *ret_ptr = (void*)(area->gc_pool_start + start_block * BYTES_PER_BLOCK);
     DEBUG_printf("gc_alloc(%p)\n", ret_ptr);
 
     #if MICROPY_GC_ALLOC_THRESHOLD
     MP_STATE_MEM(gc_alloc_amount) += n_blocks;
     #endif
 
+    #if MICROPY_GC_AUTO_THRESHOLD
+    MP_STATE_MEM(gc_auto_alloc) += n_blocks;
+    #endif
+
+    GC_PROFILE_ALLOC(n_bytes);
+
+    #if MICROPY_GC_STATS
+    gc_stats_alloc(n_bytes, n_blocks);
+    #endif
+
     GC_EXIT();
 
     #if MICROPY_GC_CONSERVATIVE_CLEAR
@@ -493,16 +1986,14 @@ found:
     #endif
 
     #if MICROPY_ENABLE_FINALISER
-    if (has_finaliser) {
+    if (alloc_flags & GC_ALLOC_FLAG_HAS_FINALISER) {
         // clear type pointer in case it is never set
         ((mp_obj_base_t*)ret_ptr)->type = NULL;
         // set mp_obj flag only if it has a finaliser
         GC_ENTER();
-        FTB_SET(start_block);
+        FTB_SET(area, start_block);
         GC_EXIT();
     }
-    #else
-    (void)has_finaliser;
     #endif
 
     #if EXTENSIVE_HEAP_PROFILING
@@ -534,22 +2025,25 @@ void gc_free(void *ptr) {
 
     DEBUG_printf("gc_free(%p)\n", ptr);
 
-    if (VERIFY_PTR(ptr)) {
-        size_t block = BLOCK_FROM_PTR(ptr);
-        if (ATB_GET_KIND(block) == AT_HEAD) {
+    mp_state_mem_area_t *area = gc_get_ptr_area(ptr);
+    if (area != NULL) {
+        size_t block = BLOCK_FROM_PTR(area, ptr);
+        if (ATB_KIND_IS_HEAD(ATB_GET_KIND(area, block))) {
             #if MICROPY_ENABLE_FINALISER
-            FTB_CLEAR(block);
+            FTB_CLEAR(area, block);
             #endif
             // set the last_free pointer to this block if it's earlier in the heap
-            if (block / BLOCKS_PER_ATB < MP_STATE_MEM(gc_last_free_atb_index)) {
-                MP_STATE_MEM(gc_last_free_atb_index) = block / BLOCKS_PER_ATB;
+            if (block / BLOCKS_PER_ATB < area->gc_last_free_atb_index) {
+                area->gc_last_free_atb_index = block / BLOCKS_PER_ATB;
             }
 
             // free head and all of its tail blocks
+            size_t first_block = block;
             do {
-                ATB_ANY_TO_FREE(block);
+                ATB_ANY_TO_FREE(area, block);
                 block += 1;
-            } while (ATB_GET_KIND(block) == AT_TAIL);
+            } while (ATB_GET_KIND(area, block) == AT_TAIL);
+            FS_SET_DIRTY(area, first_block, block - 1);
 
             GC_EXIT();
 
@@ -570,14 +2064,15 @@ void gc_free(void *ptr) {
 
 size_t gc_nbytes(const void *ptr) {
     GC_ENTER();
-    if (VERIFY_PTR(ptr)) {
-        size_t block = BLOCK_FROM_PTR(ptr);
-        if (ATB_GET_KIND(block) == AT_HEAD) {
+    mp_state_mem_area_t *area = gc_get_ptr_area(ptr);
+    if (area != NULL) {
+        size_t block = BLOCK_FROM_PTR(area, ptr);
+        if (ATB_KIND_IS_HEAD(ATB_GET_KIND(area, block))) {
             // work out number of consecutive blocks in the chain starting with this on
             size_t n_blocks = 0;
             do {
                 n_blocks += 1;
-            } while (ATB_GET_KIND(block + n_blocks) == AT_TAIL);
+            } while (ATB_GET_KIND(area, block + n_blocks) == AT_TAIL);
             GC_EXIT();
             return n_blocks * BYTES_PER_BLOCK;
         }
@@ -632,17 +2127,18 @@ void *gc_realloc(void *ptr_in, size_t n_bytes, bool allow_move) {
     void *ptr = ptr_in;
 
     // sanity check the ptr
-    if (!VERIFY_PTR(ptr)) {
+    mp_state_mem_area_t *area = gc_get_ptr_area(ptr);
+    if (area == NULL) {
         return NULL;
     }
 
     // get first block
-    size_t block = BLOCK_FROM_PTR(ptr);
+    size_t block = BLOCK_FROM_PTR(area, ptr);
 
     GC_ENTER();
 
     // sanity check the ptr is pointing to the head of a block
-    if (ATB_GET_KIND(block) != AT_HEAD) {
+    if (!ATB_KIND_IS_HEAD(ATB_GET_KIND(area, block))) {
         GC_EXIT();
         return NULL;
     }
@@ -663,9 +2159,9 @@ void *gc_realloc(void *ptr_in, size_t n_bytes, bool allow_move) {
     // efficiently shrink it (see below for shrinking code).
     size_t n_free   = 0;
     size_t n_blocks = 1; // counting HEAD block
-    size_t max_block = MP_STATE_MEM(gc_alloc_table_byte_len) * BLOCKS_PER_ATB;
+    size_t max_block = AREA_NUM_BLOCKS(area);
     for (size_t bl = block + n_blocks; bl < max_block; bl++) {
-        byte block_type = ATB_GET_KIND(bl);
+        byte block_type = ATB_GET_KIND(area, bl);
         if (block_type == AT_TAIL) {
             n_blocks++;
             continue;
@@ -691,12 +2187,13 @@ void *gc_realloc(void *ptr_in, size_t n_bytes, bool allow_move) {
     if (new_blocks < n_blocks) {
         // free unneeded tail blocks
         for (size_t bl = block + new_blocks, count = n_blocks - new_blocks; count > 0; bl++, count--) {
-            ATB_ANY_TO_FREE(bl);
+            ATB_ANY_TO_FREE(area, bl);
         }
+        FS_SET_DIRTY(area, block + new_blocks, block + n_blocks - 1);
 
         // set the last_free pointer to end of this block if it's earlier in the heap
-        if ((block + new_blocks) / BLOCKS_PER_ATB < MP_STATE_MEM(gc_last_free_atb_index)) {
-            MP_STATE_MEM(gc_last_free_atb_index) = (block + new_blocks) / BLOCKS_PER_ATB;
+        if ((block + new_blocks) / BLOCKS_PER_ATB < area->gc_last_free_atb_index) {
+            area->gc_last_free_atb_index = (block + new_blocks) / BLOCKS_PER_ATB;
         }
 
         GC_EXIT();
@@ -712,9 +2209,21 @@ void *gc_realloc(void *ptr_in, size_t n_bytes, bool allow_move) {
     if (new_blocks <= n_blocks + n_free) {
         // mark few more blocks as used tail
         for (size_t bl = block + n_blocks; bl < block + new_blocks; bl++) {
-            assert(ATB_GET_KIND(bl) == AT_FREE);
-            ATB_FREE_TO_TAIL(bl);
+            assert(ATB_GET_KIND(area, bl) == AT_FREE);
+            ATB_FREE_TO_TAIL(area, bl);
+        }
+        FS_SET_DIRTY(area, block + n_blocks, block + new_blocks - 1);
+
+        #if MICROPY_GC_INCREMENTAL
+        if (MP_STATE_MEM(gc_inc_phase) == GC_PHASE_MARK && ATB_GET_KIND(area, block) == AT_MARK
+            && !NTB_GET(area, block)) {
+            // the new tail blocks have not been traced
+            gc_inc_add_dirty(area, block);
         }
+        #endif
+
+        GC_PROFILE_ALLOC((new_blocks - n_blocks) * BYTES_PER_BLOCK);
+        GC_STATS_ADD(n_bytes_alloc, (new_blocks - n_blocks) * BYTES_PER_BLOCK);
 
         GC_EXIT();
 
@@ -733,10 +2242,16 @@ void *gc_realloc(void *ptr_in, size_t n_bytes, bool allow_move) {
         return ptr_in;
     }
 
+    unsigned int alloc_flags = 0;
     #if MICROPY_ENABLE_FINALISER
-    bool ftb_state = FTB_GET(block);
-    #else
-    bool ftb_state = false;
+    if (FTB_GET(area, block)) {
+        alloc_flags |= GC_ALLOC_FLAG_HAS_FINALISER;
+    }
+    #endif
+    #if MICROPY_GC_CENSUS
+    if (OTB_GET(area, block)) {
+        alloc_flags |= GC_ALLOC_FLAG_OBJ;
+    }
     #endif
 
     GC_EXIT();
@@ -747,7 +2262,7 @@ void *gc_realloc(void *ptr_in, size_t n_bytes, bool allow_move) {
     }
 
     // can't resize inplace; try to find a new contiguous chain
-    void *ptr_out = gc_alloc(n_bytes, ftb_state);
+    void *ptr_out = gc_alloc(n_bytes, alloc_flags);
 
     // check that the alloc succeeded
     if (ptr_out == NULL) {
@@ -756,6 +2271,7 @@ void *gc_realloc(void *ptr_in, size_t n_bytes, bool allow_move) {
 
     DEBUG_printf("gc_realloc(%p -> %p)\n", ptr_in, ptr_out);
     memcpy(ptr_out, ptr_in, n_blocks * BYTES_PER_BLOCK);
+
     gc_free(ptr_in);
     return ptr_out;
 }
@@ -770,113 +2286,179 @@ void gc_dump_info(void) {
            (uint)info.num_1block, (uint)info.num_2block, (uint)info.max_block, (uint)info.max_free);
 }
 
+#if MICROPY_GC_PROFILE
+STATIC void gc_dump_profile_stack(const mp_gc_profile_entry_t *e, bool collapsed) {
+    if (e->depth == 0) {
+        mp_printf(&mp_plat_print, "(none)");
+    }
+    for (size_t i = 0; i < e->depth; i++) {
+        // collapsed stacks are printed outermost function first
+        size_t f = collapsed ? e->depth - 1 - i : i;
+        if (i > 0) {
+            mp_printf(&mp_plat_print, collapsed ? ";" : " < ");
+        }
+        mp_printf(&mp_plat_print, "%q:%u", e->frame[f].block_name, (uint)e->frame[f].source_line);
+    }
+}
+
+void gc_dump_profile(bool collapsed) {
+    GC_ENTER();
+
+    // sort the entries by the number of bytes allocated, largest first
+    size_t order[MICROPY_GC_PROFILE_ENTRIES];
+    size_t n = 0;
+    size_t total = MP_STATE_MEM(gc_profile_lost);
+    for (size_t i = 0; i < MICROPY_GC_PROFILE_ENTRIES; i++) {
+        const mp_gc_profile_entry_t *e = &MP_STATE_MEM(gc_profile_table)[i];
+        if (e->n_samples == 0) {
+            continue;
+        }
+        total += e->n_bytes;
+        size_t j = n++;
+        for (; j > 0 && MP_STATE_MEM(gc_profile_table)[order[j - 1]].n_bytes < e->n_bytes; j--) {
+            order[j] = order[j - 1];
+        }
+        order[j] = i;
+    }
+
+    if (!collapsed) {
+        mp_printf(&mp_plat_print, "heap profile: %u bytes, sampled every %u bytes\n",
+            (uint)total, (uint)MICROPY_GC_PROFILE_PERIOD);
+        mp_printf(&mp_plat_print, "   bytes samples stack\n");
+    }
+    for (size_t i = 0; i < n; i++) {
+        const mp_gc_profile_entry_t *e = &MP_STATE_MEM(gc_profile_table)[order[i]];
+        if (collapsed) {
+            gc_dump_profile_stack(e, true);
+            mp_printf(&mp_plat_print, " %u\n", (uint)e->n_bytes);
+        } else {
+            mp_printf(&mp_plat_print, "%8u %7u ", (uint)e->n_bytes, (uint)e->n_samples);
+            gc_dump_profile_stack(e, false);
+            mp_printf(&mp_plat_print, "\n");
+        }
+    }
+    if (MP_STATE_MEM(gc_profile_lost) != 0) {
+        // stacks that didn't fit in the table
+        if (collapsed) {
+            mp_printf(&mp_plat_print, "(other) %u\n", (uint)MP_STATE_MEM(gc_profile_lost));
+        } else {
+            mp_printf(&mp_plat_print, "%8u         (other)\n", (uint)MP_STATE_MEM(gc_profile_lost));
+        }
+    }
+
+    GC_EXIT();
+}
+#endif
+
 void gc_dump_alloc_table(void) {
     GC_ENTER();
     static const size_t DUMP_BYTES_PER_LINE = 64;
-    #if !EXTENSIVE_HEAP_PROFILING
-    // When comparing heap output we don't want to print the starting
-    // pointer of the heap because it changes from run to run.
-    mp_printf(&mp_plat_print, "GC memory layout; from %p:", MP_STATE_MEM(gc_pool_start));
-    #endif
-    for (size_t bl = 0; bl < MP_STATE_MEM(gc_alloc_table_byte_len) * BLOCKS_PER_ATB; bl++) {
-        if (bl % DUMP_BYTES_PER_LINE == 0) {
-            // a new line of blocks
-            {
-                // check if this line contains only free blocks
-                size_t bl2 = bl;
-                while (bl2 < MP_STATE_MEM(gc_alloc_table_byte_len) * BLOCKS_PER_ATB && ATB_GET_KIND(bl2) == AT_FREE) {
-                    bl2++;
-                }
-                if (bl2 - bl >= 2 * DUMP_BYTES_PER_LINE) {
-                    // there are at least 2 lines containing only free blocks, so abbreviate their printing
-                    mp_printf(&mp_plat_print, "\n       (%u lines all free)", (uint)(bl2 - bl) / DUMP_BYTES_PER_LINE);
-                    bl = bl2 & (~(DUMP_BYTES_PER_LINE - 1));
-                    if (bl >= MP_STATE_MEM(gc_alloc_table_byte_len) * BLOCKS_PER_ATB) {
-                        // got to end of heap
-                        break;
-                    }
-                }
-            }
-            // print header for new line of blocks
-            // (the cast to uint32_t is for 16-bit ports)
-            //mp_printf(&mp_plat_print, "\n%05x: ", (uint)(PTR_FROM_BLOCK(bl) & (uint32_t)0xfffff));
-            mp_printf(&mp_plat_print, "\n%05x: ", (uint)((bl * BYTES_PER_BLOCK) & (uint32_t)0xfffff));
-        }
-        int c = ' ';
-        switch (ATB_GET_KIND(bl)) {
-            case AT_FREE: c = '.'; break;
-            /* this prints out if the object is reachable from BSS or STACK (for unix only)
-            case AT_HEAD: {
-                c = 'h';
-                void **ptrs = (void**)(void*)&mp_state_ctx;
-                mp_uint_t len = offsetof(mp_state_ctx_t, vm.stack_top) / sizeof(mp_uint_t);
-                for (mp_uint_t i = 0; i < len; i++) {
-                    mp_uint_t ptr = (mp_uint_t)ptrs[i];
-                    if (VERIFY_PTR(ptr) && BLOCK_FROM_PTR(ptr) == bl) {
-                        c = 'B';
-                        break;
+    for (mp_state_mem_area_t *area = &MP_STATE_MEM(area); area != NULL; area = NEXT_AREA(area)) {
+        #if !EXTENSIVE_HEAP_PROFILING
+        // When comparing heap output we don't want to print the starting
+        // pointer of the heap because it changes from run to run.
+        mp_printf(&mp_plat_print, "GC memory layout; from %p:", area->gc_pool_start);
+        #endif
+        for (size_t bl = 0; bl < AREA_NUM_BLOCKS(area); bl++) {
+            if (bl % DUMP_BYTES_PER_LINE == 0) {
+                // a new line of blocks
+                {
+                    // check if this line contains only free blocks
+                    size_t bl2 = bl;
+                    while (bl2 < AREA_NUM_BLOCKS(area) && ATB_GET_KIND(area, bl2) == AT_FREE) {
+                        bl2++;
                     }
-                }
-                if (c == 'h') {
-                    ptrs = (void**)&c;
-                    len = ((mp_uint_t)MP_STATE_THREAD(stack_top) - (mp_uint_t)&c) / sizeof(mp_uint_t);
-                    for (mp_uint_t i = 0; i < len; i++) {
-                        mp_uint_t ptr = (mp_uint_t)ptrs[i];
-                        if (VERIFY_PTR(ptr) && BLOCK_FROM_PTR(ptr) == bl) {
-                            c = 'S';
+                    if (bl2 - bl >= 2 * DUMP_BYTES_PER_LINE) {
+                        // there are at least 2 lines containing only free blocks, so abbreviate their printing
+                        mp_printf(&mp_plat_print, "\n       (%u lines all free)", (uint)(bl2 - bl) / DUMP_BYTES_PER_LINE);
+                        bl = bl2 & (~(DUMP_BYTES_PER_LINE - 1));
+                        if (bl >= AREA_NUM_BLOCKS(area)) {
+                            // got to end of heap
                             break;
                         }
                     }
                 }
-                break;
+                // print header for new line of blocks
+                // (the cast to uint32_t is for 16-bit ports)
+                //mp_printf(&mp_plat_print, "\n%05x: ", (uint)(PTR_FROM_BLOCK(area, bl) & (uint32_t)0xfffff));
+                mp_printf(&mp_plat_print, "\n%05x: ", (uint)((bl * BYTES_PER_BLOCK) & (uint32_t)0xfffff));
             }
-            */
-            /* this prints the uPy object type of the head block */
-            case AT_HEAD: {
-                void **ptr = (void**)(MP_STATE_MEM(gc_pool_start) + bl * BYTES_PER_BLOCK);
-                if (*ptr == &mp_type_tuple) { c = 'T'; }
-                else if (*ptr == &mp_type_list) { c = 'L'; }
-                else if (*ptr == &mp_type_dict) { c = 'D'; }
-                else if (*ptr == &mp_type_str || *ptr == &mp_type_bytes) { c = 'S'; }
-                #if MICROPY_PY_BUILTINS_BYTEARRAY
-                else if (*ptr == &mp_type_bytearray) { c = 'A'; }
-                #endif
-                #if MICROPY_PY_ARRAY
-                else if (*ptr == &mp_type_array) { c = 'A'; }
-                #endif
-                #if MICROPY_PY_BUILTINS_FLOAT
-                else if (*ptr == &mp_type_float) { c = 'F'; }
-                #endif
-                else if (*ptr == &mp_type_fun_bc) { c = 'B'; }
-                else if (*ptr == &mp_type_module) { c = 'M'; }
-                else {
+            int c = ' ';
+            switch (ATB_GET_KIND(area, bl)) {
+                case AT_FREE: c = '.'; break;
+                /* this prints out if the object is reachable from BSS or STACK (for unix only)
+                case AT_HEAD: {
                     c = 'h';
-                    #if 0
-                    // This code prints "Q" for qstr-pool data, and "q" for qstr-str
-                    // data.  It can be useful to see how qstrs are being allocated,
-                    // but is disabled by default because it is very slow.
-                    for (qstr_pool_t *pool = MP_STATE_VM(last_pool); c == 'h' && pool != NULL; pool = pool->prev) {
-                        if ((qstr_pool_t*)ptr == pool) {
-                            c = 'Q';
+                    void **ptrs = (void**)(void*)&mp_state_ctx;
+                    mp_uint_t len = offsetof(mp_state_ctx_t, vm.stack_top) / sizeof(mp_uint_t);
+                    for (mp_uint_t i = 0; i < len; i++) {
+                        mp_uint_t ptr = (mp_uint_t)ptrs[i];
+                        if (VERIFY_PTR(ptr) && BLOCK_FROM_PTR(area, ptr) == bl) {
+                            c = 'B';
                             break;
                         }
-                        for (const byte **q = pool->qstrs, **q_top = pool->qstrs + pool->len; q < q_top; q++) {
-                            if ((const byte*)ptr == *q) {
-                                c = 'q';
+                    }
+                    if (c == 'h') {
+                        ptrs = (void**)&c;
+                        len = ((mp_uint_t)MP_STATE_THREAD(stack_top) - (mp_uint_t)&c) / sizeof(mp_uint_t);
+                        for (mp_uint_t i = 0; i < len; i++) {
+                            mp_uint_t ptr = (mp_uint_t)ptrs[i];
+                            if (VERIFY_PTR(ptr) && BLOCK_FROM_PTR(area, ptr) == bl) {
+                                c = 'S';
                                 break;
                             }
                         }
                     }
+                    break;
+                }
+                */
+                /* this prints the uPy object type of the head block */
+                case AT_HEAD: {
+                    void **ptr = (void**)(area->gc_pool_start + bl * BYTES_PER_BLOCK);
+                    if (*ptr == &mp_type_tuple) { c = 'T'; }
+                    else if (*ptr == &mp_type_list) { c = 'L'; }
+                    else if (*ptr == &mp_type_dict) { c = 'D'; }
+                    else if (*ptr == &mp_type_str || *ptr == &mp_type_bytes) { c = 'S'; }
+                    #if MICROPY_PY_BUILTINS_BYTEARRAY
+                    else if (*ptr == &mp_type_bytearray) { c = 'A'; }
                     #endif
+                    #if MICROPY_PY_ARRAY
+                    else if (*ptr == &mp_type_array) { c = 'A'; }
+                    #endif
+                    #if MICROPY_PY_BUILTINS_FLOAT
+                    else if (*ptr == &mp_type_float) { c = 'F'; }
+                    #endif
+                    else if (*ptr == &mp_type_fun_bc) { c = 'B'; }
+                    else if (*ptr == &mp_type_module) { c = 'M'; }
+                    else {
+                        c = 'h';
+                        #if 0
+                        // This code prints "Q" for qstr-pool data, and "q" for qstr-str
+                        // data.  It can be useful to see how qstrs are being allocated,
+                        // but is disabled by default because it is very slow.
+                        for (qstr_pool_t *pool = MP_STATE_VM(last_pool); c == 'h' && pool != NULL; pool = pool->prev) {
+                            if ((qstr_pool_t*)ptr == pool) {
+                                c = 'Q';
+                                break;
+                            }
+                            for (const byte **q = pool->qstrs, **q_top = pool->qstrs + pool->len; q < q_top; q++) {
+                                if ((const byte*)ptr == *q) {
+                                    c = 'q';
+                                    break;
+                                }
+                            }
+                        }
+                        #endif
+                    }
+                    break;
                 }
-                break;
+                case AT_TAIL: c = '='; break;
+                case AT_MARK: c = 'm'; break;
             }
-            case AT_TAIL: c = '='; break;
-            case AT_MARK: c = 'm'; break;
+            mp_printf(&mp_plat_print, "%c", c);
         }
-        mp_printf(&mp_plat_print, "%c", c);
+        mp_print_str(&mp_plat_print, "\n");
     }
-    mp_print_str(&mp_plat_print, "\n");
     GC_EXIT();
 }
 
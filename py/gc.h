@@ -33,6 +33,34 @@
 
 void gc_init(void *start, void *end);
 
+#if MICROPY_GC_SPLIT_HEAP
+// Add another region of memory to the heap.
+void gc_add_region(void *start, void *end);
+#if MICROPY_GC_SPLIT_HEAP_AUTO
+// Must be provided by the port, and must not use the GC heap.  Called by
+// gc_alloc when an allocation fails even after a collection, to get memory
+// for a new region of at least *size bytes.  Returns NULL if the heap can't
+// grow, otherwise sets *size to the size of the memory returned.
+void *gc_port_get_region(size_t *size);
+#endif
+#endif
+
+#if MICROPY_GC_DEFER_FINALISER
+// Call the finalisers of at most max_n objects from the finaliser queue.
+void gc_run_finalisers(size_t max_n);
+#endif
+
+#if MICROPY_GC_PARALLEL_MARK
+// Must be provided by the port.  Returns the number of threads, including the
+// caller, that gc_port_run_markers can use to trace the heap.
+size_t gc_port_num_markers(void);
+// Must be provided by the port.  Calls gc_mark_worker(id) on n_markers
+// threads at once, with id 0 on the calling thread, and returns when they
+// have all returned.  The other threads must not touch the Python state.
+void gc_port_run_markers(size_t n_markers);
+void gc_mark_worker(size_t id);
+#endif
+
 // These lock/unlock functions can be nested.
 // They can be used to prevent the GC from allocating/freeing.
 void gc_lock(void);
@@ -45,7 +73,32 @@ void gc_collect_start(void);
 void gc_collect_root(void **ptrs, size_t len);
 void gc_collect_end(void);
 
-void *gc_alloc(size_t n_bytes, bool has_finaliser);
+#if MICROPY_GC_INCREMENTAL
+// Do at most budget blocks of marking or sweeping work, starting a new cycle
+// if none is in progress.  Returns true if the cycle was completed.
+bool gc_collect_step(size_t budget);
+// phases of an incremental collection cycle, in MP_STATE_MEM(gc_inc_phase)
+#define GC_PHASE_IDLE (0)
+#define GC_PHASE_MARK (1)
+#define GC_PHASE_SWEEP (2)
+// Must be called when an object reference is stored into existing heap memory.
+// It only has work to do while marking, which is checked inline.
+void gc_write_barrier(const void *ptr);
+#define GC_WRITE_BARRIER(ptr) \
+    do { \
+        if (MP_STATE_MEM(gc_inc_phase) == GC_PHASE_MARK) { \
+            gc_write_barrier(ptr); \
+        } \
+    } while (0)
+#else
+#define GC_WRITE_BARRIER(ptr) (void)0
+#endif
+
+// flags for gc_alloc
+#define GC_ALLOC_FLAG_HAS_FINALISER (1)
+#define GC_ALLOC_FLAG_OBJ (2) // the block is an object, for gc_census
+
+void *gc_alloc(size_t n_bytes, unsigned int alloc_flags);
 void gc_free(void *ptr); // does not call finaliser
 size_t gc_nbytes(const void *ptr);
 void *gc_realloc(void *ptr, size_t n_bytes, bool allow_move);
@@ -63,5 +116,22 @@ typedef struct _gc_info_t {
 void gc_info(gc_info_t *info);
 void gc_dump_info(void);
 void gc_dump_alloc_table(void);
+#if MICROPY_GC_PROFILE
+void gc_dump_profile(bool collapsed);
+#endif
+
+#if MICROPY_GC_CENSUS
+typedef struct _gc_census_entry_t {
+    const struct _mp_obj_type_t *type; // NULL for blocks that aren't objects
+    size_t count;
+    size_t n_bytes;
+} gc_census_entry_t;
+
+// Count the allocated blocks by the type of object at their start, in a
+// table of len (at least 2) entries.  table[0] counts the blocks that don't
+// hold an object, and the objects of any types that don't fit in the table,
+// in which case false is returned.  Unused entries have a count of 0.
+bool gc_census(gc_census_entry_t *table, size_t len);
+#endif
 
 #endif // __MICROPY_INCLUDED_PY_GC_H__
@@ -52,13 +52,37 @@ codepoint2name[ord('|')] = 'pipe'
 codepoint2name[ord('~')] = 'tilde'
 
 # this must match the equivalent function in qstr.c
-def compute_hash(qstr, bytes_hash):
+def compute_hash_full(qstr):
     hash = 5381
     for b in qstr:
-        hash = (hash * 33) ^ b
+        hash = ((hash * 33) ^ b) & 0xffffffff
+    return hash
+
+# this must match the equivalent function in qstr.c
+def compute_hash(qstr, bytes_hash):
+    hash = compute_hash_full(qstr)
     # Make sure that valid hash is never zero, zero means "hash not computed"
     return (hash & ((1 << (8 * bytes_hash)) - 1)) or 1
 
+# build the open-addressed lookup table for a ROM qstr pool, given the data
+# of each qstr in the pool (None for entries that are never looked up);
+# this must match the probing done by qstr_find_strn in qstr.c
+def make_hash_table(qbytes_list):
+    n = sum(1 for qbytes in qbytes_list if qbytes is not None)
+    alloc = 1
+    while alloc < 2 * n:
+        alloc *= 2
+    assert len(qbytes_list) < 0xffff
+    table = [0] * alloc
+    for i, qbytes in enumerate(qbytes_list):
+        if qbytes is None:
+            continue
+        slot = compute_hash_full(qbytes) & (alloc - 1)
+        while table[slot]:
+            slot = (slot + 1) & (alloc - 1)
+        table[slot] = i + 1
+    return table
+
 def qstr_escape(qst):
     def esc_char(m):
         c = ord(m.group(0))
@@ -145,11 +169,20 @@ def print_qstr_data(qcfgs, qstrs):
     # add NULL qstr with no hash or data
     print('QDEF(MP_QSTR_NULL, (const byte*)"%s%s" "")' % ('\\x00' * cfg_bytes_hash, '\\x00' * cfg_bytes_len))
 
-    # go through each qstr and print it out
-    for order, ident, qstr in sorted(qstrs.values(), key=lambda x: x[0]):
+    # go through each qstr and print it out, numbering them in order of their
+    # data so that ROM tables sorted by name are sorted by qstr value (see
+    # MP_DEFINE_CONST_DICT_SORTED)
+    qstrs_sorted = sorted(qstrs.values(), key=lambda x: bytes_cons(x[2], 'utf8'))
+    for order, ident, qstr in qstrs_sorted:
         qbytes = make_bytes(cfg_bytes_len, cfg_bytes_hash, qstr)
         print('QDEF(MP_QSTR_%s, %s)' % (ident, qbytes))
 
+    # print the lookup table, skipping the NULL qstr
+    print('')
+    table = make_hash_table([None] + [bytes_cons(qstr, 'utf8') for _, _, qstr in qstrs_sorted])
+    for idx in table:
+        print('QHASH(%u)' % idx)
+
 def do_work(infiles):
     qcfgs, qstrs = parse_input_headers(infiles)
     print_qstr_data(qcfgs, qstrs)
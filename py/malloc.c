@@ -53,8 +53,9 @@
 #undef malloc
 #undef free
 #undef realloc
-#define malloc(b) gc_alloc((b), false)
-#define malloc_with_finaliser(b) gc_alloc((b), true)
+#define malloc(b) gc_alloc((b), 0)
+#define malloc_obj(b) gc_alloc((b), GC_ALLOC_FLAG_OBJ)
+#define malloc_with_finaliser(b) gc_alloc((b), GC_ALLOC_FLAG_HAS_FINALISER | GC_ALLOC_FLAG_OBJ)
 #define free gc_free
 #define realloc(ptr, n) gc_realloc(ptr, n, true)
 #define realloc_ext(ptr, n, mv) gc_realloc(ptr, n, mv)
@@ -96,6 +97,27 @@ void *m_malloc_maybe(size_t num_bytes) {
     return ptr;
 }
 
+#if MICROPY_GC_CENSUS
+void *m_malloc_obj(size_t num_bytes) {
+    void *ptr = m_malloc_obj_maybe(num_bytes);
+    if (ptr == NULL && num_bytes != 0) {
+        return m_malloc_fail(num_bytes);
+    }
+    return ptr;
+}
+
+void *m_malloc_obj_maybe(size_t num_bytes) {
+    void *ptr = malloc_obj(num_bytes);
+#if MICROPY_MEM_STATS
+    MP_STATE_MEM(total_bytes_allocated) += num_bytes;
+    MP_STATE_MEM(current_bytes_allocated) += num_bytes;
+    UPDATE_PEAK();
+#endif
+    DEBUG_printf("malloc %d : %p\n", num_bytes, ptr);
+    return ptr;
+}
+#endif
+
 #if MICROPY_ENABLE_FINALISER
 void *m_malloc_with_finaliser(size_t num_bytes) {
     void *ptr = malloc_with_finaliser(num_bytes);
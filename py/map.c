@@ -31,8 +31,10 @@
 
 #include "py/mpconfig.h"
 #include "py/misc.h"
+#include "py/gc.h"
 #include "py/runtime0.h"
 #include "py/runtime.h"
+#include "py/objstr.h"
 
 // Fixed empty map. Useful when need to call kw-receiving functions
 // without any keywords from C, etc.
@@ -70,18 +72,123 @@ STATIC mp_uint_t get_hash_alloc_greater_or_equal_to(mp_uint_t x) {
 /******************************************************************************/
 /* map                                                                        */
 
+#if MICROPY_OPT_MAP_COMPACT
+
+// A map that is not fixed keeps its elements densely, in insertion order, in
+// table[0..fill).  Deleted elements have their key set to MP_OBJ_SENTINEL and
+// are dropped when the table is next rebuilt.  Following the alloc elements,
+// in the same heap block, is the hash index: a header and a power-of-2 array
+// of slots, each 0 for empty or 1 + the position of an element in table.  The
+// slots are 1, 2 or 4 bytes wide, depending on alloc.  Small tables have no
+// index and are searched linearly; they are kept without deleted elements, so
+// their fill is always used.  Removing the last element lowers fill past it
+// and any deleted elements before it, so the last element is at fill - 1.
+// Index slots pointing at or beyond the new fill stay in use, because other
+// probe sequences may pass through them, so the number of slots in use is
+// counted separately and decides when the table is rebuilt.
+
+#define MAP_LINEAR_MAX (8)
+
+typedef struct _mp_map_index_t {
+    mp_uint_t fill;
+    mp_uint_t nslots;
+    mp_uint_t mask;
+    byte slots[];
+} mp_map_index_t;
+
+#define MAP_INDEX(map) ((mp_map_index_t*)&(map)->table[(map)->alloc])
+
+STATIC size_t map_index_slot_size(size_t alloc) {
+    return alloc < 0xff ? 1 : alloc < 0xffff ? 2 : 4;
+}
+
+STATIC size_t map_table_nbytes(size_t alloc, size_t mask) {
+    return alloc * sizeof(mp_map_elem_t) + sizeof(mp_map_index_t) + (mask + 1) * map_index_slot_size(alloc);
+}
+
+STATIC size_t map_index_get(const mp_map_index_t *idx, size_t alloc, size_t i) {
+    if (alloc < 0xff) {
+        return idx->slots[i];
+    } else if (alloc < 0xffff) {
+        return ((const uint16_t*)idx->slots)[i];
+    } else {
+        return ((const uint32_t*)idx->slots)[i];
+    }
+}
+
+STATIC void map_index_set(mp_map_index_t *idx, size_t alloc, size_t i, size_t value) {
+    if (alloc < 0xff) {
+        idx->slots[i] = value;
+    } else if (alloc < 0xffff) {
+        ((uint16_t*)idx->slots)[i] = value;
+    } else {
+        ((uint32_t*)idx->slots)[i] = value;
+    }
+}
+
+// Set up an empty table for alloc elements, with an index at most 2/3 full.
+STATIC void map_alloc_table(mp_map_t *map, size_t alloc) {
+    map->alloc = alloc;
+    if (alloc <= MAP_LINEAR_MAX) {
+        map->table = m_new0(mp_map_elem_t, alloc);
+        return;
+    }
+    size_t mask = 3;
+    while (mask + 1 < alloc + alloc / 2) {
+        mask = mask * 2 + 1;
+    }
+    map->table = m_malloc0(map_table_nbytes(alloc, mask));
+    MAP_INDEX(map)->fill = 0;
+    MAP_INDEX(map)->nslots = 0;
+    MAP_INDEX(map)->mask = mask;
+}
+
+STATIC size_t map_table_nbytes_of(const mp_map_t *map) {
+    if (map->alloc <= MAP_LINEAR_MAX) {
+        return map->alloc * sizeof(mp_map_elem_t);
+    }
+    return map_table_nbytes(map->alloc, MAP_INDEX(map)->mask);
+}
+
+// Return the first empty index slot along the probe sequence for hash.
+STATIC size_t map_index_find_empty(mp_map_index_t *idx, size_t alloc, mp_uint_t hash) {
+    size_t mask = idx->mask;
+    size_t i = hash & mask;
+    for (mp_uint_t perturb = hash; map_index_get(idx, alloc, i) != 0;) {
+        perturb >>= 5;
+        i = (i * 5 + perturb + 1) & mask;
+    }
+    return i;
+}
+
+STATIC mp_uint_t map_hash(mp_obj_t key) {
+    if (MP_OBJ_IS_QSTR(key)) {
+        return qstr_hash(MP_OBJ_QSTR_VALUE(key));
+    } else {
+        return MP_OBJ_SMALL_INT_VALUE(mp_unary_op(MP_UNARY_OP_HASH, key));
+    }
+}
+
+#endif
+
 void mp_map_init(mp_map_t *map, mp_uint_t n) {
     if (n == 0) {
         map->alloc = 0;
         map->table = NULL;
     } else {
+        #if MICROPY_OPT_MAP_COMPACT
+        map_alloc_table(map, n);
+        #else
         map->alloc = n;
         map->table = m_new0(mp_map_elem_t, map->alloc);
+        #endif
     }
     map->used = 0;
     map->all_keys_are_qstrs = 1;
     map->is_fixed = 0;
     map->is_ordered = 0;
+    map->is_sorted = 0;
+    map->is_class_dict = 0;
 }
 
 void mp_map_init_fixed_table(mp_map_t *map, mp_uint_t n, const mp_obj_t *table) {
@@ -90,19 +197,59 @@ void mp_map_init_fixed_table(mp_map_t *map, mp_uint_t n, const mp_obj_t *table)
     map->all_keys_are_qstrs = 1;
     map->is_fixed = 1;
     map->is_ordered = 1;
+    map->is_sorted = 0;
+    map->is_class_dict = 0;
     map->table = (mp_map_elem_t*)table;
 }
 
+#if MICROPY_OPT_MAP_COMPACT
+// dest must be newly initialised with room for src->alloc elements
+void mp_map_copy(mp_map_t *dest, const mp_map_t *src) {
+    if (src->is_fixed) {
+        // a fixed table has no hash index, so insert the elements one by one
+        for (size_t i = 0; i < src->alloc; i++) {
+            if (MP_MAP_SLOT_IS_FILLED(src, i)) {
+                mp_map_lookup(dest, src->table[i].key, MP_MAP_LOOKUP_ADD_IF_NOT_FOUND)->value = src->table[i].value;
+            }
+        }
+    } else {
+        assert(dest->alloc == src->alloc);
+        memcpy(dest->table, src->table, map_table_nbytes_of(src));
+        dest->used = src->used;
+        dest->all_keys_are_qstrs = src->all_keys_are_qstrs;
+    }
+}
+
+// Return the element added to the map most recently, or NULL if it's empty.
+mp_map_elem_t *mp_map_last(mp_map_t *map) {
+    if (map->used == 0) {
+        return NULL;
+    }
+    size_t fill = map->used;
+    if (!map->is_fixed && map->alloc > MAP_LINEAR_MAX) {
+        fill = MAP_INDEX(map)->fill;
+    }
+    assert(MP_MAP_SLOT_IS_FILLED(map, fill - 1));
+    return &map->table[fill - 1];
+}
+#endif
+
 mp_map_t *mp_map_new(mp_uint_t n) {
     mp_map_t *map = m_new(mp_map_t, 1);
     mp_map_init(map, n);
     return map;
 }
 
+#if MICROPY_OPT_MAP_COMPACT
+#define MAP_DEL_TABLE(map) m_del(byte, (map)->table, map_table_nbytes_of(map))
+#else
+#define MAP_DEL_TABLE(map) m_del(mp_map_elem_t, (map)->table, (map)->alloc)
+#endif
+
 // Differentiate from mp_map_clear() - semantics is different
 void mp_map_deinit(mp_map_t *map) {
     if (!map->is_fixed) {
-        m_del(mp_map_elem_t, map->table, map->alloc);
+        MAP_DEL_TABLE(map);
     }
     map->used = map->alloc = 0;
 }
@@ -114,15 +261,54 @@ void mp_map_free(mp_map_t *map) {
 
 void mp_map_clear(mp_map_t *map) {
     if (!map->is_fixed) {
-        m_del(mp_map_elem_t, map->table, map->alloc);
+        MAP_DEL_TABLE(map);
     }
     map->alloc = 0;
     map->used = 0;
     map->all_keys_are_qstrs = 1;
     map->is_fixed = 0;
+    map->is_sorted = 0;
     map->table = NULL;
 }
 
+#if MICROPY_OPT_MAP_COMPACT
+
+// Rebuild the table without its deleted elements, growing it unless enough of
+// them were deleted to make room.
+STATIC void mp_map_rehash(mp_map_t *map) {
+    mp_map_t old = *map;
+    size_t old_fill = old.used;
+    size_t old_nslots = old.used;
+    if (old.alloc > MAP_LINEAR_MAX) {
+        old_fill = MAP_INDEX(&old)->fill;
+        old_nslots = MAP_INDEX(&old)->nslots;
+    }
+    size_t new_alloc = old.alloc;
+    if (old.alloc == 0 || 4 * (old_nslots - old.used) < old.alloc) {
+        new_alloc = get_hash_alloc_greater_or_equal_to(old.alloc + 1);
+    }
+    map_alloc_table(map, new_alloc);
+    GC_WRITE_BARRIER(map);
+    if (new_alloc <= MAP_LINEAR_MAX) {
+        memcpy(map->table, old.table, old.used * sizeof(mp_map_elem_t));
+    } else {
+        mp_map_index_t *idx = MAP_INDEX(map);
+        for (size_t i = 0; i < old_fill; i++) {
+            if (MP_MAP_SLOT_IS_FILLED(&old, i)) {
+                size_t slot = map_index_find_empty(idx, new_alloc, map_hash(old.table[i].key));
+                map->table[idx->fill] = old.table[i];
+                map_index_set(idx, new_alloc, slot, ++idx->fill);
+            }
+        }
+        idx->nslots = idx->fill;
+    }
+    if (old.alloc != 0) {
+        MAP_DEL_TABLE(&old);
+    }
+}
+
+#else
+
 STATIC void mp_map_rehash(mp_map_t *map) {
     mp_uint_t old_alloc = map->alloc;
     mp_uint_t new_alloc = get_hash_alloc_greater_or_equal_to(map->alloc + 1);
@@ -133,6 +319,7 @@ STATIC void mp_map_rehash(mp_map_t *map) {
     map->used = 0;
     map->all_keys_are_qstrs = 1;
     map->table = new_table;
+    GC_WRITE_BARRIER(map);
     for (mp_uint_t i = 0; i < old_alloc; i++) {
         if (old_table[i].key != MP_OBJ_NULL && old_table[i].key != MP_OBJ_SENTINEL) {
             mp_map_lookup(map, old_table[i].key, MP_MAP_LOOKUP_ADD_IF_NOT_FOUND)->value = old_table[i].value;
@@ -141,6 +328,8 @@ STATIC void mp_map_rehash(mp_map_t *map) {
     m_del(mp_map_elem_t, old_table, old_alloc);
 }
 
+#endif
+
 // MP_MAP_LOOKUP behaviour:
 //  - returns NULL if not found, else the slot it was found in with key,value non-null
 // MP_MAP_LOOKUP_ADD_IF_NOT_FOUND behaviour:
@@ -173,29 +362,83 @@ mp_map_elem_t *mp_map_lookup(mp_map_t *map, mp_obj_t index, mp_map_lookup_kind_t
         }
     }
 
+    // if the map is a sorted ROM table then binary search it on qstr value
+    if (map->is_sorted) {
+        qstr q;
+        if (compare_only_ptrs) {
+            q = MP_OBJ_QSTR_VALUE(index);
+        } else {
+            // the key can only match if the string is already interned
+            GET_STR_DATA_LEN(index, str, len);
+            q = qstr_find_strn((const char*)str, len);
+        }
+        for (mp_map_elem_t *lo = &map->table[0], *hi = &map->table[map->used]; lo < hi;) {
+            mp_map_elem_t *elem = lo + (hi - lo) / 2;
+            qstr key = MP_OBJ_QSTR_VALUE(elem->key);
+            if (key == q) {
+                return elem;
+            } else if (key < q) {
+                lo = elem + 1;
+            } else {
+                hi = elem;
+            }
+        }
+        return NULL;
+    }
+
+    if (lookup_kind == MP_MAP_LOOKUP_ADD_IF_NOT_FOUND) {
+        // the caller will store a value in the table
+        GC_WRITE_BARRIER(map->table);
+    }
+
+    #if MICROPY_OPT_MAP_COMPACT
+    // a fixed or small map has no hash index, so do a linear search
+    if (map->is_fixed || map->alloc <= MAP_LINEAR_MAX) {
+    #else
     // if the map is an ordered array then we must do a brute force linear search
     if (map->is_ordered) {
+    #endif
         for (mp_map_elem_t *elem = &map->table[0], *top = &map->table[map->used]; elem < top; elem++) {
             if (elem->key == index || (!compare_only_ptrs && mp_obj_equal(elem->key, index))) {
                 if (MP_UNLIKELY(lookup_kind == MP_MAP_LOOKUP_REMOVE_IF_FOUND)) {
+                    // close the gap, and leave the deleted element just past
+                    // the end so that caller can access its value if needed
+                    mp_obj_t value = elem->value;
+                    memmove(elem, elem + 1, (top - elem - 1) * sizeof(mp_map_elem_t));
+                    elem = &map->table[--map->used];
                     elem->key = MP_OBJ_SENTINEL;
-                    // keep elem->value so that caller can access it if needed
+                    elem->value = value;
                 }
                 return elem;
             }
         }
+        #if MICROPY_OPT_MAP_COMPACT
+        if (!map->is_fixed && !MP_OBJ_IS_QSTR(index)) {
+            // raise if the key is unhashable, as a hashed lookup would
+            map_hash(index);
+        }
+        #endif
         if (MP_LIKELY(lookup_kind != MP_MAP_LOOKUP_ADD_IF_NOT_FOUND)) {
             return NULL;
         }
-        // TODO shrink array down over any previously-freed slots
         if (map->used == map->alloc) {
-            // TODO: Alloc policy
-            map->alloc += 4;
-            map->table = m_renew(mp_map_elem_t, map->table, map->used, map->alloc);
-            mp_seq_clear(map->table, map->used, map->alloc, sizeof(*map->table));
+            #if MICROPY_OPT_MAP_COMPACT
+            mp_map_rehash(map);
+            if (map->alloc > MAP_LINEAR_MAX) {
+                // the map now has a hash index
+                return mp_map_lookup(map, index, lookup_kind);
+            }
+            #else
+            size_t new_alloc = get_hash_alloc_greater_or_equal_to(map->alloc + 1);
+            map->table = m_renew(mp_map_elem_t, map->table, map->alloc, new_alloc);
+            mp_seq_clear(map->table, map->alloc, new_alloc, sizeof(*map->table));
+            map->alloc = new_alloc;
+            GC_WRITE_BARRIER(map);
+            #endif
         }
         mp_map_elem_t *elem = map->table + map->used++;
         elem->key = index;
+        elem->value = MP_OBJ_NULL;
         if (!MP_OBJ_IS_QSTR(index)) {
             map->all_keys_are_qstrs = 0;
         }
@@ -212,6 +455,60 @@ mp_map_elem_t *mp_map_lookup(mp_map_t *map, mp_obj_t index, mp_map_lookup_kind_t
         }
     }
 
+    #if MICROPY_OPT_MAP_COMPACT
+
+    mp_uint_t hash = map_hash(index);
+
+    mp_map_index_t *idx = MAP_INDEX(map);
+    size_t mask = idx->mask;
+    size_t i = hash & mask;
+    for (mp_uint_t perturb = hash;;) {
+        size_t pos = map_index_get(idx, map->alloc, i);
+        if (pos == 0) {
+            break;
+        }
+        mp_map_elem_t *elem = &map->table[pos - 1];
+        if (elem->key == index || (!compare_only_ptrs && elem->key != MP_OBJ_SENTINEL && mp_obj_equal(elem->key, index))) {
+            // found index
+            // Note: CPython does not replace the index; try x={True:'true'};x[1]='one';x
+            if (lookup_kind == MP_MAP_LOOKUP_REMOVE_IF_FOUND) {
+                // delete the element, leaving its index slot to point at it
+                map->used--;
+                elem->key = MP_OBJ_SENTINEL;
+                // keep elem->value so that caller can access it if needed
+                while (idx->fill > 0 && map->table[idx->fill - 1].key == MP_OBJ_SENTINEL) {
+                    idx->fill--;
+                }
+            }
+            return elem;
+        }
+        perturb >>= 5;
+        i = (i * 5 + perturb + 1) & mask;
+    }
+
+    // index is not in table
+    if (lookup_kind != MP_MAP_LOOKUP_ADD_IF_NOT_FOUND) {
+        return NULL;
+    }
+    if (idx->nslots == map->alloc) {
+        // no room for another element
+        mp_map_rehash(map);
+        idx = MAP_INDEX(map);
+        i = map_index_find_empty(idx, map->alloc, hash);
+    }
+    mp_map_elem_t *elem = &map->table[idx->fill];
+    map_index_set(idx, map->alloc, i, ++idx->fill);
+    idx->nslots++;
+    map->used++;
+    elem->key = index;
+    elem->value = MP_OBJ_NULL;
+    if (!MP_OBJ_IS_QSTR(index)) {
+        map->all_keys_are_qstrs = 0;
+    }
+    return elem;
+
+    #else
+
     // get hash of index, with fast path for common case of qstr
     mp_uint_t hash;
     if (MP_OBJ_IS_QSTR(index)) {
@@ -289,6 +586,8 @@ mp_map_elem_t *mp_map_lookup(mp_map_t *map, mp_obj_t index, mp_map_lookup_kind_t
             }
         }
     }
+
+    #endif
 }
 
 /******************************************************************************/
@@ -308,6 +607,7 @@ STATIC void mp_set_rehash(mp_set_t *set) {
     set->alloc = get_hash_alloc_greater_or_equal_to(set->alloc + 1);
     set->used = 0;
     set->table = m_new0(mp_obj_t, set->alloc);
+    GC_WRITE_BARRIER(set);
     for (mp_uint_t i = 0; i < old_alloc; i++) {
         if (old_table[i] != MP_OBJ_NULL && old_table[i] != MP_OBJ_SENTINEL) {
             mp_set_lookup(set, old_table[i], MP_MAP_LOOKUP_ADD_IF_NOT_FOUND);
@@ -328,6 +628,9 @@ mp_obj_t mp_set_lookup(mp_set_t *set, mp_obj_t index, mp_map_lookup_kind_t looku
         }
     }
     mp_uint_t hash = MP_OBJ_SMALL_INT_VALUE(mp_unary_op(MP_UNARY_OP_HASH, index));
+    if (lookup_kind & MP_MAP_LOOKUP_ADD_IF_NOT_FOUND) {
+        GC_WRITE_BARRIER(set->table);
+    }
     mp_uint_t pos = hash % set->alloc;
     mp_uint_t start_pos = pos;
     mp_obj_t *avail_slot = NULL;
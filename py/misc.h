@@ -53,10 +53,18 @@ typedef unsigned int uint;
 #define m_new(type, num) ((type*)(m_malloc(sizeof(type) * (num))))
 #define m_new_maybe(type, num) ((type*)(m_malloc_maybe(sizeof(type) * (num))))
 #define m_new0(type, num) ((type*)(m_malloc0(sizeof(type) * (num))))
+#if MICROPY_GC_CENSUS
+// objects are tagged on the heap so gc.census can tell them from other data
+#define m_new_obj(type) ((type*)(m_malloc_obj(sizeof(type))))
+#define m_new_obj_maybe(type) ((type*)(m_malloc_obj_maybe(sizeof(type))))
+#define m_new_obj_var(obj_type, var_type, var_num) ((obj_type*)m_malloc_obj(sizeof(obj_type) + sizeof(var_type) * (var_num)))
+#define m_new_obj_var_maybe(obj_type, var_type, var_num) ((obj_type*)m_malloc_obj_maybe(sizeof(obj_type) + sizeof(var_type) * (var_num)))
+#else
 #define m_new_obj(type) (m_new(type, 1))
 #define m_new_obj_maybe(type) (m_new_maybe(type, 1))
 #define m_new_obj_var(obj_type, var_type, var_num) ((obj_type*)m_malloc(sizeof(obj_type) + sizeof(var_type) * (var_num)))
 #define m_new_obj_var_maybe(obj_type, var_type, var_num) ((obj_type*)m_malloc_maybe(sizeof(obj_type) + sizeof(var_type) * (var_num)))
+#endif
 #if MICROPY_ENABLE_FINALISER
 #define m_new_obj_with_finaliser(type) ((type*)(m_malloc_with_finaliser(sizeof(type))))
 #else
@@ -78,6 +86,10 @@ typedef unsigned int uint;
 void *m_malloc(size_t num_bytes);
 void *m_malloc_maybe(size_t num_bytes);
 void *m_malloc_with_finaliser(size_t num_bytes);
+#if MICROPY_GC_CENSUS
+void *m_malloc_obj(size_t num_bytes);
+void *m_malloc_obj_maybe(size_t num_bytes);
+#endif
 void *m_malloc0(size_t num_bytes);
 #if MICROPY_MALLOC_USES_ALLOCATED_SIZE
 void *m_realloc(void *ptr, size_t old_num_bytes, size_t new_num_bytes);
@@ -26,6 +26,7 @@
 
 #include "py/mpstate.h"
 #include "py/obj.h"
+#include "py/runtime.h"
 #include "py/gc.h"
 
 #if MICROPY_PY_GC && MICROPY_ENABLE_GC
@@ -44,6 +45,22 @@ STATIC mp_obj_t py_gc_collect(void) {
 }
 MP_DEFINE_CONST_FUN_OBJ_0(gc_collect_obj, py_gc_collect);
 
+#if MICROPY_GC_INCREMENTAL
+/// \function collect_step([budget])
+/// Do a slice of an incremental garbage collection, tracing or sweeping at
+/// most budget blocks.  Returns True if the collection cycle was completed.
+STATIC mp_obj_t py_gc_collect_step(size_t n_args, const mp_obj_t *args) {
+    size_t budget = MICROPY_GC_INCREMENTAL_BUDGET;
+    if (n_args > 0) {
+        mp_int_t val = mp_obj_get_int(args[0]);
+        // a non-positive budget means no limit, ie complete the cycle
+        budget = val > 0 ? (size_t)val : (size_t)-1;
+    }
+    return mp_obj_new_bool(gc_collect_step(budget));
+}
+MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(gc_collect_step_obj, 0, 1, py_gc_collect_step);
+#endif
+
 /// \function disable()
 /// Disable the garbage collector.
 STATIC mp_obj_t gc_disable(void) {
@@ -84,27 +101,195 @@ STATIC mp_obj_t gc_mem_alloc(void) {
 MP_DEFINE_CONST_FUN_OBJ_0(gc_mem_alloc_obj, gc_mem_alloc);
 
 #if MICROPY_GC_ALLOC_THRESHOLD
-STATIC mp_obj_t gc_threshold(size_t n_args, const mp_obj_t *args) {
-    if (n_args == 0) {
-        if (MP_STATE_MEM(gc_alloc_threshold) == (size_t)-1) {
-            return MP_OBJ_NEW_SMALL_INT(-1);
-        }
-        return mp_obj_new_int(MP_STATE_MEM(gc_alloc_threshold) * MICROPY_BYTES_PER_GC_BLOCK);
+STATIC mp_obj_t gc_threshold_get(void) {
+    if (MP_STATE_MEM(gc_alloc_threshold) == (size_t)-1) {
+        return MP_OBJ_NEW_SMALL_INT(-1);
     }
-    mp_int_t val = mp_obj_get_int(args[0]);
+    return mp_obj_new_int(MP_STATE_MEM(gc_alloc_threshold) * MICROPY_BYTES_PER_GC_BLOCK);
+}
+
+STATIC void gc_threshold_set(mp_obj_t amount) {
+    mp_int_t val = mp_obj_get_int(amount);
     if (val < 0) {
         MP_STATE_MEM(gc_alloc_threshold) = (size_t)-1;
     } else {
         MP_STATE_MEM(gc_alloc_threshold) = val / MICROPY_BYTES_PER_GC_BLOCK;
     }
+}
+
+#if MICROPY_GC_AUTO_THRESHOLD
+/// \function threshold([amount], *, auto, target_pause_us)
+/// Get or set the number of bytes allocated between collections.  With
+/// auto=True the threshold is adjusted after each collection, keeping pauses
+/// within target_pause_us microseconds if that is non-zero.  Setting a fixed
+/// amount turns auto off.
+STATIC mp_obj_t gc_threshold(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args) {
+    enum { ARG_amount, ARG_auto, ARG_target_pause_us };
+    static const mp_arg_t allowed_args[] = {
+        { MP_QSTR_amount, MP_ARG_OBJ, {.u_obj = MP_OBJ_NULL} },
+        { MP_QSTR_auto, MP_ARG_KW_ONLY | MP_ARG_OBJ, {.u_obj = MP_OBJ_NULL} },
+        { MP_QSTR_target_pause_us, MP_ARG_KW_ONLY | MP_ARG_OBJ, {.u_obj = MP_OBJ_NULL} },
+    };
+    mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+    mp_arg_parse_all(n_args, pos_args, kw_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+
+    if (n_args == 0 && kw_args->used == 0) {
+        return gc_threshold_get();
+    }
+    if (args[ARG_target_pause_us].u_obj != MP_OBJ_NULL) {
+        mp_int_t val = mp_obj_get_int(args[ARG_target_pause_us].u_obj);
+        MP_STATE_MEM(gc_auto_target_pause_us) = val > 0 ? val : 0;
+    }
+    if (args[ARG_amount].u_obj != MP_OBJ_NULL) {
+        gc_threshold_set(args[ARG_amount].u_obj);
+        MP_STATE_MEM(gc_auto_threshold) = false;
+    }
+    if (args[ARG_auto].u_obj != MP_OBJ_NULL) {
+        MP_STATE_MEM(gc_auto_threshold) = mp_obj_is_true(args[ARG_auto].u_obj);
+        if (MP_STATE_MEM(gc_auto_threshold) && MP_STATE_MEM(gc_alloc_threshold) == (size_t)-1) {
+            // start from an eighth of the heap until the first collection
+            gc_info_t info;
+            gc_info(&info);
+            MP_STATE_MEM(gc_alloc_threshold) = info.total / 8 / MICROPY_BYTES_PER_GC_BLOCK;
+        }
+    }
+    return mp_const_none;
+}
+MP_DEFINE_CONST_FUN_OBJ_KW(gc_threshold_obj, 0, gc_threshold);
+#else
+STATIC mp_obj_t gc_threshold(size_t n_args, const mp_obj_t *args) {
+    if (n_args == 0) {
+        return gc_threshold_get();
+    }
+    gc_threshold_set(args[0]);
     return mp_const_none;
 }
 MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(gc_threshold_obj, 0, 1, gc_threshold);
 #endif
+#endif
+
+#if MICROPY_GC_STATS
+/// \function stats()
+/// Return a tuple of cumulative statistics: (collections, total pause us,
+/// max pause us, blocks marked, blocks swept, finalisers run, bytes
+/// allocated, histogram of allocation sizes).
+STATIC mp_obj_t gc_stats(void) {
+    mp_gc_stats_t st = MP_STATE_MEM(gc_stats);
+    mp_obj_t hist[MICROPY_GC_STATS_HIST_BINS];
+    for (size_t i = 0; i < MICROPY_GC_STATS_HIST_BINS; i++) {
+        hist[i] = mp_obj_new_int_from_uint(st.alloc_hist[i]);
+    }
+    mp_obj_t items[8] = {
+        mp_obj_new_int_from_uint(st.n_collections),
+        mp_obj_new_int_from_uint(st.total_pause_us),
+        mp_obj_new_int_from_uint(st.max_pause_us),
+        mp_obj_new_int_from_uint(st.n_marked),
+        mp_obj_new_int_from_uint(st.n_swept),
+        mp_obj_new_int_from_uint(st.n_finalised),
+        mp_obj_new_int_from_uint(st.n_bytes_alloc),
+        mp_obj_new_tuple(MICROPY_GC_STATS_HIST_BINS, hist),
+    };
+    return mp_obj_new_tuple(8, items);
+}
+MP_DEFINE_CONST_FUN_OBJ_0(gc_stats_obj, gc_stats);
+#endif
+
+#if MICROPY_GC_CENSUS
+STATIC void gc_census_get(mp_map_t *census, mp_obj_t key, mp_int_t *count, mp_int_t *n_bytes) {
+    mp_map_elem_t *elem = mp_map_lookup(census, key, MP_MAP_LOOKUP);
+    if (elem == NULL) {
+        *count = 0;
+        *n_bytes = 0;
+    } else {
+        mp_obj_t *items;
+        mp_obj_get_array_fixed_n(elem->value, 2, &items);
+        *count = mp_obj_get_int(items[0]);
+        *n_bytes = mp_obj_get_int(items[1]);
+    }
+}
+
+STATIC void gc_census_store(mp_obj_t census, mp_obj_t key, mp_int_t count, mp_int_t n_bytes) {
+    mp_obj_t items[2] = {mp_obj_new_int(count), mp_obj_new_int(n_bytes)};
+    mp_obj_dict_store(census, key, mp_obj_new_tuple(2, items));
+}
+
+/// \function census()
+/// Count the objects on the heap, including any garbage that hasn't been
+/// collected yet.  Returns a dict mapping each type name to a tuple of the
+/// number of objects and the bytes they take up.  Blocks that don't hold an
+/// object, such as the items of a list, are counted under None.
+STATIC mp_obj_t py_gc_census(void) {
+    gc_census_entry_t table[MICROPY_GC_CENSUS_TYPES];
+    gc_census(table, MICROPY_GC_CENSUS_TYPES);
+    mp_obj_t census = mp_obj_new_dict(0);
+    for (size_t i = 0; i < MICROPY_GC_CENSUS_TYPES; i++) {
+        if (table[i].count == 0) {
+            continue;
+        }
+        mp_obj_t key = mp_const_none;
+        if (table[i].type != NULL) {
+            key = MP_OBJ_NEW_QSTR(table[i].type->name);
+        }
+        // different types can have the same name
+        mp_int_t count, n_bytes;
+        gc_census_get(mp_obj_dict_get_map(census), key, &count, &n_bytes);
+        gc_census_store(census, key, count + table[i].count, n_bytes + table[i].n_bytes);
+    }
+    return census;
+}
+MP_DEFINE_CONST_FUN_OBJ_0(gc_census_obj, py_gc_census);
+
+/// \function snapshot()
+/// Run a garbage collection and return a census of what is left.
+STATIC mp_obj_t gc_snapshot(void) {
+    gc_collect();
+    return py_gc_census();
+}
+MP_DEFINE_CONST_FUN_OBJ_0(gc_snapshot_obj, gc_snapshot);
+
+/// \function diff(old[, new])
+/// Compare two censuses, returning a dict of the changes in the number of
+/// objects and bytes for each type name whose numbers changed.  If new is not
+/// given then a snapshot is taken.
+STATIC mp_obj_t gc_diff(size_t n_args, const mp_obj_t *args) {
+    mp_obj_t new_census = n_args > 1 ? args[1] : gc_snapshot();
+    if (!MP_OBJ_IS_TYPE(args[0], &mp_type_dict) || !MP_OBJ_IS_TYPE(new_census, &mp_type_dict)) {
+        mp_raise_TypeError("census must be a dict");
+    }
+    mp_map_t *old_map = mp_obj_dict_get_map(args[0]);
+    mp_map_t *new_map = mp_obj_dict_get_map(new_census);
+    mp_obj_t diff = mp_obj_new_dict(0);
+    for (size_t i = 0; i < new_map->alloc; i++) {
+        if (MP_MAP_SLOT_IS_FILLED(new_map, i)) {
+            mp_obj_t key = new_map->table[i].key;
+            mp_int_t old_count, old_bytes, new_count, new_bytes;
+            gc_census_get(old_map, key, &old_count, &old_bytes);
+            gc_census_get(new_map, key, &new_count, &new_bytes);
+            if (new_count != old_count || new_bytes != old_bytes) {
+                gc_census_store(diff, key, new_count - old_count, new_bytes - old_bytes);
+            }
+        }
+    }
+    for (size_t i = 0; i < old_map->alloc; i++) {
+        if (MP_MAP_SLOT_IS_FILLED(old_map, i)
+            && mp_map_lookup(new_map, old_map->table[i].key, MP_MAP_LOOKUP) == NULL) {
+            // a type with no objects left
+            mp_int_t old_count, old_bytes;
+            gc_census_get(old_map, old_map->table[i].key, &old_count, &old_bytes);
+            gc_census_store(diff, old_map->table[i].key, -old_count, -old_bytes);
+        }
+    }
+    return diff;
+}
+MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(gc_diff_obj, 1, 2, gc_diff);
+#endif
 
 STATIC const mp_rom_map_elem_t mp_module_gc_globals_table[] = {
     { MP_ROM_QSTR(MP_QSTR___name__), MP_ROM_QSTR(MP_QSTR_gc) },
     { MP_ROM_QSTR(MP_QSTR_collect), MP_ROM_PTR(&gc_collect_obj) },
+    #if MICROPY_GC_INCREMENTAL
+    { MP_ROM_QSTR(MP_QSTR_collect_step), MP_ROM_PTR(&gc_collect_step_obj) },
+    #endif
     { MP_ROM_QSTR(MP_QSTR_disable), MP_ROM_PTR(&gc_disable_obj) },
     { MP_ROM_QSTR(MP_QSTR_enable), MP_ROM_PTR(&gc_enable_obj) },
     { MP_ROM_QSTR(MP_QSTR_isenabled), MP_ROM_PTR(&gc_isenabled_obj) },
@@ -113,6 +298,14 @@ STATIC const mp_rom_map_elem_t mp_module_gc_globals_table[] = {
     #if MICROPY_GC_ALLOC_THRESHOLD
     { MP_ROM_QSTR(MP_QSTR_threshold), MP_ROM_PTR(&gc_threshold_obj) },
     #endif
+    #if MICROPY_GC_STATS
+    { MP_ROM_QSTR(MP_QSTR_stats), MP_ROM_PTR(&gc_stats_obj) },
+    #endif
+    #if MICROPY_GC_CENSUS
+    { MP_ROM_QSTR(MP_QSTR_census), MP_ROM_PTR(&gc_census_obj) },
+    { MP_ROM_QSTR(MP_QSTR_snapshot), MP_ROM_PTR(&gc_snapshot_obj) },
+    { MP_ROM_QSTR(MP_QSTR_diff), MP_ROM_PTR(&gc_diff_obj) },
+    #endif
 };
 
 STATIC MP_DEFINE_CONST_DICT(mp_module_gc_globals, mp_module_gc_globals_table);
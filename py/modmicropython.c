@@ -27,9 +27,13 @@
 #include <stdio.h>
 
 #include "py/mpstate.h"
+#include "py/runtime.h"
 #include "py/builtin.h"
 #include "py/stackctrl.h"
 #include "py/gc.h"
+#include "py/stream.h"
+#include "py/profile.h"
+#include "py/bc.h"
 
 // Various builtins specific to MicroPython runtime,
 // living in micropython module
@@ -44,6 +48,22 @@ STATIC mp_obj_t mp_micropython_opt_level(size_t n_args, const mp_obj_t *args) {
 }
 STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(mp_micropython_opt_level_obj, 0, 1, mp_micropython_opt_level);
 
+#if MICROPY_EMIT_NATIVE_TIERING
+STATIC mp_obj_t mp_micropython_tier_threshold(size_t n_args, const mp_obj_t *args) {
+    if (n_args == 0) {
+        return mp_obj_new_int_from_uint(MP_STATE_VM(tier_threshold));
+    } else {
+        mp_int_t threshold = mp_obj_get_int(args[0]);
+        if (threshold < 0) {
+            mp_raise_ValueError("threshold must be >= 0");
+        }
+        MP_STATE_VM(tier_threshold) = threshold;
+        return mp_const_none;
+    }
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(mp_micropython_tier_threshold_obj, 0, 1, mp_micropython_tier_threshold);
+#endif
+
 #if MICROPY_PY_MICROPYTHON_MEM_INFO
 
 #if MICROPY_MEM_STATS
@@ -124,6 +144,59 @@ STATIC mp_obj_t mp_micropython_heap_unlock(void) {
 STATIC MP_DEFINE_CONST_FUN_OBJ_0(mp_micropython_heap_unlock_obj, mp_micropython_heap_unlock);
 #endif
 
+#if MICROPY_GC_PROFILE
+STATIC mp_obj_t mp_micropython_heap_profile(size_t n_args, const mp_obj_t *args) {
+    // a true arg means print the profile as collapsed stacks
+    gc_dump_profile(n_args == 1 && mp_obj_is_true(args[0]));
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(mp_micropython_heap_profile_obj, 0, 1, mp_micropython_heap_profile);
+#endif
+
+#if MICROPY_PY_MICROPYTHON_PROFILE
+STATIC mp_obj_t mp_micropython_profile_start(size_t n_args, const mp_obj_t *args) {
+    mp_int_t hz = n_args == 0 ? 1000 : mp_obj_get_int(args[0]);
+    if (hz <= 0) {
+        mp_raise_ValueError("hz must be positive");
+    }
+    mp_profile_start(hz);
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(mp_micropython_profile_start_obj, 0, 1, mp_micropython_profile_start);
+
+STATIC mp_obj_t mp_micropython_profile_stop(size_t n_args, const mp_obj_t *args) {
+    // the collapsed stacks are written to the given stream, or to stdout
+    if (n_args == 0 || args[0] == mp_const_none) {
+        mp_profile_stop(MP_PYTHON_PRINTER);
+    } else {
+        mp_print_t print = {MP_OBJ_TO_PTR(args[0]), mp_stream_write_adaptor};
+        mp_profile_stop(&print);
+    }
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(mp_micropython_profile_stop_obj, 0, 1, mp_micropython_profile_stop);
+#endif
+
+#if MICROPY_VM_OPCODE_STATS
+STATIC mp_obj_t mp_micropython_opcode_stats(size_t n_args, const mp_obj_t *args) {
+    // the statistics are written to the given stream, or to stdout
+    if (n_args == 0 || args[0] == mp_const_none) {
+        mp_vm_opcode_stats_print(MP_PYTHON_PRINTER);
+    } else {
+        mp_print_t print = {MP_OBJ_TO_PTR(args[0]), mp_stream_write_adaptor};
+        mp_vm_opcode_stats_print(&print);
+    }
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(mp_micropython_opcode_stats_obj, 0, 1, mp_micropython_opcode_stats);
+
+STATIC mp_obj_t mp_micropython_opcode_stats_reset(void) {
+    mp_vm_opcode_stats_reset();
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_0(mp_micropython_opcode_stats_reset_obj, mp_micropython_opcode_stats_reset);
+#endif
+
 #if MICROPY_ENABLE_EMERGENCY_EXCEPTION_BUF && (MICROPY_EMERGENCY_EXCEPTION_BUF_SIZE == 0)
 STATIC MP_DEFINE_CONST_FUN_OBJ_1(mp_alloc_emergency_exception_buf_obj, mp_alloc_emergency_exception_buf);
 #endif
@@ -132,6 +205,9 @@ STATIC const mp_rom_map_elem_t mp_module_micropython_globals_table[] = {
     { MP_ROM_QSTR(MP_QSTR___name__), MP_ROM_QSTR(MP_QSTR_micropython) },
     { MP_ROM_QSTR(MP_QSTR_const), MP_ROM_PTR(&mp_identity_obj) },
     { MP_ROM_QSTR(MP_QSTR_opt_level), MP_ROM_PTR(&mp_micropython_opt_level_obj) },
+#if MICROPY_EMIT_NATIVE_TIERING
+    { MP_ROM_QSTR(MP_QSTR_tier_threshold), MP_ROM_PTR(&mp_micropython_tier_threshold_obj) },
+#endif
 #if MICROPY_PY_MICROPYTHON_MEM_INFO
 #if MICROPY_MEM_STATS
     { MP_ROM_QSTR(MP_QSTR_mem_total), MP_ROM_PTR(&mp_micropython_mem_total_obj) },
@@ -151,6 +227,17 @@ STATIC const mp_rom_map_elem_t mp_module_micropython_globals_table[] = {
     { MP_ROM_QSTR(MP_QSTR_heap_lock), MP_ROM_PTR(&mp_micropython_heap_lock_obj) },
     { MP_ROM_QSTR(MP_QSTR_heap_unlock), MP_ROM_PTR(&mp_micropython_heap_unlock_obj) },
     #endif
+    #if MICROPY_GC_PROFILE
+    { MP_ROM_QSTR(MP_QSTR_heap_profile), MP_ROM_PTR(&mp_micropython_heap_profile_obj) },
+    #endif
+    #if MICROPY_PY_MICROPYTHON_PROFILE
+    { MP_ROM_QSTR(MP_QSTR_profile_start), MP_ROM_PTR(&mp_micropython_profile_start_obj) },
+    { MP_ROM_QSTR(MP_QSTR_profile_stop), MP_ROM_PTR(&mp_micropython_profile_stop_obj) },
+    #endif
+    #if MICROPY_VM_OPCODE_STATS
+    { MP_ROM_QSTR(MP_QSTR_opcode_stats), MP_ROM_PTR(&mp_micropython_opcode_stats_obj) },
+    { MP_ROM_QSTR(MP_QSTR_opcode_stats_reset), MP_ROM_PTR(&mp_micropython_opcode_stats_reset_obj) },
+    #endif
 };
 
 STATIC MP_DEFINE_CONST_DICT(mp_module_micropython_globals, mp_module_micropython_globals_table);
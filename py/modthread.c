@@ -178,8 +178,29 @@ STATIC void *thread_entry(void *args_in) {
     mp_stack_set_top(&ts + 1); // need to include ts in root-pointer scan
     mp_stack_set_limit(args->stack_size);
 
+    #if MICROPY_TRACK_CODE_STATE
+    ts.current_code_state = NULL;
+    #endif
+
+    #if MICROPY_STACKLESS
+    ts.frame_chunk = NULL;
+    ts.frame_top = NULL;
+    ts.frame_limit = NULL;
+    ts.frame_stack_size = 0;
+    #endif
+
+    #if MICROPY_OPT_INLINE_CACHE
+    memset(ts.inline_cache, 0, sizeof(ts.inline_cache));
+    #endif
+
     MP_THREAD_GIL_ENTER();
 
+    #if MICROPY_STACKLESS
+    // let the GC find this thread's frame stack
+    ts.next_thread = MP_STATE_VM(stackless_threads);
+    MP_STATE_VM(stackless_threads) = &ts;
+    #endif
+
     // signal that we are set up and running
     mp_thread_start();
 
@@ -211,6 +232,15 @@ STATIC void *thread_entry(void *args_in) {
 
     DEBUG_printf("[thread] finish ts=%p\n", &ts);
 
+    #if MICROPY_STACKLESS
+    for (mp_state_thread_t **t = &MP_STATE_VM(stackless_threads); *t != NULL; t = &(*t)->next_thread) {
+        if (*t == &ts) {
+            *t = ts.next_thread;
+            break;
+        }
+    }
+    #endif
+
     // signal that we are finished
     mp_thread_finish();
 
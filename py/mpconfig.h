@@ -123,6 +123,201 @@
 #define MICROPY_GC_ALLOC_THRESHOLD (1)
 #endif
 
+// Support incremental garbage collection, where the mark and sweep phases are
+// split into slices of bounded work (see gc_collect_step).  When enabled, the
+// allocation threshold starts an incremental cycle instead of a full one.
+// Code that stores object references into existing heap objects must call
+// gc_write_barrier on the object (the core containers already do this).
+#ifndef MICROPY_GC_INCREMENTAL
+#define MICROPY_GC_INCREMENTAL (0)
+#endif
+
+// Number of GC blocks traced or swept by each automatic incremental step
+#ifndef MICROPY_GC_INCREMENTAL_BUDGET
+#define MICROPY_GC_INCREMENTAL_BUDGET (256)
+#endif
+
+// Number of objects the write barrier can remember during an incremental mark;
+// if it overflows then the end of the mark phase re-traces the whole heap.
+#ifndef MICROPY_GC_INCREMENTAL_DIRTY_SIZE
+#define MICROPY_GC_INCREMENTAL_DIRTY_SIZE (32)
+#endif
+
+// Keep a summary of the free runs in each chunk of the heap so that gc_alloc
+// can skip over fragmented regions when looking for a multi-block run.  This
+// costs just over 6 bytes of heap per chunk and is worthwhile for large heaps.
+#ifndef MICROPY_GC_FREE_SUMMARY
+#define MICROPY_GC_FREE_SUMMARY (0)
+#endif
+
+// Number of ATB bytes (4 blocks each) covered by each free-run summary entry
+#ifndef MICROPY_GC_FREE_SUMMARY_CHUNK
+#define MICROPY_GC_FREE_SUMMARY_CHUNK (64)
+#endif
+
+// Keep lists of free 1-block and 2-block chunks of memory, filled by the
+// sweep, so that most small allocations don't need to search the heap.
+#ifndef MICROPY_GC_FREE_LISTS
+#define MICROPY_GC_FREE_LISTS (0)
+#endif
+
+// Maximum number of entries in each of the free lists
+#ifndef MICROPY_GC_FREE_LIST_MAX
+#define MICROPY_GC_FREE_LIST_MAX (256)
+#endif
+
+// Allow the heap to be made of several discontiguous regions, added to the
+// initial one with gc_add_region.
+#ifndef MICROPY_GC_SPLIT_HEAP
+#define MICROPY_GC_SPLIT_HEAP (0)
+#endif
+
+// When a collection fails to free enough memory, call the port-provided
+// gc_port_get_region to get memory for another region before giving up.
+#ifndef MICROPY_GC_SPLIT_HEAP_AUTO
+#define MICROPY_GC_SPLIT_HEAP_AUTO (0)
+#endif
+
+// Profile heap allocations by the Python function that made them; see
+// micropython.heap_profile().  Every MICROPY_GC_PROFILE_PERIOD bytes of
+// allocation a sample of the call stack is taken, up to
+// MICROPY_GC_PROFILE_DEPTH functions deep, and counted in a table of
+// MICROPY_GC_PROFILE_ENTRIES distinct stacks.
+#ifndef MICROPY_GC_PROFILE
+#define MICROPY_GC_PROFILE (0)
+#endif
+
+#ifndef MICROPY_GC_PROFILE_PERIOD
+#define MICROPY_GC_PROFILE_PERIOD (256)
+#endif
+
+#ifndef MICROPY_GC_PROFILE_DEPTH
+#define MICROPY_GC_PROFILE_DEPTH (4)
+#endif
+
+#ifndef MICROPY_GC_PROFILE_ENTRIES
+#define MICROPY_GC_PROFILE_ENTRIES (64)
+#endif
+
+// Statistical profiler of Python code; see micropython.profile_start().  The
+// port provides mp_hal_profile_timer(), a timer that calls mp_profile_tick(),
+// and at the next jump or return the VM records the call stack of the running
+// thread, up to MICROPY_PROFILE_DEPTH functions deep, in a table of
+// MICROPY_PROFILE_ENTRIES distinct stacks.
+#ifndef MICROPY_PY_MICROPYTHON_PROFILE
+#define MICROPY_PY_MICROPYTHON_PROFILE (0)
+#endif
+
+#ifndef MICROPY_PROFILE_DEPTH
+#define MICROPY_PROFILE_DEPTH (16)
+#endif
+
+#ifndef MICROPY_PROFILE_ENTRIES
+#define MICROPY_PROFILE_ENTRIES (256)
+#endif
+
+// Whether each thread tracks the bytecode functions it is executing, for the profilers
+#define MICROPY_TRACK_CODE_STATE (MICROPY_GC_PROFILE || MICROPY_PY_MICROPYTHON_PROFILE)
+
+// Keep cumulative statistics about collections and allocations, returned by
+// gc.stats().  Pause times are measured with mp_hal_ticks_us.  Allocation
+// sizes are counted in MICROPY_GC_STATS_HIST_BINS bins of power-of-2 blocks.
+#ifndef MICROPY_GC_STATS
+#define MICROPY_GC_STATS (0)
+#endif
+
+#ifndef MICROPY_GC_STATS_HIST_BINS
+#define MICROPY_GC_STATS_HIST_BINS (8)
+#endif
+
+// Trace the heap with several threads during a full collection.  The roots
+// are marked by the collecting thread, then the port's gc_port_run_markers
+// runs the tracing on up to MICROPY_GC_PARALLEL_MARK_THREADS threads.  Each
+// keeps its mark stack on its own C stack, and shares work by giving up to
+// MICROPY_GC_PARALLEL_MARK_PACKETS packets of it to the others.
+// Heaps with fewer than MICROPY_GC_PARALLEL_MARK_MIN_BLOCKS blocks are traced
+// by the collecting thread alone.  Requires MICROPY_PY_THREAD.
+#ifndef MICROPY_GC_PARALLEL_MARK
+#define MICROPY_GC_PARALLEL_MARK (0)
+#endif
+
+#ifndef MICROPY_GC_PARALLEL_MARK_THREADS
+#define MICROPY_GC_PARALLEL_MARK_THREADS (4)
+#endif
+
+// size of each thread's mark stack, a packet holds half as many entries
+#ifndef MICROPY_GC_PARALLEL_MARK_STACK_SIZE
+#define MICROPY_GC_PARALLEL_MARK_STACK_SIZE (128)
+#endif
+
+#ifndef MICROPY_GC_PARALLEL_MARK_PACKETS
+#define MICROPY_GC_PARALLEL_MARK_PACKETS (4)
+#endif
+
+#ifndef MICROPY_GC_PARALLEL_MARK_MIN_BLOCKS
+#define MICROPY_GC_PARALLEL_MARK_MIN_BLOCKS (16384)
+#endif
+
+// called by a marker that is waiting for work from the others
+#ifndef MICROPY_GC_PARALLEL_MARK_IDLE
+#define MICROPY_GC_PARALLEL_MARK_IDLE()
+#endif
+
+// Adjust the allocation threshold after each collection, when enabled by
+// gc.threshold(auto=True).  Collections are spaced out to take about
+// MICROPY_GC_AUTO_THRESHOLD_SHARE percent of the run time, or more often if
+// that's needed to keep pauses within gc.threshold(target_pause_us=...).
+// The threshold is at least MICROPY_GC_AUTO_THRESHOLD_MIN blocks.  Requires
+// MICROPY_GC_ALLOC_THRESHOLD.
+#ifndef MICROPY_GC_AUTO_THRESHOLD
+#define MICROPY_GC_AUTO_THRESHOLD (0)
+#endif
+
+#ifndef MICROPY_GC_AUTO_THRESHOLD_SHARE
+#define MICROPY_GC_AUTO_THRESHOLD_SHARE (10)
+#endif
+
+#ifndef MICROPY_GC_AUTO_THRESHOLD_MIN
+#define MICROPY_GC_AUTO_THRESHOLD_MIN (64)
+#endif
+
+// Don't call finalisers during the sweep.  Instead, unreachable objects with
+// a finaliser are kept alive in a queue of MICROPY_GC_FINALISER_QUEUE_SIZE
+// entries, and the VM calls their finalisers, at most
+// MICROPY_GC_FINALISER_BATCH at a time, when it checks for pending
+// exceptions.  Objects that don't fit in the queue wait for a later
+// collection.  Instances of classes that define __del__ get a finaliser too.
+#ifndef MICROPY_GC_DEFER_FINALISER
+#define MICROPY_GC_DEFER_FINALISER (0)
+#endif
+
+#ifndef MICROPY_GC_FINALISER_QUEUE_SIZE
+#define MICROPY_GC_FINALISER_QUEUE_SIZE (32)
+#endif
+
+#ifndef MICROPY_GC_FINALISER_BATCH
+#define MICROPY_GC_FINALISER_BATCH (4)
+#endif
+
+// Provide gc.census(), which counts the objects on the heap by type.  Blocks
+// allocated with m_new_obj and friends are tagged as objects, costing one bit
+// per block of heap.  At most
+// MICROPY_GC_CENSUS_TYPES types are counted in one census.  Types that aren't
+// on the heap are only recognised if the port defines
+// MICROPY_GC_CENSUS_STATIC_PTR(ptr) to say whether ptr can be read, and is
+// somewhere the port's const objects might be.
+#ifndef MICROPY_GC_CENSUS
+#define MICROPY_GC_CENSUS (0)
+#endif
+
+#ifndef MICROPY_GC_CENSUS_TYPES
+#define MICROPY_GC_CENSUS_TYPES (64)
+#endif
+
+#ifndef MICROPY_GC_CENSUS_STATIC_PTR
+#define MICROPY_GC_CENSUS_STATIC_PTR(ptr) (0)
+#endif
+
 // Number of bytes to allocate initially when creating new chunks to store
 // interned string data.  Smaller numbers lead to more chunks being needed
 // and more wastage at the end of the chunk.  Larger numbers lead to wasted
@@ -224,6 +419,19 @@
 #define MICROPY_STACKLESS_STRICT (0)
 #endif
 
+// In stackless mode the state of each called function is pushed on a per-thread
+// frame stack, made of heap chunks of at least this many bytes.
+#ifndef MICROPY_STACKLESS_CHUNK_SIZE
+#define MICROPY_STACKLESS_CHUNK_SIZE (2048)
+#endif
+
+// Maximum number of bytes in the frame stack, which limits the recursion depth
+// of stackless calls.  Beyond it, calls use the C stack again (or raise
+// RuntimeError with MICROPY_STACKLESS_STRICT).
+#ifndef MICROPY_STACKLESS_MAX_SIZE
+#define MICROPY_STACKLESS_MAX_SIZE (256 * 1024)
+#endif
+
 // Don't use alloca calls. As alloca() is not part of ANSI C, this
 // workaround option is provided for compilers lacking this de-facto
 // standard function. The way it works is allocating from heap, and
@@ -291,6 +499,13 @@
 // Convenience definition for whether any native emitter is enabled
 #define MICROPY_EMIT_NATIVE (MICROPY_EMIT_X64 || MICROPY_EMIT_X86 || MICROPY_EMIT_THUMB || MICROPY_EMIT_ARM)
 
+// Whether bytecode functions that become hot (by calls and loop iterations)
+// are recompiled at runtime with the native emitter; requires the compiler,
+// and is switched on by setting a non-zero MP_STATE_VM(tier_threshold)
+#ifndef MICROPY_EMIT_NATIVE_TIERING
+#define MICROPY_EMIT_NATIVE_TIERING (0)
+#endif
+
 /*****************************************************************************/
 /* Compiler configuration                                                    */
 
@@ -328,6 +543,11 @@
 #define MICROPY_COMP_CONST (1)
 #endif
 
+// Whether to load a tuple of literals as a single constant object; eg (1, 'a')
+#ifndef MICROPY_COMP_CONST_TUPLE
+#define MICROPY_COMP_CONST_TUPLE (0)
+#endif
+
 // Whether to enable optimisation of: a, b = c, d
 // Costs 124 bytes (Thumb2)
 #ifndef MICROPY_COMP_DOUBLE_TUPLE_ASSIGN
@@ -356,6 +576,15 @@
 #define MICROPY_DEBUG_PRINTERS (0)
 #endif
 
+// Whether the VM counts how many times each opcode, and each pair of
+// consecutive opcodes, is executed, for micropython.opcode_stats().  If set
+// to 2 then the time spent in each opcode is also measured with
+// mp_hal_ticks_cpu().  This slows down the VM and the pair table takes
+// 256KiB of RAM.
+#ifndef MICROPY_VM_OPCODE_STATS
+#define MICROPY_VM_OPCODE_STATS (0)
+#endif
+
 /*****************************************************************************/
 /* Optimisations                                                             */
 
@@ -372,6 +601,69 @@
 #define MICROPY_OPT_CACHE_MAP_LOOKUP_IN_BYTECODE (0)
 #endif
 
+// Whether to cache how LOAD_ATTR, LOAD_METHOD and STORE_ATTR find attributes
+// of Python classes and their instances, keyed on the type of the object.
+// Each bytecode site hashes to one of MICROPY_OPT_INLINE_CACHE_SIZE sets of
+// MICROPY_OPT_INLINE_CACHE_WAYS entries, held per thread.  Entries for class
+// attributes are checked against the version of the class, see objtype.c.
+#ifndef MICROPY_OPT_INLINE_CACHE
+#define MICROPY_OPT_INLINE_CACHE (0)
+#endif
+
+#ifndef MICROPY_OPT_INLINE_CACHE_SIZE
+#define MICROPY_OPT_INLINE_CACHE_SIZE (32)
+#endif
+
+#ifndef MICROPY_OPT_INLINE_CACHE_WAYS
+#define MICROPY_OPT_INLINE_CACHE_WAYS (2)
+#endif
+
+// Whether to cache what an attribute resolves to in the dicts of a Python
+// class and its bases, in a direct-mapped table keyed on (class, attr).  This
+// saves the walk of the bases for special methods and for lookups that the
+// inline caches miss.  Classes carry a version which changes with their dict.
+// MICROPY_OPT_METHOD_CACHE_SIZE must be a power of 2.
+#ifndef MICROPY_OPT_METHOD_CACHE
+#define MICROPY_OPT_METHOD_CACHE (0)
+#endif
+
+#ifndef MICROPY_OPT_METHOD_CACHE_SIZE
+#define MICROPY_OPT_METHOD_CACHE_SIZE (128)
+#endif
+
+// Whether the bytecode emitter fuses common sequences of opcodes into
+// superinstructions, which the VM runs with a single dispatch.  Each one is
+// a prefix byte in front of the sequence, so costs 1 byte of bytecode.
+#ifndef MICROPY_OPT_SUPERINSTRUCTIONS
+#define MICROPY_OPT_SUPERINSTRUCTIONS (0)
+#endif
+
+// Whether the VM can run superinstructions; it must if it loads bytecode
+// that may have been compiled elsewhere.
+#define MICROPY_VM_SUPERINSTRUCTIONS (MICROPY_OPT_SUPERINSTRUCTIONS || MICROPY_PERSISTENT_CODE_LOAD || MICROPY_MODULE_FROZEN_MPY)
+
+// Whether dicts keep their elements densely in insertion order, with a
+// separate hash index of 1, 2 or 4 byte slots, rather than in a sparse hash
+// table.  This makes all dicts (including OrderedDict) ordered with O(1)
+// lookup, and iteration and copying faster.  Without it an OrderedDict is
+// searched linearly.  Large dicts pay for the index on top of the elements.
+#ifndef MICROPY_OPT_MAP_COMPACT
+#define MICROPY_OPT_MAP_COMPACT (0)
+#endif
+
+// Whether to look up interned strings through open-addressed hash tables
+// instead of scanning every qstr pool.  The ROM pools carry precomputed
+// tables, and the heap pools share one table that grows along with them.
+#ifndef MICROPY_OPT_QSTR_HASH_TABLE
+#define MICROPY_OPT_QSTR_HASH_TABLE (0)
+#endif
+
+// Whether str and bytes search for substrings with a skip table (Horspool)
+// instead of comparing at every offset.  Uses 256 bytes of C stack per search.
+#ifndef MICROPY_OPT_FAST_SUBSTR_SEARCH
+#define MICROPY_OPT_FAST_SUBSTR_SEARCH (0)
+#endif
+
 // Whether to use fast versions of bitwise operations (and, or, xor) when the
 // arguments are both positive.  Increases Thumb2 code size by about 250 bytes.
 #ifndef MICROPY_OPT_MPZ_BITWISE
@@ -70,6 +70,11 @@ mp_uint_t mp_hal_ticks_us(void);
 mp_uint_t mp_hal_ticks_cpu(void);
 #endif
 
+#if MICROPY_PY_MICROPYTHON_PROFILE
+// Call mp_profile_tick() hz times a second, or stop doing so if hz is 0.
+void mp_hal_profile_timer(mp_uint_t hz);
+#endif
+
 // If port HAL didn't define its own pin API, use generic
 // "virtual pin" API from the core.
 #ifndef mp_hal_pin_obj_t
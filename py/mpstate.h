@@ -46,16 +46,15 @@ typedef struct mp_dynamic_compiler_t {
     uint8_t small_int_bits; // must be <= host small_int_bits
     bool opt_cache_map_lookup_in_bytecode;
     bool py_builtins_str_unicode;
+    uint8_t native_arch; // MP_NATIVE_ARCH_xxx, the target of native code
 } mp_dynamic_compiler_t;
 extern mp_dynamic_compiler_t mp_dynamic_compiler;
 #endif
 
-// This structure hold information about the memory allocation system.
-typedef struct _mp_state_mem_t {
-    #if MICROPY_MEM_STATS
-    size_t total_bytes_allocated;
-    size_t current_bytes_allocated;
-    size_t peak_bytes_allocated;
+// This structure holds the tables and pool of one region of the GC heap.
+typedef struct _mp_state_mem_area_t {
+    #if MICROPY_GC_SPLIT_HEAP
+    struct _mp_state_mem_area_t *next;
     #endif
 
     byte *gc_alloc_table_start;
@@ -63,11 +62,74 @@ typedef struct _mp_state_mem_t {
     #if MICROPY_ENABLE_FINALISER
     byte *gc_finaliser_table_start;
     #endif
+    #if MICROPY_GC_FREE_SUMMARY
+    // leading, longest and trailing free run lengths of heap chunks and groups
+    uint16_t *gc_free_summary_start;
+    #endif
+    #if MICROPY_GC_INCREMENTAL
+    // one bit per block, set for blocks allocated during the mark phase
+    byte *gc_new_table_start;
+    #endif
+    #if MICROPY_GC_CENSUS
+    // one bit per block, set for blocks allocated as objects
+    byte *gc_obj_table_start;
+    #endif
     byte *gc_pool_start;
     byte *gc_pool_end;
 
+    size_t gc_last_free_atb_index;
+} mp_state_mem_area_t;
+
+#if MICROPY_GC_PROFILE
+// A Python call stack, innermost function first, and the bytes it allocated.
+typedef struct _mp_gc_profile_entry_t {
+    size_t n_bytes;
+    size_t n_samples;
+    size_t depth;
+    struct {
+        qstr block_name;
+        size_t source_line;
+    } frame[MICROPY_GC_PROFILE_DEPTH];
+} mp_gc_profile_entry_t;
+#endif
+
+#if MICROPY_GC_STATS
+// Cumulative statistics about the garbage collector, see gc.stats().
+typedef struct _mp_gc_stats_t {
+    size_t n_collections;
+    mp_uint_t total_pause_us;
+    mp_uint_t max_pause_us;
+    size_t n_marked;
+    size_t n_swept;
+    size_t n_finalised;
+    size_t n_bytes_alloc;
+    // bin i counts allocations of up to 2**i blocks, the last bin the rest
+    size_t alloc_hist[MICROPY_GC_STATS_HIST_BINS];
+} mp_gc_stats_t;
+#endif
+
+// This structure hold information about the memory allocation system.
+typedef struct _mp_state_mem_t {
+    #if MICROPY_MEM_STATS
+    size_t total_bytes_allocated;
+    size_t current_bytes_allocated;
+    size_t peak_bytes_allocated;
+    #endif
+
+    // the first region of the heap, others are linked from it
+    mp_state_mem_area_t area;
+    #if MICROPY_GC_SPLIT_HEAP
+    // lowest and highest addresses of all the pools
+    byte *gc_lowest_ptr;
+    byte *gc_highest_ptr;
+    #endif
+
     int gc_stack_overflow;
     size_t gc_stack[MICROPY_ALLOC_GC_STACK_SIZE];
+    #if MICROPY_GC_SPLIT_HEAP
+    // the region of each block in gc_stack
+    mp_state_mem_area_t *gc_area_stack[MICROPY_ALLOC_GC_STACK_SIZE];
+    #endif
     size_t *gc_sp;
     uint16_t gc_lock_depth;
 
@@ -81,18 +143,103 @@ typedef struct _mp_state_mem_t {
     size_t gc_alloc_threshold;
     #endif
 
-    size_t gc_last_free_atb_index;
+    #if MICROPY_GC_FREE_LISTS
+    // lists of free 1-block and 2-block chunks, linked through their first
+    // word and kept in address order
+    void *gc_free_list[2];
+    void *gc_free_list_tail[2];
+    size_t gc_free_list_len[2];
+    #endif
+
+    #if MICROPY_GC_INCREMENTAL
+    uint8_t gc_inc_phase;
+    uint8_t gc_inc_roots;
+    bool gc_inc_overflow_scan;
+    // region and next block to scan for overflow recovery, or to sweep
+    mp_state_mem_area_t *gc_inc_area;
+    size_t gc_inc_cursor;
+    // marked objects that were modified during the mark phase
+    void *gc_inc_dirty[MICROPY_GC_INCREMENTAL_DIRTY_SIZE];
+    size_t gc_inc_dirty_len;
+    #endif
 
     #if MICROPY_PY_GC_COLLECT_RETVAL
     size_t gc_collected;
     #endif
 
+    #if MICROPY_GC_PROFILE
+    // bytes left to allocate before the next sample is taken
+    size_t gc_profile_countdown;
+    // sampled bytes that didn't fit in the table
+    size_t gc_profile_lost;
+    mp_gc_profile_entry_t gc_profile_table[MICROPY_GC_PROFILE_ENTRIES];
+    #endif
+
+    #if MICROPY_GC_STATS
+    mp_gc_stats_t gc_stats;
+    #endif
+
+    #if MICROPY_GC_STATS || MICROPY_GC_AUTO_THRESHOLD
+    // blocks found live and freed by the sweep of the current collection
+    size_t gc_cycle_marked;
+    size_t gc_cycle_swept;
+    // total pause of the current collection so far
+    mp_uint_t gc_cycle_pause;
+    // when the current full collection started
+    mp_uint_t gc_pause_start;
+    #endif
+
+    #if MICROPY_GC_AUTO_THRESHOLD
+    bool gc_auto_threshold;
+    mp_uint_t gc_auto_target_pause_us;
+    // blocks allocated, and when, since the last collection ended
+    size_t gc_auto_alloc;
+    mp_uint_t gc_auto_last_end;
+    #endif
+
+    #if MICROPY_GC_PARALLEL_MARK
+    // number of threads tracing the current collection, 0 if not in parallel
+    size_t gc_par_n_markers;
+    // whether the markers must first rescan the heap after a stack overflow
+    bool gc_par_rescan;
+    // markers that are waiting for work
+    size_t gc_par_n_idle;
+    // packets of work given up by markers for others to take; the markers
+    // keep their stacks and packets on their own C stacks
+    struct _gc_par_packet_t *gc_par_pool[MICROPY_GC_PARALLEL_MARK_THREADS * MICROPY_GC_PARALLEL_MARK_PACKETS];
+    size_t gc_par_pool_len;
+    mp_thread_mutex_t gc_par_mutex;
+    #endif
+
     #if MICROPY_PY_THREAD
     // This is a global mutex used to make the GC thread-safe.
     mp_thread_mutex_t gc_mutex;
     #endif
 } mp_state_mem_t;
 
+#if MICROPY_PY_MICROPYTHON_PROFILE
+// A Python call stack, innermost function first, and the times it was seen.
+typedef struct _mp_profile_entry_t {
+    size_t n_samples;
+    size_t depth;
+    struct {
+        qstr block_name;
+        size_t source_line;
+    } frame[MICROPY_PROFILE_DEPTH];
+} mp_profile_entry_t;
+#endif
+
+#if MICROPY_OPT_METHOD_CACHE
+// What attr resolves to in the dicts of a Python class and its bases, see objtype.c
+typedef struct _mp_method_cache_entry_t {
+    const struct _mp_obj_type_t *type;
+    qstr attr;
+    mp_uint_t version;
+    const struct _mp_obj_type_t *owner; // the class that has it
+    mp_obj_t value; // MP_OBJ_NULL if not found, MP_OBJ_SENTINEL if a native base was reached
+} mp_method_cache_entry_t;
+#endif
+
 // This structure hold runtime and VM information.  It includes a section
 // which contains root pointers that must be scanned by the GC.
 typedef struct _mp_state_vm_t {
@@ -104,6 +251,11 @@ typedef struct _mp_state_vm_t {
 
     qstr_pool_t *last_pool;
 
+    #if MICROPY_OPT_QSTR_HASH_TABLE
+    // index of the qstrs in the heap pools, see qstr.c
+    qstr *qstr_hash_table;
+    #endif
+
     // non-heap memory for creating an exception if we can't allocate RAM
     mp_obj_exception_t mp_emergency_exception_obj;
 
@@ -160,6 +312,16 @@ typedef struct _mp_state_vm_t {
     struct _fs_user_mount_t *fs_user_mount[MICROPY_FATFS_VOLUMES];
     #endif
 
+    #if MICROPY_GC_DEFER_FINALISER
+    // unreachable objects waiting for their finaliser to be called
+    void *gc_finaliser_queue[MICROPY_GC_FINALISER_QUEUE_SIZE];
+    #endif
+
+    #if MICROPY_PY_MICROPYTHON_PROFILE
+    // table of sampled stacks, allocated while the profiler is running
+    mp_profile_entry_t *profile_table;
+    #endif
+
     //
     // END ROOT POINTER SECTION
     ////////////////////////////////////////////////////////////
@@ -169,6 +331,47 @@ typedef struct _mp_state_vm_t {
     byte *qstr_last_chunk;
     size_t qstr_last_alloc;
     size_t qstr_last_used;
+    #if MICROPY_OPT_QSTR_HASH_TABLE
+    size_t qstr_hash_alloc;
+    #endif
+
+    #if MICROPY_OPT_INLINE_CACHE || MICROPY_OPT_METHOD_CACHE
+    // for the versions of classes, see objtype.c
+    mp_uint_t class_version_next;
+    mp_uint_t class_epoch;
+    #endif
+
+    #if MICROPY_OPT_METHOD_CACHE
+    mp_method_cache_entry_t method_cache[MICROPY_OPT_METHOD_CACHE_SIZE];
+    #endif
+
+    #if MICROPY_GC_DEFER_FINALISER
+    size_t gc_finaliser_queue_len;
+    // set while finalisers are being called, so they aren't nested
+    bool gc_finalising;
+    #endif
+
+    #if MICROPY_PY_MICROPYTHON_PROFILE
+    // timer ticks not yet sampled, incremented asynchronously by the port
+    volatile mp_uint_t profile_ticks;
+    // ticks whose stack didn't fit in the table
+    size_t profile_lost;
+    #if MICROPY_PY_THREAD
+    mp_thread_mutex_t profile_mutex;
+    #endif
+    #endif
+
+    #if MICROPY_VM_OPCODE_STATS
+    // executions of each opcode, and of each opcode following another
+    mp_uint_t opcode_count[256];
+    uint32_t opcode_pair_count[256][256];
+    byte opcode_last;
+    #if MICROPY_VM_OPCODE_STATS >= 2
+    // ticks spent in each opcode, and the time the last one started
+    mp_uint_t opcode_ticks[256];
+    mp_uint_t opcode_ticks_last;
+    #endif
+    #endif
 
     #if MICROPY_PY_THREAD
     // This is a global mutex used to make qstr interning thread-safe.
@@ -177,6 +380,11 @@ typedef struct _mp_state_vm_t {
 
     mp_uint_t mp_optimise_value;
 
+    #if MICROPY_EMIT_NATIVE_TIERING
+    // calls plus loop iterations after which a function is made native, 0 = never
+    mp_uint_t tier_threshold;
+    #endif
+
     // size of the emergency exception buf, if it's dynamically allocated
     #if MICROPY_ENABLE_EMERGENCY_EXCEPTION_BUF && MICROPY_EMERGENCY_EXCEPTION_BUF_SIZE == 0
     mp_int_t mp_emergency_exception_buf_size;
@@ -186,14 +394,39 @@ typedef struct _mp_state_vm_t {
     // This is a global mutex used to make the VM/runtime thread-safe.
     mp_thread_mutex_t gil_mutex;
     #endif
+
+    #if MICROPY_STACKLESS && MICROPY_PY_THREAD
+    // the running threads, linked by next_thread, so the GC can find their
+    // frame stacks; changed only with the GIL held
+    struct _mp_state_thread_t *stackless_threads;
+    #endif
 } mp_state_vm_t;
 
+#if MICROPY_OPT_INLINE_CACHE
+// How to find attr on objects whose type is type, see objtype.c
+typedef struct _mp_inline_cache_entry_t {
+    const struct _mp_obj_type_t *type;
+    qstr attr;
+    mp_uint_t kind;
+    mp_uint_t version;
+    union {
+        mp_obj_t value; // the class attribute
+        size_t slot; // index into the instance members
+    } u;
+} mp_inline_cache_entry_t;
+#endif
+
 // This structure holds state that is specific to a given thread.
 // Everything in this structure is scanned for root pointers.
 typedef struct _mp_state_thread_t {
     // Note: nlr asm code has the offset of this hard-coded
     nlr_buf_t *nlr_top; // ROOT POINTER
 
+    #if MICROPY_STACKLESS
+    // chunk of the frame stack holding the innermost stackless call
+    struct _mp_frame_chunk_t *frame_chunk; // ROOT POINTER
+    #endif
+
     // Stack top at the start of program
     // Note: this entry is used to locate the end of the root pointer section.
     char *stack_top;
@@ -201,6 +434,25 @@ typedef struct _mp_state_thread_t {
     #if MICROPY_STACK_CHECK
     size_t stack_limit;
     #endif
+
+    #if MICROPY_STACKLESS
+    // free space in frame_chunk, and the total size of the frame stack
+    byte *frame_top;
+    byte *frame_limit;
+    size_t frame_stack_size;
+    #if MICROPY_PY_THREAD
+    struct _mp_state_thread_t *next_thread;
+    #endif
+    #endif
+
+    #if MICROPY_TRACK_CODE_STATE
+    // innermost bytecode function being executed, see mp_code_state_t.caller
+    struct _mp_code_state_t *current_code_state;
+    #endif
+
+    #if MICROPY_OPT_INLINE_CACHE
+    mp_inline_cache_entry_t inline_cache[MICROPY_OPT_INLINE_CACHE_SIZE][MICROPY_OPT_INLINE_CACHE_WAYS];
+    #endif
 } mp_state_thread_t;
 
 // This structure combines the above 3 structures, and adds the local
@@ -25,6 +25,7 @@
  */
 
 #include <stdio.h>
+#include <stddef.h>
 #include <string.h>
 #include <assert.h>
 
@@ -98,7 +99,17 @@ void mp_native_raise(mp_obj_t o) {
     }
 }
 
+// Native code passes a pointer to the state of its code_state, rather than to
+// the code_state itself, so that the size of mp_code_state_t (which depends on
+// the config) isn't built into the code.
+void mp_native_setup_code_state(mp_obj_t *state, struct _mp_obj_fun_bc_t *self, size_t n_args, size_t n_kw, const mp_obj_t *args) {
+    mp_code_state_t *code_state = (mp_code_state_t*)((byte*)state - offsetof(mp_code_state_t, state));
+    mp_setup_code_state(code_state, self, n_args, n_kw, args);
+}
+
 // these must correspond to the respective enum in runtime0.h
+// (entries for features that are disabled are NULL, so that the indices
+// don't change, because they are built into native code in .mpy files)
 void *const mp_fun_table[MP_F_NUMBER_OF] = {
     mp_convert_obj_to_native,
     mp_convert_native_to_obj,
@@ -122,6 +133,9 @@ void *const mp_fun_table[MP_F_NUMBER_OF] = {
 #if MICROPY_PY_BUILTINS_SET
     mp_obj_new_set,
     mp_obj_set_store,
+#else
+    NULL,
+    NULL,
 #endif
     mp_make_function_from_raw_code,
     mp_native_call_function_n_kw,
@@ -137,6 +151,8 @@ void *const mp_fun_table[MP_F_NUMBER_OF] = {
     mp_import_all,
 #if MICROPY_PY_BUILTINS_SLICE
     mp_obj_new_slice,
+#else
+    NULL,
 #endif
     mp_unpack_sequence,
     mp_unpack_ex,
@@ -144,7 +160,7 @@ void *const mp_fun_table[MP_F_NUMBER_OF] = {
     mp_delete_global,
     mp_obj_new_cell,
     mp_make_closure_from_raw_code,
-    mp_setup_code_state,
+    mp_native_setup_code_state,
 };
 
 /*
@@ -327,6 +327,23 @@ static inline bool mp_obj_is_integer(mp_const_obj_t o) { return MP_OBJ_IS_INT(o)
         }, \
     }
 
+// As MP_DEFINE_CONST_DICT, for a table whose keys are in ascending order of
+// their strings.  makeqstrdata.py numbers the ROM qstrs in that same order,
+// so mp_map_lookup can binary search the table.
+#define MP_DEFINE_CONST_DICT_SORTED(dict_name, table_name) \
+    const mp_obj_dict_t dict_name = { \
+        .base = {&mp_type_dict}, \
+        .map = { \
+            .all_keys_are_qstrs = 1, \
+            .is_fixed = 1, \
+            .is_ordered = 1, \
+            .is_sorted = 1, \
+            .used = MP_ARRAY_SIZE(table_name), \
+            .alloc = MP_ARRAY_SIZE(table_name), \
+            .table = (mp_map_elem_t*)(mp_rom_map_elem_t*)table_name, \
+        }, \
+    }
+
 #define MP_DEFINE_RAM_DICT(dict_name, table_name) \
     DRAM_ATTR mp_obj_dict_t dict_name = { \
         .base = {&mp_type_dict}, \
@@ -370,7 +387,9 @@ typedef struct _mp_map_t {
     mp_uint_t all_keys_are_qstrs : 1;
     mp_uint_t is_fixed : 1;     // a fixed array that can't be modified; must also be ordered
     mp_uint_t is_ordered : 1;   // an ordered array
-    mp_uint_t used : (8 * sizeof(mp_uint_t) - 3);
+    mp_uint_t is_sorted : 1;    // a fixed array with qstr keys in ascending order
+    mp_uint_t is_class_dict : 1; // the dict of a Python class, changes to it invalidate attribute caches
+    mp_uint_t used : (8 * sizeof(mp_uint_t) - 5);
     mp_uint_t alloc;
     mp_map_elem_t *table;
 } mp_map_t;
@@ -394,6 +413,10 @@ void mp_map_deinit(mp_map_t *map);
 void mp_map_free(mp_map_t *map);
 mp_map_elem_t *mp_map_lookup(mp_map_t *map, mp_obj_t index, mp_map_lookup_kind_t lookup_kind);
 void mp_map_clear(mp_map_t *map);
+#if MICROPY_OPT_MAP_COMPACT
+void mp_map_copy(mp_map_t *dest, const mp_map_t *src);
+mp_map_elem_t *mp_map_last(mp_map_t *map);
+#endif
 void mp_map_dump(mp_map_t *map);
 
 // Underlying set implementation (not set object)
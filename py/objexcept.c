@@ -454,6 +454,7 @@ void mp_obj_exception_add_traceback(mp_obj_t self_in, qstr file, size_t line, qs
         if (self->traceback_data == NULL) {
             return;
         }
+        GC_WRITE_BARRIER(self);
         self->traceback_alloc = 3;
         self->traceback_len = 0;
     } else if (self->traceback_len + 3 > self->traceback_alloc) {
@@ -35,6 +35,7 @@
 #include "py/runtime.h"
 #include "py/bc.h"
 #include "py/stackctrl.h"
+#include "py/compile.h"
 
 #if 0 // print debugging info
 #define DEBUG_PRINT (1)
@@ -157,6 +158,11 @@ qstr mp_obj_fun_get_name(mp_const_obj_t fun_in) {
     const mp_obj_fun_bc_t *fun = MP_OBJ_TO_PTR(fun_in);
     #if MICROPY_EMIT_NATIVE
     if (fun->base.type == &mp_type_fun_native) {
+        #if MICROPY_EMIT_NATIVE_TIERING
+        if (fun->tier != NULL) {
+            return fun->tier->simple_name;
+        }
+        #endif
         // TODO native functions don't have name stored
         return MP_QSTR_;
     }
@@ -200,9 +206,85 @@ STATIC void dump_args(const mp_obj_t *a, mp_uint_t sz) {
 // Set this to enable a simple stack overflow check.
 #define VM_DETECT_STACK_OVERFLOW (0)
 
+#if MICROPY_EMIT_NATIVE_TIERING
+// Called on each call of a function that may be made native.  Once it is hot
+// enough the function object is switched over to native code in place, so that
+// its next call runs natively; the current call carries on as bytecode.
+STATIC void fun_bc_count_call(mp_obj_fun_bc_t *self) {
+    mp_tier_t *tier = self->tier;
+    mp_uint_t threshold = MP_STATE_VM(tier_threshold);
+    if (++tier->hotness < threshold || threshold == 0) {
+        return;
+    }
+    const mp_raw_code_t *rc = mp_compile_tier(tier);
+    if (rc == NULL) {
+        // can't be made native, so stay as bytecode and stop counting
+        self->tier = NULL;
+        return;
+    }
+    self->base.type = &mp_type_fun_native;
+    self->bytecode = rc->data.u_native.fun_data;
+    self->const_table = rc->data.u_native.const_table;
+}
+#endif
+
 #if MICROPY_STACKLESS
+// Frames are pushed on the frame stack of the current thread, and popped in
+// reverse order.  When a chunk is full a new one is started, and a chunk that
+// has been emptied is kept so that calls at its boundary don't thrash the heap.
+STATIC void *frame_stack_alloc_slow(size_t n) {
+    mp_frame_chunk_t *chunk = MP_STATE_THREAD(frame_chunk);
+    mp_frame_chunk_t *next = chunk == NULL ? NULL : chunk->next;
+    if (next == NULL || next->size < sizeof(mp_frame_chunk_t) + n) {
+        size_t size = MAX(MICROPY_STACKLESS_CHUNK_SIZE, sizeof(mp_frame_chunk_t) + n);
+        if (next != NULL) {
+            MP_STATE_THREAD(frame_stack_size) -= next->size;
+            m_del(byte, next, next->size);
+            chunk->next = NULL;
+        }
+        if (MP_STATE_THREAD(frame_stack_size) + size > MICROPY_STACKLESS_MAX_SIZE) {
+            return NULL;
+        }
+        next = (mp_frame_chunk_t*)m_new_maybe(byte, size);
+        if (next == NULL) {
+            return NULL;
+        }
+        next->prev = chunk;
+        next->next = NULL;
+        next->size = size;
+        if (chunk != NULL) {
+            chunk->next = next;
+        }
+        MP_STATE_THREAD(frame_stack_size) += size;
+    }
+    MP_STATE_THREAD(frame_chunk) = next;
+    MP_STATE_THREAD(frame_top) = (byte*)(next + 1);
+    MP_STATE_THREAD(frame_limit) = (byte*)next + next->size;
+    return next + 1;
+}
+
+void mp_obj_fun_bc_release_codestate(mp_code_state_t *code_state) {
+    byte *p = (byte*)code_state;
+    mp_frame_chunk_t *chunk = MP_STATE_THREAD(frame_chunk);
+    if (p < (byte*)(chunk + 1) || p >= MP_STATE_THREAD(frame_limit)) {
+        // the frame is in an earlier chunk, so this one is now empty, and the
+        // spare one after it is freed
+        do {
+            mp_frame_chunk_t *next = chunk->next;
+            if (next != NULL) {
+                MP_STATE_THREAD(frame_stack_size) -= next->size;
+                m_del(byte, next, next->size);
+                chunk->next = NULL;
+            }
+            chunk = chunk->prev;
+        } while (p < (byte*)(chunk + 1) || p >= (byte*)chunk + chunk->size);
+        MP_STATE_THREAD(frame_chunk) = chunk;
+        MP_STATE_THREAD(frame_limit) = (byte*)chunk + chunk->size;
+    }
+    MP_STATE_THREAD(frame_top) = p;
+}
+
 mp_code_state_t *mp_obj_fun_bc_prepare_codestate(mp_obj_t self_in, size_t n_args, size_t n_kw, const mp_obj_t *args) {
-    MP_STACK_CHECK();
     mp_obj_fun_bc_t *self = MP_OBJ_TO_PTR(self_in);
 
     // get start of bytecode
@@ -212,17 +294,29 @@ mp_code_state_t *mp_obj_fun_bc_prepare_codestate(mp_obj_t self_in, size_t n_args
     size_t n_state = mp_decode_uint(&ip);
     size_t n_exc_stack = mp_decode_uint(&ip);
 
-    // allocate state for locals and stack
-    size_t state_size = n_state * sizeof(mp_obj_t) + n_exc_stack * sizeof(mp_exc_stack_t);
-    mp_code_state_t *code_state;
-    code_state = m_new_obj_var_maybe(mp_code_state_t, byte, state_size);
-    if (!code_state) {
-        return NULL;
+    // allocate state for locals and stack on the frame stack
+    size_t n = sizeof(mp_code_state_t) + n_state * sizeof(mp_obj_t) + n_exc_stack * sizeof(mp_exc_stack_t);
+    mp_code_state_t *code_state = (mp_code_state_t*)MP_STATE_THREAD(frame_top);
+    if ((size_t)(MP_STATE_THREAD(frame_limit) - (byte*)code_state) < n) {
+        code_state = frame_stack_alloc_slow(n);
+        if (code_state == NULL) {
+            return NULL;
+        }
     }
 
     code_state->ip = (byte*)(ip - self->bytecode); // offset to after n_state/n_exc_stack
     code_state->n_state = n_state;
     mp_setup_code_state(code_state, self, n_args, n_kw, args);
+    // the frame is only pushed once the arguments are known to be valid
+    MP_STATE_THREAD(frame_top) = (byte*)code_state + n;
+    #if MICROPY_EMIT_NATIVE_TIERING
+    if (self->tier != NULL) {
+        fun_bc_count_call(self);
+    }
+    #endif
+    #if MICROPY_TRACK_CODE_STATE
+    code_state->caller = MP_STATE_THREAD(current_code_state);
+    #endif
 
     // execute the byte code with the correct globals context
     code_state->old_globals = mp_globals_get();
@@ -268,11 +362,23 @@ STATIC mp_obj_t fun_bc_call(mp_obj_t self_in, size_t n_args, size_t n_kw, const
     code_state->ip = (byte*)(ip - self->bytecode); // offset to after n_state/n_exc_stack
     code_state->n_state = n_state;
     mp_setup_code_state(code_state, self, n_args, n_kw, args);
+    #if MICROPY_EMIT_NATIVE_TIERING
+    if (self->tier != NULL) {
+        fun_bc_count_call(self);
+    }
+    #endif
 
     // execute the byte code with the correct globals context
     code_state->old_globals = mp_globals_get();
     mp_globals_set(self->globals);
+    #if MICROPY_TRACK_CODE_STATE
+    code_state->caller = MP_STATE_THREAD(current_code_state);
+    MP_STATE_THREAD(current_code_state) = code_state;
+    #endif
     mp_vm_return_kind_t vm_return_kind = mp_execute_bytecode(code_state, MP_OBJ_NULL);
+    #if MICROPY_TRACK_CODE_STATE
+    MP_STATE_THREAD(current_code_state) = code_state->caller;
+    #endif
     mp_globals_set(code_state->old_globals);
 
 #if VM_DETECT_STACK_OVERFLOW
@@ -366,6 +472,9 @@ mp_obj_t mp_obj_new_fun_bc(mp_obj_t def_args_in, mp_obj_t def_kw_args, const byt
     o->globals = mp_globals_get();
     o->bytecode = code;
     o->const_table = const_table;
+    #if MICROPY_EMIT_NATIVE_TIERING
+    o->tier = NULL;
+    #endif
     if (def_args != NULL) {
         memcpy(o->extra_args, def_args->items, n_def_args * sizeof(mp_obj_t));
     }
@@ -387,11 +496,40 @@ STATIC mp_obj_t fun_native_call(mp_obj_t self_in, size_t n_args, size_t n_kw, co
     return fun(self_in, n_args, n_kw, args);
 }
 
+// Tiered functions should look the same once they are native, but other
+// native functions don't have their name stored.
+
+#if MICROPY_EMIT_NATIVE_TIERING && MICROPY_CPYTHON_COMPAT
+STATIC void fun_native_print(const mp_print_t *print, mp_obj_t o_in, mp_print_kind_t kind) {
+    mp_obj_fun_bc_t *o = MP_OBJ_TO_PTR(o_in);
+    if (o->tier != NULL) {
+        fun_bc_print(print, o_in, kind);
+    } else {
+        mp_printf(print, "<%q>", MP_QSTR_function);
+    }
+}
+#endif
+
+#if MICROPY_EMIT_NATIVE_TIERING && MICROPY_PY_FUNCTION_ATTRS
+STATIC void fun_native_attr(mp_obj_t self_in, qstr attr, mp_obj_t *dest) {
+    mp_obj_fun_bc_t *o = MP_OBJ_TO_PTR(self_in);
+    if (o->tier != NULL) {
+        fun_bc_attr(self_in, attr, dest);
+    }
+}
+#endif
+
 STATIC const mp_obj_type_t mp_type_fun_native = {
     { &mp_type_type },
     .name = MP_QSTR_function,
+#if MICROPY_EMIT_NATIVE_TIERING && MICROPY_CPYTHON_COMPAT
+    .print = fun_native_print,
+#endif
     .call = fun_native_call,
     .unary_op = mp_generic_unary_op,
+#if MICROPY_EMIT_NATIVE_TIERING && MICROPY_PY_FUNCTION_ATTRS
+    .attr = fun_native_attr,
+#endif
 };
 
 mp_obj_t mp_obj_new_fun_native(mp_obj_t def_args_in, mp_obj_t def_kw_args, const void *fun_data, const mp_uint_t *const_table) {
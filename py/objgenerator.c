@@ -30,6 +30,7 @@
 
 #include "py/nlr.h"
 #include "py/obj.h"
+#include "py/gc.h"
 #include "py/runtime.h"
 #include "py/bc.h"
 #include "py/objgenerator.h"
@@ -112,8 +113,17 @@ mp_vm_return_kind_t mp_obj_gen_resume(mp_obj_t self_in, mp_obj_t send_value, mp_
     }
     mp_obj_dict_t *old_globals = mp_globals_get();
     mp_globals_set(self->globals);
+    #if MICROPY_TRACK_CODE_STATE
+    self->code_state.caller = MP_STATE_THREAD(current_code_state);
+    MP_STATE_THREAD(current_code_state) = &self->code_state;
+    #endif
     mp_vm_return_kind_t ret_kind = mp_execute_bytecode(&self->code_state, throw_value);
+    #if MICROPY_TRACK_CODE_STATE
+    MP_STATE_THREAD(current_code_state) = self->code_state.caller;
+    #endif
     mp_globals_set(old_globals);
+    // the generator's state has been updated by the VM
+    GC_WRITE_BARRIER(self);
 
     switch (ret_kind) {
         case MP_VM_RETURN_NORMAL:
@@ -28,6 +28,7 @@
 #include <assert.h>
 
 #include "py/nlr.h"
+#include "py/gc.h"
 #include "py/objlist.h"
 #include "py/runtime0.h"
 #include "py/runtime.h"
@@ -216,6 +217,7 @@ STATIC mp_obj_t list_subscr(mp_obj_t self_in, mp_obj_t index, mp_obj_t value) {
                 mp_seq_clear(self->items, self->len + len_adj, self->len, sizeof(*self->items));
                 // TODO: apply allocation policy re: alloc_size
             }
+            GC_WRITE_BARRIER(self->items);
             self->len += len_adj;
             return mp_const_none;
         }
@@ -238,6 +240,7 @@ mp_obj_t mp_obj_list_append(mp_obj_t self_in, mp_obj_t arg) {
         mp_seq_clear(self->items, self->len + 1, self->alloc, sizeof(*self->items));
     }
     self->items[self->len++] = arg;
+    GC_WRITE_BARRIER(self->items);
     return mp_const_none; // return None, as per CPython
 }
 
@@ -255,6 +258,7 @@ STATIC mp_obj_t list_extend(mp_obj_t self_in, mp_obj_t arg_in) {
         }
 
         memcpy(self->items + self->len, arg->items, sizeof(mp_obj_t) * arg->len);
+        GC_WRITE_BARRIER(self->items);
         self->len += arg->len;
     } else {
         list_extend_from_iter(self_in, arg_in);
@@ -384,6 +388,7 @@ STATIC mp_obj_t list_insert(mp_obj_t self_in, mp_obj_t idx, mp_obj_t obj) {
          self->items[i] = self->items[i-1];
     }
     self->items[index] = obj;
+    GC_WRITE_BARRIER(self->items);
 
     return mp_const_none;
 }
@@ -437,7 +442,7 @@ STATIC const mp_rom_map_elem_t list_locals_dict_table[] = {
     { MP_ROM_QSTR(MP_QSTR_sort), MP_ROM_PTR(&list_sort_obj) },
 };
 
-STATIC MP_DEFINE_CONST_DICT(list_locals_dict, list_locals_dict_table);
+STATIC MP_DEFINE_CONST_DICT_SORTED(list_locals_dict, list_locals_dict_table);
 
 const mp_obj_type_t mp_type_list = {
     { &mp_type_type },
@@ -492,6 +497,7 @@ void mp_obj_list_store(mp_obj_t self_in, mp_obj_t index, mp_obj_t value) {
     mp_obj_list_t *self = MP_OBJ_TO_PTR(self_in);
     mp_uint_t i = mp_get_index(self->base.type, self->len, index, false);
     self->items[i] = value;
+    GC_WRITE_BARRIER(self->items);
 }
 
 /******************************************************************************/
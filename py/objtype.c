@@ -31,6 +31,7 @@
 #include <assert.h>
 
 #include "py/nlr.h"
+#include "py/gc.h"
 #include "py/objtype.h"
 #include "py/runtime0.h"
 #include "py/runtime.h"
@@ -44,12 +45,47 @@
 #endif
 
 STATIC mp_obj_t static_class_method_make_new(const mp_obj_type_t *self_in, size_t n_args, size_t n_kw, const mp_obj_t *args);
+#if MICROPY_GC_DEFER_FINALISER
+STATIC bool class_has_del(const mp_obj_type_t *type);
+#endif
+
+#define CLASS_VERSIONS (MICROPY_OPT_INLINE_CACHE || MICROPY_OPT_METHOD_CACHE)
+
+#if CLASS_VERSIONS
+// a class made by Python code, with a version for the attribute caches
+typedef struct _mp_obj_class_t {
+    mp_obj_type_t type;
+    mp_uint_t version;
+    bool has_subclasses;
+    #if MICROPY_GC_DEFER_FINALISER
+    // twice the version the class was last checked for __del__ at, plus one
+    // if it has it, in one word so it's read and written in one go
+    mp_uint_t del_check;
+    #endif
+} mp_obj_class_t;
+
+#if MICROPY_PY_THREAD && !MICROPY_PY_THREAD_GIL
+#define NEW_CLASS_VERSION() (__atomic_add_fetch(&MP_STATE_VM(class_version_next), 1, __ATOMIC_RELAXED))
+#else
+#define NEW_CLASS_VERSION() (++MP_STATE_VM(class_version_next))
+#endif
+#endif
 
 /******************************************************************************/
 // instance object
 
 STATIC mp_obj_t mp_obj_new_instance(const mp_obj_type_t *class, uint subobjs) {
+    #if MICROPY_GC_DEFER_FINALISER
+    // instances of a class with __del__ have it called when they're collected
+    mp_obj_instance_t *o;
+    if (class_has_del(class)) {
+        o = m_malloc_with_finaliser(sizeof(mp_obj_instance_t) + sizeof(mp_obj_t) * subobjs);
+    } else {
+        o = m_new_obj_var(mp_obj_instance_t, mp_obj_t, subobjs);
+    }
+    #else
     mp_obj_instance_t *o = m_new_obj_var(mp_obj_instance_t, mp_obj_t, subobjs);
+    #endif
     o->base.type = class;
     mp_map_init(&o->members, 0);
     mp_seq_clear(o->subobj, 0, subobjs, sizeof(*o->subobj));
@@ -101,9 +137,162 @@ struct class_lookup_data {
     bool is_type;
 };
 
+#if CLASS_VERSIONS
+
+// Returns the version of a Python class.  Versions are never reused, and a
+// class gets a new one when its dict, or the dict of one of its bases, changes.
+// So a lookup in the dicts can be cached along with the version it was made at.
+// The subclasses of a class aren't known, so a change to a class that has them
+// makes every version given out so far stale, and they are renewed here.
+STATIC mp_uint_t class_version(const mp_obj_type_t *type) {
+    mp_obj_class_t *cls = (mp_obj_class_t*)type;
+    if (cls->version <= MP_STATE_VM(class_epoch)) {
+        cls->version = NEW_CLASS_VERSION();
+    }
+    return cls->version;
+}
+
+// Called after the dict of a Python class changes.
+STATIC void class_changed(const mp_obj_type_t *type) {
+    mp_obj_class_t *cls = (mp_obj_class_t*)type;
+    if (cls->has_subclasses) {
+        MP_STATE_VM(class_epoch) = NEW_CLASS_VERSION();
+    } else {
+        cls->version = NEW_CLASS_VERSION();
+    }
+}
+
+// Called after the dict of a Python class changes other than through the
+// class, eg through locals() in its body.  The class isn't known, so every
+// version given out so far is made stale.
+void mp_obj_class_dict_changed(void) {
+    MP_STATE_VM(class_epoch) = NEW_CLASS_VERSION();
+}
+
+// Find attr in the dicts of a Python class and its bases, in the same order as
+// mp_obj_class_lookup, and set *owner to the class that has it.  Returns
+// MP_OBJ_SENTINEL if the search reaches a native base, because those have other
+// ways to find attributes.
+STATIC mp_obj_t class_lookup_dicts(const mp_obj_type_t *type, qstr attr, const mp_obj_type_t **owner) {
+    if (mp_obj_is_native_type(type)) {
+        return MP_OBJ_SENTINEL;
+    }
+    mp_map_elem_t *elem = mp_map_lookup(&type->locals_dict->map, MP_OBJ_NEW_QSTR(attr), MP_MAP_LOOKUP);
+    if (elem != NULL) {
+        *owner = type;
+        return elem->value;
+    }
+    mp_obj_t member = MP_OBJ_NULL;
+    for (size_t i = 0; i < type->bases_tuple->len && member == MP_OBJ_NULL; i++) {
+        const mp_obj_type_t *bt = MP_OBJ_TO_PTR(type->bases_tuple->items[i]);
+        if (bt != &mp_type_object) {
+            member = class_lookup_dicts(bt, attr, owner);
+        }
+    }
+    return member;
+}
+
+#if MICROPY_OPT_METHOD_CACHE
+
+#if MICROPY_PY_THREAD && !MICROPY_PY_THREAD_GIL
+// Without the GIL other threads can use the method cache at the same time, so
+// its entries work like seqlocks with the version as the sequence.  A thread
+// claims an entry to write by setting the version to METHOD_CACHE_BUSY, and a
+// hit is checked again after it's read.  The result of a lookup only depends
+// on (type, attr, version), so an entry rewritten with the same key is fine.
+#define METHOD_CACHE_BUSY ((mp_uint_t)-1)
+#define METHOD_CACHE_VERSION(e) (__atomic_load_n(&(e)->version, __ATOMIC_ACQUIRE))
+STATIC bool method_cache_recheck(mp_method_cache_entry_t *e, const mp_obj_type_t *type, qstr attr, mp_uint_t version) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&e->version, __ATOMIC_RELAXED) == version && e->type == type && e->attr == attr;
+}
+STATIC bool method_cache_claim(mp_method_cache_entry_t *e) {
+    mp_uint_t old = __atomic_load_n(&e->version, __ATOMIC_RELAXED);
+    if (old == METHOD_CACHE_BUSY
+        || !__atomic_compare_exchange_n(&e->version, &old, METHOD_CACHE_BUSY, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        return false;
+    }
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return true;
+}
+#define METHOD_CACHE_RELEASE(e, v) (__atomic_store_n(&(e)->version, (v), __ATOMIC_RELEASE))
+#else
+#define METHOD_CACHE_VERSION(e) ((e)->version)
+#define method_cache_recheck(e, type, attr, version) (true)
+#define method_cache_claim(e) (true)
+#define METHOD_CACHE_RELEASE(e, v) ((e)->version = (v))
+#endif
+
+// As class_lookup_dicts, using and filling the method cache.
+STATIC mp_obj_t class_lookup_cached(const mp_obj_type_t *type, qstr attr, const mp_obj_type_t **owner) {
+    mp_uint_t version = class_version(type);
+    mp_method_cache_entry_t *e = &MP_STATE_VM(method_cache)[(((uintptr_t)type >> 4) ^ attr) & (MICROPY_OPT_METHOD_CACHE_SIZE - 1)];
+    if (METHOD_CACHE_VERSION(e) == version && e->type == type && e->attr == attr) {
+        const mp_obj_type_t *o = e->owner;
+        mp_obj_t member = e->value;
+        if (method_cache_recheck(e, type, attr, version)) {
+            *owner = o;
+            return member;
+        }
+    }
+    mp_obj_t member = class_lookup_dicts(type, attr, owner);
+    if (method_cache_claim(e)) {
+        e->type = type;
+        e->attr = attr;
+        e->owner = *owner;
+        e->value = member;
+        METHOD_CACHE_RELEASE(e, version);
+    }
+    return member;
+}
+#else
+#define class_lookup_cached class_lookup_dicts
+#endif
+
+#endif // CLASS_VERSIONS
+
+#if MICROPY_GC_DEFER_FINALISER
+// Whether instances of a class need a finaliser, cached with the class version
+// so that making an instance doesn't search the class and its bases each time.
+STATIC bool class_has_del(const mp_obj_type_t *type) {
+    #if CLASS_VERSIONS
+    mp_obj_class_t *cls = (mp_obj_class_t*)type;
+    mp_uint_t version = class_version(type);
+    mp_uint_t check = cls->del_check;
+    if (check >> 1 == version) {
+        return check & 1;
+    }
+    #endif
+    mp_obj_t dest[2];
+    mp_load_method_maybe(MP_OBJ_FROM_PTR(type), MP_QSTR___del__, dest);
+    bool has_del = dest[0] != MP_OBJ_NULL;
+    #if CLASS_VERSIONS
+    cls->del_check = version << 1 | has_del;
+    #endif
+    return has_del;
+}
+#endif
+
 STATIC void mp_obj_class_lookup(struct class_lookup_data  *lookup, const mp_obj_type_t *type) {
     assert(lookup->dest[0] == MP_OBJ_NULL);
     assert(lookup->dest[1] == MP_OBJ_NULL);
+    #if MICROPY_OPT_METHOD_CACHE
+    if (mp_obj_is_instance_type(type)) {
+        // a Python class, whose bases might all be Python classes too
+        const mp_obj_type_t *owner = NULL;
+        mp_obj_t member = class_lookup_cached(type, lookup->attr, &owner);
+        if (member != MP_OBJ_SENTINEL) {
+            if (member != MP_OBJ_NULL) {
+                if (lookup->is_type) {
+                    mp_convert_member_lookup(MP_OBJ_NULL, (const mp_obj_type_t*)lookup->obj, member, lookup->dest);
+                } else {
+                    mp_convert_member_lookup(MP_OBJ_FROM_PTR(lookup->obj), owner, member, lookup->dest);
+                }
+            }
+            return;
+        }
+    }
+    #endif
     for (;;) {
         // Optimize special method lookup for native types
         // This avoids extra method_name => slot lookup. On the other hand,
@@ -645,6 +834,164 @@ void mp_obj_instance_attr(mp_obj_t self_in, qstr attr, mp_obj_t *dest) {
     }
 }
 
+#if MICROPY_OPT_INLINE_CACHE
+
+// kinds of inline cache entry
+#define INLINE_CACHE_MEMBER (0) // an instance member, at u.slot in the members
+#define INLINE_CACHE_METHOD (1) // u.value from the class, bound to the instance
+#define INLINE_CACHE_VALUE (2) // u.value from the class
+#define INLINE_CACHE_CLASS (3) // u.value from the class, loaded from the class itself
+
+// Find the entry for the given type and attr in a cache set, or if there
+// isn't one then make it in place of the oldest.  Returns true if found.
+STATIC bool inline_cache_get(mp_inline_cache_entry_t *set, const mp_obj_type_t *type, qstr attr, bool is_class, mp_inline_cache_entry_t **e_out) {
+    for (size_t i = 0; i < MICROPY_OPT_INLINE_CACHE_WAYS; i++) {
+        if (set[i].type == type && set[i].attr == attr && (set[i].kind == INLINE_CACHE_CLASS) == is_class) {
+            *e_out = &set[i];
+            return true;
+        }
+    }
+    memmove(&set[1], &set[0], (MICROPY_OPT_INLINE_CACHE_WAYS - 1) * sizeof(*set));
+    set[0].type = NULL;
+    set[0].attr = attr;
+    *e_out = &set[0];
+    return false;
+}
+
+// these are handled specially by mp_load_method_maybe and friends
+#if MICROPY_CPYTHON_COMPAT
+#define INLINE_CACHE_IS_SPECIAL(attr) ((attr) == MP_QSTR___class__ || (attr) == MP_QSTR___name__ || (attr) == MP_QSTR___dict__)
+#else
+#define INLINE_CACHE_IS_SPECIAL(attr) (false)
+#endif
+
+// Does the same as mp_load_method_maybe for Python classes and their instances,
+// using and filling the given inline cache set.  Returns false if the lookup
+// must be left to mp_load_method.
+bool mp_inline_cache_load(mp_inline_cache_entry_t *set, mp_obj_t base, qstr attr, mp_obj_t *dest) {
+    if (!MP_OBJ_IS_OBJ(base)) {
+        return false;
+    }
+    const mp_obj_type_t *type = ((mp_obj_base_t*)MP_OBJ_TO_PTR(base))->type;
+    bool is_class = false;
+    if (type->attr == mp_obj_instance_attr) {
+        // an instance of a Python class
+    } else if (type == &mp_type_type && mp_obj_is_instance_type((mp_obj_type_t*)MP_OBJ_TO_PTR(base))) {
+        // a Python class
+        type = MP_OBJ_TO_PTR(base);
+        is_class = true;
+    } else {
+        return false;
+    }
+
+    mp_inline_cache_entry_t *e;
+    mp_obj_instance_t *self = MP_OBJ_TO_PTR(base);
+    mp_obj_t key = MP_OBJ_NEW_QSTR(attr);
+    if (inline_cache_get(set, type, attr, is_class, &e)) {
+        if (e->kind == INLINE_CACHE_MEMBER) {
+            if (e->u.slot < self->members.alloc && self->members.table[e->u.slot].key == key) {
+                dest[0] = self->members.table[e->u.slot].value;
+                dest[1] = MP_OBJ_NULL;
+                return true;
+            }
+        } else if (e->version == class_version(type)
+            && (is_class || self->members.used == 0 || mp_map_lookup(&self->members, key, MP_MAP_LOOKUP) == NULL)) {
+            // the class hasn't changed, and an instance member doesn't hide it
+            dest[0] = e->u.value;
+            dest[1] = e->kind == INLINE_CACHE_METHOD ? base : MP_OBJ_NULL;
+            return true;
+        }
+        e->type = NULL;
+    }
+
+    // not in the cache, so look it up and make the entry
+    if (INLINE_CACHE_IS_SPECIAL(attr)) {
+        return false;
+    }
+    if (!is_class) {
+        mp_map_elem_t *elem = mp_map_lookup(&self->members, key, MP_MAP_LOOKUP);
+        if (elem != NULL) {
+            e->type = type;
+            e->kind = INLINE_CACHE_MEMBER;
+            e->u.slot = elem - &self->members.table[0];
+            dest[0] = elem->value;
+            dest[1] = MP_OBJ_NULL;
+            return true;
+        }
+    }
+    mp_uint_t version = class_version(type);
+    const mp_obj_type_t *owner = NULL;
+    mp_obj_t member = class_lookup_cached(type, attr, &owner);
+    if (member == MP_OBJ_NULL || member == MP_OBJ_SENTINEL) {
+        return false;
+    }
+    if (!is_class) {
+        #if MICROPY_PY_BUILTINS_PROPERTY
+        if (MP_OBJ_IS_TYPE(member, &mp_type_property)) {
+            return false;
+        }
+        #endif
+        #if MICROPY_PY_DESCRIPTORS
+        if (mp_obj_is_instance_type(mp_obj_get_type(member))) {
+            // it might have __get__
+            return false;
+        }
+        #endif
+    }
+    dest[0] = dest[1] = MP_OBJ_NULL;
+    mp_convert_member_lookup(is_class ? MP_OBJ_NULL : base, type, member, dest);
+    if (dest[0] == member && (dest[1] == MP_OBJ_NULL || (!is_class && dest[1] == base))) {
+        // anything else, like a classmethod, is converted on every lookup
+        e->type = type;
+        e->kind = is_class ? INLINE_CACHE_CLASS : dest[1] != MP_OBJ_NULL ? INLINE_CACHE_METHOD : INLINE_CACHE_VALUE;
+        e->version = version;
+        e->u.value = member;
+    }
+    return true;
+}
+
+// Store to an existing member of an instance of a Python class, using and
+// filling the given inline cache set.  Returns false if the store must be left
+// to mp_store_attr.  Like the lookup cache in the bytecode, this relies on an
+// attribute in the members not being a property.
+bool mp_inline_cache_store(mp_inline_cache_entry_t *set, mp_obj_t base, qstr attr, mp_obj_t value) {
+    if (!MP_OBJ_IS_OBJ(base) || value == MP_OBJ_NULL) {
+        // a delete is done by storing MP_OBJ_NULL
+        return false;
+    }
+    const mp_obj_type_t *type = ((mp_obj_base_t*)MP_OBJ_TO_PTR(base))->type;
+    if (type->attr != mp_obj_instance_attr) {
+        return false;
+    }
+    mp_obj_instance_t *self = MP_OBJ_TO_PTR(base);
+    mp_obj_t key = MP_OBJ_NEW_QSTR(attr);
+    mp_inline_cache_entry_t *e;
+    if (inline_cache_get(set, type, attr, false, &e)) {
+        if (e->kind == INLINE_CACHE_MEMBER
+            && e->u.slot < self->members.alloc && self->members.table[e->u.slot].key == key) {
+            self->members.table[e->u.slot].value = value;
+            GC_WRITE_BARRIER(self->members.table);
+            return true;
+        }
+        e->type = NULL;
+    }
+    if (INLINE_CACHE_IS_SPECIAL(attr)) {
+        return false;
+    }
+    mp_map_elem_t *elem = mp_map_lookup(&self->members, key, MP_MAP_LOOKUP);
+    if (elem == NULL) {
+        return false;
+    }
+    e->type = type;
+    e->kind = INLINE_CACHE_MEMBER;
+    e->u.slot = elem - &self->members.table[0];
+    elem->value = value;
+    GC_WRITE_BARRIER(self->members.table);
+    return true;
+}
+
+#endif // MICROPY_OPT_INLINE_CACHE
+
 STATIC mp_obj_t instance_subscr(mp_obj_t self_in, mp_obj_t index, mp_obj_t value) {
     mp_obj_instance_t *self = MP_OBJ_TO_PTR(self_in);
     mp_obj_t member[2] = {MP_OBJ_NULL};
@@ -849,6 +1196,11 @@ STATIC void type_attr(mp_obj_t self_in, qstr attr, mp_obj_t *dest) {
                 mp_map_elem_t *elem = mp_map_lookup(locals_map, MP_OBJ_NEW_QSTR(attr), MP_MAP_LOOKUP_REMOVE_IF_FOUND);
                 // note that locals_map may be in ROM, so remove will fail in that case
                 if (elem != NULL) {
+                    #if CLASS_VERSIONS
+                    if (mp_obj_is_instance_type(self)) {
+                        class_changed(self);
+                    }
+                    #endif
                     dest[0] = MP_OBJ_NULL; // indicate success
                 }
             } else {
@@ -857,6 +1209,11 @@ STATIC void type_attr(mp_obj_t self_in, qstr attr, mp_obj_t *dest) {
                 // note that locals_map may be in ROM, so add will fail in that case
                 if (elem != NULL) {
                     elem->value = dest[1];
+                    #if CLASS_VERSIONS
+                    if (mp_obj_is_instance_type(self)) {
+                        class_changed(self);
+                    }
+                    #endif
                     dest[0] = MP_OBJ_NULL; // indicate success
                 }
             }
@@ -898,7 +1255,21 @@ mp_obj_t mp_obj_new_type(qstr name, mp_obj_t bases_tuple, mp_obj_t locals_dict)
         }
     }
 
-    mp_obj_type_t *o = m_new0(mp_obj_type_t, 1);
+    #if CLASS_VERSIONS
+    mp_obj_class_t *cls = m_new_obj(mp_obj_class_t);
+    memset(cls, 0, sizeof(*cls));
+    cls->version = NEW_CLASS_VERSION();
+    for (uint i = 0; i < len; i++) {
+        mp_obj_type_t *t = MP_OBJ_TO_PTR(items[i]);
+        if (mp_obj_is_instance_type(t)) {
+            ((mp_obj_class_t*)t)->has_subclasses = true;
+        }
+    }
+    mp_obj_type_t *o = &cls->type;
+    #else
+    mp_obj_type_t *o = m_new_obj(mp_obj_type_t);
+    memset(o, 0, sizeof(*o));
+    #endif
     o->base.type = &mp_type_type;
     o->name = name;
     o->print = instance_print;
@@ -920,6 +1291,9 @@ mp_obj_t mp_obj_new_type(qstr name, mp_obj_t bases_tuple, mp_obj_t locals_dict)
     }
     o->bases_tuple = MP_OBJ_TO_PTR(bases_tuple);
     o->locals_dict = MP_OBJ_TO_PTR(locals_dict);
+    #if CLASS_VERSIONS
+    o->locals_dict->map.is_class_dict = 1;
+    #endif
 
     const mp_obj_type_t *native_base;
     uint num_native_bases = instance_count_native_bases(o, &native_base);
@@ -40,6 +40,18 @@ typedef struct _mp_obj_instance_t {
 // this needs to be exposed for MICROPY_OPT_CACHE_MAP_LOOKUP_IN_BYTECODE to work
 void mp_obj_instance_attr(mp_obj_t self_in, qstr attr, mp_obj_t *dest);
 
+#if MICROPY_OPT_INLINE_CACHE
+// used by the VM to find attributes, with the cache set for the bytecode site
+struct _mp_inline_cache_entry_t;
+bool mp_inline_cache_load(struct _mp_inline_cache_entry_t *set, mp_obj_t base, qstr attr, mp_obj_t *dest);
+bool mp_inline_cache_store(struct _mp_inline_cache_entry_t *set, mp_obj_t base, qstr attr, mp_obj_t value);
+#endif
+
+#if MICROPY_OPT_INLINE_CACHE || MICROPY_OPT_METHOD_CACHE
+// used by dict to make the attribute caches drop what they have for a class
+void mp_obj_class_dict_changed(void);
+#endif
+
 // these need to be exposed so mp_obj_is_callable can work correctly
 bool mp_obj_instance_is_callable(mp_obj_t self_in);
 mp_obj_t mp_obj_instance_call(mp_obj_t self_in, size_t n_args, size_t n_kw, const mp_obj_t *args);
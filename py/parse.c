@@ -38,6 +38,7 @@
 #include "py/runtime0.h"
 #include "py/runtime.h"
 #include "py/objint.h"
+#include "py/objstr.h"
 #include "py/builtin.h"
 
 #if MICROPY_ENABLE_COMPILER
@@ -398,6 +399,43 @@ STATIC mp_parse_node_t make_node_const_object(parser_t *parser, size_t src_line,
     return (mp_parse_node_t)pn;
 }
 
+STATIC mp_parse_node_t make_node_str_or_bytes(parser_t *parser, size_t src_line, bool is_str, const char *str, size_t len) {
+    // Don't automatically intern all strings/bytes.  doc strings (which are usually large)
+    // will be discarded by the compiler, and so we shouldn't intern them.
+    qstr qst = MP_QSTR_NULL;
+    if (len <= MICROPY_ALLOC_PARSE_INTERN_STRING_LEN) {
+        // intern short strings
+        qst = qstr_from_strn(str, len);
+    } else {
+        // check if this string is already interned
+        qst = qstr_find_strn(str, len);
+    }
+    if (qst != MP_QSTR_NULL) {
+        // qstr exists, make a leaf node
+        return mp_parse_node_new_leaf(is_str ? MP_PARSE_NODE_STRING : MP_PARSE_NODE_BYTES, qst);
+    } else {
+        // not interned, make a node holding a pointer to the string/bytes data
+        return make_node_string_bytes(parser, src_line, is_str ? RULE_string : RULE_bytes, str, len);
+    }
+}
+
+#if MICROPY_COMP_CONST || MICROPY_COMP_CONST_FOLDING
+// make the most compact node that represents the given constant object
+STATIC mp_parse_node_t make_node_from_object(parser_t *parser, size_t src_line, mp_obj_t obj) {
+    if (MP_OBJ_IS_SMALL_INT(obj)) {
+        return mp_parse_node_new_leaf(MP_PARSE_NODE_SMALL_INT, MP_OBJ_SMALL_INT_VALUE(obj));
+    } else if (obj == mp_const_false || obj == mp_const_true) {
+        return mp_parse_node_new_leaf(MP_PARSE_NODE_TOKEN, obj == mp_const_true ? MP_TOKEN_KW_TRUE : MP_TOKEN_KW_FALSE);
+    } else if (MP_OBJ_IS_STR_OR_BYTES(obj)) {
+        size_t len;
+        const char *str = mp_obj_str_get_data(obj, &len);
+        return make_node_str_or_bytes(parser, src_line, MP_OBJ_IS_STR(obj), str, len);
+    } else {
+        return make_node_const_object(parser, src_line, obj);
+    }
+}
+#endif
+
 STATIC void push_result_token(parser_t *parser, const rule_t *rule) {
     mp_parse_node_t pn;
     mp_lexer_t *lex = parser->lexer;
@@ -408,7 +446,7 @@ STATIC void push_result_token(parser_t *parser, const rule_t *rule) {
         mp_map_elem_t *elem;
         if (rule->rule_id == RULE_atom
             && (elem = mp_map_lookup(&parser->consts, MP_OBJ_NEW_QSTR(id), MP_MAP_LOOKUP)) != NULL) {
-            pn = mp_parse_node_new_leaf(MP_PARSE_NODE_SMALL_INT, MP_OBJ_SMALL_INT_VALUE(elem->value));
+            pn = make_node_from_object(parser, lex->tok_line, elem->value);
         } else {
             pn = mp_parse_node_new_leaf(MP_PARSE_NODE_ID, id);
         }
@@ -427,23 +465,7 @@ STATIC void push_result_token(parser_t *parser, const rule_t *rule) {
         mp_obj_t o = mp_parse_num_decimal(lex->vstr.buf, lex->vstr.len, true, false, lex);
         pn = make_node_const_object(parser, lex->tok_line, o);
     } else if (lex->tok_kind == MP_TOKEN_STRING || lex->tok_kind == MP_TOKEN_BYTES) {
-        // Don't automatically intern all strings/bytes.  doc strings (which are usually large)
-        // will be discarded by the compiler, and so we shouldn't intern them.
-        qstr qst = MP_QSTR_NULL;
-        if (lex->vstr.len <= MICROPY_ALLOC_PARSE_INTERN_STRING_LEN) {
-            // intern short strings
-            qst = qstr_from_strn(lex->vstr.buf, lex->vstr.len);
-        } else {
-            // check if this string is already interned
-            qst = qstr_find_strn(lex->vstr.buf, lex->vstr.len);
-        }
-        if (qst != MP_QSTR_NULL) {
-            // qstr exists, make a leaf node
-            pn = mp_parse_node_new_leaf(lex->tok_kind == MP_TOKEN_STRING ? MP_PARSE_NODE_STRING : MP_PARSE_NODE_BYTES, qst);
-        } else {
-            // not interned, make a node holding a pointer to the string/bytes data
-            pn = make_node_string_bytes(parser, lex->tok_line, lex->tok_kind == MP_TOKEN_STRING ? RULE_string : RULE_bytes, lex->vstr.buf, lex->vstr.len);
-        }
+        pn = make_node_str_or_bytes(parser, lex->tok_line, lex->tok_kind == MP_TOKEN_STRING, lex->vstr.buf, lex->vstr.len);
     } else {
         pn = mp_parse_node_new_leaf(MP_PARSE_NODE_TOKEN, lex->tok_kind);
     }
@@ -467,8 +489,78 @@ STATIC MP_DEFINE_CONST_MAP(mp_constants_map, mp_constants_table);
 STATIC void push_result_rule(parser_t *parser, size_t src_line, const rule_t *rule, size_t num_args);
 
 #if MICROPY_COMP_CONST_FOLDING
+// the longest str/bytes that repetition of a literal may be folded into
+#define FOLD_STR_MAX_LEN (256)
+
+// get the constant value of an int, str or bytes literal, or of True/False/None
+STATIC bool get_const_object_maybe(mp_parse_node_t pn, mp_obj_t *o) {
+    if (mp_parse_node_get_int_maybe(pn, o)) {
+        return true;
+    } else if (MP_PARSE_NODE_IS_LEAF(pn)) {
+        uintptr_t arg = MP_PARSE_NODE_LEAF_ARG(pn);
+        switch (MP_PARSE_NODE_LEAF_KIND(pn)) {
+            case MP_PARSE_NODE_STRING:
+                *o = MP_OBJ_NEW_QSTR(arg);
+                return true;
+            case MP_PARSE_NODE_BYTES: {
+                size_t len;
+                const byte *data = qstr_data(arg, &len);
+                *o = mp_obj_new_bytes(data, len);
+                return true;
+            }
+            case MP_PARSE_NODE_TOKEN:
+                if (arg == MP_TOKEN_KW_NONE) {
+                    *o = mp_const_none;
+                } else if (arg == MP_TOKEN_KW_TRUE) {
+                    *o = mp_const_true;
+                } else if (arg == MP_TOKEN_KW_FALSE) {
+                    *o = mp_const_false;
+                } else {
+                    return false;
+                }
+                return true;
+        }
+    } else if (MP_PARSE_NODE_IS_STRUCT_KIND(pn, RULE_string)
+        || MP_PARSE_NODE_IS_STRUCT_KIND(pn, RULE_bytes)) {
+        mp_parse_node_struct_t *pns = (mp_parse_node_struct_t*)pn;
+        if (MP_PARSE_NODE_STRUCT_KIND(pns) == RULE_string) {
+            *o = mp_obj_new_str((const char*)pns->nodes[0], pns->nodes[1], false);
+        } else {
+            *o = mp_obj_new_bytes((const byte*)pns->nodes[0], pns->nodes[1]);
+        }
+        return true;
+    }
+    return false;
+}
+
+// check that a binary op on (at least one) str/bytes operand can be folded
+// without raising, and without making an unreasonably large literal
+STATIC bool fold_str_binary_op_ok(mp_binary_op_t op, mp_obj_t *lhs, mp_obj_t *rhs) {
+    if (op == MP_BINARY_OP_ADD) {
+        // "a" + "b", both str or both bytes
+        return MP_OBJ_IS_STR_OR_BYTES(*lhs) && mp_obj_get_type(*lhs) == mp_obj_get_type(*rhs);
+    } else if (op == MP_BINARY_OP_MULTIPLY) {
+        // "a" * n or n * "a"
+        if (MP_OBJ_IS_SMALL_INT(*lhs)) {
+            mp_obj_t tmp = *lhs;
+            *lhs = *rhs;
+            *rhs = tmp;
+        }
+        if (!MP_OBJ_IS_STR_OR_BYTES(*lhs) || !MP_OBJ_IS_SMALL_INT(*rhs)) {
+            return false;
+        }
+        size_t len;
+        mp_obj_str_get_data(*lhs, &len);
+        mp_int_t n = MP_OBJ_SMALL_INT_VALUE(*rhs);
+        return len == 0 || n <= 0 || (size_t)n <= FOLD_STR_MAX_LEN / len;
+    }
+    return false;
+}
+
 STATIC bool fold_constants(parser_t *parser, const rule_t *rule, size_t num_args) {
-    // this code does folding of arbitrary integer expressions, eg 1 + 2 * 3 + 4
+    // this code does folding of arbitrary integer expressions, eg 1 + 2 * 3 + 4,
+    // concatenation and repetition of str/bytes literals, eg "a" + "b" * 3,
+    // comparisons of such values and "not" applied to a constant
     // it does not do partial folding, eg 1 + 2 + x -> 3 + x
 
     mp_obj_t arg0;
@@ -501,13 +593,13 @@ STATIC bool fold_constants(parser_t *parser, const rule_t *rule, size_t num_args
         || rule->rule_id == RULE_term) {
         // folding for binary ops: << >> + - * / % //
         mp_parse_node_t pn = peek_result(parser, num_args - 1);
-        if (!mp_parse_node_get_int_maybe(pn, &arg0)) {
+        if (!get_const_object_maybe(pn, &arg0)) {
             return false;
         }
         for (ssize_t i = num_args - 2; i >= 1; i -= 2) {
             pn = peek_result(parser, i - 1);
             mp_obj_t arg1;
-            if (!mp_parse_node_get_int_maybe(pn, &arg1)) {
+            if (!get_const_object_maybe(pn, &arg1)) {
                 return false;
             }
             mp_token_kind_t tok = MP_PARSE_NODE_LEAF_ARG(peek_result(parser, i));
@@ -528,16 +620,22 @@ STATIC bool fold_constants(parser_t *parser, const rule_t *rule, size_t num_args
             if (op == (mp_binary_op_t)255) {
                 return false;
             }
-            int rhs_sign = mp_obj_int_sign(arg1);
-            if (op <= MP_BINARY_OP_RSHIFT) {
-                // << and >> can't have negative rhs
-                if (rhs_sign < 0) {
+            if (!MP_OBJ_IS_INT(arg0) || !MP_OBJ_IS_INT(arg1)) {
+                if (!fold_str_binary_op_ok(op, &arg0, &arg1)) {
                     return false;
                 }
-            } else if (op >= MP_BINARY_OP_FLOOR_DIVIDE) {
-                // % and // can't have zero rhs
-                if (rhs_sign == 0) {
-                    return false;
+            } else {
+                int rhs_sign = mp_obj_int_sign(arg1);
+                if (op <= MP_BINARY_OP_RSHIFT) {
+                    // << and >> can't have negative rhs
+                    if (rhs_sign < 0) {
+                        return false;
+                    }
+                } else if (op >= MP_BINARY_OP_FLOOR_DIVIDE) {
+                    // % and // can't have zero rhs
+                    if (rhs_sign == 0) {
+                        return false;
+                    }
                 }
             }
             arg0 = mp_binary_op(op, arg0, arg1);
@@ -559,6 +657,54 @@ STATIC bool fold_constants(parser_t *parser, const rule_t *rule, size_t num_args
             op = MP_UNARY_OP_INVERT;
         }
         arg0 = mp_unary_op(op, arg0);
+    } else if (rule->rule_id == RULE_comparison) {
+        // folding for comparisons: < > == <= >= != (possibly chained)
+        // between two ints, or between two str/bytes of the same type
+        mp_parse_node_t pn = peek_result(parser, num_args - 1);
+        if (!get_const_object_maybe(pn, &arg0)) {
+            return false;
+        }
+        bool result = true;
+        for (ssize_t i = num_args - 2; i >= 1; i -= 2) {
+            pn = peek_result(parser, i - 1);
+            mp_obj_t arg1;
+            if (!get_const_object_maybe(pn, &arg1)) {
+                return false;
+            }
+            if (MP_OBJ_IS_INT(arg0) && MP_OBJ_IS_INT(arg1)) {
+                // ok
+            } else if (MP_OBJ_IS_STR_OR_BYTES(arg0) && mp_obj_get_type(arg0) == mp_obj_get_type(arg1)) {
+                // ok
+            } else {
+                return false;
+            }
+            pn = peek_result(parser, i);
+            if (!MP_PARSE_NODE_IS_TOKEN(pn)) {
+                // "not in", "is" or "is not"
+                return false;
+            }
+            mp_binary_op_t op;
+            switch (MP_PARSE_NODE_LEAF_ARG(pn)) {
+                case MP_TOKEN_OP_LESS: op = MP_BINARY_OP_LESS; break;
+                case MP_TOKEN_OP_MORE: op = MP_BINARY_OP_MORE; break;
+                case MP_TOKEN_OP_DBL_EQUAL: op = MP_BINARY_OP_EQUAL; break;
+                case MP_TOKEN_OP_LESS_EQUAL: op = MP_BINARY_OP_LESS_EQUAL; break;
+                case MP_TOKEN_OP_MORE_EQUAL: op = MP_BINARY_OP_MORE_EQUAL; break;
+                case MP_TOKEN_OP_NOT_EQUAL: op = MP_BINARY_OP_NOT_EQUAL; break;
+                default: return false; // "in"
+            }
+            if (mp_binary_op(op, arg0, arg1) == mp_const_false) {
+                result = false;
+            }
+            arg0 = arg1;
+        }
+        arg0 = mp_obj_new_bool(result);
+    } else if (rule->rule_id == RULE_not_test_2) {
+        // folding for unary op: not
+        if (!get_const_object_maybe(peek_result(parser, 0), &arg0)) {
+            return false;
+        }
+        arg0 = mp_obj_new_bool(!mp_obj_is_true(arg0));
 
     #if MICROPY_COMP_CONST
     } else if (rule->rule_id == RULE_expr_stmt) {
@@ -581,16 +727,17 @@ STATIC bool fold_constants(parser_t *parser, const rule_t *rule, size_t num_args
 
                 // get the value
                 mp_parse_node_t pn_value = ((mp_parse_node_struct_t*)((mp_parse_node_struct_t*)pn1)->nodes[1])->nodes[0];
-                if (!MP_PARSE_NODE_IS_SMALL_INT(pn_value)) {
+                mp_obj_t value;
+                if (!get_const_object_maybe(pn_value, &value)
+                    || !(MP_OBJ_IS_INT(value) || MP_OBJ_IS_STR_OR_BYTES(value))) {
                     parser->parse_error = PARSE_ERROR_CONST;
                     return false;
                 }
-                mp_int_t value = MP_PARSE_NODE_LEAF_SMALL_INT(pn_value);
 
                 // store the value in the table of dynamic constants
                 mp_map_elem_t *elem = mp_map_lookup(&parser->consts, MP_OBJ_NEW_QSTR(id), MP_MAP_LOOKUP_ADD_IF_NOT_FOUND);
                 assert(elem->value == MP_OBJ_NULL);
-                elem->value = MP_OBJ_NEW_SMALL_INT(value);
+                elem->value = value;
 
                 // If the constant starts with an underscore then treat it as a private
                 // variable and don't emit any code to store the value to the id.
@@ -647,12 +794,8 @@ STATIC bool fold_constants(parser_t *parser, const rule_t *rule, size_t num_args
     for (size_t i = num_args; i > 0; i--) {
         pop_result(parser);
     }
-    if (MP_OBJ_IS_SMALL_INT(arg0)) {
-        push_result_node(parser, mp_parse_node_new_leaf(MP_PARSE_NODE_SMALL_INT, MP_OBJ_SMALL_INT_VALUE(arg0)));
-    } else {
-        // TODO reuse memory for parse node struct?
-        push_result_node(parser, make_node_const_object(parser, 0, arg0));
-    }
+    // TODO reuse memory for parse node struct?
+    push_result_node(parser, make_node_from_object(parser, 0, arg0));
 
     return true;
 }
@@ -1025,7 +1168,7 @@ mp_parse_tree_t mp_parse(mp_lexer_t *lex, mp_parse_input_kind_t input_kind) {
         #if MICROPY_COMP_CONST
         if (parser.parse_error == PARSE_ERROR_CONST) {
             exc = mp_obj_new_exception_msg(&mp_type_SyntaxError,
-                "constant must be an integer");
+                "constant must be an integer, str or bytes");
         } else
         #endif
         {
@@ -0,0 +1,142 @@
+/*
+ * This file is part of the Micro Python project, http://micropython.org/
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Pycom Limited
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "py/mpstate.h"
+#include "py/mphal.h"
+#include "py/bc.h"
+#include "py/profile.h"
+
+#if MICROPY_PY_MICROPYTHON_PROFILE
+
+#if MICROPY_PY_THREAD
+#define PROFILE_ENTER() mp_thread_mutex_lock(&MP_STATE_VM(profile_mutex), 1)
+#define PROFILE_EXIT() mp_thread_mutex_unlock(&MP_STATE_VM(profile_mutex))
+#else
+#define PROFILE_ENTER()
+#define PROFILE_EXIT()
+#endif
+
+void mp_profile_init(void) {
+    MP_STATE_VM(profile_table) = NULL;
+    MP_STATE_VM(profile_ticks) = 0;
+    #if MICROPY_PY_THREAD
+    mp_thread_mutex_init(&MP_STATE_VM(profile_mutex));
+    #endif
+}
+
+void mp_profile_start(mp_uint_t hz) {
+    mp_profile_stop(NULL);
+    mp_profile_entry_t *table = m_new0(mp_profile_entry_t, MICROPY_PROFILE_ENTRIES);
+    PROFILE_ENTER();
+    MP_STATE_VM(profile_table) = table;
+    MP_STATE_VM(profile_ticks) = 0;
+    MP_STATE_VM(profile_lost) = 0;
+    PROFILE_EXIT();
+    mp_hal_profile_timer(hz);
+}
+
+void mp_profile_tick(void) {
+    MP_STATE_VM(profile_ticks) += 1;
+}
+
+void mp_profile_sample(void) {
+    PROFILE_ENTER();
+    mp_uint_t n_ticks = MP_STATE_VM(profile_ticks);
+    MP_STATE_VM(profile_ticks) -= n_ticks;
+    if (n_ticks == 0 || MP_STATE_VM(profile_table) == NULL) {
+        // another thread took the sample, or the profiler was stopped
+        PROFILE_EXIT();
+        return;
+    }
+
+    // get the innermost part of the Python call stack
+    mp_profile_entry_t key;
+    key.n_samples = 0;
+    key.depth = 0;
+    size_t hash = 0;
+    for (const mp_code_state_t *cs = MP_STATE_THREAD(current_code_state);
+        cs != NULL && key.depth < MICROPY_PROFILE_DEPTH; cs = cs->caller) {
+        qstr source_file;
+        qstr block_name = mp_code_state_get_location(cs, &source_file, &key.frame[key.depth].source_line);
+        key.frame[key.depth].block_name = block_name;
+        hash = hash * 33 + block_name * 7 + key.frame[key.depth].source_line;
+        key.depth += 1;
+    }
+
+    // find its entry in the table by linear probing, making one if needed
+    size_t i = hash % MICROPY_PROFILE_ENTRIES;
+    for (size_t n = 0; n < MICROPY_PROFILE_ENTRIES; n++) {
+        mp_profile_entry_t *e = &MP_STATE_VM(profile_table)[i];
+        if (e->n_samples == 0) {
+            memcpy(e, &key, sizeof(key));
+        }
+        if (e->depth == key.depth && memcmp(e->frame, key.frame, key.depth * sizeof(key.frame[0])) == 0) {
+            e->n_samples += n_ticks;
+            PROFILE_EXIT();
+            return;
+        }
+        i = (i + 1) % MICROPY_PROFILE_ENTRIES;
+    }
+
+    // the table is full
+    MP_STATE_VM(profile_lost) += n_ticks;
+    PROFILE_EXIT();
+}
+
+// Stop the profiler and, if print isn't NULL, print the samples as collapsed
+// stacks: one line per stack with the outermost function first, eg
+// "<module>:12;f:4;g:7 25", as read by flamegraph.pl.
+void mp_profile_stop(const mp_print_t *print) {
+    mp_hal_profile_timer(0);
+    PROFILE_ENTER();
+    mp_profile_entry_t *table = MP_STATE_VM(profile_table);
+    MP_STATE_VM(profile_table) = NULL;
+    MP_STATE_VM(profile_ticks) = 0;
+    PROFILE_EXIT();
+    if (table == NULL) {
+        return;
+    }
+    for (size_t i = 0; print != NULL && i < MICROPY_PROFILE_ENTRIES; i++) {
+        const mp_profile_entry_t *e = &table[i];
+        if (e->n_samples == 0) {
+            continue;
+        }
+        for (size_t f = e->depth; f > 0; f--) {
+            mp_printf(print, f == e->depth ? "%q:%u" : ";%q:%u",
+                e->frame[f - 1].block_name, (uint)e->frame[f - 1].source_line);
+        }
+        mp_printf(print, " %u\n", (uint)e->n_samples);
+    }
+    if (print != NULL && MP_STATE_VM(profile_lost) != 0) {
+        // stacks that didn't fit in the table
+        mp_printf(print, "(other) %u\n", (uint)MP_STATE_VM(profile_lost));
+    }
+    m_del(mp_profile_entry_t, table, MICROPY_PROFILE_ENTRIES);
+}
+
+#endif // MICROPY_PY_MICROPYTHON_PROFILE
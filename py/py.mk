@@ -200,6 +200,7 @@ PY_O_BASENAME = \
 	vm.o \
 	bc.o \
 	showbc.o \
+	profile.o \
 	repl.o \
 	smallint.o \
 	frozenmod.o \
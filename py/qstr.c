@@ -32,8 +32,8 @@
 #include "py/qstr.h"
 #include "py/gc.h"
 
-// NOTE: we are using linear arrays to store and search for qstr's (unique strings, interned strings)
-// ultimately we will replace this with a static hash table of some kind
+// NOTE: we are using linear arrays to store qstr's (unique strings, interned strings), and
+// with MICROPY_OPT_QSTR_HASH_TABLE search them through open-addressed hash tables of indices
 // also probably need to include the length in the string data, to allow null bytes in the string
 
 #if 0 // print debugging info
@@ -81,13 +81,18 @@
 #endif
 
 // this must match the equivalent function in makeqstrdata.py
-mp_uint_t qstr_compute_hash(const byte *data, size_t len) {
+STATIC uint32_t qstr_compute_hash_full(const byte *data, size_t len) {
     // djb2 algorithm; see http://www.cse.yorku.ca/~oz/hash.html
-    mp_uint_t hash = 5381;
+    uint32_t hash = 5381;
     for (const byte *top = data + len; data < top; data++) {
         hash = ((hash << 5) + hash) ^ (*data); // hash * 33 ^ data
     }
-    hash &= Q_HASH_MASK;
+    return hash;
+}
+
+// this must match the equivalent function in makeqstrdata.py
+mp_uint_t qstr_compute_hash(const byte *data, size_t len) {
+    mp_uint_t hash = qstr_compute_hash_full(data, len) & Q_HASH_MASK;
     // Make sure that valid hash is never zero, zero means "hash not computed"
     if (hash == 0) {
         hash++;
@@ -95,15 +100,36 @@ mp_uint_t qstr_compute_hash(const byte *data, size_t len) {
     return hash;
 }
 
+#if MICROPY_OPT_QSTR_HASH_TABLE
+STATIC const uint16_t mp_qstr_const_hash_table[] = {
+#ifndef NO_QSTR
+#define QDEF(id, str)
+#define QHASH(idx) idx,
+#include "genhdr/qstrdefs.generated.h"
+#undef QHASH
+#undef QDEF
+#endif
+};
+#endif
+
 const qstr_pool_t mp_qstr_const_pool = {
     NULL,               // no previous pool
     0,                  // no previous pool
     10,                 // set so that the first dynamically allocated pool is twice this size; must be <= the len (just below)
     MP_QSTRnumber_of,   // corresponds to number of strings in array just below
+    #if MICROPY_OPT_QSTR_HASH_TABLE
+    mp_qstr_const_hash_table,
+    MP_ARRAY_SIZE(mp_qstr_const_hash_table),
+    #else
+    NULL,
+    0,
+    #endif
     {
 #ifndef NO_QSTR
 #define QDEF(id, str) str,
+#define QHASH(idx)
 #include "genhdr/qstrdefs.generated.h"
+#undef QHASH
 #undef QDEF
 #endif
     },
@@ -119,6 +145,10 @@ extern const qstr_pool_t MICROPY_QSTR_EXTRA_POOL;
 void qstr_init(void) {
     MP_STATE_VM(last_pool) = (qstr_pool_t*)&CONST_POOL; // we won't modify the const_pool since it has no allocated room left
     MP_STATE_VM(qstr_last_chunk) = NULL;
+    #if MICROPY_OPT_QSTR_HASH_TABLE
+    MP_STATE_VM(qstr_hash_table) = NULL;
+    MP_STATE_VM(qstr_hash_alloc) = 0;
+    #endif
 
     #if MICROPY_PY_THREAD
     mp_thread_mutex_init(&MP_STATE_VM(qstr_mutex));
@@ -137,10 +167,56 @@ STATIC const byte *find_qstr(qstr q) {
     return 0;
 }
 
+#if MICROPY_OPT_QSTR_HASH_TABLE
+
+// The heap pools share one table of qstr ids, indexed by the full hash of the
+// string and probed linearly.  It is kept at most half full.
+
+STATIC void qstr_hash_insert(qstr *table, size_t alloc, qstr q, const byte *q_ptr) {
+    size_t slot = qstr_compute_hash_full(Q_GET_DATA(q_ptr), Q_GET_LENGTH(q_ptr)) & (alloc - 1);
+    while (table[slot] != 0) {
+        slot = (slot + 1) & (alloc - 1);
+    }
+    table[slot] = q;
+}
+
+// qstr_mutex must be taken while in this function
+STATIC void qstr_hash_reserve(void) {
+    size_t n = MP_STATE_VM(last_pool)->total_prev_len + MP_STATE_VM(last_pool)->len
+        - (CONST_POOL.total_prev_len + CONST_POOL.len);
+    if (2 * (n + 1) <= MP_STATE_VM(qstr_hash_alloc)) {
+        return;
+    }
+
+    size_t alloc = MP_STATE_VM(qstr_hash_alloc) == 0 ? 32 : MP_STATE_VM(qstr_hash_alloc) * 2;
+    qstr *table = m_new_maybe(qstr, alloc);
+    if (table == NULL) {
+        QSTR_EXIT();
+        m_malloc_fail(alloc * sizeof(qstr));
+    }
+    memset(table, 0, alloc * sizeof(qstr));
+    for (qstr_pool_t *pool = MP_STATE_VM(last_pool); pool != &CONST_POOL; pool = pool->prev) {
+        for (size_t i = 0; i < pool->len; i++) {
+            qstr_hash_insert(table, alloc, pool->total_prev_len + i, pool->qstrs[i]);
+        }
+    }
+    // the old table is left to the GC, in case a lookup is still probing it
+    MP_STATE_VM(qstr_hash_table) = table;
+    MP_STATE_VM(qstr_hash_alloc) = alloc;
+    DEBUG_printf("QSTR: allocate new hash table of size %d\n", alloc);
+}
+
+#endif
+
 // qstr_mutex must be taken while in this function
 STATIC qstr qstr_add(const byte *q_ptr) {
     DEBUG_printf("QSTR: add hash=%d len=%d data=%.*s\n", Q_GET_HASH(q_ptr), Q_GET_LENGTH(q_ptr), Q_GET_LENGTH(q_ptr), Q_GET_DATA(q_ptr));
 
+    #if MICROPY_OPT_QSTR_HASH_TABLE
+    // make sure the hash table has room, before anything is modified
+    qstr_hash_reserve();
+    #endif
+
     // make sure we have room in the pool for a new qstr
     if (MP_STATE_VM(last_pool)->len >= MP_STATE_VM(last_pool)->alloc) {
         qstr_pool_t *pool = m_new_obj_var_maybe(qstr_pool_t, const char*, MP_STATE_VM(last_pool)->alloc * 2);
@@ -152,18 +228,68 @@ STATIC qstr qstr_add(const byte *q_ptr) {
         pool->total_prev_len = MP_STATE_VM(last_pool)->total_prev_len + MP_STATE_VM(last_pool)->len;
         pool->alloc = MP_STATE_VM(last_pool)->alloc * 2;
         pool->len = 0;
+        pool->hash_table = NULL;
+        pool->hash_alloc = 0;
         MP_STATE_VM(last_pool) = pool;
         DEBUG_printf("QSTR: allocate new pool of size %d\n", MP_STATE_VM(last_pool)->alloc);
     }
 
     // add the new qstr
     MP_STATE_VM(last_pool)->qstrs[MP_STATE_VM(last_pool)->len++] = q_ptr;
+    qstr q = MP_STATE_VM(last_pool)->total_prev_len + MP_STATE_VM(last_pool)->len - 1;
+
+    #if MICROPY_OPT_QSTR_HASH_TABLE
+    qstr_hash_insert(MP_STATE_VM(qstr_hash_table), MP_STATE_VM(qstr_hash_alloc), q, q_ptr);
+    #endif
 
     // return id for the newly-added qstr
-    return MP_STATE_VM(last_pool)->total_prev_len + MP_STATE_VM(last_pool)->len - 1;
+    return q;
 }
 
 qstr qstr_find_strn(const char *str, size_t str_len) {
+    #if MICROPY_OPT_QSTR_HASH_TABLE
+
+    // work out hash of str
+    uint32_t str_hash_full = qstr_compute_hash_full((const byte*)str, str_len);
+    mp_uint_t str_hash = str_hash_full & Q_HASH_MASK;
+    if (str_hash == 0) {
+        str_hash++;
+    }
+
+    // search the ROM pools, through their table if they have one
+    for (const qstr_pool_t *pool = &CONST_POOL; pool != NULL; pool = pool->prev) {
+        if (pool->hash_table == NULL) {
+            for (const byte *const *q = pool->qstrs, *const *q_top = pool->qstrs + pool->len; q < q_top; q++) {
+                if (Q_GET_HASH(*q) == str_hash && Q_GET_LENGTH(*q) == str_len && memcmp(Q_GET_DATA(*q), str, str_len) == 0) {
+                    return pool->total_prev_len + (q - pool->qstrs);
+                }
+            }
+            continue;
+        }
+        size_t mask = pool->hash_alloc - 1;
+        for (size_t slot = str_hash_full & mask; pool->hash_table[slot] != 0; slot = (slot + 1) & mask) {
+            size_t i = pool->hash_table[slot] - 1;
+            const byte *q = pool->qstrs[i];
+            if (Q_GET_HASH(q) == str_hash && Q_GET_LENGTH(q) == str_len && memcmp(Q_GET_DATA(q), str, str_len) == 0) {
+                return pool->total_prev_len + i;
+            }
+        }
+    }
+
+    // search the heap pools
+    qstr *table = MP_STATE_VM(qstr_hash_table);
+    if (table != NULL) {
+        size_t mask = MP_STATE_VM(qstr_hash_alloc) - 1;
+        for (size_t slot = str_hash_full & mask; table[slot] != 0; slot = (slot + 1) & mask) {
+            const byte *q = find_qstr(table[slot]);
+            if (Q_GET_HASH(q) == str_hash && Q_GET_LENGTH(q) == str_len && memcmp(Q_GET_DATA(q), str, str_len) == 0) {
+                return table[slot];
+            }
+        }
+    }
+
+    #else
+
     // work out hash of str
     mp_uint_t str_hash = qstr_compute_hash((const byte*)str, str_len);
 
@@ -176,6 +302,8 @@ qstr qstr_find_strn(const char *str, size_t str_len) {
         }
     }
 
+    #endif
+
     // not found; return null qstr
     return 0;
 }
@@ -304,6 +432,9 @@ void qstr_pool_info(size_t *n_pool, size_t *n_qstr, size_t *n_str_data_bytes, si
         *n_total_bytes += sizeof(qstr_pool_t) + sizeof(qstr) * pool->alloc;
         #endif
     }
+    #if MICROPY_OPT_QSTR_HASH_TABLE
+    *n_total_bytes += sizeof(qstr) * MP_STATE_VM(qstr_hash_alloc);
+    #endif
     *n_total_bytes += *n_str_data_bytes;
     QSTR_EXIT();
 }
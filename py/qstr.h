@@ -39,7 +39,9 @@
 enum {
 #ifndef NO_QSTR
 #define QDEF(id, str) id,
+#define QHASH(idx)
 #include "genhdr/qstrdefs.generated.h"
+#undef QHASH
 #undef QDEF
 #endif
     MP_QSTRnumber_of, // no underscore so it can't clash with any of the above
@@ -52,6 +54,10 @@ typedef struct _qstr_pool_t {
     size_t total_prev_len;
     size_t alloc;
     size_t len;
+    // precomputed lookup table for ROM pools, NULL for pools on the heap;
+    // entries are 1 + index into qstrs, 0 for an empty slot
+    const uint16_t *hash_table;
+    size_t hash_alloc; // a power of 2
     const byte *qstrs[];
 } qstr_pool_t;
 
@@ -39,10 +39,12 @@
 #include "py/objgenerator.h"
 #include "py/smallint.h"
 #include "py/runtime0.h"
+#include "py/bc.h"
 #include "py/runtime.h"
 #include "py/builtin.h"
 #include "py/stackctrl.h"
 #include "py/gc.h"
+#include "py/profile.h"
 
 #if 0 // print debugging info
 #define DEBUG_PRINT (1)
@@ -76,6 +78,40 @@ void mp_init(void) {
     // optimization disabled by default
     MP_STATE_VM(mp_optimise_value) = 0;
 
+    #if MICROPY_EMIT_NATIVE_TIERING
+    // tiering to native code disabled by default
+    MP_STATE_VM(tier_threshold) = 0;
+    #endif
+
+    #if MICROPY_OPT_INLINE_CACHE
+    // start with no cached attributes
+    memset(MP_STATE_THREAD(inline_cache), 0, sizeof(MP_STATE_THREAD(inline_cache)));
+    #endif
+
+    #if MICROPY_OPT_METHOD_CACHE
+    memset(MP_STATE_VM(method_cache), 0, sizeof(MP_STATE_VM(method_cache)));
+    #endif
+
+    #if MICROPY_PY_MICROPYTHON_PROFILE
+    mp_profile_init();
+    #endif
+
+    #if MICROPY_VM_OPCODE_STATS
+    mp_vm_opcode_stats_reset();
+    #endif
+
+    #if MICROPY_STACKLESS
+    // the frame stack is allocated on the first stackless call
+    MP_STATE_THREAD(frame_chunk) = NULL;
+    MP_STATE_THREAD(frame_top) = NULL;
+    MP_STATE_THREAD(frame_limit) = NULL;
+    MP_STATE_THREAD(frame_stack_size) = 0;
+    #if MICROPY_PY_THREAD
+    MP_STATE_VM(stackless_threads) = mp_thread_get_state();
+    MP_STATE_THREAD(next_thread) = NULL;
+    #endif
+    #endif
+
     // init global module stuff
     mp_module_init();
 
@@ -100,8 +136,18 @@ void mp_init(void) {
 
 void mp_deinit(void) {
     //mp_obj_dict_free(&dict_main);
+    #if MICROPY_GC_DEFER_FINALISER
+    // call the finalisers left in the queue, while the modules still work
+    gc_run_finalisers(MICROPY_GC_FINALISER_QUEUE_SIZE);
+    #endif
+
     mp_module_deinit();
 
+    #if MICROPY_PY_MICROPYTHON_PROFILE
+    // the port's timer must not fire after this
+    mp_profile_stop(NULL);
+    #endif
+
     // call port specific deinitialization if any 
 #ifdef MICROPY_PORT_INIT_FUNC
     MICROPY_PORT_DEINIT_FUNC;
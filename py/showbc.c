@@ -25,11 +25,141 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
 
+#include "py/mpstate.h"
 #include "py/bc0.h"
 #include "py/bc.h"
 
+#if MICROPY_VM_OPCODE_STATS >= 2
+#include "py/mphal.h"
+#endif
+
+#if MICROPY_DEBUG_PRINTERS || MICROPY_VM_OPCODE_STATS
+
+STATIC const char *const opcode_names[MP_BC_IMPORT_STAR + 1] = {
+    [MP_BC_LOAD_CONST_FALSE] = "LOAD_CONST_FALSE",
+    [MP_BC_LOAD_CONST_NONE] = "LOAD_CONST_NONE",
+    [MP_BC_LOAD_CONST_TRUE] = "LOAD_CONST_TRUE",
+    [MP_BC_LOAD_CONST_SMALL_INT] = "LOAD_CONST_SMALL_INT",
+    [MP_BC_LOAD_CONST_STRING] = "LOAD_CONST_STRING",
+    [MP_BC_LOAD_CONST_OBJ] = "LOAD_CONST_OBJ",
+    [MP_BC_LOAD_NULL] = "LOAD_NULL",
+    [MP_BC_LOAD_FAST_N] = "LOAD_FAST_N",
+    [MP_BC_LOAD_DEREF] = "LOAD_DEREF",
+    [MP_BC_LOAD_NAME] = "LOAD_NAME",
+    [MP_BC_LOAD_GLOBAL] = "LOAD_GLOBAL",
+    [MP_BC_LOAD_ATTR] = "LOAD_ATTR",
+    [MP_BC_LOAD_METHOD] = "LOAD_METHOD",
+    [MP_BC_LOAD_BUILD_CLASS] = "LOAD_BUILD_CLASS",
+    [MP_BC_LOAD_SUBSCR] = "LOAD_SUBSCR",
+    [MP_BC_STORE_FAST_N] = "STORE_FAST_N",
+    [MP_BC_STORE_DEREF] = "STORE_DEREF",
+    [MP_BC_STORE_NAME] = "STORE_NAME",
+    [MP_BC_STORE_GLOBAL] = "STORE_GLOBAL",
+    [MP_BC_STORE_ATTR] = "STORE_ATTR",
+    [MP_BC_STORE_SUBSCR] = "STORE_SUBSCR",
+    [MP_BC_DELETE_FAST] = "DELETE_FAST",
+    [MP_BC_DELETE_DEREF] = "DELETE_DEREF",
+    [MP_BC_DELETE_NAME] = "DELETE_NAME",
+    [MP_BC_DELETE_GLOBAL] = "DELETE_GLOBAL",
+    [MP_BC_FUSED_LOAD_FAST_ATTR] = "FUSED_LOAD_FAST_ATTR",
+    [MP_BC_FUSED_LOAD_FAST_METHOD] = "FUSED_LOAD_FAST_METHOD",
+    [MP_BC_FUSED_FAST_INT_BINARY_OP] = "FUSED_FAST_INT_BINARY_OP",
+    [MP_BC_FUSED_COMPARE_JUMP] = "FUSED_COMPARE_JUMP",
+    [MP_BC_DUP_TOP] = "DUP_TOP",
+    [MP_BC_DUP_TOP_TWO] = "DUP_TOP_TWO",
+    [MP_BC_POP_TOP] = "POP_TOP",
+    [MP_BC_ROT_TWO] = "ROT_TWO",
+    [MP_BC_ROT_THREE] = "ROT_THREE",
+    [MP_BC_JUMP] = "JUMP",
+    [MP_BC_POP_JUMP_IF_TRUE] = "POP_JUMP_IF_TRUE",
+    [MP_BC_POP_JUMP_IF_FALSE] = "POP_JUMP_IF_FALSE",
+    [MP_BC_JUMP_IF_TRUE_OR_POP] = "JUMP_IF_TRUE_OR_POP",
+    [MP_BC_JUMP_IF_FALSE_OR_POP] = "JUMP_IF_FALSE_OR_POP",
+    [MP_BC_SETUP_WITH] = "SETUP_WITH",
+    [MP_BC_WITH_CLEANUP] = "WITH_CLEANUP",
+    [MP_BC_SETUP_EXCEPT] = "SETUP_EXCEPT",
+    [MP_BC_SETUP_FINALLY] = "SETUP_FINALLY",
+    [MP_BC_END_FINALLY] = "END_FINALLY",
+    [MP_BC_GET_ITER] = "GET_ITER",
+    [MP_BC_FOR_ITER] = "FOR_ITER",
+    [MP_BC_POP_BLOCK] = "POP_BLOCK",
+    [MP_BC_POP_EXCEPT] = "POP_EXCEPT",
+    [MP_BC_UNWIND_JUMP] = "UNWIND_JUMP",
+    [MP_BC_BUILD_TUPLE] = "BUILD_TUPLE",
+    [MP_BC_BUILD_LIST] = "BUILD_LIST",
+    [MP_BC_BUILD_MAP] = "BUILD_MAP",
+    [MP_BC_STORE_MAP] = "STORE_MAP",
+    [MP_BC_BUILD_SET] = "BUILD_SET",
+    [MP_BC_BUILD_SLICE] = "BUILD_SLICE",
+    [MP_BC_STORE_COMP] = "STORE_COMP",
+    [MP_BC_UNPACK_SEQUENCE] = "UNPACK_SEQUENCE",
+    [MP_BC_UNPACK_EX] = "UNPACK_EX",
+    [MP_BC_RETURN_VALUE] = "RETURN_VALUE",
+    [MP_BC_RAISE_VARARGS] = "RAISE_VARARGS",
+    [MP_BC_YIELD_VALUE] = "YIELD_VALUE",
+    [MP_BC_YIELD_FROM] = "YIELD_FROM",
+    [MP_BC_MAKE_FUNCTION] = "MAKE_FUNCTION",
+    [MP_BC_MAKE_FUNCTION_DEFARGS] = "MAKE_FUNCTION_DEFARGS",
+    [MP_BC_MAKE_CLOSURE] = "MAKE_CLOSURE",
+    [MP_BC_MAKE_CLOSURE_DEFARGS] = "MAKE_CLOSURE_DEFARGS",
+    [MP_BC_CALL_FUNCTION] = "CALL_FUNCTION",
+    [MP_BC_CALL_FUNCTION_VAR_KW] = "CALL_FUNCTION_VAR_KW",
+    [MP_BC_CALL_METHOD] = "CALL_METHOD",
+    [MP_BC_CALL_METHOD_VAR_KW] = "CALL_METHOD_VAR_KW",
+    [MP_BC_IMPORT_NAME] = "IMPORT_NAME",
+    [MP_BC_IMPORT_FROM] = "IMPORT_FROM",
+    [MP_BC_IMPORT_STAR] = "IMPORT_STAR",
+};
+
+// Returns the name of an opcode, without its arguments, or NULL if it's not
+// a valid opcode.  The opcodes that encode an argument share a name.
+const char *mp_bytecode_opcode_name(byte op) {
+    if (op <= MP_BC_IMPORT_STAR) {
+        return opcode_names[op];
+    } else if (op < MP_BC_LOAD_CONST_SMALL_INT_MULTI) {
+        return NULL;
+    } else if (op < MP_BC_LOAD_CONST_SMALL_INT_MULTI + 64) {
+        return "LOAD_CONST_SMALL_INT";
+    } else if (op < MP_BC_LOAD_FAST_MULTI + 16) {
+        return "LOAD_FAST";
+    } else if (op < MP_BC_STORE_FAST_MULTI + 16) {
+        return "STORE_FAST";
+    } else if (op < MP_BC_UNARY_OP_MULTI + 7) {
+        return "UNARY_OP";
+    } else if (op < MP_BC_BINARY_OP_MULTI + 36) {
+        return "BINARY_OP";
+    } else {
+        return NULL;
+    }
+}
+
+// Prints the name of an opcode, and the argument encoded in it if it has one
+void mp_bytecode_print_opcode(const mp_print_t *print, byte op) {
+    const char *name = mp_bytecode_opcode_name(op);
+    if (name == NULL) {
+        mp_printf(print, "0x%02x", op);
+        return;
+    }
+    mp_print_str(print, name);
+    if (op >= MP_BC_BINARY_OP_MULTI) {
+        mp_uint_t n = op - MP_BC_BINARY_OP_MULTI;
+        mp_printf(print, " " UINT_FMT " %s", n, qstr_str(mp_binary_op_method_name[n]));
+    } else if (op >= MP_BC_UNARY_OP_MULTI) {
+        mp_printf(print, " " UINT_FMT, (mp_uint_t)op - MP_BC_UNARY_OP_MULTI);
+    } else if (op >= MP_BC_STORE_FAST_MULTI) {
+        mp_printf(print, " " UINT_FMT, (mp_uint_t)op - MP_BC_STORE_FAST_MULTI);
+    } else if (op >= MP_BC_LOAD_FAST_MULTI) {
+        mp_printf(print, " " UINT_FMT, (mp_uint_t)op - MP_BC_LOAD_FAST_MULTI);
+    } else if (op >= MP_BC_LOAD_CONST_SMALL_INT_MULTI) {
+        mp_printf(print, " " INT_FMT, (mp_int_t)op - MP_BC_LOAD_CONST_SMALL_INT_MULTI - 16);
+    }
+}
+
+#endif // MICROPY_DEBUG_PRINTERS || MICROPY_VM_OPCODE_STATS
+
 #if MICROPY_DEBUG_PRINTERS
 
 // redirect all printfs in this file to the platform print stream
@@ -524,18 +654,26 @@ const byte *mp_bytecode_print_str(const byte *ip) {
             printf("IMPORT_STAR");
             break;
 
+        case MP_BC_FUSED_LOAD_FAST_ATTR:
+            printf("FUSED_LOAD_FAST_ATTR");
+            break;
+
+        case MP_BC_FUSED_LOAD_FAST_METHOD:
+            printf("FUSED_LOAD_FAST_METHOD");
+            break;
+
+        case MP_BC_FUSED_FAST_INT_BINARY_OP:
+            printf("FUSED_FAST_INT_BINARY_OP");
+            break;
+
+        case MP_BC_FUSED_COMPARE_JUMP:
+            printf("FUSED_COMPARE_JUMP");
+            break;
+
         default:
-            if (ip[-1] < MP_BC_LOAD_CONST_SMALL_INT_MULTI + 64) {
-                printf("LOAD_CONST_SMALL_INT " INT_FMT, (mp_int_t)ip[-1] - MP_BC_LOAD_CONST_SMALL_INT_MULTI - 16);
-            } else if (ip[-1] < MP_BC_LOAD_FAST_MULTI + 16) {
-                printf("LOAD_FAST " UINT_FMT, (mp_uint_t)ip[-1] - MP_BC_LOAD_FAST_MULTI);
-            } else if (ip[-1] < MP_BC_STORE_FAST_MULTI + 16) {
-                printf("STORE_FAST " UINT_FMT, (mp_uint_t)ip[-1] - MP_BC_STORE_FAST_MULTI);
-            } else if (ip[-1] < MP_BC_UNARY_OP_MULTI + 7) {
-                printf("UNARY_OP " UINT_FMT, (mp_uint_t)ip[-1] - MP_BC_UNARY_OP_MULTI);
-            } else if (ip[-1] < MP_BC_BINARY_OP_MULTI + 36) {
-                mp_uint_t op = ip[-1] - MP_BC_BINARY_OP_MULTI;
-                printf("BINARY_OP " UINT_FMT " %s", op, qstr_str(mp_binary_op_method_name[op]));
+            if (ip[-1] >= MP_BC_LOAD_CONST_SMALL_INT_MULTI && mp_bytecode_opcode_name(ip[-1]) != NULL) {
+                // an opcode with its argument encoded in it
+                mp_bytecode_print_opcode(&mp_plat_print, ip[-1]);
             } else {
                 printf("code %p, byte code 0x%02x not implemented\n", ip, ip[-1]);
                 assert(0);
@@ -557,3 +695,149 @@ void mp_bytecode_print2(const byte *ip, mp_uint_t len) {
 }
 
 #endif // MICROPY_DEBUG_PRINTERS
+
+#if MICROPY_VM_OPCODE_STATS
+
+// number of opcode pairs to print, most frequent first
+#define OPCODE_STATS_NUM_PAIRS (32)
+
+// mp_printf can't print a mp_uint_t wider than an int
+STATIC void opcode_stats_print_uint(const mp_print_t *print, mp_uint_t x, int width) {
+    char buf[24];
+    char *b = buf + sizeof(buf);
+    do {
+        *--b = '0' + x % 10;
+        x /= 10;
+    } while (x != 0);
+    mp_print_strn(print, b, buf + sizeof(buf) - b, 0, ' ', width);
+}
+
+#if MICROPY_VM_OPCODE_STATS >= 2
+// The opcodes that encode an argument are a family, named by their first opcode
+STATIC byte opcode_stats_family(byte op) {
+    if (op < MP_BC_LOAD_CONST_SMALL_INT_MULTI) {
+        return op;
+    } else if (op < MP_BC_LOAD_FAST_MULTI) {
+        return MP_BC_LOAD_CONST_SMALL_INT_MULTI;
+    } else if (op < MP_BC_STORE_FAST_MULTI) {
+        return MP_BC_LOAD_FAST_MULTI;
+    } else if (op < MP_BC_UNARY_OP_MULTI) {
+        return MP_BC_STORE_FAST_MULTI;
+    } else if (op < MP_BC_BINARY_OP_MULTI) {
+        return MP_BC_UNARY_OP_MULTI;
+    } else {
+        return MP_BC_BINARY_OP_MULTI;
+    }
+}
+#endif
+
+void mp_vm_opcode_stats_reset(void) {
+    memset(MP_STATE_VM(opcode_count), 0, sizeof(MP_STATE_VM(opcode_count)));
+    memset(MP_STATE_VM(opcode_pair_count), 0, sizeof(MP_STATE_VM(opcode_pair_count)));
+    // 0 is not an opcode, so the pairs and ticks charged to it are ignored
+    MP_STATE_VM(opcode_last) = 0;
+    #if MICROPY_VM_OPCODE_STATS >= 2
+    memset(MP_STATE_VM(opcode_ticks), 0, sizeof(MP_STATE_VM(opcode_ticks)));
+    MP_STATE_VM(opcode_ticks_last) = mp_hal_ticks_cpu();
+    #endif
+}
+
+void mp_vm_opcode_stats_print(const mp_print_t *print) {
+    // sort the opcodes by the number of times they were executed, most first
+    byte order[256];
+    size_t n = 0;
+    mp_uint_t total = 0;
+    for (size_t op = 1; op < 256; op++) {
+        mp_uint_t count = MP_STATE_VM(opcode_count)[op];
+        if (count == 0) {
+            continue;
+        }
+        total += count;
+        size_t j = n++;
+        for (; j > 0 && MP_STATE_VM(opcode_count)[order[j - 1]] < count; j--) {
+            order[j] = order[j - 1];
+        }
+        order[j] = op;
+    }
+
+    mp_print_str(print, "opcodes: ");
+    opcode_stats_print_uint(print, total, 0);
+    mp_print_str(print, " executed\n     count opcode\n");
+    for (size_t i = 0; i < n; i++) {
+        opcode_stats_print_uint(print, MP_STATE_VM(opcode_count)[order[i]], 10);
+        mp_print_str(print, " ");
+        mp_bytecode_print_opcode(print, order[i]);
+        mp_print_str(print, "\n");
+    }
+
+    // the most frequent pairs of consecutive opcodes
+    uint16_t pairs[OPCODE_STATS_NUM_PAIRS];
+    n = 0;
+    for (size_t p = 256; p < 256 * 256; p++) {
+        uint32_t count = MP_STATE_VM(opcode_pair_count)[p >> 8][p & 0xff];
+        if (count == 0 || (n == OPCODE_STATS_NUM_PAIRS
+            && MP_STATE_VM(opcode_pair_count)[pairs[n - 1] >> 8][pairs[n - 1] & 0xff] >= count)) {
+            continue;
+        }
+        size_t j = n < OPCODE_STATS_NUM_PAIRS ? n++ : n - 1;
+        for (; j > 0 && MP_STATE_VM(opcode_pair_count)[pairs[j - 1] >> 8][pairs[j - 1] & 0xff] < count; j--) {
+            pairs[j] = pairs[j - 1];
+        }
+        pairs[j] = p;
+    }
+    mp_print_str(print, "pairs:\n     count opcodes\n");
+    for (size_t i = 0; i < n; i++) {
+        mp_printf(print, "%10u ", (uint)MP_STATE_VM(opcode_pair_count)[pairs[i] >> 8][pairs[i] & 0xff]);
+        mp_bytecode_print_opcode(print, pairs[i] >> 8);
+        mp_print_str(print, ", ");
+        mp_bytecode_print_opcode(print, pairs[i] & 0xff);
+        mp_print_str(print, "\n");
+    }
+
+    #if MICROPY_VM_OPCODE_STATS >= 2
+    // the ticks spent in each family of opcodes, most first
+    struct {
+        byte op;
+        mp_uint_t count;
+        mp_uint_t ticks;
+    } fams[MP_BC_IMPORT_STAR + 1 + 5], fam;
+    n = 0;
+    mp_uint_t total_ticks = 0;
+    for (size_t op = 1; op < 256; op++) {
+        if (MP_STATE_VM(opcode_count)[op] == 0) {
+            continue;
+        }
+        fam.op = opcode_stats_family(op);
+        fam.count = MP_STATE_VM(opcode_count)[op];
+        fam.ticks = MP_STATE_VM(opcode_ticks)[op];
+        total_ticks += fam.ticks;
+        if (n > 0 && fams[n - 1].op == fam.op) {
+            // the opcodes of a family are consecutive
+            fams[n - 1].count += fam.count;
+            fams[n - 1].ticks += fam.ticks;
+        } else {
+            fams[n++] = fam;
+        }
+    }
+    for (size_t i = 1; i < n; i++) {
+        fam = fams[i];
+        size_t j = i;
+        for (; j > 0 && fams[j - 1].ticks < fam.ticks; j--) {
+            fams[j] = fams[j - 1];
+        }
+        fams[j] = fam;
+    }
+    mp_print_str(print, "ticks: ");
+    opcode_stats_print_uint(print, total_ticks, 0);
+    mp_print_str(print, "\n     ticks  per-op   % family\n");
+    for (size_t i = 0; i < n; i++) {
+        opcode_stats_print_uint(print, fams[i].ticks, 10);
+        opcode_stats_print_uint(print, fams[i].ticks / fams[i].count, 8);
+        mp_printf(print, " %3u %s\n",
+            (uint)((unsigned long long)fams[i].ticks * 100 / (total_ticks ? total_ticks : 1)),
+            mp_bytecode_opcode_name(fams[i].op));
+    }
+    #endif
+}
+
+#endif // MICROPY_VM_OPCODE_STATS
@@ -33,9 +33,17 @@
 #include "py/nlr.h"
 #include "py/emitglue.h"
 #include "py/objtype.h"
+#include "py/runtime0.h"
 #include "py/runtime.h"
 #include "py/bc0.h"
 #include "py/bc.h"
+#include "py/gc.h"
+#include "py/smallint.h"
+#include "py/profile.h"
+
+#if MICROPY_VM_OPCODE_STATS >= 2
+#include "py/mphal.h"
+#endif
 
 #if 0
 //#define TRACE(ip) printf("sp=" INT_FMT " ", sp - code_state->sp); mp_bytecode_print2(ip, 1);
@@ -96,6 +104,17 @@ typedef enum {
 
 #endif
 
+#if MICROPY_EMIT_NATIVE_TIERING
+// a taken backward jump is a loop iteration, which makes the function hotter
+#define TIER_JUMP(slab) do { \
+    if ((mp_int_t)(slab) < 0 && code_state->tier != NULL) { \
+        code_state->tier->hotness += 1; \
+    } \
+} while (0)
+#else
+#define TIER_JUMP(slab) (void)0
+#endif
+
 #define PUSH(val) *++sp = (val)
 #define POP() (*sp--)
 #define TOP() (*sp)
@@ -121,6 +140,47 @@ typedef enum {
     exc_sp--; /* pop back to previous exception handler */ \
     CLEAR_SYS_EXC_INFO() /* just clear sys.exc_info(), not compliant, but it shouldn't be used in 1st place */
 
+#if MICROPY_VM_SUPERINSTRUCTIONS
+// The common binary ops on small ints, for the superinstructions.  Returns
+// MP_OBJ_NULL if the op is not one of these or the result is not a small int.
+STATIC mp_obj_t vm_small_int_binary_op(mp_binary_op_t op, mp_int_t lhs, mp_int_t rhs) {
+    switch (op) {
+        case MP_BINARY_OP_LESS: return mp_obj_new_bool(lhs < rhs);
+        case MP_BINARY_OP_MORE: return mp_obj_new_bool(lhs > rhs);
+        case MP_BINARY_OP_EQUAL: return mp_obj_new_bool(lhs == rhs);
+        case MP_BINARY_OP_LESS_EQUAL: return mp_obj_new_bool(lhs <= rhs);
+        case MP_BINARY_OP_MORE_EQUAL: return mp_obj_new_bool(lhs >= rhs);
+        case MP_BINARY_OP_NOT_EQUAL: return mp_obj_new_bool(lhs != rhs);
+        case MP_BINARY_OP_ADD:
+        case MP_BINARY_OP_INPLACE_ADD: lhs += rhs; break;
+        case MP_BINARY_OP_SUBTRACT:
+        case MP_BINARY_OP_INPLACE_SUBTRACT: lhs -= rhs; break;
+        default: return MP_OBJ_NULL;
+    }
+    if (!MP_SMALL_INT_FITS(lhs)) {
+        return MP_OBJ_NULL;
+    }
+    return MP_OBJ_NEW_SMALL_INT(lhs);
+}
+#endif
+
+#if MICROPY_VM_OPCODE_STATS
+// Count an opcode that is about to be executed.  With timing, the ticks since
+// the previous opcode started are charged to that opcode (they include any
+// non-bytecode functions it called).  Threads may race on these counters.
+static inline void vm_opcode_stats(byte op) {
+    byte last = MP_STATE_VM(opcode_last);
+    MP_STATE_VM(opcode_count)[op] += 1;
+    MP_STATE_VM(opcode_pair_count)[last][op] += 1;
+    MP_STATE_VM(opcode_last) = op;
+    #if MICROPY_VM_OPCODE_STATS >= 2
+    mp_uint_t t = mp_hal_ticks_cpu();
+    MP_STATE_VM(opcode_ticks)[last] += t - MP_STATE_VM(opcode_ticks_last);
+    MP_STATE_VM(opcode_ticks_last) = t;
+    #endif
+}
+#endif
+
 // fastn has items in reverse order (fastn[0] is local[0], fastn[-1] is local[1], etc)
 // sp points to bottom of stack which grows up
 // returns:
@@ -136,11 +196,28 @@ mp_vm_return_kind_t mp_execute_bytecode(mp_code_state_t *code_state, volatile mp
 #define MARK_EXC_IP_SELECTIVE()
 #define MARK_EXC_IP_GLOBAL() { code_state->ip = ip; } /* stores ip pointing to last opcode */
 #endif
+#if MICROPY_PY_MICROPYTHON_PROFILE
+// sample the call stack if the profiler's timer has ticked
+#define PROFILE_SAMPLE() do { \
+    if (MP_STATE_VM(profile_ticks) != 0) { \
+        MARK_EXC_IP_SELECTIVE(); \
+        mp_profile_sample(); \
+    } \
+} while (0)
+#else
+#define PROFILE_SAMPLE()
+#endif
+#if MICROPY_VM_OPCODE_STATS
+#define OPCODE_STATS(op) vm_opcode_stats(op)
+#else
+#define OPCODE_STATS(op)
+#endif
 #if MICROPY_OPT_COMPUTED_GOTO
     #include "py/vmentrytable.h"
     #define DISPATCH() do { \
         TRACE(ip); \
         MARK_EXC_IP_GLOBAL(); \
+        OPCODE_STATS(*ip); \
         goto *entry_table[*ip++]; \
     } while (0)
     #define DISPATCH_WITH_PEND_EXC_CHECK() goto pending_exception_check
@@ -159,16 +236,23 @@ mp_vm_return_kind_t mp_execute_bytecode(mp_code_state_t *code_state, volatile mp
     // loop and the exception handler, leading to very obscure bugs.
     #define RAISE(o) do { nlr_pop(); nlr.ret_val = MP_OBJ_TO_PTR(o); goto exception_handler; } while (0)
 
-#if MICROPY_STACKLESS
-run_code_state: ;
-#endif
     // Pointers which are constant for particular invocation of mp_execute_bytecode()
     mp_obj_t * /*const*/ fastn = &code_state->state[code_state->n_state - 1];
     mp_exc_stack_t * /*const*/ exc_stack = (mp_exc_stack_t*)(code_state->state + code_state->n_state);
 
+    #if MICROPY_OPT_INLINE_CACHE
+    // the inline cache entries for the current bytecode site
+    #define INLINE_CACHE_SET() (MP_STATE_THREAD(inline_cache)[(uintptr_t)ip % MICROPY_OPT_INLINE_CACHE_SIZE])
+    #endif
+
     // variables that are visible to the exception handler (declared volatile)
     volatile bool currently_in_except_block = MP_TAGPTR_TAG0(code_state->exc_sp); // 0 or 1, to detect nested exceptions
     mp_exc_stack_t *volatile exc_sp = MP_TAGPTR_PTR(code_state->exc_sp); // stack grows up, exc_sp points to top of stack
+    #if MICROPY_STACKLESS
+    // stackless calls and returns change code_state without leaving the nlr
+    // block, so keep a copy that the exception handler can rely on
+    mp_code_state_t *volatile code_state_exc = code_state;
+    #endif
 
     // outer exception handling loop
     for (;;) {
@@ -181,6 +265,25 @@ outer_dispatch_loop:
             mp_obj_t obj_shared;
             MICROPY_VM_HOOK_INIT
 
+            #if MICROPY_STACKLESS
+            if (0) {
+            stackless_switch:
+                // a stackless call or return: switch to the new code_state
+                // while staying inside this nlr block
+                code_state_exc = code_state;
+                #if MICROPY_TRACK_CODE_STATE
+                MP_STATE_THREAD(current_code_state) = code_state;
+                #endif
+                fastn = &code_state->state[code_state->n_state - 1];
+                exc_stack = (mp_exc_stack_t*)(code_state->state + code_state->n_state);
+                currently_in_except_block = MP_TAGPTR_TAG0(code_state->exc_sp);
+                exc_sp = MP_TAGPTR_PTR(code_state->exc_sp);
+                ip = code_state->ip;
+                sp = code_state->sp;
+                goto dispatch_loop;
+            }
+            #endif
+
             // If we have exception to inject, now that we finish setting up
             // execution context, raise it. This works as if RAISE_VARARGS
             // bytecode was executed.
@@ -201,6 +304,7 @@ dispatch_loop:
 #else
                 TRACE(ip);
                 MARK_EXC_IP_GLOBAL();
+                OPCODE_STATS(*ip);
                 switch (*ip++) {
 #endif
 
@@ -325,13 +429,26 @@ dispatch_loop:
                 #endif
 
                 #if !MICROPY_OPT_CACHE_MAP_LOOKUP_IN_BYTECODE
+                #if MICROPY_VM_SUPERINSTRUCTIONS
+                load_attr:
+                #endif
                 ENTRY(MP_BC_LOAD_ATTR): {
                     MARK_EXC_IP_SELECTIVE();
                     DECODE_QSTR;
+                    #if MICROPY_OPT_INLINE_CACHE
+                    mp_obj_t dest[2];
+                    if (mp_inline_cache_load(INLINE_CACHE_SET(), TOP(), qst, dest)) {
+                        SET_TOP(dest[1] == MP_OBJ_NULL ? dest[0] : mp_obj_new_bound_meth(dest[0], dest[1]));
+                        DISPATCH();
+                    }
+                    #endif
                     SET_TOP(mp_load_attr(TOP(), qst));
                     DISPATCH();
                 }
                 #else
+                #if MICROPY_VM_SUPERINSTRUCTIONS
+                load_attr:
+                #endif
                 ENTRY(MP_BC_LOAD_ATTR): {
                     MARK_EXC_IP_SELECTIVE();
                     DECODE_QSTR;
@@ -356,15 +473,32 @@ dispatch_loop:
                         DISPATCH();
                     }
                 load_attr_cache_fail:
+                    #if MICROPY_OPT_INLINE_CACHE
+                    {
+                        // eg a method or class attribute
+                        mp_obj_t dest[2];
+                        if (mp_inline_cache_load(INLINE_CACHE_SET(), top, qst, dest)) {
+                            SET_TOP(dest[1] == MP_OBJ_NULL ? dest[0] : mp_obj_new_bound_meth(dest[0], dest[1]));
+                            ip++;
+                            DISPATCH();
+                        }
+                    }
+                    #endif
                     SET_TOP(mp_load_attr(top, qst));
                     ip++;
                     DISPATCH();
                 }
                 #endif
 
+                #if MICROPY_VM_SUPERINSTRUCTIONS
+                load_method:
+                #endif
                 ENTRY(MP_BC_LOAD_METHOD): {
                     MARK_EXC_IP_SELECTIVE();
                     DECODE_QSTR;
+                    #if MICROPY_OPT_INLINE_CACHE
+                    if (!mp_inline_cache_load(INLINE_CACHE_SET(), *sp, qst, sp))
+                    #endif
                     mp_load_method(*sp, qst, sp);
                     sp += 1;
                     DISPATCH();
@@ -412,6 +546,9 @@ dispatch_loop:
                 ENTRY(MP_BC_STORE_ATTR): {
                     MARK_EXC_IP_SELECTIVE();
                     DECODE_QSTR;
+                    #if MICROPY_OPT_INLINE_CACHE
+                    if (!mp_inline_cache_store(INLINE_CACHE_SET(), sp[0], qst, sp[-1]))
+                    #endif
                     mp_store_attr(sp[0], qst, sp[-1]);
                     sp -= 2;
                     DISPATCH();
@@ -442,6 +579,7 @@ dispatch_loop:
                             }
                         }
                         elem->value = sp[-1];
+                        GC_WRITE_BARRIER(self->members.table);
                         sp -= 2;
                         ip++;
                         DISPATCH();
@@ -528,6 +666,7 @@ dispatch_loop:
                 ENTRY(MP_BC_JUMP): {
                     DECODE_SLABEL;
                     ip += slab;
+                    TIER_JUMP(slab);
                     DISPATCH_WITH_PEND_EXC_CHECK();
                 }
 
@@ -535,6 +674,7 @@ dispatch_loop:
                     DECODE_SLABEL;
                     if (mp_obj_is_true(POP())) {
                         ip += slab;
+                        TIER_JUMP(slab);
                     }
                     DISPATCH_WITH_PEND_EXC_CHECK();
                 }
@@ -543,6 +683,7 @@ dispatch_loop:
                     DECODE_SLABEL;
                     if (!mp_obj_is_true(POP())) {
                         ip += slab;
+                        TIER_JUMP(slab);
                     }
                     DISPATCH_WITH_PEND_EXC_CHECK();
                 }
@@ -889,8 +1030,7 @@ unwind_jump:;
                         if (new_state) {
                             new_state->prev = code_state;
                             code_state = new_state;
-                            nlr_pop();
-                            goto run_code_state;
+                            goto stackless_switch;
                         }
                         #if MICROPY_STACKLESS_STRICT
                         else {
@@ -927,8 +1067,7 @@ unwind_jump:;
                         if (new_state) {
                             new_state->prev = code_state;
                             code_state = new_state;
-                            nlr_pop();
-                            goto run_code_state;
+                            goto stackless_switch;
                         }
                         #if MICROPY_STACKLESS_STRICT
                         else {
@@ -961,8 +1100,7 @@ unwind_jump:;
                         if (new_state) {
                             new_state->prev = code_state;
                             code_state = new_state;
-                            nlr_pop();
-                            goto run_code_state;
+                            goto stackless_switch;
                         }
                         #if MICROPY_STACKLESS_STRICT
                         else {
@@ -998,8 +1136,7 @@ unwind_jump:;
                         if (new_state) {
                             new_state->prev = code_state;
                             code_state = new_state;
-                            nlr_pop();
-                            goto run_code_state;
+                            goto stackless_switch;
                         }
                         #if MICROPY_STACKLESS_STRICT
                         else {
@@ -1014,6 +1151,7 @@ unwind_jump:;
 
                 ENTRY(MP_BC_RETURN_VALUE):
                     MARK_EXC_IP_SELECTIVE();
+                    PROFILE_SAMPLE();
                     // These next 3 lines pop a try-finally exception handler, if one
                     // is there on the exception stack.  Without this the finally block
                     // is executed a second time when the return is executed, because
@@ -1048,7 +1186,6 @@ unwind_return:
                         }
                         exc_sp--;
                     }
-                    nlr_pop();
                     code_state->sp = sp;
                     assert(exc_sp == exc_stack - 1);
                     MICROPY_VM_HOOK_RETURN
@@ -1056,11 +1193,14 @@ unwind_return:
                     if (code_state->prev != NULL) {
                         mp_obj_t res = *sp;
                         mp_globals_set(code_state->old_globals);
-                        code_state = code_state->prev;
+                        mp_code_state_t *new_code_state = code_state->prev;
+                        mp_obj_fun_bc_release_codestate(code_state);
+                        code_state = new_code_state;
                         *code_state->sp = res;
-                        goto run_code_state;
+                        goto stackless_switch;
                     }
                     #endif
+                    nlr_pop();
                     return MP_VM_RETURN_NORMAL;
 
                 ENTRY(MP_BC_RAISE_VARARGS): {
@@ -1175,6 +1315,75 @@ yield:
                     mp_import_all(POP());
                     DISPATCH();
 
+                #if MICROPY_VM_SUPERINSTRUCTIONS
+                // A superinstruction is followed by the opcodes it stands for,
+                // which it reads and then skips.
+                ENTRY(MP_BC_FUSED_LOAD_FAST_ATTR):
+                    obj_shared = fastn[MP_BC_LOAD_FAST_MULTI - (mp_int_t)ip[0]];
+                    if (obj_shared == MP_OBJ_NULL) {
+                        goto local_name_error;
+                    }
+                    PUSH(obj_shared);
+                    ip += 2;
+                    goto load_attr;
+
+                ENTRY(MP_BC_FUSED_LOAD_FAST_METHOD):
+                    obj_shared = fastn[MP_BC_LOAD_FAST_MULTI - (mp_int_t)ip[0]];
+                    if (obj_shared == MP_OBJ_NULL) {
+                        goto local_name_error;
+                    }
+                    PUSH(obj_shared);
+                    ip += 2;
+                    goto load_method;
+
+                ENTRY(MP_BC_FUSED_FAST_INT_BINARY_OP): {
+                    MARK_EXC_IP_SELECTIVE();
+                    mp_obj_t lhs = fastn[MP_BC_LOAD_FAST_MULTI - (mp_int_t)ip[0]];
+                    if (lhs == MP_OBJ_NULL) {
+                        goto local_name_error;
+                    }
+                    mp_int_t rhs = (mp_int_t)ip[1] - MP_BC_LOAD_CONST_SMALL_INT_MULTI - 16;
+                    mp_binary_op_t op = ip[2] - MP_BC_BINARY_OP_MULTI;
+                    ip += 3;
+                    obj_shared = MP_OBJ_NULL;
+                    if (MP_OBJ_IS_SMALL_INT(lhs)) {
+                        obj_shared = vm_small_int_binary_op(op, MP_OBJ_SMALL_INT_VALUE(lhs), rhs);
+                    }
+                    if (obj_shared == MP_OBJ_NULL) {
+                        obj_shared = mp_binary_op(op, lhs, MP_OBJ_NEW_SMALL_INT(rhs));
+                    }
+                    if (*ip == MP_BC_POP_JUMP_IF_TRUE || *ip == MP_BC_POP_JUMP_IF_FALSE) {
+                        goto pop_jump_if;
+                    }
+                    PUSH(obj_shared);
+                    DISPATCH();
+                }
+
+                ENTRY(MP_BC_FUSED_COMPARE_JUMP): {
+                    MARK_EXC_IP_SELECTIVE();
+                    mp_obj_t rhs = POP();
+                    mp_obj_t lhs = POP();
+                    mp_binary_op_t op = *ip++ - MP_BC_BINARY_OP_MULTI;
+                    obj_shared = MP_OBJ_NULL;
+                    if (MP_OBJ_IS_SMALL_INT(lhs) && MP_OBJ_IS_SMALL_INT(rhs)) {
+                        obj_shared = vm_small_int_binary_op(op, MP_OBJ_SMALL_INT_VALUE(lhs), MP_OBJ_SMALL_INT_VALUE(rhs));
+                    }
+                    if (obj_shared == MP_OBJ_NULL) {
+                        obj_shared = mp_binary_op(op, lhs, rhs);
+                    }
+                    pop_jump_if: {
+                        // obj_shared is the condition, and ip is at the jump
+                        bool jump_if_true = *ip++ == MP_BC_POP_JUMP_IF_TRUE;
+                        DECODE_SLABEL;
+                        if (mp_obj_is_true(obj_shared) == jump_if_true) {
+                            ip += slab;
+                            TIER_JUMP(slab);
+                        }
+                        DISPATCH_WITH_PEND_EXC_CHECK();
+                    }
+                }
+                #endif
+
 #if MICROPY_OPT_COMPUTED_GOTO
                 ENTRY(MP_BC_LOAD_CONST_SMALL_INT_MULTI):
                     PUSH(MP_OBJ_NEW_SMALL_INT((mp_int_t)ip[-1] - MP_BC_LOAD_CONST_SMALL_INT_MULTI - 16));
@@ -1237,6 +1446,12 @@ yield:
 
 pending_exception_check:
                 MICROPY_VM_HOOK_LOOP
+                PROFILE_SAMPLE();
+                #if MICROPY_GC_DEFER_FINALISER
+                if (MP_STATE_VM(gc_finaliser_queue_len) != 0) {
+                    gc_run_finalisers(MICROPY_GC_FINALISER_BATCH);
+                }
+                #endif
                 if (MP_STATE_VM(mp_pending_exception) != MP_OBJ_NULL) {
                     MARK_EXC_IP_SELECTIVE();
                     mp_obj_t obj = MP_STATE_VM(mp_pending_exception);
@@ -1254,6 +1469,12 @@ pending_exception_check:
 exception_handler:
             // exception occurred
 
+            #if MICROPY_STACKLESS
+            code_state = code_state_exc;
+            fastn = &code_state->state[code_state->n_state - 1];
+            exc_stack = (mp_exc_stack_t*)(code_state->state + code_state->n_state);
+            #endif
+
             #if MICROPY_PY_SYS_EXC_INFO
             MP_STATE_VM(cur_exception) = nlr.ret_val;
             #endif
@@ -1290,40 +1511,9 @@ unwind_loop:
             // But consider how to handle nested exceptions.
             // TODO need a better way of not adding traceback to constant objects (right now, just GeneratorExit_obj and MemoryError_obj)
             if (nlr.ret_val != &mp_const_GeneratorExit_obj && nlr.ret_val != &mp_const_MemoryError_obj) {
-                const byte *ip = code_state->code_info;
-                mp_uint_t code_info_size = mp_decode_uint(&ip);
-                #if MICROPY_PERSISTENT_CODE
-                qstr block_name = ip[0] | (ip[1] << 8);
-                qstr source_file = ip[2] | (ip[3] << 8);
-                ip += 4;
-                #else
-                qstr block_name = mp_decode_uint(&ip);
-                qstr source_file = mp_decode_uint(&ip);
-                #endif
-                size_t bc = code_state->ip - code_state->code_info - code_info_size;
-                size_t source_line = 1;
-                size_t c;
-                while ((c = *ip)) {
-                    mp_uint_t b, l;
-                    if ((c & 0x80) == 0) {
-                        // 0b0LLBBBBB encoding
-                        b = c & 0x1f;
-                        l = c >> 5;
-                        ip += 1;
-                    } else {
-                        // 0b1LLLBBBB 0bLLLLLLLL encoding (l's LSB in second byte)
-                        b = c & 0xf;
-                        l = ((c << 4) & 0x700) | ip[1];
-                        ip += 2;
-                    }
-                    if (bc >= b) {
-                        bc -= b;
-                        source_line += l;
-                    } else {
-                        // found source line corresponding to bytecode offset
-                        break;
-                    }
-                }
+                qstr source_file;
+                size_t source_line;
+                qstr block_name = mp_code_state_get_location(code_state, &source_file, &source_line);
                 mp_obj_exception_add_traceback(MP_OBJ_FROM_PTR(nlr.ret_val), source_file, source_line, block_name);
             }
 
@@ -1355,7 +1545,13 @@ unwind_loop:
             #if MICROPY_STACKLESS
             } else if (code_state->prev != NULL) {
                 mp_globals_set(code_state->old_globals);
-                code_state = code_state->prev;
+                mp_code_state_t *new_code_state = code_state->prev;
+                mp_obj_fun_bc_release_codestate(code_state);
+                code_state = new_code_state;
+                code_state_exc = code_state;
+                #if MICROPY_TRACK_CODE_STATE
+                MP_STATE_THREAD(current_code_state) = code_state;
+                #endif
                 fastn = &code_state->state[code_state->n_state - 1];
                 exc_stack = (mp_exc_stack_t*)(code_state->state + code_state->n_state);
                 // variables that are visible to the exception handler (declared volatile)
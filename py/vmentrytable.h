@@ -56,6 +56,12 @@ static const void *const entry_table[256] = {
     [MP_BC_DELETE_DEREF] = &&entry_MP_BC_DELETE_DEREF,
     [MP_BC_DELETE_NAME] = &&entry_MP_BC_DELETE_NAME,
     [MP_BC_DELETE_GLOBAL] = &&entry_MP_BC_DELETE_GLOBAL,
+    #if MICROPY_VM_SUPERINSTRUCTIONS
+    [MP_BC_FUSED_LOAD_FAST_ATTR] = &&entry_MP_BC_FUSED_LOAD_FAST_ATTR,
+    [MP_BC_FUSED_LOAD_FAST_METHOD] = &&entry_MP_BC_FUSED_LOAD_FAST_METHOD,
+    [MP_BC_FUSED_FAST_INT_BINARY_OP] = &&entry_MP_BC_FUSED_FAST_INT_BINARY_OP,
+    [MP_BC_FUSED_COMPARE_JUMP] = &&entry_MP_BC_FUSED_COMPARE_JUMP,
+    #endif
     [MP_BC_DUP_TOP] = &&entry_MP_BC_DUP_TOP,
     [MP_BC_DUP_TOP_TWO] = &&entry_MP_BC_DUP_TOP_TWO,
     [MP_BC_POP_TOP] = &&entry_MP_BC_POP_TOP,
@@ -0,0 +1,32 @@
+# test that every name that dir() lists for builtin types and modules can be
+# looked up, and that names which are not there can't; the types with sorted
+# tables are all here, and one out of order shows up as a name not found
+
+try:
+    import math
+except ImportError:
+    math = None
+try:
+    import uio as io
+except ImportError:
+    try:
+        import io
+    except ImportError:
+        io = None
+
+objs = [list, dict, set, frozenset, str, bytes]
+if math is not None:
+    objs.append(math)
+if io is not None:
+    objs.append(io.StringIO)
+    objs.append(io.BytesIO)
+
+for o in objs:
+    names = dir(o)
+    print(all([hasattr(o, name) for name in names]))
+    print(all([hasattr(o, "".join(list(name))) for name in names]))
+    print(hasattr(o, 'not_an_attr'), hasattr(o, ''), hasattr(o, '~'))
+
+# lookups that fall before the first and after the last entry
+print(hasattr([], 'AAAA'), hasattr([], 'zzzz'))
+print([].append is not None, {}.values is not None, 'a'.upper())
@@ -0,0 +1,76 @@
+# test that attribute lookups see changes to classes and instances
+# (the VM may cache how attributes are found at each bytecode site)
+
+class A:
+    x = 1
+    def f(self):
+        return 'A.f'
+
+class B(A):
+    def g(self):
+        return 'B.g'
+
+class C(A):
+    x = 3
+    def f(self):
+        return 'C.f'
+
+def get(o):
+    return o.x
+
+def call(o):
+    return o.f()
+
+def load(o):
+    m = o.f
+    return m()
+
+# the same sites see several types
+a, b, c = A(), B(), C()
+for i in range(3):
+    print(get(a), get(b), get(c), get(A), get(B), get(C))
+    print(call(a), call(b), call(c), load(b))
+
+# changes to a class are seen by instances of it and its subclasses
+A.x = 10
+print(get(a), get(b), get(c), get(A), get(B))
+A.f = lambda self: 'new A.f'
+print(call(a), call(b), call(c), load(b))
+del A.x
+try:
+    get(b)
+except AttributeError:
+    print('AttributeError')
+A.x = 1
+
+# an instance member hides the class attribute, until it's deleted
+b.x = 'member'
+b.f = lambda: 'member f'
+print(get(b), call(b), load(b))
+del b.x
+del b.f
+print(get(b), call(b), load(b))
+
+# stores to a member at the same site on different types
+def put(o, v):
+    o.y = v
+    return o.y
+
+for o in (a, b, c, a, b, c):
+    print(put(o, id(o) == id(a)))
+
+# static and class methods, and classes as attributes
+class D:
+    @staticmethod
+    def s():
+        return 'static'
+    @classmethod
+    def k(cls):
+        return cls.__name__
+    kind = A
+
+class E(D):
+    pass
+
+for o in (D(), E(), D, E):
+    print(o.s(), o.k(), o.kind.__name__)
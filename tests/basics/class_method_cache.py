@@ -0,0 +1,49 @@
+# test that lookups in deep class hierarchies see changes to the classes
+
+class A:
+    def f(self):
+        return 'A.f'
+    def __add__(self, other):
+        return 'A.add'
+
+class B(A):
+    pass
+
+class C(B):
+    @classmethod
+    def cm(cls):
+        return cls.__name__
+
+class D(C):
+    pass
+
+d = D()
+for i in range(3):
+    print(d.f(), getattr(d, 'f')(), d + 1, D.f(d))
+
+# a change to a base class is seen by its subclasses
+A.f = lambda self: 'new A.f'
+A.__add__ = lambda self, other: 'new A.add'
+print(d.f(), getattr(d, 'f')(), d + 1, D.f(d))
+
+# an attribute that isn't there, and then is
+for i in range(3):
+    print(hasattr(d, 'g'))
+B.g = lambda self: 'B.g'
+print(hasattr(d, 'g'), d.g())
+del B.g
+print(hasattr(d, 'g'))
+
+# a class that hides an attribute of its base, and then doesn't
+D.f = lambda self: 'D.f'
+print(d.f())
+del D.f
+print(d.f())
+
+# a classmethod is bound to the class of the object
+print(d.cm(), D.cm(), C().cm())
+
+# new classes with the same bases and attributes
+for i in range(4):
+    X = type('X', (A,), {'v': i})
+    print(X().v, X.v, X() + 1)
@@ -0,0 +1,58 @@
+# tests constant folding in the compiler of str/bytes, comparisons, "not" and tuples
+
+# concatenation
+print('a' + 'b', b'a' + b'b', 'a' + 'b' + 'c' + 'd')
+print('' + 'abc' + '')
+print('a long string that is not interned' + ' and another one')
+
+# repetition
+print('ab' * 3, 3 * 'ab', b'ab' * 2, 'ab' * 0, 'ab' * -1, '' * 1000)
+print(len('x' * 1000), len('ab' * 200 + 'c'))
+print(('a' + 'b') * 2, 2 * 'a' * 3)
+
+# these aren't folded and must raise at runtime
+for f in (lambda: 'a' + b'b', lambda: 'a' + 1, lambda: 1 + 'a', lambda: 'a' - 'a', lambda: 'a' * 1.5):
+    try:
+        f()
+    except TypeError:
+        print('TypeError')
+
+# comparisons
+print(1 < 2, 2 < 1, 1 > 2, 1 == 1, 1 != 1, 1 <= 1, 1 >= 2)
+print(1 < 2 < 3, 1 < 3 < 2, 3 > 2 > 1 > 0, 1 == 1 != 2)
+print(1 << 100 > 1 << 99, -(1 << 100) < 0)
+print('a' < 'b', 'b' < 'a', 'a' == 'a', 'ab' >= 'a', b'a' < b'b', 'x' * 3 == 'xxx')
+print(1 == 'a', 1 in (1, 2), 'a' in 'abc', None is None)
+try:
+    'a' < 1
+except TypeError:
+    print('TypeError')
+
+# not
+print(not 0, not 1, not '', not 'a', not b'', not None, not True, not False)
+print(not 1 < 2, not not 1, not (1 == 2))
+
+# conditions
+if 1 < 2:
+    print('taken')
+if 'a' > 'b':
+    print('not taken')
+if not 0:
+    print('taken')
+if None:
+    print('not taken')
+else:
+    print('else')
+while 2 < 1:
+    print('not taken')
+
+# tuples of constants
+print((1, 2), (1, 'a', b'b', None, True, False, ...), (1,), ())
+print((1, 2.5, 1 << 100, (), 'a long string that is not interned'))
+print((1, (2, 3)), (1, [2]), (-1, 3 + 4, 'a' * 2))
+t = (1, 2, 3)
+print(t, t[1], 1 in t, t + t, len(t))
+
+def f():
+    return (1, 2)
+print(f() == (1, 2))
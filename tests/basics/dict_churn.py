@@ -0,0 +1,56 @@
+# a dict held at a constant size under insert/delete churn must not keep growing
+
+try:
+    import gc
+    gc.mem_free
+except (ImportError, AttributeError):
+    print("SKIP")
+    import sys
+    sys.exit()
+
+try:
+    from ucollections import OrderedDict
+except ImportError:
+    from collections import OrderedDict
+
+for cls in (dict, OrderedDict):
+    d = cls()
+    for i in range(1000):
+        d[i] = i
+    n = 1000
+    growth = []
+    for r in range(4):
+        for j in range(5000):
+            d[n] = n
+            del d[n - 1000]
+            n += 1
+        gc.collect()
+        if r == 0:
+            m0 = gc.mem_free()
+        else:
+            growth.append(m0 - gc.mem_free())
+    print(cls.__name__, len(d), max(growth) < 4096)
+
+# popitem followed by an insert reuses the place of the popped element
+for cls in (dict, OrderedDict):
+    d = cls()
+    for i in range(1000):
+        d[i] = i
+    n = 1000
+    growth = []
+    for r in range(4):
+        for j in range(5000):
+            d.popitem()
+            d[n] = n
+            n += 1
+        gc.collect()
+        if r == 0:
+            m0 = gc.mem_free()
+        else:
+            growth.append(m0 - gc.mem_free())
+    k = list(d)
+    print(cls.__name__, len(d), k[-2:], max(growth) < 4096)
+    while d:
+        d.popitem()
+    d[0] = 0
+    print(list(d.items()))
@@ -0,0 +1,63 @@
+# test sequences of opcodes that the compiler may fuse into one
+
+# a local and a small int
+def f(x):
+    return x + 1, x - 2, x * 3, x < 4, x >= 5, x == 6, x != 7, x % 8, x in (9,)
+print(f(5))
+print(f(-100))
+print(f(True))
+print(f(2.5))
+print(f(1 << 100))
+
+# results that don't fit a small int
+def f(x):
+    return x + 47, x - 16, x + -16
+for i in (0, 1, 0x3fffffff - 47, 0x3fffffff, 0x7fffffffffffffff - 47, 0x7fffffffffffffff, -0x40000000, -0x4000000000000000):
+    print(f(i), f(-i))
+
+# a compare and a conditional jump
+def f(n):
+    i = 0
+    while i < n:
+        i += 1
+    return i
+print(f(10), f(0), f(-1), f(2.5))
+
+def f(a, b):
+    if a < b:
+        return 'lt'
+    elif a == b:
+        return 'eq'
+    if not a >= b:
+        return 'never'
+    return 'gt'
+print(f(1, 2), f(2, 2), f(3, 2), f('a', 'b'), f([2], [1]), f(1 << 80, 1 << 79))
+
+# compare that returns an object that isn't a bool
+class A:
+    def __init__(self, v):
+        self.v = v
+    def __lt__(self, other):
+        return self.v
+    def get(self):
+        return self.v
+def f(a):
+    if a < 1:
+        return True
+    return False
+print(f(A(0)), f(A(1)), f(A([])), f(A('x')))
+
+# a local and an attribute or method
+def f(a):
+    return a.v, a.get(), a.get
+a = A(5)
+print(f(a)[:2], f(a)[2]())
+
+# a jump to the next instruction
+def f(x):
+    if x:
+        y = 1
+    else:
+        pass
+    return x
+print(f(0), f(1))
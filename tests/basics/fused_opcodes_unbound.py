@@ -0,0 +1,24 @@
+# test fused opcodes whose local isn't bound yet
+
+class A:
+    def __init__(self, v):
+        self.v = v
+    def get(self):
+        return self.v
+a = A(5)
+
+def f():
+    try:
+        x.v
+    except NameError:
+        print('NameError')
+    try:
+        x.get()
+    except NameError:
+        print('NameError')
+    try:
+        x + 1
+    except NameError:
+        print('NameError')
+    x = a
+f()
@@ -0,0 +1,20 @@
+# check that attribute names built at runtime find their interned strings,
+# for both builtin names and lots of new ones
+
+class A:
+    pass
+
+a = A()
+
+# names that are already interned in ROM
+print(getattr([], "app" + "end") is not None)
+print(getattr(a, "__cl" + "ass__") is A)
+
+# enough new names to grow the interned string storage several times
+n = 500
+for i in range(n):
+    setattr(a, "attr_%d" % i, i)
+
+print(all([getattr(a, "attr_" + str(i)) == i for i in range(n)]))
+print(sum([getattr(a, "".join(["at", "tr_", str(i)])) for i in range(0, n, 7)]))
+print(hasattr(a, "attr_%d" % n))
@@ -0,0 +1,27 @@
+# OrderedDict with many deletions and reinsertions
+try:
+    from collections import OrderedDict
+except ImportError:
+    try:
+        from ucollections import OrderedDict
+    except ImportError:
+        print("SKIP")
+        import sys
+        sys.exit()
+
+d = OrderedDict()
+for i in range(50):
+    k = 'k%d' % (i * 7 % 50)
+    d[k] = i
+    if i % 3 == 0:
+        del d[k]
+print(len(d), list(d.keys()))
+print(d['k14'], 'k0' in d, 'k7' in d)
+
+# reinsert a deleted key, it goes at the end
+d['k0'] = 100
+print(list(d.items())[-2:])
+
+e = d.copy()
+print(type(e) is type(d), list(e) == list(d))
+print(e.pop('k0'), len(e), len(d))
@@ -0,0 +1,14 @@
+# Allocates and discards objects larger than the holes left in a heap that
+# is fragmented by small live objects.
+import bench
+
+def test(num):
+    objs = [(i,) for i in range(num // 1000)]
+    # free every other object to leave small holes throughout the heap
+    keep = objs[1::2]
+    objs = None
+    t = (None,)
+    for i in range(num // 200):
+        t * (32 + i % 32)
+
+bench.run(test)
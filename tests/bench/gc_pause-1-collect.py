@@ -0,0 +1,11 @@
+# Full garbage collections of a populated heap, each one a pause of the
+# whole program.
+import bench
+import gc
+
+def test(num):
+    heap = [[i, str(i)] for i in range(num // 4000)]
+    for i in range(num // 1000000):
+        gc.collect()
+
+bench.run(test)
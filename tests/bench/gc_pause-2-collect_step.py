@@ -0,0 +1,19 @@
+# The same collections as gc_pause-1 done in small incremental steps, with
+# the application running between them.
+import bench
+import gc
+
+if not hasattr(gc, 'collect_step'):
+    print('SKIP')
+    raise SystemExit
+
+def test(num):
+    heap = [[i, str(i)] for i in range(num // 4000)]
+    # only the explicit steps below may advance the collection
+    gc.disable()
+    for i in range(num // 1000000):
+        while not gc.collect_step(256):
+            heap[i] = [i, str(i)]
+    gc.enable()
+
+bench.run(test)
@@ -0,0 +1,10 @@
+# Searching a log buffer for a substring that is near its end
+import bench
+
+def test(num):
+    buf = "GET /index.html HTTP/1.1 200 512\n" * 200 + "POST /login HTTP/1.1 403 0\n"
+    for i in iter(range(num//20000)):
+        buf.find("HTTP/1.1 403")
+        buf.rfind("GET /login")
+
+bench.run(test)
@@ -0,0 +1,11 @@
+# Splitting and counting in a multi-kilobyte buffer with a multi-byte separator
+import bench
+
+def test(num):
+    buf = b"Host: example.com\r\nAccept: */*\r\nX-Id: 1234567890\r\n" * 100
+    for i in iter(range(num//40000)):
+        buf.split(b"\r\n")
+        buf.count(b"X-Id:")
+        b"\r\n\r\n" in buf
+
+bench.run(test)
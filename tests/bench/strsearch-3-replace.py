@@ -0,0 +1,10 @@
+# Replacing a rare substring in a long string
+import bench
+
+def test(num):
+    buf = "abcdefghij" * 1000 + "needle" + "abcdefghij" * 1000
+    for i in iter(range(num//100000)):
+        buf.replace("needle", "pin")
+        buf.partition("needle")
+
+bench.run(test)
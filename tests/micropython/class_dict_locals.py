@@ -0,0 +1,43 @@
+# test that the attribute caches see changes made to the dict of a class
+# that isn't made through the class; unlike CPython, the class doesn't copy it
+
+class A:
+    d = locals()
+    def f(self):
+        return 1
+
+class B(A):
+    pass
+
+a = A()
+b = B()
+for i in range(3):
+    print(a.f(), b.f(), hasattr(a, 'g'))
+
+A.d['f'] = lambda self: 2
+A.d['g'] = 3
+print(a.f(), b.f(), hasattr(a, 'g'), b.g)
+del A.d['g']
+print(hasattr(b, 'g'))
+A.d.update(f=lambda self: 4)
+print(a.f(), b.f())
+A.d.pop('f')
+print(hasattr(a, 'f'), hasattr(b, 'f'))
+
+# a dict passed to type() is also the dict of the class
+def get(o):
+    return o.v
+
+d = {'v': 1}
+X = type('X', (), d)
+x = X()
+for i in range(3):
+    print(get(x))
+d['v'] = 2
+print(get(x), get(X))
+X.v = 3
+print(d['v'], get(x))
+d.setdefault('w', 4)
+print(x.w)
+d.clear()
+print(hasattr(x, 'v'), hasattr(X, 'w'))
@@ -0,0 +1,31 @@
+# test constant optimisation of str, bytes and big int values
+
+from micropython import const
+
+S = const('abc')
+B = const(b'abc' * 2)
+L = const(1 << 100)
+_DEBUG = const(0)
+_NAME = const('name' + '_' + S)
+
+print(S, B, L, _NAME)
+
+def f():
+    # constants are also substituted in nested functions
+    def g():
+        return S + '!', L + 1, _NAME
+    return g()
+
+print(f())
+
+def f(x):
+    if _DEBUG:
+        print('debug', undefined_name)
+    if not _DEBUG:
+        print('not debug')
+    if _NAME == 'name_abc':
+        return x
+    return None
+
+print(f(1))
+print(S in ('abc', 'def'), (S, _DEBUG))
@@ -13,3 +13,7 @@ test_syntax("a = const(x)")
 
 # redefined constant
 test_syntax("A = const(1); A = const(2)")
+
+# argument not an int, str or bytes
+test_syntax("a = const(1.5)")
+test_syntax("a = const(None)")
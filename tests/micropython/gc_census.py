@@ -0,0 +1,45 @@
+# test gc.census(), gc.snapshot() and gc.diff()
+
+import gc
+
+try:
+    gc.census
+except AttributeError:
+    print('SKIP')
+    import sys
+    sys.exit()
+
+class Leak:
+    pass
+
+# classes are counted as type objects
+c = gc.census()
+print(type(c))
+print('Leak' in c, c['type'][0] >= 1)
+print(all([n >= 1 and b > 0 for n, b in c.values()]))
+
+leaked = []
+old = gc.snapshot()
+for i in range(10):
+    leaked.append(Leak())
+d = gc.diff(old)
+print(d['Leak'][0], d['Leak'][1] > 0)
+
+# the new objects go away again
+leaked = None
+d = gc.diff(old, gc.snapshot())
+print('Leak' in d)
+
+# a type that disappears from the census has negative changes
+print(gc.diff({'Leak': (3, 48)}, {}))
+
+try:
+    gc.diff(1)
+except TypeError:
+    print('TypeError')
+
+# only objects are counted, not eg the items of a list of classes
+old = gc.snapshot()
+classes = [Leak] * 20
+d = gc.diff(old)
+print('Leak' in d, d['list'][0])
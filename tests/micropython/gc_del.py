@@ -0,0 +1,83 @@
+# test finalisers called after a collection, via __del__
+
+import gc
+
+deleted = []
+
+class A:
+    def __init__(self, n):
+        self.n = n
+        self.data = [n] * 4
+
+    def __del__(self):
+        # a finaliser can allocate, and the object's members are still alive
+        deleted.append(str(self.data[-1]))
+
+class B:
+    raised = False
+
+    def __init__(self, n):
+        pass
+
+    def __del__(self):
+        if not B.raised:
+            B.raised = True
+            raise ValueError('in finaliser')
+
+def make(n, cls=A):
+    for i in range(n):
+        cls(i)
+
+def clear_stack():
+    x = [0, 0, 0, 0, 0, 0, 0, 0]
+    return x
+
+def collect():
+    clear_stack()
+    gc.collect()
+    # finalisers are called by the VM loop
+    for i in range(100):
+        pass
+
+make(20)
+collect()
+if not deleted:
+    print('SKIP')
+    import sys
+    sys.exit()
+
+# most objects will be finalised, each once, some may still be on the stack
+collect()
+collect()
+print(len(deleted) >= 10, len(set(deleted)) == len(deleted))
+print(all([0 <= int(n) < 20 for n in deleted]))
+
+# an exception in a finaliser is reported and the program continues
+make(5, B)
+collect()
+
+# instances made after __del__ is added to a class get a finaliser
+class C:
+    pass
+
+class D(C):
+    pass
+
+make(5, D)
+def c_del(self):
+    deleted.append('C')
+C.__del__ = c_del
+make(5, D)
+collect()
+collect()
+print(deleted.count('C') >= 2)
+
+# the finalisers left in the queue are called at exit
+class E:
+    def __del__(self):
+        print('finalised at exit')
+
+make(1, E)
+clear_stack()
+print('end')
+gc.collect()
@@ -0,0 +1,69 @@
+# test incremental garbage collection using gc.collect_step
+
+import gc
+
+if not hasattr(gc, 'collect_step'):
+    print('SKIP')
+    import sys
+    sys.exit()
+
+def run_cycle(budget, mutate):
+    n = 0
+    while not gc.collect_step(budget):
+        mutate(n)
+        n += 1
+    return n
+
+# containers that are modified while the mark phase is in progress
+d = {}
+l = []
+s = set()
+def counter():
+    x = 0
+    def inc():
+        nonlocal x
+        x = [x]
+    inc()
+    return inc
+c = counter()
+def gen():
+    a = []
+    while True:
+        a.append(str(len(a)))
+        yield a
+
+g = gen()
+
+def mutate(n):
+    d[n] = str(n) * 2
+    l.append((n, str(n)))
+    s.add(str(n))
+    c()
+    next(g)
+    # create some garbage
+    [str(i) for i in range(10)]
+
+# only do explicit steps
+gc.disable()
+gc.collect()
+n = run_cycle(64, mutate)
+print(n > 0)
+
+# check that everything added during the cycle is still intact
+for i in range(n):
+    assert d[i] == str(i) * 2
+    assert l[i] == (i, str(i))
+    assert str(i) in s
+assert next(g)[-1] == str(n)
+print(len(d) == n, len(l) == n, len(s) == n)
+
+# the next cycle must free what was dropped
+del d, l, s
+gc.collect_step(0)
+print(gc.collect_step(0))
+
+# a full collection can interrupt a cycle
+gc.collect_step(1)
+gc.collect()
+print(gc.collect_step(0))
+gc.enable()
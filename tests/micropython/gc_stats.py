@@ -0,0 +1,39 @@
+# test gc.stats
+
+import gc
+
+if not hasattr(gc, 'stats'):
+    print('SKIP')
+    import sys
+    sys.exit()
+
+s0 = gc.stats()
+print(len(s0), len(s0[7]) > 1)
+
+# a collection is counted, and finds some live blocks
+gc.collect()
+s1 = gc.stats()
+print(s1[0] == s0[0] + 1)
+print(s1[1] >= s0[1], s1[2] <= s1[1])
+print(s1[3] > s0[3])
+
+# allocations are counted, and freed by the next collection
+l = [bytearray(100) for i in range(10)]
+s2 = gc.stats()
+print(s2[6] - s1[6] >= 1000)
+print(sum(s2[7]) - sum(s1[7]) >= 11)
+l = None
+gc.collect()
+s3 = gc.stats()
+print(s3[4] > s2[4])
+
+# each pause is no longer than the maximum
+print(s3[2] >= s1[2], s3[2] <= s3[1])
+
+# an incremental cycle counts as one collection
+if hasattr(gc, 'collect_step'):
+    while not gc.collect_step(10):
+        pass
+    print(gc.stats()[0] == s3[0] + 1)
+else:
+    print(True)
@@ -0,0 +1,45 @@
+# test the self-adjusting gc.threshold
+
+import gc
+
+try:
+    gc.threshold(auto=False)
+except (AttributeError, TypeError):
+    print('SKIP')
+    import sys
+    sys.exit()
+
+def churn():
+    for i in range(2000):
+        x = [i] * 8
+
+# auto mode starts from a threshold and keeps adjusting it
+gc.threshold(-1)
+gc.threshold(auto=True)
+print(gc.threshold() > 0)
+churn()
+gc.collect()
+print(gc.threshold() > 0)
+
+# a target pause still leaves a working threshold
+gc.threshold(auto=True, target_pause_us=1)
+churn()
+gc.collect()
+print(gc.threshold() > 0)
+
+# a fixed amount turns auto mode off
+gc.threshold(4096)
+churn()
+gc.collect()
+print(gc.threshold())
+
+# auto can be turned off, keeping the current threshold
+gc.threshold(auto=True)
+gc.threshold(auto=False)
+t = gc.threshold()
+churn()
+gc.collect()
+print(gc.threshold() == t)
+
+gc.threshold(-1)
+print(gc.threshold())
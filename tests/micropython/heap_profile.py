@@ -0,0 +1,24 @@
+# test the allocation profiler
+
+import micropython
+
+# this function is not always available
+if not hasattr(micropython, 'heap_profile'):
+    print('SKIP')
+    import sys
+    sys.exit()
+
+def alloc(n):
+    return [bytearray(1000) for i in range(n)]
+
+def f():
+    for i in range(10):
+        alloc(10)
+
+f()
+
+# the largest allocations are first in the table
+micropython.heap_profile()
+print('end')
+micropython.heap_profile(True)
+print('end')
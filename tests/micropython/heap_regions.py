@@ -0,0 +1,44 @@
+# cmdline: -X heapsize=64K -X heapmax=256K
+# test that the heap grows into new regions, up to the heapmax limit
+
+import gc
+
+def heap_size():
+    return gc.mem_alloc() + gc.mem_free()
+
+gc.collect()
+size0 = heap_size()
+print(size0 <= 64 * 1024)
+
+def fill(objs):
+    try:
+        while True:
+            objs.append(bytearray(1024))
+    except MemoryError:
+        print('MemoryError')
+
+def test():
+    # allocate past the initial heap, so that a new region is added
+    objs = []
+    for i in range(120):
+        objs.append(bytes([i]) * 1024)
+    print(heap_size() > size0)
+
+    # objects in all regions survive collections, and garbage is reclaimed
+    for i in range(3):
+        for j in range(50):
+            [j] * 20
+        gc.collect()
+    print(all([len(o) == 1024 and o[0] == i and o[-1] == i for i, o in enumerate(objs)]))
+
+    # allocating past heapmax raises MemoryError
+    fill(objs)
+    print(heap_size() <= 256 * 1024)
+
+    # the heap is usable again once memory is freed
+    objs.clear()
+    gc.collect()
+    objs = [bytearray(1024) for i in range(100)]
+    print(len(objs))
+
+test()
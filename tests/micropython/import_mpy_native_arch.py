@@ -0,0 +1,127 @@
+# test that .mpy files with native code for another arch are refused; a port
+# can load the code of at most one of these, the same module for x64 and thumb
+
+import sys
+try:
+    import uos as os
+except ImportError:
+    import os
+
+if not hasattr(os, 'unlink'):
+    print('SKIP')
+    raise SystemExit
+
+mpy_x64 = (
+    b'M\x03\x07\x1f\x818\x02\x00\x00\x00\x00\x00\r\n\x00\xfd'
+    b'\x00j e \x85\x07\x00\x00\xff\x82P\x01\x18a\x00'
+    b'$\xfe\x00`\x01$\x01\x01`\x02$\x04\x01`\x03$'
+    b'\x07\x01\x11[\x08<module>\x06mo'
+    b'd.py\x01f\x01s\x01g\x01h\x00\x04\x85!'
+    b'UH\x89\xe5H\x83\xecxSATAUAVA'
+    b'WI\x89\xc8H\x89\xd1H\x89\xf2H\x89\xfe\xbf\x8d\x00'
+    b'\x00\x00H\x89}\xc8\xbf\x04\x00\x00\x00H\x89}\xd0H'
+    b'\x8d}\xd8\x90\x90\x90H\xb81\x8eYf1V\x00\x00'
+    b'\xff\xd0H\x8b]\xf0L\x8be\xe8L\x89\xe2H\x89\xde'
+    b'\xbf\x07\x00\x00\x00\x90H\xb8\xbb\x88Yf1V\x00\x00'
+    b'\xff\xd0\xba\x03\x00\x00\x00H\x89\xc6\xbf\x05\x00\x00\x00\x90'
+    b'\x90\x90\x90\x90\x90\x90H\xb8\xbb\x88Yf1V\x00\x00'
+    b'\xff\xd0A_A^A]A\\[\xc9\xc3\x00\x02\x00'
+    b'\x01\x05\xfe\x00\xfd\x00\xff\x00\xfe\x03\x00\x00\x00\x00\x00\x00'
+    b'\x02\x04\x00\x00\x00\x00\x00\x00\x81\x18\x00\x02\x078\x00('
+    b'X\x00\rx\x00\r\x81\x12\x03\x01f\x81\x14\x03\x06m'
+    b'od.py\x81\x18\x04\x01x\x81 \x04\x01y\x86'
+    b'AUH\x89\xe5H\x83\xecxSATAUAV'
+    b'AWI\x89\xc8H\x89\xd1H\x89\xf2H\x89\xfe\xbf\xbd'
+    b'\x00\x00\x00H\x89}\xc8\xbf\x04\x00\x00\x00H\x89}\xd0'
+    b'H\x8d}\xd8\x90\x90\x90H\xb81\x8eYf1V\x00'
+    b'\x00\xff\xd0H\x8b]\xf0H\xb8\x0e\x04\x00\x00\x00\x00\x00'
+    b'\x00H\x89E\x88\x90\x90H\xbf\xe6\x00\x00\x00\x00\x00\x00'
+    b'\x00\x90\x90\x90\x90\x90\x90H\xb8\xbatYf1V\x00'
+    b'\x00\xff\xd0H\x89E\x90H\x89]\x98H\x8dU\x98H'
+    b'\x8b}\x90\xbe\x01\x00\x00\x00\x90\x90\x90\x90\x90\x90\x90H'
+    b'\xb8\x1f\x8eYf1V\x00\x00\xff\xd0H\x89\xc2H\x8b'
+    b'u\x88\xbf\x05\x00\x00\x00H\xb8\xbb\x88Yf1V\x00'
+    b'\x00\xff\xd0A_A^A]A\\[\xc9\xc3\x00\x01'
+    b'\x00\x00\x05\x01\x01\xfd\x00\xff\x00\n\x04\x00\x00\x00\x00\x00'
+    b'\x00\x81H\x00\x01\t8\x00(H\x04\x02a=X\x02'
+    b'\x03strh\x00\x03\x81\x10\x00\x16\x81(\x00\r\x81'
+    b'B\x03\x01s\x81D\x03\x06mod.py\x81H'
+    b'\x04\x01a\x83vUH\x89\xe5H\x83\xec8SAT'
+    b'AUAVAWI\x89\xfd\xbb\x00\x00\x00\x00L\x89'
+    b'm\xe0\xb8\x00\x00\x00\x00H\x89E\xe8\xe9$\x00\x00\x00'
+    b'H\x8bE\xe8I\x89\xc4H\x89\xdeL\x01\xe6H\x89\xf3'
+    b'H\x89E\xe8\xba\x01\x00\x00\x00H\x8bu\xe8H\x01\xd6'
+    b'H\x89u\xe8H\x8bE\xe8H\x8b}\xe0H\x89E\xe8'
+    b'H\x89}\xe0H\x89\xc6H1\xc0H9\xfe\x0f\x9c\xc0'
+    b'\x84\xc0u\xbcH\x89\xd8A_A^A]A\\['
+    b'\xc9\xc3\x00\x01"\x00\x814\x05\x00\x00\x01\x00\x00\t\x07'
+    b'\x01\xfd\x00\x81\x10\x00\x00\xff`\x01\x1d\xcb\x00\x00\xb0d'
+    b'\x01Bd\x01\x1d\x04\x01\x00\xb0d\x01\x1d\x01\x01\x00\xb0'
+    b'd\x01P\x03[\x01h\x06mod.py\x05r'
+    b'ange\x01g\x01s\x00\x01\x01n\x81\x10\x06\x00'
+    b'\x00\x01\x00\x00\t\t\x00\xfd\x00\x88\x10\x00\x00\xffQ\x00'
+    b'\xb0C\r\x00\xc1\x1d\xfe\x00\x00\xb1d\x01W\x085\xf0'
+    b'\x7f[\n<listcomp>\x06mo'
+    b'd.py\x01f\x00\x00\x01*'
+)
+
+mpy_thumb = (
+    b'M\x03\x0b\x1f\x818\x02\x00\x00\x00\x00\x00\r\n\x00\xfd'
+    b'\x00j e \x85\x07\x00\x00\xff\x82P\x01\x18a\x00'
+    b'$\xfe\x00`\x01$\x01\x01`\x02$\x04\x01`\x03$'
+    b'\x07\x01\x11[\x08<module>\x06mo'
+    b'd.py\x01f\x01s\x01g\x01h\x00\x04\x82q'
+    b'\xfe\xb5\x8c\xb0\x00\xbf\x01\xe0\x00\x80]\xc8_\xf8\x08p'
+    b'\x1cF\x13F\nF\x01FH \x08\x90\x04 \t\x90'
+    b'\n\xa8\x10\xb4\xd7\xf8\xa0@\xa0G\x01\xbc\r\x9c\x0c\x9d'
+    b'*F!F\x07 {k\x98G\x03"\x01F\x05 '
+    b'{k\x98G\x0c\xb0\xfe\xbd\x00\x02\x00\x01\x05\xfe\x00\xfd'
+    b'\x00\xff\x00\x00\xfe\x03\x00\x00\x02\x04\x00\x00T\x00\x02\x05'
+    b'\x08\x01M\x03\x01fO\x03\x06mod.pyT'
+    b'\x04\x01xX\x04\x01y\x83Q\xfe\xb5\x8c\xb0\x00\xbf\x01'
+    b'\xe0\x00\x80]\xc8_\xf8\x08p\x1cF\x13F\nF\x01'
+    b'Fd \x08\x90\x04 \t\x90\n\xa8\x10\xb4\xd7\xf8\xa0'
+    b'@\xa0G\x01\xbc\r\x9c\x01\xe0\x0e\x04\x00\x00_\xf8\x08'
+    b'\x00\x00\x90\x01\xe0\xe6\x00\x00\x00_\xf8\x08\x00\xfbh\x98'
+    b'G\x01\x90\x02\x94\x02\xaa\x01\x98\x01!\xbbm\x98G\x02'
+    b'F\x00\x99\x05 {k\x98G\x0c\xb0\xfe\xbd\x00\x01\x00'
+    b'\x00\x05\x01\x01\xfd\x00\xff\x00\x00\n\x04\x00\x00p\x00\x01'
+    b'\x06\x08\x010\x04\x02a=<\x02\x03stri\x03'
+    b'\x01sk\x03\x06mod.pyp\x04\x01a\x82'
+    b'B\xfe\xb5\x84\xb0\x00\xbf\x01\xe0\x00\x80]\xc8_\xf8\x08'
+    b'p\x06F\x00$\x03\x96\x00 \x04\x90\x00\xf0\n\xb8\x04'
+    b'\x98\x05F!FI\x19\x0cF\x04\x90\x01"\x04\x99\x89'
+    b'\x18\x04\x91\x04\x98\x03\x99\x04\x90\x03\x91\nF\x01F\x91'
+    b'B\xac\xbf\x00 \x01 \x00(\xe9\xd1 F\x04\xb0\xfe'
+    b'\xbd\x00\x01"\x01\x08\x01\x814\x05\x00\x00\x01\x00\x00\t'
+    b'\x07\x01\xfd\x00\x81\x10\x00\x00\xff`\x01\x1d\xcb\x00\x00\xb0'
+    b'd\x01Bd\x01\x1d\x04\x01\x00\xb0d\x01\x1d\x01\x01\x00'
+    b'\xb0d\x01P\x03[\x01h\x06mod.py\x05'
+    b'range\x01g\x01s\x00\x01\x01n\x81\x10\x06'
+    b'\x00\x00\x01\x00\x00\t\t\x00\xfd\x00\x88\x10\x00\x00\xffQ'
+    b'\x00\xb0C\r\x00\xc1\x1d\xfe\x00\x00\xb1d\x01W\x085'
+    b'\xf0\x7f[\n<listcomp>\x06m'
+    b'od.py\x01f\x00\x00\x01*'
+)
+
+# import a module from .mpy data written to the current directory
+def import_mpy(name, data):
+    f = open(name + '.mpy', 'wb')
+    f.write(data)
+    f.close()
+    sys.path.insert(0, '')
+    try:
+        mod = __import__(name)
+    finally:
+        sys.path.pop(0)
+        os.unlink(name + '.mpy')
+    return mod
+
+loaded = 0
+for name, data in (('x64', mpy_x64), ('thumb', mpy_thumb)):
+    try:
+        import_mpy('import_mpy_native_arch_' + name, data)
+        loaded += 1
+    except ValueError as er:
+        print(er)
+print(loaded <= 1)
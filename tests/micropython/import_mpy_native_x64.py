@@ -0,0 +1,107 @@
+# test importing a .mpy file with native and viper code compiled for x64,
+# made by mpy-cross -mcache-lookup-bc -march=x64 from this source:
+#
+#   @micropython.native
+#   def f(x, y=2):
+#       return x * y + 1
+#
+#   @micropython.native
+#   def s(a):
+#       return 'a=' + str(a)
+#
+#   @micropython.viper
+#   def g(x: int) -> int:
+#       t = 0
+#       for i in range(x):
+#           t += i
+#       return t
+#
+#   def h(n):
+#       return [f(i) for i in range(n)], g(n), s(n)
+
+import sys
+try:
+    import uos as os
+except ImportError:
+    import os
+
+if not hasattr(os, 'unlink'):
+    print('SKIP')
+    raise SystemExit
+
+mpy = (
+    b'M\x03\x07\x1f\x818\x02\x00\x00\x00\x00\x00\r\n\x00\xfd'
+    b'\x00j e \x85\x07\x00\x00\xff\x82P\x01\x18a\x00'
+    b'$\xfe\x00`\x01$\x01\x01`\x02$\x04\x01`\x03$'
+    b'\x07\x01\x11[\x08<module>\x06mo'
+    b'd.py\x01f\x01s\x01g\x01h\x00\x04\x85!'
+    b'UH\x89\xe5H\x83\xecxSATAUAVA'
+    b'WI\x89\xc8H\x89\xd1H\x89\xf2H\x89\xfe\xbf\x8d\x00'
+    b'\x00\x00H\x89}\xc8\xbf\x04\x00\x00\x00H\x89}\xd0H'
+    b'\x8d}\xd8\x90\x90\x90H\xb81\x8eYf1V\x00\x00'
+    b'\xff\xd0H\x8b]\xf0L\x8be\xe8L\x89\xe2H\x89\xde'
+    b'\xbf\x07\x00\x00\x00\x90H\xb8\xbb\x88Yf1V\x00\x00'
+    b'\xff\xd0\xba\x03\x00\x00\x00H\x89\xc6\xbf\x05\x00\x00\x00\x90'
+    b'\x90\x90\x90\x90\x90\x90H\xb8\xbb\x88Yf1V\x00\x00'
+    b'\xff\xd0A_A^A]A\\[\xc9\xc3\x00\x02\x00'
+    b'\x01\x05\xfe\x00\xfd\x00\xff\x00\xfe\x03\x00\x00\x00\x00\x00\x00'
+    b'\x02\x04\x00\x00\x00\x00\x00\x00\x81\x18\x00\x02\x078\x00('
+    b'X\x00\rx\x00\r\x81\x12\x03\x01f\x81\x14\x03\x06m'
+    b'od.py\x81\x18\x04\x01x\x81 \x04\x01y\x86'
+    b'AUH\x89\xe5H\x83\xecxSATAUAV'
+    b'AWI\x89\xc8H\x89\xd1H\x89\xf2H\x89\xfe\xbf\xbd'
+    b'\x00\x00\x00H\x89}\xc8\xbf\x04\x00\x00\x00H\x89}\xd0'
+    b'H\x8d}\xd8\x90\x90\x90H\xb81\x8eYf1V\x00'
+    b'\x00\xff\xd0H\x8b]\xf0H\xb8\x0e\x04\x00\x00\x00\x00\x00'
+    b'\x00H\x89E\x88\x90\x90H\xbf\xe6\x00\x00\x00\x00\x00\x00'
+    b'\x00\x90\x90\x90\x90\x90\x90H\xb8\xbatYf1V\x00'
+    b'\x00\xff\xd0H\x89E\x90H\x89]\x98H\x8dU\x98H'
+    b'\x8b}\x90\xbe\x01\x00\x00\x00\x90\x90\x90\x90\x90\x90\x90H'
+    b'\xb8\x1f\x8eYf1V\x00\x00\xff\xd0H\x89\xc2H\x8b'
+    b'u\x88\xbf\x05\x00\x00\x00H\xb8\xbb\x88Yf1V\x00'
+    b'\x00\xff\xd0A_A^A]A\\[\xc9\xc3\x00\x01'
+    b'\x00\x00\x05\x01\x01\xfd\x00\xff\x00\n\x04\x00\x00\x00\x00\x00'
+    b'\x00\x81H\x00\x01\t8\x00(H\x04\x02a=X\x02'
+    b'\x03strh\x00\x03\x81\x10\x00\x16\x81(\x00\r\x81'
+    b'B\x03\x01s\x81D\x03\x06mod.py\x81H'
+    b'\x04\x01a\x83vUH\x89\xe5H\x83\xec8SAT'
+    b'AUAVAWI\x89\xfd\xbb\x00\x00\x00\x00L\x89'
+    b'm\xe0\xb8\x00\x00\x00\x00H\x89E\xe8\xe9$\x00\x00\x00'
+    b'H\x8bE\xe8I\x89\xc4H\x89\xdeL\x01\xe6H\x89\xf3'
+    b'H\x89E\xe8\xba\x01\x00\x00\x00H\x8bu\xe8H\x01\xd6'
+    b'H\x89u\xe8H\x8bE\xe8H\x8b}\xe0H\x89E\xe8'
+    b'H\x89}\xe0H\x89\xc6H1\xc0H9\xfe\x0f\x9c\xc0'
+    b'\x84\xc0u\xbcH\x89\xd8A_A^A]A\\['
+    b'\xc9\xc3\x00\x01"\x00\x814\x05\x00\x00\x01\x00\x00\t\x07'
+    b'\x01\xfd\x00\x81\x10\x00\x00\xff`\x01\x1d\xcb\x00\x00\xb0d'
+    b'\x01Bd\x01\x1d\x04\x01\x00\xb0d\x01\x1d\x01\x01\x00\xb0'
+    b'd\x01P\x03[\x01h\x06mod.py\x05r'
+    b'ange\x01g\x01s\x00\x01\x01n\x81\x10\x06\x00'
+    b'\x00\x01\x00\x00\t\t\x00\xfd\x00\x88\x10\x00\x00\xffQ\x00'
+    b'\xb0C\r\x00\xc1\x1d\xfe\x00\x00\xb1d\x01W\x085\xf0'
+    b'\x7f[\n<listcomp>\x06mo'
+    b'd.py\x01f\x00\x00\x01*'
+)
+
+# import a module from .mpy data written to the current directory
+def import_mpy(name, data):
+    f = open(name + '.mpy', 'wb')
+    f.write(data)
+    f.close()
+    sys.path.insert(0, '')
+    try:
+        mod = __import__(name)
+    finally:
+        sys.path.pop(0)
+        os.unlink(name + '.mpy')
+    return mod
+
+try:
+    mod = import_mpy('import_mpy_native_x64_mod', mpy)
+except ValueError:
+    # not an x64 port, or no native emitter
+    print('SKIP')
+    raise SystemExit
+
+print(mod.f(3), mod.f(3, 4), mod.g(10), mod.s(5))
+print(mod.h(5))
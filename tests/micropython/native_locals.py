@@ -0,0 +1,101 @@
+# test native and viper functions with many locals, some kept in registers
+
+@micropython.viper
+def viper_sum(buf:ptr8, n:int) -> int:
+    a = 0
+    b = 0
+    c = 1
+    d = 2
+    e = 3
+    f = 4
+    for i in range(n):
+        v = buf[i]
+        a += v * c
+        b ^= v + d
+        c = e
+        e = f
+        f = c
+    return a + b + c + d + e + f
+
+buf = bytearray(100)
+for i in range(len(buf)):
+    buf[i] = i
+print(viper_sum(buf, len(buf)))
+
+# a value stored then loaded straight back
+@micropython.viper
+def viper_store_load(n:int) -> int:
+    x0 = 1
+    x1 = 2
+    x2 = 3
+    x3 = 4
+    x4 = 5
+    x5 = 6
+    x6 = n
+    x7 = x6 + 1
+    return x0 + x1 + x2 + x3 + x4 + x5 + x6 + x7
+print(viper_store_load(10))
+
+# stores through a pointer while the loop counter is on the stack
+@micropython.viper
+def viper_fill(buf:ptr8, n:int):
+    for i in range(n):
+        buf[i] = i * 3
+        buf[0] = buf[i]
+viper_fill(buf, 10)
+print(buf[:10])
+
+# locals stored inside a try block keep their value in the handler
+@micropython.native
+def native_try():
+    a = 0
+    b = 0
+    for i in range(3):
+        try:
+            a = i
+            b += 1
+            raise ValueError
+        except ValueError:
+            pass
+    return a, b
+print(native_try())
+
+@micropython.native
+def native_finally():
+    x = 0
+    try:
+        try:
+            x = 1
+            raise KeyError
+        finally:
+            x += 10
+    except KeyError:
+        pass
+    return x
+print(native_finally())
+
+class CM:
+    def __enter__(self):
+        return 5
+    def __exit__(self, a, b, c):
+        return True
+
+@micropython.native
+def native_with():
+    y = 0
+    with CM() as x:
+        y = x
+        raise ValueError
+    return x, y
+print(native_with())
+
+# constants that need a full 64-bit load into each register local
+@micropython.native
+def native_big_consts():
+    a = 1 << 40
+    b = 2 << 40
+    c = 3 << 40
+    d = 4 << 40
+    e = 5 << 40
+    return a + b + c + d + e
+print(native_big_consts())
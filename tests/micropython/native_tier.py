@@ -0,0 +1,84 @@
+# test hot functions being recompiled natively at runtime
+
+import micropython
+
+# this feature is not always available
+if not hasattr(micropython, 'tier_threshold'):
+    print('SKIP')
+    import sys
+    sys.exit()
+
+try:
+    import uio as io
+except ImportError:
+    import io
+
+# native functions don't add themselves to a traceback, which tells us
+# whether a function from the exec'd code has been made native yet
+def in_traceback(f, *args):
+    try:
+        f(*args)
+    except ValueError as e:
+        buf = io.StringIO()
+        import sys
+        sys.print_exception(e, buf)
+        return buf.getvalue().count('"<string>"')
+
+# only code compiled while the threshold is set can be made native
+micropython.tier_threshold(4)
+print(micropython.tier_threshold())
+
+exec('''
+def f(n, k=2, *args, **kw):
+    s = 0
+    for i in range(n):
+        s += i * k
+    if n < 0:
+        raise ValueError
+    return s, args, kw
+
+def gen(n):
+    if n < 0:
+        raise ValueError
+    yield n
+
+def outer():
+    v = 3
+    def inner(n):
+        if n < 0:
+            raise ValueError
+        return v + n
+    return inner
+
+def sq(n):
+    return [i * i for i in range(n)]
+''')
+
+# calls and loop iterations both count towards the threshold
+print(in_traceback(f, -1))
+print(f(3), f(3, 3, 4, z=5))
+print(in_traceback(f, -1))
+print(f.__name__, repr(f).startswith('<function f at '))
+
+# generators stay as bytecode
+for i in range(5):
+    print(list(gen(i)), in_traceback(lambda: next(gen(-1))))
+
+# a closure stays as bytecode, even when what makes it is native
+for i in range(5):
+    print(outer()(i), sq(i), in_traceback(outer(), -1))
+
+# a threshold of 0 turns it off
+micropython.tier_threshold(0)
+exec('''
+def g(n):
+    raise ValueError
+''')
+for i in range(10):
+    in_traceback(g, 0)
+print(in_traceback(g, 0))
+
+try:
+    micropython.tier_threshold(-1)
+except ValueError:
+    print('ValueError')
@@ -0,0 +1,35 @@
+# test the opcode statistics
+
+import micropython
+
+# these functions are not always available
+if not hasattr(micropython, 'opcode_stats'):
+    print('SKIP')
+    import sys
+    sys.exit()
+
+try:
+    import uio as io
+except ImportError:
+    import io
+
+def f():
+    return 1
+
+def stats():
+    s = io.StringIO()
+    micropython.opcode_stats(s)
+    return [l.split() for l in s.getvalue().split('\n')]
+
+micropython.opcode_stats_reset()
+for i in range(3):
+    f()
+s = stats()
+print(s[0][0])
+print(['3', 'RETURN_VALUE'] in s)
+print(['3', 'RETURN_VALUE,', 'POP_TOP'] in s)
+
+# after a reset only the opcodes since then are counted
+micropython.opcode_stats_reset()
+s = stats()
+print(['3', 'RETURN_VALUE'] in s)
@@ -0,0 +1,41 @@
+# test the sampling profiler
+
+import micropython
+
+# these functions are not always available
+if not hasattr(micropython, 'profile_start'):
+    print('SKIP')
+    import sys
+    sys.exit()
+
+try:
+    import uio as io
+except ImportError:
+    import io
+
+def f(n):
+    x = 0
+    for i in range(n):
+        x += i
+    return x
+
+# the samples depend on timing, so only check the format of the output
+micropython.profile_start(1000)
+f(20000)
+s = io.StringIO()
+micropython.profile_stop(s)
+for line in s.getvalue().split('\n'):
+    if line:
+        stack, n = line.rsplit(' ', 1)
+        assert int(n) > 0
+        assert stack
+print('ok')
+
+# stopping when not started does nothing
+micropython.profile_stop()
+print('ok')
+
+try:
+    micropython.profile_start(0)
+except ValueError:
+    print('ValueError')
@@ -0,0 +1,52 @@
+# test deep recursion of bytecode functions, which is only possible in
+# stackless mode
+
+def f(n):
+    if n == 0:
+        return 0
+    return f(n - 1) + 1
+
+try:
+    f(5000)
+except RuntimeError:
+    print('SKIP')
+    import sys
+    sys.exit()
+
+print(f(5000))
+
+# an exception unwinds through the stackless frames
+def g(n):
+    if n == 0:
+        raise ValueError(n)
+    return g(n - 1)
+
+try:
+    g(3000)
+except ValueError as e:
+    print('ValueError', e)
+
+# frames are popped correctly by finally blocks and handlers
+def h(n):
+    try:
+        if n == 0:
+            raise KeyError
+        return h(n - 1) + 1
+    except KeyError:
+        return 100
+    finally:
+        pass
+
+print(h(3000))
+
+# keyword and default arguments
+def k(n, a=1, *, b=2):
+    if n == 0:
+        return a + b
+    return k(n - 1, b=b + 1)
+
+print(k(3000))
+
+# the frame stack is reused after recursion ends
+for i in range(3):
+    print(f(4000))
@@ -0,0 +1,45 @@
+# an LRU cache built on a large OrderedDict
+
+try:
+    from collections import OrderedDict
+except ImportError:
+    try:
+        from ucollections import OrderedDict
+    except ImportError:
+        print("SKIP")
+        import sys
+        sys.exit()
+
+import gc
+
+SIZE = 2000
+cache = OrderedDict()
+hits = misses = 0
+x = 1
+
+def access(n):
+    global hits, misses, x
+    for i in range(n):
+        x = (x * 1103515245 + 12345) & 0x7fffffff
+        k = x % 3000
+        if k in cache:
+            hits += 1
+            # move the key to the end, as the most recently used
+            cache[k] = cache.pop(k)
+        else:
+            misses += 1
+            if len(cache) >= SIZE:
+                del cache[next(iter(cache))]
+            cache[k] = i
+
+# the cache stays at SIZE entries, so its memory use must not keep growing
+access(40000)
+gc.collect()
+m0 = gc.mem_free()
+access(120000)
+gc.collect()
+print(m0 - gc.mem_free() < 16384)
+
+print(hits, misses, len(cache))
+print(list(cache.keys())[:10])
+print(sum(cache.values()))
@@ -0,0 +1,59 @@
+# stress test for tracing the heap while threads hold large structures; when
+# the collector marks in parallel, the structures are traced by several
+# threads at once
+
+import gc
+import _thread
+
+def make_tree(depth):
+    if depth == 0:
+        return None
+    return [make_tree(depth - 1), make_tree(depth - 1), depth]
+
+def sum_tree(t):
+    if t is None:
+        return 0
+    return sum_tree(t[0]) + sum_tree(t[1]) + t[2]
+
+def make_chain(n):
+    head = None
+    for i in range(n):
+        head = (i, head)
+    return head
+
+def sum_chain(c):
+    s = 0
+    while c is not None:
+        s += c[0]
+        c = c[1]
+    return s
+
+def thread_entry(n):
+    # a deep structure, a long one and a wide one
+    tree = make_tree(8)
+    chain = make_chain(1000)
+    wide = [str(i) for i in range(1000)]
+
+    # collect repeatedly while making garbage
+    for i in range(n):
+        garbage = [[j] for j in range(50)]
+        gc.collect()
+
+    # check the structures survived
+    s = sum_tree(tree) + sum_chain(chain) + sum(int(x) for x in wide)
+    with lock:
+        print(s)
+        global n_finished
+        n_finished += 1
+
+lock = _thread.allocate_lock()
+n_thread = 4
+n_finished = 0
+
+# spawn threads
+for i in range(n_thread):
+    _thread.start_new_thread(thread_entry, (10,))
+
+# busy wait for threads to finish
+while n_finished < n_thread:
+    pass
@@ -0,0 +1,81 @@
+# test that incremental GC keeps objects that are only referred to by frames
+# in the older chunks of another thread's frame stack
+
+import gc
+import _thread
+try:
+    import utime
+except ImportError:
+    print('SKIP')
+    raise SystemExit
+
+if not hasattr(gc, 'collect_step'):
+    print('SKIP')
+    raise SystemExit
+
+# the items are at the end of a long chain, so they're traced many steps
+# after the thread's frame stack
+chain = [None, []]
+for i in range(3):
+    chain[1].append([i, str(i) * 4])
+for i in range(5000):
+    chain = [chain, None]
+
+state = {'ready': False, 'go': False, 'held': False, 'done': False, 'ok': None}
+
+def deeper(n, wait):
+    if n:
+        return deeper(n - 1, wait)
+    if not wait:
+        return
+    state['held'] = True
+    while not state['done']:
+        utime.sleep_ms(1)
+
+def hold():
+    # allocate more chunks of the frame stack, then return to this one
+    deeper(100, False)
+    state['ready'] = True
+    while not state['go']:
+        utime.sleep_ms(1)
+    # once popped the items are only referred to by this frame, and its chunk
+    # isn't the innermost one while they're held
+    p = chain
+    while p[1] is None:
+        p = p[0]
+    x = p[1].pop()
+    y = p[1].pop()
+    z = p[1].pop()
+    p = None
+    deeper(100, True)
+    return x[1] == str(x[0]) * 4 and y[1] == str(y[0]) * 4
+
+def outer(n):
+    # put the frame of hold past the first chunk, which the C stack refers to
+    if n:
+        return outer(n - 1)
+    return hold()
+
+def thread_entry():
+    state['ok'] = outer(40)
+
+_thread.start_new_thread(thread_entry, ())
+while not state['ready']:
+    utime.sleep_ms(1)
+
+# trace the thread's frame stack, then let it take the items
+gc.collect()
+for i in range(5):
+    gc.collect_step(8)
+state['go'] = True
+while not state['held']:
+    utime.sleep_ms(1)
+while not gc.collect_step(1 << 20):
+    pass
+
+# reuse any memory that was freed
+junk = [[i, 'x' * 8] for i in range(200)]
+state['done'] = True
+while state['ok'] is None:
+    utime.sleep_ms(1)
+print(state['ok'])
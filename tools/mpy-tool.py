@@ -62,6 +62,8 @@ class Config:
     MICROPY_LONGINT_IMPL_MPZ = 2
 config = Config()
 
+MPY_VERSION = 3
+
 MP_OPCODE_BYTE = 0
 MP_OPCODE_QSTR = 1
 MP_OPCODE_VAR_UINT = 2
@@ -98,7 +100,7 @@ def make_opcode_format():
     OC4(B, B, V, V), # 0x20-0x23
     OC4(Q, Q, Q, B), # 0x24-0x27
     OC4(V, V, Q, Q), # 0x28-0x2b
-    OC4(U, U, U, U), # 0x2c-0x2f
+    OC4(B, B, B, B), # 0x2c-0x2f
     OC4(B, B, B, B), # 0x30-0x33
     OC4(B, O, O, O), # 0x34-0x37
     OC4(O, O, U, U), # 0x38-0x3b
@@ -241,6 +243,82 @@ class RawCode:
             rc.freeze()
         # TODO
 
+    def freeze_obj(self, obj_name, obj):
+        # print the definition of a constant object, if it needs one, and return
+        # a reference to it: a C expression, or a list of lines for a float
+        if obj is None:
+            return '&mp_const_none_obj'
+        elif obj is False:
+            return '&mp_const_false_obj'
+        elif obj is True:
+            return '&mp_const_true_obj'
+        elif obj is Ellipsis:
+            return '&mp_const_ellipsis_obj'
+        elif is_str_type(obj) or is_bytes_type(obj):
+            if is_str_type(obj):
+                obj = bytes_cons(obj, 'utf8')
+                obj_type = 'mp_type_str'
+            else:
+                obj_type = 'mp_type_bytes'
+            print('STATIC const mp_obj_str_t %s = {{&%s}, %u, %u, (const byte*)"%s"};'
+                % (obj_name, obj_type, qstrutil.compute_hash(obj, config.MICROPY_QSTR_BYTES_IN_HASH),
+                    len(obj), ''.join(('\\x%02x' % b) for b in obj)))
+        elif is_int_type(obj):
+            if -(1 << (config.mp_small_int_bits - 1)) <= obj < (1 << (config.mp_small_int_bits - 1)):
+                # only found as an item of a constant tuple
+                return 'MP_OBJ_NEW_SMALL_INT(%d)' % obj
+            elif config.MICROPY_LONGINT_IMPL == config.MICROPY_LONGINT_IMPL_NONE:
+                # TODO check if we can actually fit this long-int into a small-int
+                raise FreezeError(self, 'target does not support long int')
+            elif config.MICROPY_LONGINT_IMPL == config.MICROPY_LONGINT_IMPL_LONGLONG:
+                # TODO
+                raise FreezeError(self, 'freezing int to long-long is not implemented')
+            elif config.MICROPY_LONGINT_IMPL == config.MICROPY_LONGINT_IMPL_MPZ:
+                neg = 0
+                if obj < 0:
+                    obj = -obj
+                    neg = 1
+                bits_per_dig = config.MPZ_DIG_SIZE
+                digs = []
+                z = obj
+                while z:
+                    digs.append(z & ((1 << bits_per_dig) - 1))
+                    z >>= bits_per_dig
+                ndigs = len(digs)
+                digs = ','.join(('%#x' % d) for d in digs)
+                print('STATIC const mp_obj_int_t %s = {{&mp_type_int}, '
+                    '{.neg=%u, .fixed_dig=1, .alloc=%u, .len=%u, .dig=(uint%u_t[]){%s}}};'
+                    % (obj_name, neg, ndigs, ndigs, bits_per_dig, digs))
+        elif type(obj) is float:
+            print('#if MICROPY_OBJ_REPR == MICROPY_OBJ_REPR_A || MICROPY_OBJ_REPR == MICROPY_OBJ_REPR_B')
+            print('STATIC const mp_obj_float_t %s = {{&mp_type_float}, %.16g};'
+                % (obj_name, obj))
+            print('#endif')
+            n = struct.unpack('<I', struct.pack('<f', obj))[0]
+            n = ((n & ~0x3) | 2) + 0x80800000
+            return [
+                '#if MICROPY_OBJ_REPR == MICROPY_OBJ_REPR_A || MICROPY_OBJ_REPR == MICROPY_OBJ_REPR_B',
+                '&' + obj_name,
+                '#elif MICROPY_OBJ_REPR == MICROPY_OBJ_REPR_C',
+                '0x%08x' % n,
+                '#else',
+                '#error "MICROPY_OBJ_REPR_D not supported with floats in frozen mpy files"',
+                '#endif',
+            ]
+        elif type(obj) is complex:
+            print('STATIC const mp_obj_complex_t %s = {{&mp_type_complex}, %.16g, %.16g};'
+                % (obj_name, obj.real, obj.imag))
+        elif type(obj) is tuple:
+            item_refs = [self.freeze_obj('%s_%u' % (obj_name, i), item) for i, item in enumerate(obj)]
+            print('STATIC const mp_rom_obj_tuple_t %s = {{&mp_type_tuple}, %u, {' % (obj_name, len(obj)))
+            for item_ref in item_refs:
+                print_obj_ref('    (mp_rom_obj_t)(%s),', item_ref)
+            print('}};')
+        else:
+            # TODO
+            raise FreezeError(self, 'freezing of object %r is not implemented' % (obj,))
+        return '&' + obj_name
+
     def freeze(self, parent_name):
         self.escaped_name = parent_name + self.simple_name.qstr_esc
 
@@ -281,70 +359,18 @@ class RawCode:
         print('};')
 
         # generate constant objects
+        obj_refs = []
         for i, obj in enumerate(self.objs):
             obj_name = 'const_obj_%s_%u' % (self.escaped_name, i)
-            if is_str_type(obj) or is_bytes_type(obj):
-                if is_str_type(obj):
-                    obj = bytes_cons(obj, 'utf8')
-                    obj_type = 'mp_type_str'
-                else:
-                    obj_type = 'mp_type_bytes'
-                print('STATIC const mp_obj_str_t %s = {{&%s}, %u, %u, (const byte*)"%s"};'
-                    % (obj_name, obj_type, qstrutil.compute_hash(obj, config.MICROPY_QSTR_BYTES_IN_HASH),
-                        len(obj), ''.join(('\\x%02x' % b) for b in obj)))
-            elif is_int_type(obj):
-                if config.MICROPY_LONGINT_IMPL == config.MICROPY_LONGINT_IMPL_NONE:
-                    # TODO check if we can actually fit this long-int into a small-int
-                    raise FreezeError(self, 'target does not support long int')
-                elif config.MICROPY_LONGINT_IMPL == config.MICROPY_LONGINT_IMPL_LONGLONG:
-                    # TODO
-                    raise FreezeError(self, 'freezing int to long-long is not implemented')
-                elif config.MICROPY_LONGINT_IMPL == config.MICROPY_LONGINT_IMPL_MPZ:
-                    neg = 0
-                    if obj < 0:
-                        obj = -obj
-                        neg = 1
-                    bits_per_dig = config.MPZ_DIG_SIZE
-                    digs = []
-                    z = obj
-                    while z:
-                        digs.append(z & ((1 << bits_per_dig) - 1))
-                        z >>= bits_per_dig
-                    ndigs = len(digs)
-                    digs = ','.join(('%#x' % d) for d in digs)
-                    print('STATIC const mp_obj_int_t %s = {{&mp_type_int}, '
-                        '{.neg=%u, .fixed_dig=1, .alloc=%u, .len=%u, .dig=(uint%u_t[]){%s}}};'
-                        % (obj_name, neg, ndigs, ndigs, bits_per_dig, digs))
-            elif type(obj) is float:
-                print('#if MICROPY_OBJ_REPR == MICROPY_OBJ_REPR_A || MICROPY_OBJ_REPR == MICROPY_OBJ_REPR_B')
-                print('STATIC const mp_obj_float_t %s = {{&mp_type_float}, %.16g};'
-                    % (obj_name, obj))
-                print('#endif')
-            elif type(obj) is complex:
-                print('STATIC const mp_obj_complex_t %s = {{&mp_type_complex}, %.16g, %.16g};'
-                    % (obj_name, obj.real, obj.imag))
-            else:
-                # TODO
-                raise FreezeError(self, 'freezing of object %r is not implemented' % (obj,))
+            obj_refs.append(self.freeze_obj(obj_name, obj))
 
         # generate constant table
         print('STATIC const mp_uint_t const_table_data_%s[%u] = {'
             % (self.escaped_name, len(self.qstrs) + len(self.objs) + len(self.raw_codes)))
         for qst in self.qstrs:
             print('    (mp_uint_t)MP_OBJ_NEW_QSTR(%s),' % global_qstrs[qst].qstr_id)
-        for i in range(len(self.objs)):
-            if type(self.objs[i]) is float:
-                print('#if MICROPY_OBJ_REPR == MICROPY_OBJ_REPR_A || MICROPY_OBJ_REPR == MICROPY_OBJ_REPR_B')
-                print('    (mp_uint_t)&const_obj_%s_%u,' % (self.escaped_name, i))
-                print('#elif MICROPY_OBJ_REPR == MICROPY_OBJ_REPR_C')
-                n = struct.unpack('<I', struct.pack('<f', self.objs[i]))[0]
-                n = ((n & ~0x3) | 2) + 0x80800000
-                print('    (mp_uint_t)0x%08x,' % (n,))
-                print('#else')
-                print('#error "MICROPY_OBJ_REPR_D not supported with floats in frozen mpy files"')
-                print('#endif')
-            else:
-                print('    (mp_uint_t)&const_obj_%s_%u,' % (self.escaped_name, i))
+        for obj_ref in obj_refs:
+            print_obj_ref('    (mp_uint_t)(%s),', obj_ref)
         for rc in self.raw_codes:
             print('    (mp_uint_t)&raw_code_%s,' % rc.escaped_name)
         print('};')
@@ -385,10 +411,28 @@ def read_qstr(f):
     global_qstrs.append(qstr_type(data, qstr_esc, 'MP_QSTR_' + qstr_esc))
     return len(global_qstrs) - 1
 
+def print_obj_ref(fmt, obj_ref):
+    if type(obj_ref) is list:
+        for line in obj_ref:
+            if line.startswith('#'):
+                print(line)
+            else:
+                print(fmt % line)
+    else:
+        print(fmt % obj_ref)
+
 def read_obj(f):
     obj_type = f.read(1)
     if obj_type == b'e':
         return Ellipsis
+    elif obj_type == b'N':
+        return None
+    elif obj_type == b'F':
+        return False
+    elif obj_type == b'T':
+        return True
+    elif obj_type == b't':
+        return tuple(read_obj(f) for _ in range(read_uint(f)))
     else:
         buf = f.read(read_uint(f))
         if obj_type == b's':
@@ -417,7 +461,10 @@ def read_bytecode_qstrs(file, bytecode, ip):
         ip += sz
 
 def read_raw_code(f):
-    bc_len = read_uint(f)
+    kind_len = read_uint(f)
+    if kind_len & 3:
+        raise Exception('can only freeze bytecode, not native code')
+    bc_len = kind_len >> 2
     bytecode = bytearray(f.read(bc_len))
     ip, ip2, prelude = extract_prelude(bytecode)
     read_qstr_and_pack(f, bytecode, ip2) # simple_name
@@ -435,7 +482,7 @@ def read_mpy(filename):
         header = bytes_cons(f.read(4))
         if header[0] != ord('M'):
             raise Exception('not a valid .mpy file')
-        if header[1] != 0:
+        if header[1] != MPY_VERSION:
             raise Exception('incompatible version')
         feature_flags = header[2]
         config.MICROPY_OPT_CACHE_MAP_LOOKUP_IN_BYTECODE = (feature_flags & 1) != 0
@@ -460,6 +507,7 @@ def freeze_mpy(base_qstrs, raw_codes):
     print('#include "py/mpconfig.h"')
     print('#include "py/objint.h"')
     print('#include "py/objstr.h"')
+    print('#include "py/objtuple.h"')
     print('#include "py/emitglue.h"')
     print()
 
@@ -505,6 +553,13 @@ def freeze_mpy(base_qstrs, raw_codes):
             print('    MP_QSTR_%s,' % new[i][1])
     print('};')
 
+    print()
+    hash_table = qstrutil.make_hash_table([qstrutil.bytes_cons(qstr, 'utf8') for _, _, qstr in new])
+    print('STATIC const uint16_t mp_qstr_frozen_const_hash_table[] = {')
+    for i in range(0, len(hash_table), 16):
+        print('    %s,' % ', '.join('%u' % idx for idx in hash_table[i:i + 16]))
+    print('};')
+
     print()
     print('extern const qstr_pool_t mp_qstr_const_pool;');
     print('const qstr_pool_t mp_qstr_frozen_const_pool = {')
@@ -512,6 +567,8 @@ def freeze_mpy(base_qstrs, raw_codes):
     print('    MP_QSTRnumber_of, // previous pool size')
     print('    %u, // allocated entries' % len(new))
     print('    %u, // used entries' % len(new))
+    print('    mp_qstr_frozen_const_hash_table,')
+    print('    %u, // hash table entries' % len(hash_table))
     print('    {')
     for _, _, qstr in new:
         print('        %s,'
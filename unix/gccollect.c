@@ -24,6 +24,11 @@
  * THE SOFTWARE.
  */
 
+#ifdef __linux__
+// for dl_iterate_phdr
+#define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
 
 #include "py/mpstate.h"
@@ -176,4 +181,131 @@ void gc_collect(void) {
     //gc_dump_info();
 }
 
+#if MICROPY_GC_PARALLEL_MARK
+
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+
+// Helper threads for tracing the heap are started when first needed and
+// then wait for each collection.  They only run gc_mark_worker.
+STATIC pthread_mutex_t marker_mutex = PTHREAD_MUTEX_INITIALIZER;
+STATIC pthread_cond_t marker_start_cond = PTHREAD_COND_INITIALIZER;
+STATIC pthread_cond_t marker_done_cond = PTHREAD_COND_INITIALIZER;
+STATIC size_t marker_n_helpers;
+// incremented to start the helpers with an id below marker_n_active
+STATIC unsigned int marker_generation;
+STATIC size_t marker_n_active;
+STATIC size_t marker_n_running;
+
+STATIC void *marker_thread(void *arg) {
+    size_t id = (size_t)arg;
+    unsigned int generation = 0;
+    pthread_mutex_lock(&marker_mutex);
+    for (;;) {
+        while (marker_generation == generation) {
+            pthread_cond_wait(&marker_start_cond, &marker_mutex);
+        }
+        generation = marker_generation;
+        if (id < marker_n_active) {
+            pthread_mutex_unlock(&marker_mutex);
+            gc_mark_worker(id);
+            pthread_mutex_lock(&marker_mutex);
+            if (--marker_n_running == 0) {
+                pthread_cond_signal(&marker_done_cond);
+            }
+        }
+    }
+    return NULL;
+}
+
+size_t gc_port_num_markers(void) {
+    static long n_cpus = 0;
+    if (n_cpus == 0) {
+        n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        if (n_cpus < 1) {
+            n_cpus = 1;
+        }
+    }
+    size_t n_helpers = MIN((size_t)n_cpus, MICROPY_GC_PARALLEL_MARK_THREADS) - 1;
+    pthread_mutex_lock(&marker_mutex);
+    if (marker_n_helpers < n_helpers) {
+        // signals are for the Python threads, so the helpers block them all
+        sigset_t all, old;
+        sigfillset(&all);
+        pthread_sigmask(SIG_BLOCK, &all, &old);
+        while (marker_n_helpers < n_helpers) {
+            pthread_t id;
+            if (pthread_create(&id, NULL, marker_thread, (void*)(marker_n_helpers + 1)) != 0) {
+                break;
+            }
+            pthread_detach(id);
+            marker_n_helpers += 1;
+        }
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+    }
+    n_helpers = marker_n_helpers;
+    pthread_mutex_unlock(&marker_mutex);
+    return n_helpers + 1;
+}
+
+void gc_port_run_markers(size_t n_markers) {
+    pthread_mutex_lock(&marker_mutex);
+    marker_n_active = n_markers;
+    marker_n_running = n_markers - 1;
+    marker_generation += 1;
+    pthread_cond_broadcast(&marker_start_cond);
+    pthread_mutex_unlock(&marker_mutex);
+
+    gc_mark_worker(0);
+
+    pthread_mutex_lock(&marker_mutex);
+    while (marker_n_running > 0) {
+        pthread_cond_wait(&marker_done_cond, &marker_mutex);
+    }
+    pthread_mutex_unlock(&marker_mutex);
+}
+
+#endif // MICROPY_GC_PARALLEL_MARK
+
+#if MICROPY_GC_CENSUS && defined(__linux__)
+
+#include <link.h>
+
+// The loaded segments of the executable, which hold its const objects.
+STATIC struct {
+    uintptr_t start;
+    uintptr_t end;
+} static_segments[8];
+STATIC size_t static_n_segments;
+
+STATIC int find_static_segments(struct dl_phdr_info *info, size_t size, void *data) {
+    (void)size;
+    (void)data;
+    for (size_t i = 0; i < info->dlpi_phnum && static_n_segments < MP_ARRAY_SIZE(static_segments); i++) {
+        if (info->dlpi_phdr[i].p_type == PT_LOAD) {
+            uintptr_t start = info->dlpi_addr + info->dlpi_phdr[i].p_vaddr;
+            static_segments[static_n_segments].start = start;
+            static_segments[static_n_segments].end = start + info->dlpi_phdr[i].p_memsz;
+            static_n_segments += 1;
+        }
+    }
+    // the executable comes first, so stop here
+    return 1;
+}
+
+int mp_unix_is_static_ptr(const void *ptr) {
+    if (static_n_segments == 0) {
+        dl_iterate_phdr(find_static_segments, NULL);
+    }
+    for (size_t i = 0; i < static_n_segments; i++) {
+        if ((uintptr_t)ptr >= static_segments[i].start && (uintptr_t)ptr < static_segments[i].end) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+#endif
+
 #endif //MICROPY_ENABLE_GC
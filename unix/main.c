@@ -53,11 +53,21 @@
 // Command line options, with their defaults
 STATIC bool compile_only = false;
 STATIC uint emit_opt = MP_EMIT_OPT_NONE;
+#if MICROPY_EMIT_NATIVE_TIERING
+STATIC mp_uint_t tier_threshold = 0;
+#endif
 
 #if MICROPY_ENABLE_GC
 // Heap size of GC heap (if enabled)
 // Make it larger on a 64 bit machine, because pointers are larger.
 long heap_size = 1024*1024 * (sizeof(mp_uint_t) / 4);
+#if MICROPY_GC_SPLIT_HEAP_AUTO
+// Size the GC heap may grow to by adding regions (0 means not beyond heap_size)
+long heap_max = 0;
+// Total size of the GC heap, and the list of regions added to it
+STATIC long heap_total;
+STATIC void **heap_regions;
+#endif
 #endif
 
 STATIC void stderr_print_strn(void *env, const char *str, size_t len) {
@@ -301,11 +311,23 @@ STATIC int usage(char **argv) {
 "  emit={bytecode,native,viper} -- set the default code emitter\n"
 );
     impl_opts_cnt++;
+#if MICROPY_EMIT_NATIVE_TIERING
+    printf(
+"  tier=<n>                     -- make functions native after n calls and loops\n"
+);
+    impl_opts_cnt++;
+#endif
 #if MICROPY_ENABLE_GC
     printf(
 "  heapsize=<n>[w][K|M] -- set the heap size for the GC (default %ld)\n"
 , heap_size);
     impl_opts_cnt++;
+#if MICROPY_GC_SPLIT_HEAP_AUTO
+    printf(
+"  heapmax=<n>[w][K|M]  -- let the GC heap grow up to this size (default heapsize)\n"
+);
+    impl_opts_cnt++;
+#endif
 #endif
 
     if (impl_opts_cnt == 0) {
@@ -315,6 +337,41 @@ STATIC int usage(char **argv) {
     return 1;
 }
 
+#if MICROPY_ENABLE_GC
+// Parse a size given as <n>[w][K|M], returning false if it is malformed.
+STATIC bool parse_heap_size(const char *str, long *size) {
+    char *end;
+    long n = strtol(str, &end, 0);
+    // Don't bring unneeded libc dependencies like tolower()
+    // If there's 'w' immediately after number, adjust it for
+    // target word size. Note that it should be *before* size
+    // suffix like K or M, to avoid confusion with kilowords,
+    // etc. the size is still in bytes, just can be adjusted
+    // for word size (taking 32bit as baseline).
+    bool word_adjust = false;
+    if ((*end | 0x20) == 'w') {
+        word_adjust = true;
+        end++;
+    }
+    if ((*end | 0x20) == 'k') {
+        n *= 1024;
+    } else if ((*end | 0x20) == 'm') {
+        n *= 1024 * 1024;
+    } else {
+        // Compensate for ++ below
+        --end;
+    }
+    if (*++end != 0) {
+        return false;
+    }
+    if (word_adjust) {
+        n = n * BYTES_PER_WORD / 4;
+    }
+    *size = n;
+    return true;
+}
+#endif
+
 // Process options which set interpreter init options
 STATIC void pre_process_options(int argc, char **argv) {
     for (int a = 1; a < argc; a++) {
@@ -332,35 +389,25 @@ STATIC void pre_process_options(int argc, char **argv) {
                     emit_opt = MP_EMIT_OPT_NATIVE_PYTHON;
                 } else if (strcmp(argv[a + 1], "emit=viper") == 0) {
                     emit_opt = MP_EMIT_OPT_VIPER;
-#if MICROPY_ENABLE_GC
-                } else if (strncmp(argv[a + 1], "heapsize=", sizeof("heapsize=") - 1) == 0) {
+#if MICROPY_EMIT_NATIVE_TIERING
+                } else if (strncmp(argv[a + 1], "tier=", sizeof("tier=") - 1) == 0) {
                     char *end;
-                    heap_size = strtol(argv[a + 1] + sizeof("heapsize=") - 1, &end, 0);
-                    // Don't bring unneeded libc dependencies like tolower()
-                    // If there's 'w' immediately after number, adjust it for
-                    // target word size. Note that it should be *before* size
-                    // suffix like K or M, to avoid confusion with kilowords,
-                    // etc. the size is still in bytes, just can be adjusted
-                    // for word size (taking 32bit as baseline).
-                    bool word_adjust = false;
-                    if ((*end | 0x20) == 'w') {
-                        word_adjust = true;
-                        end++;
-                    }
-                    if ((*end | 0x20) == 'k') {
-                        heap_size *= 1024;
-                    } else if ((*end | 0x20) == 'm') {
-                        heap_size *= 1024 * 1024;
-                    } else {
-                        // Compensate for ++ below
-                        --end;
+                    tier_threshold = strtoul(argv[a + 1] + sizeof("tier=") - 1, &end, 0);
+                    if (*end != 0) {
+                        goto invalid_arg;
                     }
-                    if (*++end != 0) {
+#endif
+#if MICROPY_ENABLE_GC
+                } else if (strncmp(argv[a + 1], "heapsize=", sizeof("heapsize=") - 1) == 0) {
+                    if (!parse_heap_size(argv[a + 1] + sizeof("heapsize=") - 1, &heap_size)) {
                         goto invalid_arg;
                     }
-                    if (word_adjust) {
-                        heap_size = heap_size * BYTES_PER_WORD / 4;
+#if MICROPY_GC_SPLIT_HEAP_AUTO
+                } else if (strncmp(argv[a + 1], "heapmax=", sizeof("heapmax=") - 1) == 0) {
+                    if (!parse_heap_size(argv[a + 1] + sizeof("heapmax=") - 1, &heap_max)) {
+                        goto invalid_arg;
                     }
+#endif
 #endif
                 } else {
 invalid_arg:
@@ -408,10 +455,17 @@ MP_NOINLINE int main_(int argc, char **argv) {
 #if MICROPY_ENABLE_GC
     char *heap = malloc(heap_size);
     gc_init(heap, heap + heap_size);
+    #if MICROPY_GC_SPLIT_HEAP_AUTO
+    heap_total = heap_size;
+    #endif
 #endif
 
     mp_init();
 
+    #if MICROPY_EMIT_NATIVE_TIERING
+    MP_STATE_VM(tier_threshold) = tier_threshold;
+    #endif
+
     // create keyboard interrupt object
     MP_STATE_VM(keyboard_interrupt_obj) = mp_obj_new_exception(&mp_type_KeyboardInterrupt);
 
@@ -596,12 +650,42 @@ MP_NOINLINE int main_(int argc, char **argv) {
     // We don't really need to free memory since we are about to exit the
     // process, but doing so helps to find memory leaks.
     free(heap);
+    #if MICROPY_GC_SPLIT_HEAP_AUTO
+    while (heap_regions != NULL) {
+        void **next = *heap_regions;
+        free(heap_regions);
+        heap_regions = next;
+    }
+    #endif
 #endif
 
     //printf("total bytes = %d\n", m_get_total_bytes_allocated());
     return ret & 0xff;
 }
 
+#if MICROPY_GC_SPLIT_HEAP_AUTO
+void *gc_port_get_region(size_t *size) {
+    // grow in steps of at least the initial heap size, as long as it fits
+    long n = MAX((long)*size, heap_size);
+    if (heap_total + n > heap_max) {
+        n = heap_max - heap_total;
+        if (n < (long)*size) {
+            return NULL;
+        }
+    }
+    // each region starts with a link to the previous one, to free them at exit
+    void **region = malloc(sizeof(void*) + n);
+    if (region == NULL) {
+        return NULL;
+    }
+    *region = heap_regions;
+    heap_regions = region;
+    heap_total += n;
+    *size = n;
+    return region + 1;
+}
+#endif
+
 uint mp_import_stat(const char *path) {
     struct stat st;
     if (stat(path, &st) == 0) {
@@ -43,10 +43,22 @@
 #if !defined(MICROPY_EMIT_ARM) && defined(__arm__) && !defined(__thumb2__)
     #define MICROPY_EMIT_ARM        (1)
 #endif
+// hot functions can be made native with -X tier=<n> or micropython.tier_threshold()
+#ifndef MICROPY_EMIT_NATIVE_TIERING
+#define MICROPY_EMIT_NATIVE_TIERING (MICROPY_EMIT_X64 || MICROPY_EMIT_X86)
+#endif
 #define MICROPY_COMP_MODULE_CONST   (1)
+#define MICROPY_COMP_CONST_TUPLE    (1)
 #define MICROPY_COMP_TRIPLE_TUPLE_ASSIGN (1)
 #define MICROPY_ENABLE_GC           (1)
 #define MICROPY_ENABLE_FINALISER    (1)
+#define MICROPY_GC_FREE_SUMMARY     (1)
+#define MICROPY_GC_SPLIT_HEAP       (1)
+#define MICROPY_GC_SPLIT_HEAP_AUTO  (1)
+#define MICROPY_GC_STATS            (1)
+#define MICROPY_GC_AUTO_THRESHOLD   (1)
+#define MICROPY_GC_DEFER_FINALISER  (1)
+#define MICROPY_GC_CENSUS           (1)
 #define MICROPY_STACK_CHECK         (1)
 #define MICROPY_MALLOC_USES_ALLOCATED_SIZE (1)
 #define MICROPY_MEM_STATS           (1)
@@ -68,6 +80,12 @@
 #ifndef MICROPY_OPT_CACHE_MAP_LOOKUP_IN_BYTECODE
 #define MICROPY_OPT_CACHE_MAP_LOOKUP_IN_BYTECODE (1)
 #endif
+#define MICROPY_OPT_INLINE_CACHE    (1)
+#define MICROPY_OPT_METHOD_CACHE    (1)
+#define MICROPY_OPT_SUPERINSTRUCTIONS (1)
+#define MICROPY_OPT_QSTR_HASH_TABLE (1)
+#define MICROPY_OPT_MAP_COMPACT     (1)
+#define MICROPY_OPT_FAST_SUBSTR_SEARCH (1)
 #define MICROPY_CAN_OVERRIDE_BUILTINS (1)
 #define MICROPY_PY_FUNCTION_ATTRS   (1)
 #define MICROPY_PY_DESCRIPTORS      (1)
@@ -80,6 +98,9 @@
 #define MICROPY_PY_BUILTINS_COMPILE (1)
 #define MICROPY_PY_BUILTINS_NOTIMPLEMENTED (1)
 #define MICROPY_PY_MICROPYTHON_MEM_INFO (1)
+#ifndef _WIN32
+#define MICROPY_PY_MICROPYTHON_PROFILE (1)
+#endif
 #define MICROPY_PY_ALL_SPECIAL_METHODS (1)
 #define MICROPY_PY_ARRAY_SLICE_ASSIGN (1)
 #define MICROPY_PY_BUILTINS_SLICE_ATTRS (1)
@@ -101,8 +122,9 @@
 #define MICROPY_PY_GC_COLLECT_RETVAL (1)
 #define MICROPY_MODULE_FROZEN_STR   (1)
 
-#define MICROPY_STACKLESS           (0)
+#define MICROPY_STACKLESS           (1)
 #define MICROPY_STACKLESS_STRICT    (0)
+#define MICROPY_STACKLESS_MAX_SIZE  (1024 * 1024)
 
 #define MICROPY_PY_OS_STATVFS       (1)
 #define MICROPY_PY_UTIME            (1)
@@ -254,6 +276,9 @@ void mp_unix_mark_exec(void);
 #ifdef __linux__
 // Can access physical memory using /dev/mem
 #define MICROPY_PLAT_DEV_MEM  (1)
+// The census can look at types in the executable, see gccollect.c
+int mp_unix_is_static_ptr(const void *ptr);
+#define MICROPY_GC_CENSUS_STATIC_PTR(ptr) mp_unix_is_static_ptr(ptr)
 #endif
 
 // Assume that select() call, interrupted with a signal, and erroring
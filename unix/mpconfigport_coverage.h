@@ -36,3 +36,19 @@
 #define MICROPY_FSUSERMOUNT            (1)
 #define MICROPY_VFS_FAT                (1)
 #define MICROPY_PY_FRAMEBUF            (1)
+#define MICROPY_GC_PROFILE             (1)
+#define MICROPY_GC_FREE_LISTS          (1)
+#define MICROPY_VM_OPCODE_STATS        (2)
+
+#if MICROPY_PY_THREAD
+// Trace large heaps on several cores, see gccollect.c
+#include <sched.h>
+#define MICROPY_GC_PARALLEL_MARK       (1)
+#define MICROPY_GC_PARALLEL_MARK_IDLE() sched_yield()
+#endif
+
+// Incremental GC needs the GIL, so that no other thread mutates the heap
+// during a mark slice
+#define MICROPY_GC_INCREMENTAL         (1)
+#undef MICROPY_PY_THREAD_GIL
+#define MICROPY_PY_THREAD_GIL          (1)
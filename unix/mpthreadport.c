@@ -46,7 +46,9 @@ typedef struct _thread_t {
     struct _thread_t *next;
 } thread_t;
 
-STATIC pthread_key_t tls_key;
+// the state of the current thread, thread-local storage is much faster to
+// access than pthread_getspecific and the VM reads it on every call
+STATIC __thread mp_state_thread_t *tls_state;
 
 // the mutex controls access to the linked list
 STATIC pthread_mutex_t thread_mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -72,8 +74,7 @@ STATIC void mp_thread_gc(int signo, siginfo_t *info, void *context) {
 }
 
 void mp_thread_init(void) {
-    pthread_key_create(&tls_key, NULL);
-    pthread_setspecific(tls_key, &mp_state_ctx.thread);
+    tls_state = &mp_state_ctx.thread;
 
     // create first entry in linked list of all threads
     thread = malloc(sizeof(thread_t));
@@ -116,11 +117,11 @@ void mp_thread_gc_others(void) {
 }
 
 mp_state_thread_t *mp_thread_get_state(void) {
-    return (mp_state_thread_t*)pthread_getspecific(tls_key);
+    return tls_state;
 }
 
 void mp_thread_set_state(void *state) {
-    pthread_setspecific(tls_key, state);
+    tls_state = state;
 }
 
 void mp_thread_start(void) {
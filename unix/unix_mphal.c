@@ -82,6 +82,35 @@ void mp_hal_set_interrupt_char(char c) {
     }
 }
 
+#if MICROPY_PY_MICROPYTHON_PROFILE
+
+#include "py/profile.h"
+
+STATIC void profile_sighandler(int signum) {
+    (void)signum;
+    mp_profile_tick();
+}
+
+void mp_hal_profile_timer(mp_uint_t hz) {
+    // SIGPROF is sent after every interval of CPU time used by the process;
+    // SA_RESTART so that system calls aren't interrupted by it
+    struct sigaction sa;
+    sa.sa_flags = SA_RESTART;
+    sa.sa_handler = profile_sighandler;
+    sigemptyset(&sa.sa_mask);
+    struct itimerval itv = {{0, 0}, {0, 0}};
+    if (hz != 0) {
+        mp_uint_t us = hz > 1000000 ? 1 : 1000000 / hz;
+        itv.it_interval.tv_sec = us / 1000000;
+        itv.it_interval.tv_usec = us % 1000000;
+        itv.it_value = itv.it_interval;
+        sigaction(SIGPROF, &sa, NULL);
+    }
+    setitimer(ITIMER_PROF, &itv, NULL);
+}
+
+#endif
+
 #if MICROPY_USE_READLINE == 1
 
 #include <termios.h>